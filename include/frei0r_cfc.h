@@ -25,8 +25,12 @@
 //	of a float value used as table index)
 //	see  http://mysite.verizon.net/spitzak/conversion/
 
+#ifndef INCLUDED_FREI0R_CFC_H
+#define INCLUDED_FREI0R_CFC_H
+
 #include <math.h>
 #include <inttypes.h>
+#include "frei0r_planar.h"
 
 
 typedef struct
@@ -317,3 +321,57 @@ return tab[((flint*)in)->i[1]];
 //return tab[((flint*)in)->i[0]];
 //}
 //#endif
+
+
+//--------------------------------------------------
+//  -- Strip streaming --
+//instead of converting the whole frame to float_rgba (16 bytes
+//per pixel), processing it and converting it back, a strip of
+//a few rows is converted, handed to a callback and converted
+//back while it is still in the cache. The strip buffer is
+//allocated once by the caller, cfc_strip_rows() pixel rows.
+//Works for point-wise processing, or anything that needs only
+//the rows of the strip.
+
+//bytes of float_rgba per strip, so that the strip and its
+//input and output rows stay in L2
+#define CFC_STRIP_BYTES 131072
+
+//strip callback
+//s = n rows of w pixels, converted from in
+//in, out = the same n rows of the input and output frames
+//arg = whatever was passed to cfc_stream()
+typedef void (*cfc_strip_fn)(float_rgba *s, int w, int n, const uint32_t *in, uint32_t *out, void *arg);
+
+//--------------------------------------------------------
+//number of rows per strip for width w
+static inline int cfc_strip_rows(int w)
+{
+int n=CFC_STRIP_BYTES/(w*(int)sizeof(float_rgba));
+
+return (n<1) ? 1 : n;
+}
+
+//--------------------------------------------------------
+//runs fn over the frame in strips of up to 'rows' rows
+//strip = space for rows*w float_rgba
+//scale = uchar to float factor (1.0/255.0 gives 0...1)
+//back = 1: after fn the strip is converted back into out,
+//	as (uint8_t)(x*255.0), see float_to_rgba()
+//	0: fn writes out itself
+//the conversions are SSE2 where available (frei0r_planar.h)
+static inline void cfc_stream(const uint32_t *in, uint32_t *out, int w, int h, float_rgba *strip, int rows, float scale, int back, cfc_strip_fn fn, void *arg)
+{
+int y,n;
+
+for (y=0;y<h;y+=n)
+	{
+	n = (h-y<rows) ? h-y : rows;
+	rgba_to_float(in+y*w, (float*)strip, scale, n*w);
+	fn(strip, w, n, in+y*w, out+y*w, arg);
+	if (back)
+		float_to_rgba((const float*)strip, out+y*w, n*w);
+	}
+}
+
+#endif
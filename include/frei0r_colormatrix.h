@@ -0,0 +1,234 @@
+/* frei0r_colormatrix.h
+ * 3x3 colour matrix on packed RGBA8888 frames, in linear light
+ * (colgate)
+ *
+ * This file is a part of the Frei0r package
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*******************************************************************
+ * cmat_set_matrix	frame is sRGB, matrix applies to linear RGB
+ * cmat_apply		n pixels, alpha kept
+ *
+ * The matrix is fixed point. Input pixels (linear, 0..1) are 1.15,
+ * matrix elements s4.10, clipped to +/-16; extreme corrections have
+ * elements of 5-6. A product is s5.25 and the sum of three can not
+ * overflow, since the largest pixel is 1.0 (2^15):
+ *
+ *   3 * 2^15 * (2^14 - 1) ~= 3 * 2^29 < 2^31.
+ *
+ * The sRGB to linear step and the matrix are folded into three
+ * tables of 256 premultiplied columns, so a pixel costs three
+ * lookups and two adds (four lanes at once with SSE2) before the
+ * linear to sRGB lookup. Linear to sRGB needs 13 bits to tell all
+ * outputs apart; the table has 14 (16 kB, stays in L1).
+ *
+ * The lookups are what a pixel costs. Two ways around them were
+ * tried and dropped:
+ * - 16 bit pmaddwd: sRGB to linear through a scalar table, pixels
+ *   packed into vectors, three madd pairs per four pixels, scalar
+ *   linear to sRGB lookups. About 30% slower than the premultiplied
+ *   columns, because it has as many lookups plus the packing. It
+ *   was also off by up to 2 levels, since the 16 bit elements must
+ *   be rounded.
+ * - Two pixels per round, sharing the pack and the clip and storing
+ *   whole pixels: same output, no faster.
+ *
+ * Any span of pixels can be converted on its own, so the frame can
+ * be done in bands of rows on separate threads (colgate does that
+ * with frei0r_threads.h). A diagonal matrix on the sRGB values as
+ * they are is just three tables; use histo_lut_apply
+ * (frei0r_histogram.h) for that.
+ ******************************************************************/
+
+#ifndef INCLUDED_FREI0R_COLORMATRIX_H
+#define INCLUDED_FREI0R_COLORMATRIX_H
+
+#include <math.h>
+#include <inttypes.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define CMAT_PIXEL_BITS 15
+#define CMAT_FRAC_BITS 10
+#define CMAT_ELEMENT_BITS (4+CMAT_FRAC_BITS)
+#define CMAT_LUT_BITS 14
+#define CMAT_LUT_SIZE (1<<CMAT_LUT_BITS)
+#define CMAT_SHIFT (CMAT_PIXEL_BITS+CMAT_FRAC_BITS-CMAT_LUT_BITS)
+
+typedef struct
+{
+#if defined(__SSE2__)
+	__m128i pr[256];	//premultiplied columns (r0,r1,r2,0)
+	__m128i pg[256];
+	__m128i pb[256];
+#else
+	int pr[256][3];
+	int pg[256][3];
+	int pb[256][3];
+#endif
+	uint8_t to_srgb[CMAT_LUT_SIZE];	//linear >> CMAT_SHIFT -> sRGB
+	int srgb_ready;		//to_srgb is filled
+} cmat;
+
+//--------------------------------------------------------
+//sRGB 0...255 -> linear 0...1
+static inline float cmat_srgb_to_linear(float x)
+{
+	if (x < 255.0f * 0.04045f)
+		return x * (1.0f / (255.0f * 12.92f));
+	else
+		return pow((x + 255.0f * 0.055) * (1.0 / (255.0f * 1.055f)), 2.4);
+}
+
+//--------------------------------------------------------
+//linear 0...1 -> sRGB 0...255
+static inline float cmat_linear_to_srgb(float x)
+{
+	if (x < 0.0031308f)
+		return (255.0f * 12.92f) * x;
+	else
+		return ((255.0f * 1.055f) * pow(x, 1.0f / 2.4f)) - (0.055 * 255.0f);
+}
+
+//--------------------------------------------------------
+static inline void cmat_fill_srgb(cmat *c)
+{
+	int i;
+
+	for (i=0;i<CMAT_LUT_SIZE;i++)
+	{
+		//-0.5: the lookup truncates instead of rounding
+		float x = (i - 0.5) / (float)CMAT_LUT_SIZE;
+		long s = lrintf(cmat_linear_to_srgb(x));
+		c->to_srgb[i] = s<0 ? 0 : (s>255 ? 255 : s);
+	}
+	c->srgb_ready=1;
+}
+
+//--------------------------------------------------------
+//m is row major, out = m * in on linear R,G,B
+static inline void cmat_set_matrix(cmat *c, const float m[9])
+{
+	float s[9];
+	int i,k,r[3],g[3],b[3];
+
+	if (!c->srgb_ready) cmat_fill_srgb(c);
+
+	//scale for fixed point and clip the elements (rather than the
+	//sums later), so the results are consistent over the range
+	for (k=0;k<9;k++)
+	{
+		s[k] = m[k] * (float)(1 << CMAT_FRAC_BITS);
+		if (s[k] < -(1 << CMAT_ELEMENT_BITS))
+			s[k] = -(1 << CMAT_ELEMENT_BITS);
+		if (s[k] > (1 << CMAT_ELEMENT_BITS) - 1)
+			s[k] = (1 << CMAT_ELEMENT_BITS) - 1;
+	}
+
+	for (i=0;i<256;i++)
+	{
+		int x = cmat_srgb_to_linear(i) * (float)(1 << CMAT_PIXEL_BITS);
+
+		for (k=0;k<3;k++)
+		{
+			r[k] = lrintf(x * s[3*k]);
+			g[k] = lrintf(x * s[3*k+1]);
+			b[k] = lrintf(x * s[3*k+2]);
+		}
+#if defined(__SSE2__)
+		c->pr[i] = _mm_setr_epi32(r[0], r[1], r[2], 0);
+		c->pg[i] = _mm_setr_epi32(g[0], g[1], g[2], 0);
+		c->pb[i] = _mm_setr_epi32(b[0], b[1], b[2], 0);
+#else
+		for (k=0;k<3;k++)
+		{
+			c->pr[i][k] = r[k];
+			c->pg[i][k] = g[k];
+			c->pb[i][k] = b[k];
+		}
+#endif
+	}
+}
+
+//--------------------------------------------------------
+//linear s6.25 -> sRGB
+static inline uint8_t cmat_to_srgb(const cmat *c, int x)
+{
+	if (x < 0)
+		return 0;
+	if (x >= (CMAT_LUT_SIZE << CMAT_SHIFT))
+		return 255;
+	return c->to_srgb[((unsigned)x) >> CMAT_SHIFT];
+}
+
+//--------------------------------------------------------
+//in==out is allowed
+static inline void cmat_apply(const cmat *c, const uint32_t *in, uint32_t *out, int n)
+{
+	const uint8_t *src = (const uint8_t*)in;
+	uint8_t *dst = (uint8_t*)out;
+	int i;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i max = _mm_set1_epi16(CMAT_LUT_SIZE - 1);
+	__m128i v;
+	unsigned rg, b;
+
+	for (i=0;i<n;i++)
+	{
+		v = _mm_add_epi32(c->pb[src[2]], _mm_add_epi32(c->pr[src[0]], c->pg[src[1]]));
+
+		//shift to the table range and clip to [0, max]; done on
+		//16 bit lanes, which have min/max without SSE4 and leave
+		//r,g in one word
+		v = _mm_srai_epi32(v, CMAT_SHIFT);
+		v = _mm_packs_epi32(v, v);
+		v = _mm_max_epi16(v, zero);
+		v = _mm_min_epi16(v, max);
+
+		rg = _mm_cvtsi128_si32(v);
+		b = _mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+
+		dst[0] = c->to_srgb[rg & 0xffff];
+		dst[1] = c->to_srgb[rg >> 16];
+		dst[2] = c->to_srgb[b];
+		dst[3] = src[3];
+		src+=4;
+		dst+=4;
+	}
+#else
+	int r,g,b;
+
+	for (i=0;i<n;i++)
+	{
+		r = c->pr[src[0]][0] + c->pg[src[1]][0] + c->pb[src[2]][0];
+		g = c->pr[src[0]][1] + c->pg[src[1]][1] + c->pb[src[2]][1];
+		b = c->pr[src[0]][2] + c->pg[src[1]][2] + c->pb[src[2]][2];
+		dst[0] = cmat_to_srgb(c, r);
+		dst[1] = cmat_to_srgb(c, g);
+		dst[2] = cmat_to_srgb(c, b);
+		dst[3] = src[3];
+		src+=4;
+		dst+=4;
+	}
+#endif
+}
+
+#endif
@@ -22,8 +22,13 @@
 
 #include "frei0r_math.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // # Basic colorspace convert functions (from the Gimp gimpcolorspace.h) ####
 
 /*  int functions  */
@@ -236,12 +241,13 @@ rgb_to_hsl_int (unsigned int *red         /* returns red        */,
     else
       s = 255 * (double) delta / (double) (511 - max - min);
 
+    /* signed differences, the hue may be negative here */
     if (r == max)
-      h = (g - b) / (double) delta;
+      h = ((int) g - (int) b) / (double) delta;
     else if (g == max)
-      h = 2 + (b - r) / (double) delta;
+      h = 2 + ((int) b - (int) r) / (double) delta;
     else
-      h = 4 + (r - g) / (double) delta;
+      h = 4 + ((int) r - (int) g) / (double) delta;
 
     h = h * 42.5;
 
@@ -413,4 +419,388 @@ cmyk_to_rgb_int (int *cyan,
 }
 
 
+// # Span conversions #######################################################
+
+/*
+ * The span functions convert n packed RGBA pixels to or from three planes,
+ * with the same results as the int functions above on every pixel. The
+ * inverse functions write R, G and B and keep the alpha bytes of rgba.
+ *
+ * With SSE2 4 pixels are converted at a time without branches, in double
+ * precision and with the same operations as above, so nothing changes
+ * but the speed.
+ */
+
+typedef struct
+{
+  uint16_t *h;  /* hue, HSV 0...360, HSL 0...255 */
+  uint8_t *s;   /* saturation */
+  uint8_t *v;   /* value, or lightness for HSL */
+} hsv_planes;
+
+typedef hsv_planes hsl_planes;
+
+#if defined(__SSE2__)
+
+static inline __m128d cs_sel (__m128d m, __m128d a, __m128d b)
+{
+  return _mm_or_pd (_mm_and_pd (m, a), _mm_andnot_pd (m, b));
+}
+
+static inline __m128i cs_seli (__m128i m, __m128i a, __m128i b)
+{
+  return _mm_or_si128 (_mm_and_si128 (m, a), _mm_andnot_si128 (m, b));
+}
+
+/* ROUND() of two pairs of doubles, as 4 ints */
+static inline __m128i cs_round4 (__m128d lo, __m128d hi)
+{
+  const __m128d h = _mm_set1_pd (0.5);
+
+  return _mm_unpacklo_epi64 (_mm_cvttpd_epi32 (_mm_add_pd (lo, h)),
+                             _mm_cvttpd_epi32 (_mm_add_pd (hi, h)));
+}
+
+/* ints 0,1 and 2,3 as doubles */
+static inline __m128d cs_lo (__m128i x)
+{
+  return _mm_cvtepi32_pd (x);
+}
+
+static inline __m128d cs_hi (__m128i x)
+{
+  return _mm_cvtepi32_pd (_mm_srli_si128 (x, 8));
+}
+
+/* 4 bytes or 4 shorts to ints */
+static inline __m128i cs_load4u8 (const uint8_t *p)
+{
+  int32_t x;
+  const __m128i z = _mm_setzero_si128 ();
+
+  memcpy (&x, p, 4);
+  return _mm_unpacklo_epi16 (_mm_unpacklo_epi8 (_mm_cvtsi32_si128 (x), z), z);
+}
+
+static inline __m128i cs_load4u16 (const uint16_t *p)
+{
+  return _mm_unpacklo_epi16 (_mm_loadl_epi64 ((const __m128i*) p), _mm_setzero_si128 ());
+}
+
+/* 4 ints (0...65535) to shorts or bytes */
+static inline void cs_store4u16 (uint16_t *p, __m128i x)
+{
+  x = _mm_sub_epi32 (x, _mm_set1_epi32 (32768));
+  _mm_storel_epi64 ((__m128i*) p, _mm_xor_si128 (_mm_packs_epi32 (x, x), _mm_set1_epi16 ((short) 0x8000)));
+}
+
+static inline void cs_store4u8 (uint8_t *p, __m128i x)
+{
+  int32_t y;
+
+  x = _mm_packs_epi32 (x, x);
+  y = _mm_cvtsi128_si32 (_mm_packus_epi16 (x, x));
+  memcpy (p, &y, 4);
+}
+
+/* rgb_to_hsv_int for 2 pixels, h and s before rounding */
+static inline void cs_hsv2 (__m128d r, __m128d g, __m128d b, __m128d *h, __m128d *s)
+{
+  const __m128d zero = _mm_setzero_pd ();
+  __m128d v, delta, grey, isr, isg, num, off, hh;
+
+  v = _mm_max_pd (_mm_max_pd (r, g), b);
+  delta = _mm_sub_pd (v, _mm_min_pd (_mm_min_pd (r, g), b));
+  grey = _mm_cmpeq_pd (delta, zero);
+
+  *s = _mm_mul_pd (_mm_andnot_pd (_mm_cmpeq_pd (v, zero), _mm_div_pd (delta, v)), _mm_set1_pd (255.0));
+
+  isr = _mm_cmpeq_pd (r, v);
+  isg = _mm_cmpeq_pd (g, v);
+  num = cs_sel (isr, _mm_sub_pd (g, b), cs_sel (isg, _mm_sub_pd (b, r), _mm_sub_pd (r, g)));
+  off = cs_sel (isr, zero, cs_sel (isg, _mm_set1_pd (120.0), _mm_set1_pd (240.0)));
+  hh = _mm_add_pd (off, _mm_div_pd (_mm_mul_pd (_mm_set1_pd (60.0), num), delta));
+  hh = _mm_add_pd (hh, _mm_and_pd (_mm_cmplt_pd (hh, zero), _mm_set1_pd (360.0)));
+  *h = _mm_andnot_pd (grey, hh);
+}
+
+/* rgb_to_hsl_int for 2 pixels, before rounding */
+static inline void cs_hsl2 (__m128d r, __m128d g, __m128d b, __m128d *h, __m128d *s, __m128d *l)
+{
+  const __m128d zero = _mm_setzero_pd ();
+  __m128d max, min, delta, grey, isr, isg, num, off, hh, ss;
+
+  max = _mm_max_pd (_mm_max_pd (r, g), b);
+  min = _mm_min_pd (_mm_min_pd (r, g), b);
+  delta = _mm_sub_pd (max, min);
+  grey = _mm_cmpeq_pd (delta, zero);
+
+  *l = _mm_div_pd (_mm_add_pd (max, min), _mm_set1_pd (2.0));
+
+  ss = cs_sel (_mm_cmplt_pd (*l, _mm_set1_pd (128.0)),
+               _mm_add_pd (max, min),
+               _mm_sub_pd (_mm_sub_pd (_mm_set1_pd (511.0), max), min));
+  ss = _mm_div_pd (_mm_mul_pd (_mm_set1_pd (255.0), delta), ss);
+  *s = _mm_andnot_pd (grey, ss);
+
+  isr = _mm_cmpeq_pd (r, max);
+  isg = _mm_cmpeq_pd (g, max);
+  num = cs_sel (isr, _mm_sub_pd (g, b), cs_sel (isg, _mm_sub_pd (b, r), _mm_sub_pd (r, g)));
+  off = cs_sel (isr, zero, cs_sel (isg, _mm_set1_pd (2.0), _mm_set1_pd (4.0)));
+  hh = _mm_mul_pd (_mm_add_pd (off, _mm_div_pd (num, delta)), _mm_set1_pd (42.5));
+  hh = cs_sel (_mm_cmplt_pd (hh, zero), _mm_add_pd (hh, _mm_set1_pd (255.0)),
+               cs_sel (_mm_cmpgt_pd (hh, _mm_set1_pd (255.0)), _mm_sub_pd (hh, _mm_set1_pd (255.0)), hh));
+  *h = _mm_andnot_pd (grey, hh);
+}
+
+/* hsv_to_rgb_int for 2 pixels: the rounded v, p, q, t and the sector */
+static inline void cs_vpqt2 (__m128d h, __m128d s, __m128d v,
+                             __m128d *vv, __m128d *p, __m128d *q, __m128d *t, __m128i *i)
+{
+  const __m128d one = _mm_set1_pd (1.0);
+  __m128d f;
+
+  h = _mm_andnot_pd (_mm_cmpeq_pd (h, _mm_set1_pd (360.0)), h);
+  s = _mm_div_pd (s, _mm_set1_pd (255.0));
+  v = _mm_div_pd (v, _mm_set1_pd (255.0));
+  h = _mm_div_pd (h, _mm_set1_pd (60.0));
+  *i = _mm_cvttpd_epi32 (h);
+  f = _mm_sub_pd (h, _mm_cvtepi32_pd (*i));
+  *vv = _mm_mul_pd (v, _mm_set1_pd (255.0));
+  *p = _mm_mul_pd (_mm_mul_pd (v, _mm_sub_pd (one, s)), _mm_set1_pd (255.0));
+  *q = _mm_mul_pd (_mm_mul_pd (v, _mm_sub_pd (one, _mm_mul_pd (s, f))), _mm_set1_pd (255.0));
+  *t = _mm_mul_pd (_mm_mul_pd (v, _mm_sub_pd (one, _mm_mul_pd (s, _mm_sub_pd (one, f)))), _mm_set1_pd (255.0));
+}
+
+/* hsl_value_int for 2 pixels, before rounding */
+static inline __m128d cs_hsl_value2 (__m128d n1, __m128d n2, __m128d hue)
+{
+  const __m128d c255 = _mm_set1_pd (255.0);
+  const __m128d c42 = _mm_set1_pd (42.5);
+  const __m128d c170 = _mm_set1_pd (170.0);
+  __m128d d, a, c;
+
+  hue = cs_sel (_mm_cmpgt_pd (hue, c255), _mm_sub_pd (hue, c255),
+                cs_sel (_mm_cmplt_pd (hue, _mm_setzero_pd ()), _mm_add_pd (hue, c255), hue));
+  d = _mm_sub_pd (n2, n1);
+  a = _mm_add_pd (n1, _mm_mul_pd (d, _mm_div_pd (hue, c42)));
+  c = _mm_add_pd (n1, _mm_mul_pd (d, _mm_div_pd (_mm_sub_pd (c170, hue), c42)));
+  a = cs_sel (_mm_cmplt_pd (hue, c42), a,
+              cs_sel (_mm_cmplt_pd (hue, _mm_set1_pd (127.5)), n2,
+                      cs_sel (_mm_cmplt_pd (hue, c170), c, n1)));
+  return _mm_mul_pd (a, c255);
+}
+
+/* hsl_to_rgb_int for 2 pixels, m1 and m2 */
+static inline void cs_m2 (__m128d s, __m128d l, __m128d *m1, __m128d *m2)
+{
+  const __m128d c255 = _mm_set1_pd (255.0);
+
+  *m2 = cs_sel (_mm_cmplt_pd (l, _mm_set1_pd (128.0)),
+                _mm_div_pd (_mm_mul_pd (l, _mm_add_pd (c255, s)), _mm_set1_pd (65025.0)),
+                _mm_div_pd (_mm_sub_pd (_mm_add_pd (l, s), _mm_div_pd (_mm_mul_pd (l, s), c255)), c255));
+  *m1 = _mm_sub_pd (_mm_div_pd (l, _mm_set1_pd (127.5)), *m2);
+}
+
+#endif
+
+/**
+ * rgba_span_to_hsv
+ * @rgba: n RGBA pixels
+ * @p: returns H [0, 360], S [0, 255], V [0, 255]
+ **/
+static inline void
+rgba_span_to_hsv (const uint8_t *rgba, hsv_planes *p, int n)
+{
+  int i = 0;
+  int r, g, b;
+
+#if defined(__SSE2__)
+  const __m128i m = _mm_set1_epi32 (0xFF);
+  __m128i x, ri, gi, bi;
+  __m128d h0, s0, h1, s1;
+
+  for (; i < n-3; i += 4)
+  {
+    x = _mm_loadu_si128 ((const __m128i*) (rgba + 4*i));
+    ri = _mm_and_si128 (x, m);
+    gi = _mm_and_si128 (_mm_srli_epi32 (x, 8), m);
+    bi = _mm_and_si128 (_mm_srli_epi32 (x, 16), m);
+    cs_hsv2 (cs_lo (ri), cs_lo (gi), cs_lo (bi), &h0, &s0);
+    cs_hsv2 (cs_hi (ri), cs_hi (gi), cs_hi (bi), &h1, &s1);
+    cs_store4u16 (p->h + i, cs_round4 (h0, h1));
+    cs_store4u8 (p->s + i, cs_round4 (s0, s1));
+    cs_store4u8 (p->v + i, _mm_max_epi16 (_mm_max_epi16 (ri, gi), bi));
+  }
+#endif
+  for (; i < n; i++)
+  {
+    r = rgba[4*i];
+    g = rgba[4*i+1];
+    b = rgba[4*i+2];
+    rgb_to_hsv_int (&r, &g, &b);
+    p->h[i] = r;
+    p->s[i] = g;
+    p->v[i] = b;
+  }
+}
+
+/**
+ * hsv_span_to_rgba
+ * @p: H [0, 360], S [0, 255], V [0, 255]
+ * @rgba: returns R, G and B of n pixels, alpha is left as it is
+ **/
+static inline void
+hsv_span_to_rgba (const hsv_planes *p, uint8_t *rgba, int n)
+{
+  int i = 0;
+  int r, g, b;
+
+#if defined(__SSE2__)
+  __m128i hi, si, vi, i0, i1, k, vv, pp, qq, tt, e0, e1, e2, e3, e4, e5, ri, gi, bi, grey, x;
+  __m128d v0, p0, q0, t0, v1, p1, q1, t1;
+
+  for (; i < n-3; i += 4)
+  {
+    hi = cs_load4u16 (p->h + i);
+    si = cs_load4u8 (p->s + i);
+    vi = cs_load4u8 (p->v + i);
+    cs_vpqt2 (cs_lo (hi), cs_lo (si), cs_lo (vi), &v0, &p0, &q0, &t0, &i0);
+    cs_vpqt2 (cs_hi (hi), cs_hi (si), cs_hi (vi), &v1, &p1, &q1, &t1, &i1);
+    k = _mm_unpacklo_epi64 (i0, i1);
+    vv = cs_round4 (v0, v1);
+    pp = cs_round4 (p0, p1);
+    qq = cs_round4 (q0, q1);
+    tt = cs_round4 (t0, t1);
+
+    e0 = _mm_cmpeq_epi32 (k, _mm_set1_epi32 (0));
+    e1 = _mm_cmpeq_epi32 (k, _mm_set1_epi32 (1));
+    e2 = _mm_cmpeq_epi32 (k, _mm_set1_epi32 (2));
+    e3 = _mm_cmpeq_epi32 (k, _mm_set1_epi32 (3));
+    e4 = _mm_cmpeq_epi32 (k, _mm_set1_epi32 (4));
+    e5 = _mm_cmpeq_epi32 (k, _mm_set1_epi32 (5));
+    ri = cs_seli (_mm_or_si128 (e0, e5), vv, cs_seli (e1, qq, cs_seli (_mm_or_si128 (e2, e3), pp, tt)));
+    gi = cs_seli (_mm_or_si128 (e1, e2), vv, cs_seli (e0, tt, cs_seli (e3, qq, pp)));
+    bi = cs_seli (_mm_or_si128 (e3, e4), vv, cs_seli (e2, tt, cs_seli (e5, qq, pp)));
+
+    grey = _mm_cmpeq_epi32 (si, _mm_setzero_si128 ());
+    ri = cs_seli (grey, vi, ri);
+    gi = cs_seli (grey, vi, gi);
+    bi = cs_seli (grey, vi, bi);
+
+    x = _mm_and_si128 (_mm_loadu_si128 ((const __m128i*) (rgba + 4*i)), _mm_set1_epi32 (0xFF000000));
+    x = _mm_or_si128 (x, _mm_or_si128 (ri, _mm_or_si128 (_mm_slli_epi32 (gi, 8), _mm_slli_epi32 (bi, 16))));
+    _mm_storeu_si128 ((__m128i*) (rgba + 4*i), x);
+  }
+#endif
+  for (; i < n; i++)
+  {
+    r = p->h[i];
+    g = p->s[i];
+    b = p->v[i];
+    hsv_to_rgb_int (&r, &g, &b);
+    rgba[4*i] = r;
+    rgba[4*i+1] = g;
+    rgba[4*i+2] = b;
+  }
+}
+
+/**
+ * rgba_span_to_hsl
+ * @rgba: n RGBA pixels
+ * @p: returns H [0, 255], S [0, 255], L [0, 255]
+ **/
+static inline void
+rgba_span_to_hsl (const uint8_t *rgba, hsl_planes *p, int n)
+{
+  int i = 0;
+  unsigned int r, g, b;
+
+#if defined(__SSE2__)
+  const __m128i m = _mm_set1_epi32 (0xFF);
+  __m128i x, ri, gi, bi;
+  __m128d h0, s0, l0, h1, s1, l1;
+
+  for (; i < n-3; i += 4)
+  {
+    x = _mm_loadu_si128 ((const __m128i*) (rgba + 4*i));
+    ri = _mm_and_si128 (x, m);
+    gi = _mm_and_si128 (_mm_srli_epi32 (x, 8), m);
+    bi = _mm_and_si128 (_mm_srli_epi32 (x, 16), m);
+    cs_hsl2 (cs_lo (ri), cs_lo (gi), cs_lo (bi), &h0, &s0, &l0);
+    cs_hsl2 (cs_hi (ri), cs_hi (gi), cs_hi (bi), &h1, &s1, &l1);
+    cs_store4u16 (p->h + i, cs_round4 (h0, h1));
+    cs_store4u8 (p->s + i, cs_round4 (s0, s1));
+    cs_store4u8 (p->v + i, cs_round4 (l0, l1));
+  }
+#endif
+  for (; i < n; i++)
+  {
+    r = rgba[4*i];
+    g = rgba[4*i+1];
+    b = rgba[4*i+2];
+    rgb_to_hsl_int (&r, &g, &b);
+    p->h[i] = r;
+    p->s[i] = g;
+    p->v[i] = b;
+  }
+}
+
+/**
+ * hsl_span_to_rgba
+ * @p: H [0, 255], S [0, 255], L [0, 255]
+ * @rgba: returns R, G and B of n pixels, alpha is left as it is
+ **/
+static inline void
+hsl_span_to_rgba (const hsl_planes *p, uint8_t *rgba, int n)
+{
+  int i = 0;
+  unsigned int r, g, b;
+
+#if defined(__SSE2__)
+  const __m128d c85 = _mm_set1_pd (85.0);
+  __m128i hi, si, li, ri, gi, bi, grey, x;
+  __m128d h0, l0, h1, l1, m10, m20, m11, m21;
+
+  for (; i < n-3; i += 4)
+  {
+    hi = cs_load4u16 (p->h + i);
+    si = cs_load4u8 (p->s + i);
+    li = cs_load4u8 (p->v + i);
+    h0 = cs_lo (hi);
+    h1 = cs_hi (hi);
+    l0 = cs_lo (li);
+    l1 = cs_hi (li);
+    cs_m2 (cs_lo (si), l0, &m10, &m20);
+    cs_m2 (cs_hi (si), l1, &m11, &m21);
+    ri = cs_round4 (cs_hsl_value2 (m10, m20, _mm_add_pd (h0, c85)),
+                    cs_hsl_value2 (m11, m21, _mm_add_pd (h1, c85)));
+    gi = cs_round4 (cs_hsl_value2 (m10, m20, h0),
+                    cs_hsl_value2 (m11, m21, h1));
+    bi = cs_round4 (cs_hsl_value2 (m10, m20, _mm_sub_pd (h0, c85)),
+                    cs_hsl_value2 (m11, m21, _mm_sub_pd (h1, c85)));
+
+    grey = _mm_cmpeq_epi32 (si, _mm_setzero_si128 ());
+    ri = cs_seli (grey, li, ri);
+    gi = cs_seli (grey, li, gi);
+    bi = cs_seli (grey, li, bi);
+
+    x = _mm_and_si128 (_mm_loadu_si128 ((const __m128i*) (rgba + 4*i)), _mm_set1_epi32 (0xFF000000));
+    x = _mm_or_si128 (x, _mm_or_si128 (ri, _mm_or_si128 (_mm_slli_epi32 (gi, 8), _mm_slli_epi32 (bi, 16))));
+    _mm_storeu_si128 ((__m128i*) (rgba + 4*i), x);
+  }
+#endif
+  for (; i < n; i++)
+  {
+    r = p->h[i];
+    g = p->s[i];
+    b = p->v[i];
+    hsl_to_rgb_int (&r, &g, &b);
+    rgba[4*i] = r;
+    rgba[4*i+1] = g;
+    rgba[4*i+2] = b;
+  }
+}
+
+
 #endif
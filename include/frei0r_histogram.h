@@ -0,0 +1,338 @@
+/* frei0r_histogram.h
+ * Channel histograms of a packed RGBA8888 frame and the lookup
+ * table pass that usually follows them (levels, equaliz0r,
+ * normaliz0r)
+ *
+ * This file is a part of the Frei0r package
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*******************************************************************
+ * histo_rgb		R,G,B counts, uint32_t hist[3][256]
+ * histo_channel	counts of one byte of the pixel
+ * histo_luma		counts of (int)(.299R+.587G+.114B)
+ * histo_lut_apply	one 256 entry table per channel, alpha kept
+ * histo_*_rows		counts of a band of rows, added to hist
+ * histo_merge		adds one histogram to another
+ *
+ * Counts are integers. Neighbouring pixels often have the same
+ * value, and incrementing the same counter back to back makes each
+ * increment wait for the one before; so consecutive pixels go to
+ * HISTO_SUBS separate sub-histograms that are summed at the end.
+ *
+ * The _rows variants count rows y0, y0+step, ... below y1 and add
+ * to what is in hist; step>1 samples every step-th row where an
+ * estimate is enough (ranges, auto levels), step=1 counts every
+ * pixel. histo_rgb, histo_channel and histo_luma cut the frame
+ * into bands of rows that are counted on separate threads (see
+ * frei0r_threads.h) into their own histograms and merged with
+ * histo_merge; histo_lut_apply maps bands of pixels. Counts and
+ * output are the same on any number of threads.
+ ******************************************************************/
+
+#ifndef INCLUDED_FREI0R_HISTOGRAM_H
+#define INCLUDED_FREI0R_HISTOGRAM_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "frei0r_threads.h"
+
+#define HISTO_SUBS 4
+
+//pixels below which a band is not worth a thread
+#define HISTO_MIN_JOB 65536
+
+//--------------------------------------------------------
+//dst[i]+=src[i], i<n
+static inline void histo_merge(uint32_t *dst, const uint32_t *src, int n)
+{
+	int i;
+
+	for (i=0;i<n;i++)
+		dst[i]+=src[i];
+}
+
+//--------------------------------------------------------
+//adds the R,G,B counts of rows y0, y0+step, ... (<y1) to hist
+static inline void histo_rgb_rows(const uint32_t *in, int w, int y0, int y1, int step, uint32_t hist[3][256])
+{
+	uint32_t sub[HISTO_SUBS-1][3][256];	//hist itself is the first
+	const uint32_t *p;
+	uint32_t a,b,c,d;
+	int x,y,k;
+
+	memset(sub,0,sizeof(sub));
+	for (y=y0;y<y1;y+=step)
+	{
+		p=in+(size_t)y*w;
+		for (x=0;x<w-3;x+=4)
+		{
+			a=p[x]; b=p[x+1]; c=p[x+2]; d=p[x+3];
+			hist[0][a&0xFF]++;
+			sub[0][0][b&0xFF]++;
+			sub[1][0][c&0xFF]++;
+			sub[2][0][d&0xFF]++;
+			hist[1][(a>>8)&0xFF]++;
+			sub[0][1][(b>>8)&0xFF]++;
+			sub[1][1][(c>>8)&0xFF]++;
+			sub[2][1][(d>>8)&0xFF]++;
+			hist[2][(a>>16)&0xFF]++;
+			sub[0][2][(b>>16)&0xFF]++;
+			sub[1][2][(c>>16)&0xFF]++;
+			sub[2][2][(d>>16)&0xFF]++;
+		}
+		for (;x<w;x++)
+		{
+			a=p[x];
+			hist[0][a&0xFF]++;
+			hist[1][(a>>8)&0xFF]++;
+			hist[2][(a>>16)&0xFF]++;
+		}
+	}
+	for (k=0;k<HISTO_SUBS-1;k++)
+		histo_merge(&hist[0][0],&sub[k][0][0],3*256);
+}
+
+
+//--------------------------------------------------------
+//adds the counts of byte (p>>shift)&0xFF, shift = 0,8,16,24
+static inline void histo_channel_rows(const uint32_t *in, int w, int y0, int y1, int step, int shift, uint32_t *hist)
+{
+	uint32_t sub[HISTO_SUBS-1][256];
+	const uint32_t *p;
+	int x,y,k;
+
+	memset(sub,0,sizeof(sub));
+	for (y=y0;y<y1;y+=step)
+	{
+		p=in+(size_t)y*w;
+		for (x=0;x<w-3;x+=4)
+		{
+			hist[(p[x]>>shift)&0xFF]++;
+			sub[0][(p[x+1]>>shift)&0xFF]++;
+			sub[1][(p[x+2]>>shift)&0xFF]++;
+			sub[2][(p[x+3]>>shift)&0xFF]++;
+		}
+		for (;x<w;x++)
+			hist[(p[x]>>shift)&0xFF]++;
+	}
+	for (k=0;k<HISTO_SUBS-1;k++)
+		histo_merge(hist,sub[k],256);
+}
+
+
+//--------------------------------------------------------
+//Rec.601 luma, truncated
+static inline int histo_luma_of(uint32_t p)
+{
+	return (int)(((p>>16)&0xFF)*.114+((p>>8)&0xFF)*.587+(p&0xFF)*.299);
+}
+
+//--------------------------------------------------------
+//adds the luma counts
+static inline void histo_luma_rows(const uint32_t *in, int w, int y0, int y1, int step, uint32_t *hist)
+{
+	uint32_t sub[HISTO_SUBS-1][256];
+	const uint32_t *p;
+	int x,y,k;
+
+	memset(sub,0,sizeof(sub));
+	for (y=y0;y<y1;y+=step)
+	{
+		p=in+(size_t)y*w;
+		for (x=0;x<w-3;x+=4)
+		{
+			hist[histo_luma_of(p[x])]++;
+			sub[0][histo_luma_of(p[x+1])]++;
+			sub[1][histo_luma_of(p[x+2])]++;
+			sub[2][histo_luma_of(p[x+3])]++;
+		}
+		for (;x<w;x++)
+			hist[histo_luma_of(p[x])]++;
+	}
+	for (k=0;k<HISTO_SUBS-1;k++)
+		histo_merge(hist,sub[k],256);
+}
+
+//--------------------------------------------------------
+//a frame cut into bands of sampled rows, one histogram each
+typedef struct
+{
+	const uint32_t *in;
+	int w,h,step,shift;
+	int kind;		//0: R,G,B  1: one channel  2: luma
+	int n;			//histogram entries, 3*256 or 256
+	int jobs;
+	uint32_t *hist;		//band 0, and the result
+	uint32_t *part;		//bands 1..jobs-1
+} histo_frame;
+
+static inline void histo_job(void *arg, int k)
+{
+	histo_frame *f=(histo_frame*)arg;
+	uint32_t *hist=k ? f->part+(size_t)(k-1)*f->n : f->hist;
+	int rows=(f->h+f->step-1)/f->step;
+	int y0,y1;
+
+	thr_band(rows,f->jobs,k,&y0,&y1);
+	y0*=f->step;
+	y1*=f->step;
+	if (y1>f->h) y1=f->h;
+	switch (f->kind)
+	{
+	case 0:
+		histo_rgb_rows(f->in,f->w,y0,y1,f->step,(uint32_t (*)[256])hist);
+		break;
+	case 1:
+		histo_channel_rows(f->in,f->w,y0,y1,f->step,f->shift,hist);
+		break;
+	default:
+		histo_luma_rows(f->in,f->w,y0,y1,f->step,hist);
+		break;
+	}
+}
+
+static inline void histo_frame_run(histo_frame *f)
+{
+	int k;
+
+	f->jobs=thr_jobs((long)f->w*((f->h+f->step-1)/f->step),HISTO_MIN_JOB);
+	f->part=NULL;
+	if (f->jobs>1)
+	{
+		f->part=(uint32_t*)calloc((size_t)(f->jobs-1)*f->n,sizeof(uint32_t));
+		if (f->part==NULL) f->jobs=1;
+	}
+	memset(f->hist,0,f->n*sizeof(uint32_t));
+	thr_run(f->jobs,histo_job,f);
+	for (k=1;k<f->jobs;k++)
+		histo_merge(f->hist,f->part+(size_t)(k-1)*f->n,f->n);
+	free(f->part);
+}
+
+//--------------------------------------------------------
+//R,G,B counts of a whole frame (every step-th row)
+static inline void histo_rgb(const uint32_t *in, int w, int h, int step, uint32_t hist[3][256])
+{
+	histo_frame f;
+
+	f.in=in; f.w=w; f.h=h; f.step=step; f.shift=0;
+	f.kind=0; f.n=3*256; f.hist=&hist[0][0];
+	histo_frame_run(&f);
+}
+
+//--------------------------------------------------------
+//counts of byte (p>>shift)&0xFF of a whole frame
+static inline void histo_channel(const uint32_t *in, int w, int h, int step, int shift, uint32_t *hist)
+{
+	histo_frame f;
+
+	f.in=in; f.w=w; f.h=h; f.step=step; f.shift=shift;
+	f.kind=1; f.n=256; f.hist=hist;
+	histo_frame_run(&f);
+}
+
+//--------------------------------------------------------
+//luma counts of a whole frame
+static inline void histo_luma(const uint32_t *in, int w, int h, int step, uint32_t *hist)
+{
+	histo_frame f;
+
+	f.in=in; f.w=w; f.h=h; f.step=step; f.shift=0;
+	f.kind=2; f.n=256; f.hist=hist;
+	histo_frame_run(&f);
+}
+
+//--------------------------------------------------------
+//largest count
+static inline uint32_t histo_peak(const uint32_t *hist)
+{
+	uint32_t m=0;
+	int i;
+
+	for (i=0;i<256;i++)
+		if (hist[i]>m) m=hist[i];
+	return m;
+}
+
+//--------------------------------------------------------
+//lowest and highest value present (0 for an empty histogram)
+static inline int histo_low(const uint32_t *hist)
+{
+	int i;
+
+	for (i=0;i<256;i++)
+		if (hist[i]!=0) return i;
+	return 0;
+}
+
+static inline int histo_high(const uint32_t *hist)
+{
+	int i;
+
+	for (i=255;i>=0;i--)
+		if (hist[i]!=0) return i;
+	return 0;
+}
+
+//--------------------------------------------------------
+//out = lr[R],lg[G],lb[B], alpha from in, n pixels
+static inline void histo_lut_span(const uint32_t *in, uint32_t *out, long n, const uint8_t *lr, const uint8_t *lg, const uint8_t *lb)
+{
+	uint32_t p;
+	long i;
+
+	for (i=0;i<n;i++)
+	{
+		p=in[i];
+		out[i]=((uint32_t)lr[p&0xFF])|((uint32_t)lg[(p>>8)&0xFF]<<8)
+			|((uint32_t)lb[(p>>16)&0xFF]<<16)|(p&0xFF000000);
+	}
+}
+
+typedef struct
+{
+	const uint32_t *in;
+	uint32_t *out;
+	long n;
+	int jobs;
+	const uint8_t *lr,*lg,*lb;
+} histo_lut;
+
+static inline void histo_lut_job(void *arg, int k)
+{
+	histo_lut *l=(histo_lut*)arg;
+	long i0=l->n*k/l->jobs, i1=l->n*(k+1)/l->jobs;
+
+	histo_lut_span(l->in+i0,l->out+i0,i1-i0,l->lr,l->lg,l->lb);
+}
+
+//--------------------------------------------------------
+//out = lr[R],lg[G],lb[B], alpha from in
+//(in==out is allowed)
+static inline void histo_lut_apply(const uint32_t *in, uint32_t *out, int n, const uint8_t *lr, const uint8_t *lg, const uint8_t *lb)
+{
+	histo_lut l;
+
+	l.in=in; l.out=out; l.n=n;
+	l.lr=lr; l.lg=lg; l.lb=lb;
+	l.jobs=thr_jobs(n,HISTO_MIN_JOB);
+	thr_run(l.jobs,histo_lut_job,&l);
+}
+
+#endif
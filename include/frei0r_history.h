@@ -0,0 +1,600 @@
+/* frei0r_history.h
+ * Compact frame history for effects that keep many past frames
+ * (nervous, delaygrab)
+ *
+ * This file is a part of the Frei0r package
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*******************************************************************
+ * hist_init		planes of w x h RGBA8888 pixels
+ * hist_put		stores a frame as plane p
+ * hist_get		decodes a whole plane
+ * hist_span		decodes the pixels around (x,y) of a plane
+ *
+ * Storage is lossless. A plane is kept as the difference to a key
+ * frame, a raw copy of an earlier input, so it decodes from its key
+ * alone and never from a chain of planes; only the planes that are
+ * read are decoded. A frame becomes the new key when its differences
+ * to the current one would outgrow a raw frame, or have more than
+ * doubled since that key was taken (motion, drift): at a cut at once,
+ * else at most once per keyint planes. Noise alone doesn't double
+ * them, so a noisy still shot keeps one key.
+ *
+ * The differences are coded in groups of 16 pixels of a row. Each
+ * channel of a group gets 0, 2, 4 or 8 bits per pixel, the fewest
+ * that hold all its 16 differences (as signed bytes). A mode byte
+ * per group holds the four widths, and every 4th group the offset
+ * of its data, so any group can be found and decoded on its own.
+ *
+ * Memory per plane, in bytes per pixel, 4 being a raw frame:
+ *   index (mode, offsets)		1/8
+ *   still picture			0
+ *   noise up to +-3 levels		1.5 (alpha unchanged: 0)
+ *   noise up to +-8, motion		3
+ *   alpha changing as well		4
+ * plus 4 per live key frame (those still referenced, and one kept
+ * for reuse). A still camera with noise of a few levels takes
+ * about 1.8, a moving subject costs 3 only in the groups it covers.
+ * The worst case, a cut on every frame, makes every plane a key:
+ * planes+2 raw frames plus the index, about 10% over keeping every
+ * plane raw as before, at 32 planes. Encoding and decoding cost
+ * about two to three times the memcpy of a frame.
+ ******************************************************************/
+
+#ifndef INCLUDED_FREI0R_HISTORY_H
+#define INCLUDED_FREI0R_HISTORY_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define HIST_GROUP 16
+
+typedef struct
+{
+	int key;		//key slot, -1: never written, reads as zeros
+	uint8_t *mode;		//per group: 2 bits per channel
+	uint32_t *off;		//data offset of every 4th group
+	uint8_t *data;
+	size_t size, cap;
+	int cy, cg;		//group held in cache, cy<0: none
+	uint32_t cache[HIST_GROUP];
+} hist_plane;
+
+typedef struct
+{
+	uint32_t *pix;		//raw frame
+	int refs;		//planes coded against it
+} hist_key;
+
+typedef struct
+{
+	int planes;
+	int w, h;
+	int gw;			//groups per row
+	int qw;			//offsets per row
+	int keyint;		//least planes between key frames
+	int cur;		//key of the last plane, -1: none
+	int since;		//planes coded against cur
+	size_t base;		//data of the first of them, 0: none yet
+	hist_plane *plane;
+	hist_key *key;		//planes+1 slots
+	uint32_t *spare;	//freed key frame, for the next key
+	uint32_t zeros[HIST_GROUP];
+} frei0r_history;
+
+//--------------------------------------------------------
+//bits per pixel of width code k (0..3), and data bytes of a group
+static inline int hist_bits(int k)
+{
+	return (1 << k) & ~1;
+}
+
+static inline int hist_gsize(int mode)
+{
+	return 2 * (hist_bits(mode & 3) + hist_bits((mode >> 2) & 3)
+		+ hist_bits((mode >> 4) & 3) + hist_bits(mode >> 6));
+}
+
+//--------------------------------------------------------
+//width code for differences whose largest magnitude
+//(d or ~d for negative d) is m, any nonzero: nz
+static inline int hist_code(int m, int nz)
+{
+	if (!nz) return 0;
+	if (m <= 1) return 1;
+	if (m <= 7) return 2;
+	return 3;
+}
+
+//--------------------------------------------------------
+//planes of w x h, at most one key frame per keyint planes
+//except at cuts
+//returns 0 on failure
+static inline int hist_init(frei0r_history *h, int planes, int w, int hgt, int keyint)
+{
+	int i;
+
+	memset(h, 0, sizeof(*h));
+	h->planes = planes;
+	h->w = w;
+	h->h = hgt;
+	h->gw = (w + HIST_GROUP - 1) / HIST_GROUP;
+	h->qw = (h->gw + 3) / 4;
+	h->keyint = keyint < 1 ? 1 : keyint;
+	h->cur = -1;
+	h->plane = (hist_plane*)calloc(planes, sizeof(hist_plane));
+	h->key = (hist_key*)calloc(planes + 1, sizeof(hist_key));
+	if ((h->plane == NULL) || (h->key == NULL))
+		return 0;
+	for (i = 0; i < planes; i++)
+	{
+		h->plane[i].key = -1;
+		h->plane[i].cy = -1;
+		h->plane[i].mode = (uint8_t*)malloc((size_t)h->gw * hgt);
+		h->plane[i].off = (uint32_t*)malloc(sizeof(uint32_t) * h->qw * hgt);
+		if ((h->plane[i].mode == NULL) || (h->plane[i].off == NULL))
+			return 0;
+	}
+	return 1;
+}
+
+//--------------------------------------------------------
+static inline void hist_free(frei0r_history *h)
+{
+	int i;
+
+	if (h->plane != NULL)
+		for (i = 0; i < h->planes; i++)
+		{
+			free(h->plane[i].mode);
+			free(h->plane[i].off);
+			free(h->plane[i].data);
+		}
+	if (h->key != NULL)
+		for (i = 0; i <= h->planes; i++)
+			free(h->key[i].pix);
+	free(h->spare);
+	free(h->plane);
+	free(h->key);
+	h->plane = NULL;
+	h->key = NULL;
+	h->spare = NULL;
+}
+
+//--------------------------------------------------------
+static inline void hist_unref(frei0r_history *h, int k)
+{
+	if (k < 0 || --h->key[k].refs > 0)
+		return;
+	if (h->spare == NULL)
+		h->spare = h->key[k].pix;
+	else
+		free(h->key[k].pix);
+	h->key[k].pix = NULL;
+	if (h->cur == k)
+		h->cur = -1;
+}
+
+//--------------------------------------------------------
+//frame as a new key, returns the slot or -1
+static inline int hist_new_key(frei0r_history *h, const uint32_t *frame)
+{
+	int k;
+
+	for (k = 0; k <= h->planes; k++)
+		if (h->key[k].pix == NULL)
+			break;
+	if (k > h->planes)
+		return -1;
+	if (h->spare != NULL)
+	{
+		h->key[k].pix = h->spare;
+		h->spare = NULL;
+	}
+	else
+	{
+		h->key[k].pix = (uint32_t*)malloc(sizeof(uint32_t) * h->w * h->h);
+		if (h->key[k].pix == NULL)
+			return -1;
+	}
+	memcpy(h->key[k].pix, frame, sizeof(uint32_t) * h->w * h->h);
+	h->key[k].refs = 0;
+	return k;
+}
+
+//--------------------------------------------------------
+//codes n (<=16) pixels of in against key into dst
+//returns the mode byte, dst gets hist_gsize(mode) bytes
+static inline int hist_encode_group(const uint32_t *in, const uint32_t *key, int n, uint8_t *dst)
+{
+	uint8_t d[4][HIST_GROUP];
+	int i, c, k, mode = 0;
+	uint8_t *o = dst;
+
+#if defined(__SSE2__)
+	if (n == HIST_GROUP)
+	{
+		const __m128i z = _mm_setzero_si128();
+		const __m128i lo = _mm_set1_epi32(0xFF);
+		__m128i v[4], t, mx = z, nz = z;
+		unsigned m, o4;
+
+		for (i = 0; i < 4; i++)
+		{
+			v[i] = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(in + 4*i)),
+				_mm_loadu_si128((const __m128i*)(key + 4*i)));
+			t = _mm_xor_si128(v[i], _mm_cmplt_epi8(v[i], z));
+			mx = _mm_max_epu8(mx, t);
+			nz = _mm_or_si128(nz, v[i]);
+		}
+		//per channel over the 4 pixel lanes
+		mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 8));
+		mx = _mm_max_epu8(mx, _mm_srli_si128(mx, 4));
+		nz = _mm_or_si128(nz, _mm_srli_si128(nz, 8));
+		nz = _mm_or_si128(nz, _mm_srli_si128(nz, 4));
+		m = _mm_cvtsi128_si32(mx);
+		o4 = _mm_cvtsi128_si32(nz);
+
+		for (c = 0; c < 4; c++)
+		{
+			__m128i p;
+
+			k = hist_code((m >> (8*c)) & 0xFF, (o4 >> (8*c)) & 0xFF);
+			mode |= k << (2*c);
+			if (k == 0)
+				continue;
+			//channel c of the 16 pixels, in pixel order
+			p = _mm_packus_epi16(
+				_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v[0], 8*c), lo),
+						_mm_and_si128(_mm_srli_epi32(v[1], 8*c), lo)),
+				_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v[2], 8*c), lo),
+						_mm_and_si128(_mm_srli_epi32(v[3], 8*c), lo)));
+			if (k == 3)
+			{
+				_mm_storeu_si128((__m128i*)o, p);
+				o += 16;
+			}
+			else if (k == 2)
+			{
+				p = _mm_and_si128(p, _mm_set1_epi8(0x0F));
+				p = _mm_and_si128(_mm_or_si128(p, _mm_srli_epi16(p, 4)), _mm_set1_epi16(0xFF));
+				_mm_storel_epi64((__m128i*)o, _mm_packus_epi16(p, p));
+				o += 8;
+			}
+			else
+			{
+				uint32_t b;
+
+				p = _mm_and_si128(p, _mm_set1_epi8(0x03));
+				p = _mm_or_si128(_mm_or_si128(p, _mm_srli_epi32(p, 6)),
+					_mm_or_si128(_mm_srli_epi32(p, 12), _mm_srli_epi32(p, 18)));
+				p = _mm_and_si128(p, lo);
+				p = _mm_packs_epi32(p, p);
+				b = _mm_cvtsi128_si32(_mm_packus_epi16(p, p));
+				memcpy(o, &b, 4);
+				o += 4;
+			}
+		}
+		return mode;
+	}
+#endif
+
+	memset(d, 0, sizeof(d));
+	for (c = 0; c < 4; c++)
+	{
+		int m = 0, nz = 0;
+
+		for (i = 0; i < n; i++)
+		{
+			int8_t s = (int8_t)(((in[i] >> (8*c)) & 0xFF) - ((key[i] >> (8*c)) & 0xFF));
+			d[c][i] = (uint8_t)s;
+			nz |= s;
+			if ((s < 0 ? ~s : s) > m) m = s < 0 ? ~s : s;
+		}
+		k = hist_code(m, nz);
+		mode |= k << (2*c);
+		switch (k)
+		{
+		case 3:
+			memcpy(o, d[c], 16);
+			o += 16;
+			break;
+		case 2:
+			for (i = 0; i < 8; i++)
+				o[i] = (d[c][2*i] & 0x0F) | ((d[c][2*i+1] & 0x0F) << 4);
+			o += 8;
+			break;
+		case 1:
+			for (i = 0; i < 4; i++)
+				o[i] = (d[c][4*i] & 3) | ((d[c][4*i+1] & 3) << 2)
+					| ((d[c][4*i+2] & 3) << 4) | ((d[c][4*i+3] & 3) << 6);
+			o += 4;
+			break;
+		}
+	}
+	return mode;
+}
+
+//--------------------------------------------------------
+//n (<=16) pixels of a group: key + differences
+static inline void hist_decode_group(int mode, const uint8_t *src, const uint32_t *key, int n, uint32_t *out)
+{
+	int i, c, k;
+
+	if (mode == 0)
+	{
+		memcpy(out, key, sizeof(uint32_t) * n);
+		return;
+	}
+#if defined(__SSE2__)
+	if (n == HIST_GROUP)
+	{
+		const __m128i z = _mm_setzero_si128();
+		__m128i ch[4], rg, ba, t;
+
+		for (c = 0; c < 4; c++)
+		{
+			k = (mode >> (2*c)) & 3;
+			if (k == 0)
+				ch[c] = z;
+			else if (k == 3)
+			{
+				ch[c] = _mm_loadu_si128((const __m128i*)src);
+				src += 16;
+			}
+			else if (k == 2)
+			{
+				const __m128i m4 = _mm_set1_epi8(0x0F), s4 = _mm_set1_epi8(8);
+				t = _mm_loadl_epi64((const __m128i*)src);
+				t = _mm_unpacklo_epi8(_mm_and_si128(t, m4), _mm_and_si128(_mm_srli_epi16(t, 4), m4));
+				ch[c] = _mm_sub_epi8(_mm_xor_si128(t, s4), s4);
+				src += 8;
+			}
+			else
+			{
+				const __m128i m2 = _mm_set1_epi8(0x03), s2 = _mm_set1_epi8(2);
+				uint32_t b;
+				__m128i a0, a1, a2, a3;
+
+				memcpy(&b, src, 4);
+				t = _mm_cvtsi32_si128(b);
+				a0 = _mm_and_si128(t, m2);
+				a1 = _mm_and_si128(_mm_srli_epi16(t, 2), m2);
+				a2 = _mm_and_si128(_mm_srli_epi16(t, 4), m2);
+				a3 = _mm_and_si128(_mm_srli_epi16(t, 6), m2);
+				t = _mm_unpacklo_epi16(_mm_unpacklo_epi8(a0, a1), _mm_unpacklo_epi8(a2, a3));
+				ch[c] = _mm_sub_epi8(_mm_xor_si128(t, s2), s2);
+				src += 4;
+			}
+		}
+		//back to pixels, plus the key
+		rg = _mm_unpacklo_epi8(ch[0], ch[1]);
+		ba = _mm_unpacklo_epi8(ch[2], ch[3]);
+		_mm_storeu_si128((__m128i*)out, _mm_add_epi8(_mm_unpacklo_epi16(rg, ba),
+			_mm_loadu_si128((const __m128i*)key)));
+		_mm_storeu_si128((__m128i*)(out + 4), _mm_add_epi8(_mm_unpackhi_epi16(rg, ba),
+			_mm_loadu_si128((const __m128i*)(key + 4))));
+		rg = _mm_unpackhi_epi8(ch[0], ch[1]);
+		ba = _mm_unpackhi_epi8(ch[2], ch[3]);
+		_mm_storeu_si128((__m128i*)(out + 8), _mm_add_epi8(_mm_unpacklo_epi16(rg, ba),
+			_mm_loadu_si128((const __m128i*)(key + 8))));
+		_mm_storeu_si128((__m128i*)(out + 12), _mm_add_epi8(_mm_unpackhi_epi16(rg, ba),
+			_mm_loadu_si128((const __m128i*)(key + 12))));
+		return;
+	}
+#endif
+
+	for (i = 0; i < n; i++)
+		out[i] = key[i];
+	for (c = 0; c < 4; c++)
+	{
+		k = (mode >> (2*c)) & 3;
+		for (i = 0; i < n && k; i++)
+		{
+			int v;
+
+			if (k == 3)
+				v = (int8_t)src[i];
+			else if (k == 2)
+				v = (((src[i >> 1] >> (4 * (i & 1))) & 0x0F) ^ 8) - 8;
+			else
+				v = (((src[i >> 2] >> (2 * (i & 3))) & 3) ^ 2) - 2;
+			out[i] = (out[i] & ~(0xFFu << (8*c)))
+				| ((uint32_t)((((out[i] >> (8*c)) & 0xFF) + v) & 0xFF) << (8*c));
+		}
+		src += 2 * hist_bits(k);
+	}
+}
+
+//--------------------------------------------------------
+//codes frame against key slot kk into plane p
+//returns 0 if the data would outgrow 'limit' bytes
+static inline int hist_encode(frei0r_history *h, hist_plane *pl, const uint32_t *frame, int kk, size_t limit)
+{
+	const uint32_t *key = h->key[kk].pix;
+	size_t need;
+	int x, y, g, n;
+
+	pl->size = 0;
+	for (y = 0; y < h->h; y++)
+	{
+		need = pl->size + (size_t)h->gw * 64;
+		if (need > limit)
+			return 0;
+		if (need > pl->cap)
+		{
+			size_t cap = need + need / 2;
+			uint8_t *d = (uint8_t*)realloc(pl->data, cap);
+			if (d == NULL)
+				return 0;
+			pl->data = d;
+			pl->cap = cap;
+		}
+		for (g = 0; g < h->gw; g++)
+		{
+			x = g * HIST_GROUP;
+			n = h->w - x < HIST_GROUP ? h->w - x : HIST_GROUP;
+			if ((g & 3) == 0)
+				pl->off[y * h->qw + g / 4] = (uint32_t)pl->size;
+			pl->mode[y * h->gw + g] = hist_encode_group(frame + (size_t)y * h->w + x,
+				key + (size_t)y * h->w + x, n, pl->data + pl->size);
+			pl->size += hist_gsize(pl->mode[y * h->gw + g]);
+		}
+	}
+	return 1;
+}
+
+//--------------------------------------------------------
+//stores frame as plane p
+static inline void hist_put(frei0r_history *h, int p, const uint32_t *frame)
+{
+	hist_plane *pl = &h->plane[p];
+	int old = pl->key;
+	int kk = h->cur;
+	size_t raw = sizeof(uint32_t) * h->w * h->h;
+
+	pl->cy = -1;
+	pl->key = -1;
+
+	//against the current key; the frame is a key itself when the
+	//differences outgrow a raw frame, or have more than doubled
+	//since the key was taken, at a cut at once, else at most
+	//once per keyint planes (noise alone never doubles them)
+	if (kk >= 0 && hist_encode(h, pl, frame, kk, raw))
+	{
+		if (h->base == 0)
+			h->base = pl->size + 1;
+		else if (pl->size > 2 * h->base + raw / 16
+			&& (h->since >= h->keyint || pl->size > raw / 2))
+			kk = -1;
+	}
+	else
+		kk = -1;
+	if (kk < 0)
+	{
+		kk = hist_new_key(h, frame);
+		if (kk < 0)
+		{
+			hist_unref(h, old);	//plane p reads as zeros
+			return;
+		}
+		h->cur = kk;
+		h->since = 0;
+		h->base = 0;
+		memset(pl->mode, 0, (size_t)h->gw * h->h);
+		memset(pl->off, 0, sizeof(uint32_t) * h->qw * h->h);
+		pl->size = 0;
+	}
+	//give back what the coding did not use
+	if (pl->cap > pl->size + pl->size / 8 + 4096)
+	{
+		if (pl->size == 0)
+		{
+			free(pl->data);
+			pl->data = NULL;
+			pl->cap = 0;
+		}
+		else
+		{
+			uint8_t *d = (uint8_t*)realloc(pl->data, pl->size);
+			if (d != NULL)
+			{
+				pl->data = d;
+				pl->cap = pl->size;
+			}
+		}
+	}
+	pl->key = kk;
+	h->key[kk].refs++;
+	h->since++;
+	hist_unref(h, old);
+}
+
+//--------------------------------------------------------
+//data of group g of row y
+static inline const uint8_t *hist_group_data(const frei0r_history *h, const hist_plane *pl, int y, int g)
+{
+	const uint8_t *m = pl->mode + (size_t)y * h->gw;
+	size_t o = pl->off[y * h->qw + g / 4];
+	int i;
+
+	for (i = g & ~3; i < g; i++)
+		o += hist_gsize(m[i]);
+	return pl->data + o;
+}
+
+//--------------------------------------------------------
+//decodes plane p into frame
+static inline void hist_get(const frei0r_history *h, int p, uint32_t *frame)
+{
+	const hist_plane *pl = &h->plane[p];
+	const uint32_t *key;
+	const uint8_t *src, *m;
+	int x, y, g, n;
+
+	if (pl->key < 0)
+	{
+		memset(frame, 0, sizeof(uint32_t) * h->w * h->h);
+		return;
+	}
+	key = h->key[pl->key].pix;
+	src = pl->data;
+	for (y = 0; y < h->h; y++)
+	{
+		m = pl->mode + (size_t)y * h->gw;
+		for (g = 0; g < h->gw; g++)
+		{
+			x = g * HIST_GROUP;
+			n = h->w - x < HIST_GROUP ? h->w - x : HIST_GROUP;
+			hist_decode_group(m[g], src, key + (size_t)y * h->w + x, n,
+				frame + (size_t)y * h->w + x);
+			src += hist_gsize(m[g]);
+		}
+	}
+}
+
+//--------------------------------------------------------
+//pixels x... of row y of plane p; *n gets how many follow in
+//the returned buffer (at least 1), valid until the next call
+//for the same plane
+static inline const uint32_t *hist_span(frei0r_history *h, int p, int y, int x, int *n)
+{
+	hist_plane *pl = &h->plane[p];
+	int g = x / HIST_GROUP;
+	int gn = h->w - g * HIST_GROUP;
+
+	if (gn > HIST_GROUP)
+		gn = HIST_GROUP;
+	*n = gn - x % HIST_GROUP;
+	if (pl->key < 0)
+		return h->zeros;
+	if (pl->cy != y || pl->cg != g)
+	{
+		hist_decode_group(pl->mode[(size_t)y * h->gw + g], hist_group_data(h, pl, y, g),
+			h->key[pl->key].pix + (size_t)y * h->w + g * HIST_GROUP, gn, pl->cache);
+		pl->cy = y;
+		pl->cg = g;
+	}
+	return pl->cache + x % HIST_GROUP;
+}
+
+#endif
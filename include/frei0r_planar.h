@@ -0,0 +1,176 @@
+/* frei0r_planar.h
+ * Conversions between the packed RGBA8888 frame and the planar or
+ * float layouts that some filters work in
+ *
+ * This file is a part of the Frei0r package
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*******************************************************************
+ * planar_split8 / planar_merge8	R,G,B byte planes
+ * rgba_to_float / float_to_rgba	4 floats per pixel (r,g,b,a)
+ *
+ * n is the number of pixels. The merge functions take alpha from
+ * a packed frame (usually the input), so it passes through.
+ * With SSE2 16 pixels are done per step, the rest one by one;
+ * the results are the same either way.
+ ******************************************************************/
+
+#ifndef INCLUDED_FREI0R_PLANAR_H
+#define INCLUDED_FREI0R_PLANAR_H
+
+#include <inttypes.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//--------------------------------------------------------
+//packed RGBA -> R,G,B byte planes (alpha is dropped)
+static inline void planar_split8(const uint32_t *in, uint8_t *r, uint8_t *g, uint8_t *b, int n)
+{
+	int i=0;
+
+#if defined(__SSE2__)
+	const __m128i m=_mm_set1_epi32(0xFF);
+	__m128i v0,v1,v2,v3;
+
+	for (;i<n-15;i+=16)
+	{
+		v0=_mm_loadu_si128((const __m128i*)(in+i));
+		v1=_mm_loadu_si128((const __m128i*)(in+i+4));
+		v2=_mm_loadu_si128((const __m128i*)(in+i+8));
+		v3=_mm_loadu_si128((const __m128i*)(in+i+12));
+		_mm_storeu_si128((__m128i*)(r+i), _mm_packus_epi16(
+			_mm_packs_epi32(_mm_and_si128(v0,m),_mm_and_si128(v1,m)),
+			_mm_packs_epi32(_mm_and_si128(v2,m),_mm_and_si128(v3,m))));
+		v0=_mm_srli_epi32(v0,8); v1=_mm_srli_epi32(v1,8);
+		v2=_mm_srli_epi32(v2,8); v3=_mm_srli_epi32(v3,8);
+		_mm_storeu_si128((__m128i*)(g+i), _mm_packus_epi16(
+			_mm_packs_epi32(_mm_and_si128(v0,m),_mm_and_si128(v1,m)),
+			_mm_packs_epi32(_mm_and_si128(v2,m),_mm_and_si128(v3,m))));
+		v0=_mm_srli_epi32(v0,8); v1=_mm_srli_epi32(v1,8);
+		v2=_mm_srli_epi32(v2,8); v3=_mm_srli_epi32(v3,8);
+		_mm_storeu_si128((__m128i*)(b+i), _mm_packus_epi16(
+			_mm_packs_epi32(_mm_and_si128(v0,m),_mm_and_si128(v1,m)),
+			_mm_packs_epi32(_mm_and_si128(v2,m),_mm_and_si128(v3,m))));
+	}
+#endif
+	for (;i<n;i++)
+	{
+		r[i]=in[i]&0xFF;
+		g[i]=(in[i]>>8)&0xFF;
+		b[i]=(in[i]>>16)&0xFF;
+	}
+}
+
+//--------------------------------------------------------
+//R,G,B byte planes -> packed RGBA, alpha from a
+static inline void planar_merge8(const uint8_t *r, const uint8_t *g, const uint8_t *b, const uint32_t *a, uint32_t *out, int n)
+{
+	int i=0;
+
+#if defined(__SSE2__)
+	const __m128i am=_mm_set1_epi32(0xFF000000);
+	const __m128i z=_mm_setzero_si128();
+	__m128i vr,vg,vb,rg,b0;
+
+	for (;i<n-15;i+=16)
+	{
+		vr=_mm_loadu_si128((const __m128i*)(r+i));
+		vg=_mm_loadu_si128((const __m128i*)(g+i));
+		vb=_mm_loadu_si128((const __m128i*)(b+i));
+		rg=_mm_unpacklo_epi8(vr,vg);
+		b0=_mm_unpacklo_epi8(vb,z);
+		_mm_storeu_si128((__m128i*)(out+i), _mm_or_si128(_mm_unpacklo_epi16(rg,b0),
+			_mm_and_si128(_mm_loadu_si128((const __m128i*)(a+i)),am)));
+		_mm_storeu_si128((__m128i*)(out+i+4), _mm_or_si128(_mm_unpackhi_epi16(rg,b0),
+			_mm_and_si128(_mm_loadu_si128((const __m128i*)(a+i+4)),am)));
+		rg=_mm_unpackhi_epi8(vr,vg);
+		b0=_mm_unpackhi_epi8(vb,z);
+		_mm_storeu_si128((__m128i*)(out+i+8), _mm_or_si128(_mm_unpacklo_epi16(rg,b0),
+			_mm_and_si128(_mm_loadu_si128((const __m128i*)(a+i+8)),am)));
+		_mm_storeu_si128((__m128i*)(out+i+12), _mm_or_si128(_mm_unpackhi_epi16(rg,b0),
+			_mm_and_si128(_mm_loadu_si128((const __m128i*)(a+i+12)),am)));
+	}
+#endif
+	for (;i<n;i++)
+		out[i]=((uint32_t)r[i])|((uint32_t)g[i]<<8)|((uint32_t)b[i]<<16)|(a[i]&0xFF000000);
+}
+
+//--------------------------------------------------------
+//packed RGBA -> 4 floats per pixel, each channel times scale
+//(scale=1.0/255.0 gives 0...1)
+static inline void rgba_to_float(const uint32_t *in, float *out, float scale, int n)
+{
+	const uint8_t *c=(const uint8_t*)in;
+	int i=0;
+
+#if defined(__SSE2__)
+	const __m128 s=_mm_set1_ps(scale);
+	const __m128i z=_mm_setzero_si128();
+	__m128i v,lo,hi;
+
+	for (;i<n-3;i+=4)
+	{
+		v=_mm_loadu_si128((const __m128i*)(in+i));
+		lo=_mm_unpacklo_epi8(v,z);
+		hi=_mm_unpackhi_epi8(v,z);
+		_mm_storeu_ps(out+4*i, _mm_mul_ps(s,_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo,z))));
+		_mm_storeu_ps(out+4*i+4, _mm_mul_ps(s,_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo,z))));
+		_mm_storeu_ps(out+4*i+8, _mm_mul_ps(s,_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi,z))));
+		_mm_storeu_ps(out+4*i+12, _mm_mul_ps(s,_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi,z))));
+	}
+#endif
+	for (i=4*i;i<4*n;i++)
+		out[i]=scale*(float)c[i];
+}
+
+//--------------------------------------------------------
+//4 floats per pixel (0...1) -> packed RGBA
+//same as (uint8_t)(x*255.0) on each channel: no rounding,
+//values outside 0...1 are not clipped
+static inline void float_to_rgba(const float *in, uint32_t *out, int n)
+{
+	uint8_t *c=(uint8_t*)out;
+	int i=0;
+
+#if defined(__SSE2__)
+	const __m128d s=_mm_set1_pd(255.0);
+	const __m128i m=_mm_set1_epi32(0xFF);
+	__m128i q[4];
+	__m128 f;
+	int k;
+
+	for (;i<n-3;i+=4)
+	{
+		for (k=0;k<4;k++)
+		{
+			f=_mm_loadu_ps(in+4*i+4*k);
+			q[k]=_mm_unpacklo_epi64(
+				_mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(f),s)),
+				_mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(f,f)),s)));
+			q[k]=_mm_and_si128(q[k],m);	//low byte, as the cast
+		}
+		_mm_storeu_si128((__m128i*)(out+i), _mm_packus_epi16(
+			_mm_packs_epi32(q[0],q[1]),_mm_packs_epi32(q[2],q[3])));
+	}
+#endif
+	for (i=4*i;i<4*n;i++)
+		c[i]=(uint8_t)(in[i]*255.0);
+}
+
+#endif
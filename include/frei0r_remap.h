@@ -0,0 +1,531 @@
+/* frei0r_remap.h
+ * Geometric remapping of packed RGBA video through a precomputed map
+ *
+ * Based on the interp.h remap/interpolation functions of the c0rners
+ * and defish0r plugins,
+ * Copyright (C) 2010 Marko Cebokli   http://lea.hamradio.si/~s57uuu
+ * This file is a part of the Frei0r package
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*******************************************************************
+ * The map holds, for each pixel of the output image, the location
+ * in the input image from where its value is interpolated.
+ * The location is stored as integer pixel coordinates (int16) plus
+ * 8 bit fractions, six bytes per pixel instead of two floats.
+ * Pixels whose location was set negative get the background color.
+ *
+ * The map is usually computation intensive to generate, it is
+ * filled once with remap_set() and then used to remap every frame.
+ *
+ * All interpolators are separable. Their weights depend only on the
+ * 8 bit fraction, so they are tabulated once by remap_set_interp(),
+ * and the per pixel work is a gather and a multiply-add, done with
+ * SSE2 when available. Taps falling outside the input image are
+ * clamped to the edge pixels.
+ *
+ * remap_rows() processes a range of output rows, so a host may split
+ * a frame into bands; remap32() does the whole frame.
+ *
+ * With strong distortion or rotation, consecutive output pixels of a
+ * row read from distant input rows, and raster order thrashes the
+ * cache and TLB. remap_tiles() (called once after the map is filled)
+ * finds the input bounding box of each REMAP_TILE x REMAP_TILE output
+ * tile; remapping then goes tile by tile, prefetching the input area
+ * of the next tile. Maps where every output row reads only a narrow
+ * band of input rows (near identity) stay in raster order.
+ ******************************************************************/
+
+#ifndef INCLUDED_FREI0R_REMAP_H
+#define INCLUDED_FREI0R_REMAP_H
+
+#include <stdlib.h>
+#include <math.h>
+#include <inttypes.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//interpolator types, same numbering as the plugin parameters
+#define REMAP_NN   0	//nearest neighbor
+#define REMAP_BL   1	//bilinear
+#define REMAP_BC   2	//bicubic smooth (Aitken-Neville)
+#define REMAP_BC2  3	//bicubic sharp (Helmut Dersch)
+#define REMAP_SP4  4	//spline 4x4 (Helmut Dersch)
+#define REMAP_SP6  5	//spline 6x6 (Helmut Dersch)
+#define REMAP_SC16 6	//truncated sinc "lanczos" 16x16
+
+#define REMAP_MAXTAPS 16
+#define REMAP_MAXSIZE 32767	//largest input width and height (int16)
+
+#define REMAP_TILE 16		//output tile size
+#define REMAP_BAND 16		//max input rows per output row for raster order
+#define REMAP_PREFETCH 512	//max cache lines prefetched per tile
+
+typedef struct
+{
+	int16_t x,y;	//integer part, x<0 = background
+	uint8_t fx,fy;	//fraction in 1/256 pixel
+} remap_point;
+
+typedef struct
+{
+	int wi,hi;	//input image size
+	int wo,ho;	//output image size
+	remap_point *pt;	//wo*ho locations
+
+	int type;	//interpolator
+	int taps;	//kernel size (1, 2, 4, 6 or 16)
+	float *wt;	//taps weights for each of the 256 fractions
+
+	int tiled;	//0 = raster order, 1 = tile by tile
+	int ntx,nty;	//number of tiles
+	int *box;	//input bounding box x0,y0,x1,y1 of each tile
+} remap_map;
+
+//--------------------------------------------------------
+//weights of the separable interpolators, at position xx
+//from the first tap of the kernel (these are the polynomials
+//from the old interp.h, so the results stay the same)
+static void remap_weights(int type, float xx, float *w)
+{
+	float x1,xxx;
+	float PI=3.141592654;
+	int i;
+
+	switch (type)
+	{
+	case REMAP_BC:		//Lagrange through four points = Aitken-Neville
+		w[0]=-(xx-1.0)*(xx-2.0)*(xx-3.0)/6.0;
+		w[1]=xx*(xx-2.0)*(xx-3.0)/2.0;
+		w[2]=-xx*(xx-1.0)*(xx-3.0)/2.0;
+		w[3]=xx*(xx-1.0)*(xx-2.0)/6.0;
+		break;
+	case REMAP_BC2:
+		w[0]=(-0.75*(xx-5.0)*xx-6.0)*xx+3.0;
+		xx=xx-1.0; w[1]=(1.25*xx-2.25)*xx*xx+1.0;
+		xx=1.0-xx; w[2]=(1.25*xx-2.25)*xx*xx+1.0;
+		xx=xx+1.0; w[3]=(-0.75*(xx-5.0)*xx-6.0)*xx+3.0;
+		break;
+	case REMAP_SP4:
+		w[0]=((-0.333333*(xx-1.0)+0.8)*(xx-1.0)-0.466667)*(xx-1.0);
+		xx=xx-1.0; w[1]=((xx-1.8)*xx-0.2)*xx+1.0;
+		xx=1.0-xx; w[2]=((xx-1.8)*xx-0.2)*xx+1.0;
+		xx=xx+1.0; w[3]=((-0.333333*(xx-1.0)+0.8)*(xx-1.0)-0.466667)*(xx-1.0);
+		break;
+	case REMAP_SP6:
+		w[0]=((0.090909*(xx-2.0)-0.215311)*(xx-2.0)+0.124402)*(xx-2.0);
+		xx=xx-1.0;
+		w[1]=((-0.545455*(xx-1.0)+1.291866)*(xx-1.0)-0.746411)*(xx-1.0);
+		xx=xx-1.0;
+		w[2]=((1.181818*xx-2.167464)*xx+0.014354)*xx+1.0;
+		xx=1.0-xx;
+		w[3]=((1.181818*xx-2.167464)*xx+0.014354)*xx+1.0;
+		xx=xx+1.0;
+		w[4]=((-0.545455*(xx-1.0)+1.291866)*(xx-1.0)-0.746411)*(xx-1.0);
+		xx=xx+1.0;
+		w[5]=((0.090909*(xx-2.0)-0.215311)*(xx-2.0)+0.124402)*(xx-2.0);
+		break;
+	case REMAP_SC16:
+		for (i=7;i>=0;i--)
+		{
+			x1=xx*PI;
+			w[7-i]=(x1!=0)?(sin(x1)/(x1))*(sin(x1*0.125)/(x1*0.125)):1.0;
+			xxx=(float)(2*i+1)-xx;
+			x1=xxx*PI;
+			w[8+i]=(x1!=0)?(sin(x1)/(x1))*(sin(x1*0.125)/(x1*0.125)):1.0;
+			xx=xx-1.0;
+		}
+		break;
+	}
+}
+
+//--------------------------------------------------------
+//allocates a map for wi x hi input and wo x ho output,
+//all pixels set to background
+//the input must fit the int16 locations (at most REMAP_MAXSIZE)
+//returns 0 on failure, with nothing allocated and an empty
+//0 x 0 map (remap32 then does nothing)
+static inline int remap_alloc(remap_map *m, int wi, int hi, int wo, int ho)
+{
+	size_t i,n;
+
+	m->wi=0; m->hi=0;
+	m->wo=0; m->ho=0;
+	m->ntx=0; m->nty=0;
+	m->pt=NULL; m->wt=NULL; m->box=NULL;
+	m->type=REMAP_NN; m->taps=1;
+	m->tiled=0;
+	if ((wi<1)||(hi<1)||(wo<1)||(ho<1)||(wi>REMAP_MAXSIZE)||(hi>REMAP_MAXSIZE))
+		return 0;
+	n=(size_t)wo*ho;
+	m->pt=(remap_point*)malloc(sizeof(remap_point)*n);
+	m->wt=(float*)calloc(256*REMAP_MAXTAPS, sizeof(float));
+	m->ntx=(wo+REMAP_TILE-1)/REMAP_TILE;
+	m->nty=(ho+REMAP_TILE-1)/REMAP_TILE;
+	m->box=(int*)calloc((size_t)4*m->ntx*m->nty, sizeof(int));
+	if ((m->pt==NULL)||(m->wt==NULL)||(m->box==NULL))
+	{
+		free(m->pt); free(m->wt); free(m->box);
+		m->pt=NULL; m->wt=NULL; m->box=NULL;
+		m->ntx=0; m->nty=0;
+		return 0;
+	}
+	m->wi=wi; m->hi=hi;
+	m->wo=wo; m->ho=ho;
+	for (i=0;i<n;i++)
+	{
+		m->pt[i].x=-1; m->pt[i].y=-1;
+		m->pt[i].fx=0; m->pt[i].fy=0;
+	}
+	return 1;
+}
+
+//--------------------------------------------------------
+static inline void remap_free(remap_map *m)
+{
+	free(m->pt);
+	free(m->wt);
+	free(m->box);
+	m->pt=NULL;
+	m->wt=NULL;
+	m->box=NULL;
+}
+
+//--------------------------------------------------------
+//selects the interpolator and tabulates its weights
+//(SP6 includes the old 0.947 fudge factor, split between x and y)
+static inline void remap_set_interp(remap_map *m, int type)
+{
+	int k,j;
+	float *w;
+
+	m->type=type;
+	switch (type)
+	{
+	case REMAP_NN:   m->taps=1; return;
+	case REMAP_BL:   m->taps=2; return;
+	case REMAP_BC:
+	case REMAP_BC2:
+	case REMAP_SP4:  m->taps=4; break;
+	case REMAP_SP6:  m->taps=6; break;
+	case REMAP_SC16: m->taps=16; break;
+	default: m->type=REMAP_NN; m->taps=1; return;
+	}
+
+	for (k=0;k<256;k++)
+	{
+		w=m->wt+k*m->taps;
+		remap_weights(type, (float)k/256.0+m->taps/2-1, w);
+		if (type==REMAP_SP6)
+			for (j=0;j<6;j++)
+				w[j]=0.973139*w[j];	//sqrt of fudge factor 0.947
+	}
+}
+
+//--------------------------------------------------------
+//marks output pixel i as background
+static inline void remap_set_bg(remap_map *m, int i)
+{
+	m->pt[i].x=-1; m->pt[i].y=-1;
+	m->pt[i].fx=0; m->pt[i].fy=0;
+}
+
+//--------------------------------------------------------
+//sets the input location x,y (in input pixels) of output pixel i
+//negative x or y means background
+static inline void remap_set(remap_map *m, int i, float x, float y)
+{
+	int ix,iy,fx,fy;
+
+	if ((x<0.0)||(y<0.0))
+	{
+		remap_set_bg(m, i);
+		return;
+	}
+	if (x>m->wi-1) x=m->wi-1;
+	if (y>m->hi-1) y=m->hi-1;
+	ix=(int)x; iy=(int)y;
+	//truncated, so the kernel window is the same as for the exact x,y
+	fx=(int)((x-ix)*256.0f); if (fx>255) fx=255;
+	fy=(int)((y-iy)*256.0f); if (fy>255) fy=255;
+	m->pt[i].x=ix; m->pt[i].y=iy;
+	m->pt[i].fx=fx; m->pt[i].fy=fy;
+}
+
+//--------------------------------------------------------
+//finds the input bounding boxes of the output tiles and
+//chooses between raster and tiled order
+//call after the map has been filled
+static inline void remap_tiles(remap_map *m)
+{
+	const remap_point *p;
+	int *b;
+	int i,j,ymin,ymax,band;
+
+	for (i=0;i<m->ntx*m->nty;i++)
+	{	//empty
+		b=m->box+4*i;
+		b[0]=m->wi; b[1]=m->hi; b[2]=-1; b[3]=-1;
+	}
+
+	band=0;
+	for (i=0;i<m->ho;i++)
+	{
+		p=m->pt+i*m->wo;
+		ymin=m->hi; ymax=-1;
+		for (j=0;j<m->wo;j++)
+		{
+			if (p[j].x<0) continue;
+			b=m->box+4*((i/REMAP_TILE)*m->ntx+j/REMAP_TILE);
+			if (p[j].x<b[0]) b[0]=p[j].x;
+			if (p[j].x>b[2]) b[2]=p[j].x;
+			if (p[j].y<b[1]) b[1]=p[j].y;
+			if (p[j].y>b[3]) b[3]=p[j].y;
+			if (p[j].y<ymin) ymin=p[j].y;
+			if (p[j].y>ymax) ymax=p[j].y;
+		}
+		if (ymax-ymin>band) band=ymax-ymin;
+	}
+
+	m->tiled=(band>REMAP_BAND);
+}
+
+//--------------------------------------------------------
+//prefetches the input area of tile t, with the kernel margin
+static inline void remap_prefetch(const remap_map *m, const uint32_t *in, int t)
+{
+#if defined(__SSE2__)
+	const int *b=m->box+4*t;
+	int x0,y0,x1,y1,x,y;
+
+	if (b[2]<0) return;	//all background
+	x0=b[0]-m->taps/2; if (x0<0) x0=0;
+	y0=b[1]-m->taps/2; if (y0<0) y0=0;
+	x1=b[2]+m->taps/2+1; if (x1>m->wi-1) x1=m->wi-1;
+	y1=b[3]+m->taps/2+1; if (y1>m->hi-1) y1=m->hi-1;
+	//a box this big would not stay in cache anyway
+	if ((y1-y0+1)*((x1-x0)/16+1)>REMAP_PREFETCH) return;
+	for (y=y0;y<=y1;y++)
+		for (x=x0&~15;x<=x1;x=x+16)	//16 pixels per cache line
+			_mm_prefetch((const char*)(in+y*m->wi+x),_MM_HINT_T0);
+#else
+	(void)m; (void)in; (void)t;
+#endif
+}
+
+//--------------------------------------------------------
+//nearest neighbor
+static inline uint32_t remap_nn(const remap_map *m, const uint32_t *in, remap_point p)
+{
+	int x,y;
+
+	x=p.x+(p.fx>>7); if (x>m->wi-1) x=m->wi-1;
+	y=p.y+(p.fy>>7); if (y>m->hi-1) y=m->hi-1;
+	return in[y*m->wi+x];
+}
+
+//--------------------------------------------------------
+//bilinear, 8 bit weights, rounded
+//takes just the input size, so it can also be used without a map
+static inline uint32_t remap_bl(const uint32_t *in, int wi, int hi, remap_point p)
+{
+	const uint32_t *s0,*s1;
+	int dx;
+
+	s0=in+p.y*wi+p.x;
+	s1=(p.y+1<hi) ? s0+wi : s0;
+	dx=(p.x+1<wi) ? 1 : 0;
+#if defined(__SSE2__)
+	{
+		const __m128i zero=_mm_setzero_si128();
+		__m128i wx,wy,a,b,h0,h1;
+
+		wx=_mm_set1_epi32((p.fx<<16)|(256-p.fx));
+		wy=_mm_set1_epi32((p.fy<<16)|(256-p.fy));
+		//r00,r01,g00,g01,... pairs for madd
+		a=_mm_unpacklo_epi8(_mm_cvtsi32_si128(s0[0]),zero);
+		b=_mm_unpacklo_epi8(_mm_cvtsi32_si128(s0[dx]),zero);
+		h0=_mm_madd_epi16(_mm_unpacklo_epi16(a,b),wx);
+		a=_mm_unpacklo_epi8(_mm_cvtsi32_si128(s1[0]),zero);
+		b=_mm_unpacklo_epi8(_mm_cvtsi32_si128(s1[dx]),zero);
+		h1=_mm_madd_epi16(_mm_unpacklo_epi16(a,b),wx);
+		//rows at scale 128 fit int16
+		h0=_mm_srli_epi32(h0,1);
+		h1=_mm_srli_epi32(h1,1);
+		h0=_mm_madd_epi16(_mm_or_si128(h0,_mm_slli_epi32(h1,16)),wy);
+		h0=_mm_srli_epi32(_mm_add_epi32(h0,_mm_set1_epi32(1<<14)),15);
+		h0=_mm_packs_epi32(h0,h0);
+		return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(h0,h0));
+	}
+#else
+	{
+		uint32_t v=0;
+		int b,h0,h1;
+
+		for (b=0;b<32;b=b+8)
+		{
+			h0=((s0[0]>>b)&0xFF)*(256-p.fx)+((s0[dx]>>b)&0xFF)*p.fx;
+			h1=((s1[0]>>b)&0xFF)*(256-p.fx)+((s1[dx]>>b)&0xFF)*p.fx;
+			v|=(uint32_t)((h0*(256-p.fy)+h1*p.fy+32768)>>16)<<b;
+		}
+		return v;
+	}
+#endif
+}
+
+//--------------------------------------------------------
+//separable kernels from the weight tables (bicubics, splines, sinc)
+static inline uint32_t remap_sep(const remap_map *m, const uint32_t *in, remap_point p)
+{
+	const int n=m->taps;
+	const float *wx=m->wt+p.fx*n;
+	const float *wy=m->wt+p.fy*n;
+	int col[REMAP_MAXTAPS];
+	const uint32_t *s;
+	int i,j,r;
+
+	for (j=0;j<n;j++)
+	{
+		col[j]=p.x-n/2+1+j;
+		if (col[j]<0) col[j]=0;
+		if (col[j]>m->wi-1) col[j]=m->wi-1;
+	}
+
+#if defined(__SSE2__)
+	{
+		const __m128i zero=_mm_setzero_si128();
+		__m128 acc,row,v;
+		__m128i q;
+
+		acc=_mm_setzero_ps();
+		for (i=0;i<n;i++)
+		{
+			r=p.y-n/2+1+i;
+			if (r<0) r=0;
+			if (r>m->hi-1) r=m->hi-1;
+			s=in+r*m->wi;
+			row=_mm_setzero_ps();
+			for (j=0;j<n;j++)
+			{
+				q=_mm_unpacklo_epi8(_mm_cvtsi32_si128(s[col[j]]),zero);
+				v=_mm_cvtepi32_ps(_mm_unpacklo_epi16(q,zero));
+				row=_mm_add_ps(row,_mm_mul_ps(v,_mm_set1_ps(wx[j])));
+			}
+			acc=_mm_add_ps(acc,_mm_mul_ps(row,_mm_set1_ps(wy[i])));
+		}
+		q=_mm_cvtps_epi32(acc);
+		q=_mm_packs_epi32(q,q);
+		return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(q,q));
+	}
+#else
+	{
+		float acc[4]={0.0,0.0,0.0,0.0},row[4];
+		uint32_t v=0;
+		int b;
+
+		for (i=0;i<n;i++)
+		{
+			r=p.y-n/2+1+i;
+			if (r<0) r=0;
+			if (r>m->hi-1) r=m->hi-1;
+			s=in+r*m->wi;
+			row[0]=0.0; row[1]=0.0; row[2]=0.0; row[3]=0.0;
+			for (j=0;j<n;j++)
+				for (b=0;b<4;b++)
+					row[b]=row[b]+wx[j]*((s[col[j]]>>(8*b))&0xFF);
+			for (b=0;b<4;b++)
+				acc[b]=acc[b]+wy[i]*row[b];
+		}
+		for (b=0;b<4;b++)
+		{
+			if (acc[b]<0.0) acc[b]=0.0;
+			if (acc[b]>255.0) acc[b]=255.0;
+			v|=(uint32_t)(acc[b]+0.5)<<(8*b);
+		}
+		return v;
+	}
+#endif
+}
+
+//--------------------------------------------------------
+//remaps pixels j0 to j1-1 of output row i
+static inline void remap_span(const remap_map *m, const uint32_t *in, uint32_t *out, uint32_t bgc, int i, int j0, int j1)
+{
+	const remap_point *p=m->pt+i*m->wo;
+	uint32_t *o=out+i*m->wo;
+	int j;
+
+	switch (m->type)	//once per span, not per pixel
+	{
+	case REMAP_NN:
+		for (j=j0;j<j1;j++)
+			o[j]=(p[j].x>=0) ? remap_nn(m,in,p[j]) : bgc;
+		break;
+	case REMAP_BL:
+		for (j=j0;j<j1;j++)
+			o[j]=(p[j].x>=0) ? remap_bl(in,m->wi,m->hi,p[j]) : bgc;
+		break;
+	default:
+		for (j=j0;j<j1;j++)
+			o[j]=(p[j].x>=0) ? remap_sep(m,in,p[j]) : bgc;
+		break;
+	}
+}
+
+//--------------------------------------------------------
+//remaps output rows y0 to y1-1
+//in = input image wi x hi, out = output image wo x ho
+//bgc = background color
+static inline void remap_rows(const remap_map *m, const uint32_t *in, uint32_t *out, uint32_t bgc, int y0, int y1)
+{
+	int i,tx,ty,t0,t1,x1;
+
+	if (!m->tiled)
+	{
+		for (i=y0;i<y1;i++)
+			remap_span(m, in, out, bgc, i, 0, m->wo);
+		return;
+	}
+
+	//each tile prefetches the next one
+	remap_prefetch(m, in, (y0/REMAP_TILE)*m->ntx);
+	for (ty=y0/REMAP_TILE;ty*REMAP_TILE<y1;ty++)
+	{
+		t0=ty*REMAP_TILE; if (t0<y0) t0=y0;
+		t1=(ty+1)*REMAP_TILE; if (t1>y1) t1=y1;
+		for (tx=0;tx<m->ntx;tx++)
+		{
+			if (tx+1<m->ntx)
+				remap_prefetch(m, in, ty*m->ntx+tx+1);
+			else if (ty+1<m->nty)
+				remap_prefetch(m, in, (ty+1)*m->ntx);
+			x1=(tx+1)*REMAP_TILE; if (x1>m->wo) x1=m->wo;
+			for (i=t0;i<t1;i++)
+				remap_span(m, in, out, bgc, i, tx*REMAP_TILE, x1);
+		}
+	}
+}
+
+//--------------------------------------------------------
+//remaps the whole frame
+static inline void remap32(const remap_map *m, const uint32_t *in, uint32_t *out, uint32_t bgc)
+{
+	remap_rows(m, in, out, bgc, 0, m->ho);
+}
+
+#endif
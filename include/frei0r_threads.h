@@ -0,0 +1,166 @@
+/* frei0r_threads.h
+ * Runs the work of one f0r_update on several threads
+ *
+ * This file is a part of the Frei0r package
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*******************************************************************
+ * thr_count		threads to use: CPUs online, at most THR_MAX
+ * thr_jobs		how many jobs n units of work are worth
+ * thr_run		job(arg,0) ... job(arg,n-1), returns when all
+ *			of them are done
+ * thr_band		rows y0..y1-1 of band k of n
+ *
+ * A host calls one instance from one thread at a time; f0r_update
+ * may still hand parts of its frame to other threads, as long as
+ * they are done when it returns. thr_run starts the threads on each
+ * call and joins them, so an instance keeps no thread state and any
+ * number of instances can run side by side. Jobs are taken in order
+ * by whichever thread is free; the calling thread works too.
+ *
+ * Threads need HAVE_PTHREAD, which the build defines unless it is
+ * configured WITHOUT_THREADS. The environment variable
+ * FREI0R_THREADS=n sets the count (1: all work on the calling
+ * thread), for hosts that already run many instances in parallel.
+ ******************************************************************/
+
+#ifndef INCLUDED_FREI0R_THREADS_H
+#define INCLUDED_FREI0R_THREADS_H
+
+#include <stdlib.h>
+
+#if defined(HAVE_PTHREAD)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define THR_MAX 16
+
+typedef void (*thr_job)(void *arg, int job);
+
+#if defined(HAVE_PTHREAD)
+
+typedef struct
+{
+	thr_job job;
+	void *arg;
+	int n;
+	int next;		//first job not taken yet
+	pthread_mutex_t lock;
+} thr_queue;
+
+static int thr_ncpu = 1;
+static pthread_once_t thr_once = PTHREAD_ONCE_INIT;
+
+static inline void thr_init(void)
+{
+	long n = 1;
+	const char *env = getenv("FREI0R_THREADS");
+
+#if defined(_SC_NPROCESSORS_ONLN)
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (env && atoi(env) > 0)
+		n = atoi(env);
+	thr_ncpu = n < 1 ? 1 : (n > THR_MAX ? THR_MAX : n);
+}
+
+static inline void *thr_worker(void *p)
+{
+	thr_queue *q = (thr_queue*)p;
+	int j;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&q->lock);
+		j = q->next++;
+		pthread_mutex_unlock(&q->lock);
+		if (j >= q->n)
+			return NULL;
+		q->job(q->arg, j);
+	}
+}
+
+#endif
+
+//--------------------------------------------------------
+static inline int thr_count(void)
+{
+#if defined(HAVE_PTHREAD)
+	pthread_once(&thr_once, thr_init);
+	return thr_ncpu;
+#else
+	return 1;
+#endif
+}
+
+//--------------------------------------------------------
+//jobs for n units (rows, pixels...) of which one job should
+//get at least min: starting a thread costs some 10 us, a
+//small frame is done faster on one
+static inline int thr_jobs(long n, long min)
+{
+	int t = thr_count();
+
+	if (min > 0 && n / min < t)
+		t = (int)(n / min);
+	return t < 1 ? 1 : t;
+}
+
+//--------------------------------------------------------
+static inline void thr_run(int n, thr_job job, void *arg)
+{
+	int j;
+#if defined(HAVE_PTHREAD)
+	pthread_t t[THR_MAX];
+	thr_queue q;
+	int k, started = 0;
+	int threads = thr_count();
+
+	if (threads > n)
+		threads = n;
+	if (threads > 1)
+	{
+		q.job = job;
+		q.arg = arg;
+		q.n = n;
+		q.next = 0;
+		pthread_mutex_init(&q.lock, NULL);
+		//if a thread can't be started, the others take its jobs
+		for (k = 1; k < threads; k++)
+			if (pthread_create(&t[started], NULL, thr_worker, &q) == 0)
+				started++;
+		thr_worker(&q);
+		for (k = 0; k < started; k++)
+			pthread_join(t[k], NULL);
+		pthread_mutex_destroy(&q.lock);
+		return;
+	}
+#endif
+	for (j = 0; j < n; j++)
+		job(arg, j);
+}
+
+//--------------------------------------------------------
+//even split of h rows into n bands
+static inline void thr_band(int h, int n, int k, int *y0, int *y1)
+{
+	*y0 = (int)((long)h * k / n);
+	*y1 = (int)((long)h * (k + 1) / n);
+}
+
+#endif
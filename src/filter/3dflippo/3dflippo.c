@@ -49,15 +49,15 @@ typedef struct tdflippo_instance
   unsigned int width,height,fsize;
   int *mask;
   float flip[3],rate[3],center[2];
-  unsigned char invertrot,dontblank,fillblack,mustrecompute;
+  unsigned char invertrot,dontblank,fillblack,mustrecompute,identity;
 } tdflippo_instance_t;
 
-static float **newmat(unsigned char unit_flg);
-static void matfree(float **mat);
-static float **mat_translate(float tx,float ty,float tz);
-static float **mat_rotate(enum axis ax,float angle);
-static float **matmult(float **mat1,float **mat2);
-static void vetmat(float **mat,float *x,float *y,float *z);
+typedef float mat4[MSIZE][MSIZE];
+
+static void newmat(mat4 mat,unsigned char unit_flg);
+static void mat_translate(mat4 mat,float tx,float ty,float tz);
+static void mat_rotate(mat4 mat,enum axis ax,float angle);
+static void matmult(mat4 mat1,mat4 mat2);
 static void recompute_mask(tdflippo_instance_t* inst);
 
 int f0r_init()
@@ -77,7 +77,7 @@ void f0r_get_plugin_info(f0r_plugin_info_t* flippoInfo)
   flippoInfo->color_model=F0R_COLOR_MODEL_PACKED32;
   flippoInfo->frei0r_version=FREI0R_MAJOR_VERSION;
   flippoInfo->major_version=0;
-  flippoInfo->minor_version=1;
+  flippoInfo->minor_version=2;
   flippoInfo->num_params=11;
   flippoInfo->explanation="Frame rotation in 3d-space";
 }
@@ -154,6 +154,7 @@ f0r_instance_t f0r_construct(unsigned int width,unsigned int height)
   inst->flip[0]=inst->flip[1]=inst->flip[2]=inst->rate[0]=inst->rate[1]=inst->rate[2]=0.5;
   
   inst->mask=(int*)malloc(sizeof(int)*inst->fsize);
+  inst->mustrecompute=1;
 
   return (f0r_instance_t)inst;
 }
@@ -265,7 +266,7 @@ void f0r_update(f0r_instance_t instance,double time,
   assert(instance);
 
   tdflippo_instance_t* inst=(tdflippo_instance_t*)instance;  
-  int i;
+  unsigned int i;
 
   if(inst->rate[0]!=0.5 || inst->rate[1]!=0.5 || inst->rate[2]!=0.5 || inst->mustrecompute)
   {
@@ -286,59 +287,53 @@ void f0r_update(f0r_instance_t instance,double time,
     recompute_mask(inst);
   }
 
-  for(i=0;i<inst->fsize;i++)
+/*
+ * Constant angles: the mask is reused, and a null rotation is a copy
+ */
+
+  if(inst->identity)
   {
-    if(inst->mask[i]>=0)
-      outframe[i]=inframe[inst->mask[i]];
-    else if(!inst->fillblack)
-      outframe[i]=inframe[i];
-    else
-      outframe[i]=0;
+    memcpy(outframe,inframe,sizeof(uint32_t)*inst->fsize);
+    return;
   }
-}
 
-static float **newmat(unsigned char unit_flg)
-{
-  int i;
-  float **to_ret=(float**)malloc(sizeof(float *)*MSIZE);
-
-  for(i=0;i<MSIZE;i++)
+  if(inst->fillblack)
   {
-    to_ret[i]=(float*)calloc(MSIZE,sizeof(float));
-    if(unit_flg)
-      to_ret[i][i]=1.0;
+    for(i=0;i<inst->fsize;i++)
+      outframe[i]=(inst->mask[i]>=0) ? inframe[inst->mask[i]] : 0;
+  }
+  else
+  {
+    for(i=0;i<inst->fsize;i++)
+      outframe[i]=inframe[(inst->mask[i]>=0) ? (unsigned int)inst->mask[i] : i];
   }
-
-  return to_ret;
 }
 
-static void matfree(float **mat)
+static void newmat(mat4 mat,unsigned char unit_flg)
 {
   int i;
 
-  for(i=0;i<MSIZE;i++)
-    free(mat[i]);
-  
-  free(mat);
+  memset(mat,0,sizeof(mat4));
+  if(unit_flg)
+    for(i=0;i<MSIZE;i++)
+      mat[i][i]=1.0;
 }
 
-static float **mat_translate(float tx,float ty,float tz)
+static void mat_translate(mat4 mat,float tx,float ty,float tz)
 {
-  float **mat=newmat(1);
+  newmat(mat,1);
 
   mat[0][3]=tx;
   mat[1][3]=ty;
   mat[2][3]=tz;
-
-  return mat;
 }
 
-static float **mat_rotate(enum axis ax,float angle)
+static void mat_rotate(mat4 mat,enum axis ax,float angle)
 {
-  float **mat=newmat(1);
   float sf=sinf(angle);
   float cf=cosf(angle);
 
+  newmat(mat,1);
   switch(ax)
   {
     case AXIS_X:
@@ -360,55 +355,49 @@ static float **mat_rotate(enum axis ax,float angle)
       mat[1][1]=cf;
       break;
   }
-  return mat;
 }  
 
-static float **matmult(float **mat1,float **mat2)
+/* mat1 = mat1 * mat2 */
+static void matmult(mat4 mat1,mat4 mat2)
 {
-  float **mat=newmat(0);
+  mat4 mat;
   int i,j,k;
 
+  newmat(mat,0);
   for(i=0;i<MSIZE;i++)
     for(j=0;j<MSIZE;j++)
       for(k=0;k<MSIZE;k++)
 	mat[i][j]+=mat1[i][k]*mat2[k][j];
   
-  matfree(mat1);
-  matfree(mat2);
-
-  return mat;
+  memcpy(mat1,mat,sizeof(mat4));
 }
 
-static void vetmat(float **mat,float *x,float *y,float *z)
-{
-  float v;
-  float vet[]={*x,*y,*z,1.0};
-  float *vetp[]={x,y,z,&v};
-  int i,j;
-
-  for(i=0;i<MSIZE;i++)
-  {
-    *(vetp[i])=0.0;
-
-    for(j=0;j<MSIZE;j++)
-      *(vetp[i])+=mat[i][j]*vet[j];
-  }
-}
-  
 static void recompute_mask(tdflippo_instance_t* inst)
 {
   float xpos=(float)inst->width*inst->center[0];
   float ypos=(float)inst->height*inst->center[1];
-  float **mat=mat_translate(xpos,ypos,0.0);
+  mat4 mat,m;
+
+  mat_translate(mat,xpos,ypos,0.0);
   
   if(inst->flip[0]!=0.5)
-    mat=matmult(mat,mat_rotate(AXIS_X,(inst->flip[0]-0.5)*TWO_PI));
+  {
+    mat_rotate(m,AXIS_X,(inst->flip[0]-0.5)*TWO_PI);
+    matmult(mat,m);
+  }
   if(inst->flip[1]!=0.5)
-    mat=matmult(mat,mat_rotate(AXIS_Y,(inst->flip[1]-0.5)*TWO_PI));
+  {
+    mat_rotate(m,AXIS_Y,(inst->flip[1]-0.5)*TWO_PI);
+    matmult(mat,m);
+  }
   if(inst->flip[2]!=0.5)
-    mat=matmult(mat,mat_rotate(AXIS_Z,(inst->flip[2]-0.5)*TWO_PI));
+  {
+    mat_rotate(m,AXIS_Z,(inst->flip[2]-0.5)*TWO_PI);
+    matmult(mat,m);
+  }
   
-  mat=matmult(mat,mat_translate(-xpos,-ypos,0.0));
+  mat_translate(m,-xpos,-ypos,0.0);
+  matmult(mat,m);
   
 #if 0
   fprintf(stderr,"Resarra %.2f %.2f %.2f %.2f | %.2f %.2f %.2f %.2f | %.2f %.2f %.2f %.2f | %.2f %.2f %.2f %.2f\n",
@@ -419,18 +408,35 @@ static void recompute_mask(tdflippo_instance_t* inst)
 #endif
   
   int x,y,nx,ny,pos;
-  float xf,yf,zf;
+  float xf,yf,xrow,yrow;
+
+/*
+ * No rotation and nothing left over from earlier masks: plain copy
+ */
+
+  inst->identity=(inst->flip[0]==0.5 && inst->flip[1]==0.5 && inst->flip[2]==0.5 && !inst->dontblank);
+  if(inst->identity)
+  {
+    for(pos=0;pos<inst->fsize;pos++)
+      inst->mask[pos]=pos;
+    return;
+  }
 
   if(!inst->dontblank)
     memset(inst->mask,0xff,sizeof(int)*inst->fsize);
 
+/*
+ * z is 0 on input, so only the x, y and translation columns are needed
+ */
+
   for(y=0,pos=0;y<inst->height;y++)
+  {
+    xrow=mat[0][1]*(float)y;
+    yrow=mat[1][1]*(float)y;
     for(x=0;x<inst->width;x++,pos++)
     {
-      xf=x;
-      yf=y;
-      zf=0.0;
-      vetmat(mat,&xf,&yf,&zf);
+      xf=mat[0][0]*(float)x+xrow+mat[0][3];
+      yf=mat[1][0]*(float)x+yrow+mat[1][3];
       nx=(int)(xf+0.5);
       ny=(int)(yf+0.5);
       
@@ -442,5 +448,5 @@ static void recompute_mask(tdflippo_instance_t* inst)
 	  inst->mask[pos]=ny*inst->width+nx;
       }
     }
-  matfree(mat);
+  }
 }
@@ -29,6 +29,7 @@
 
 #include "frei0r.h"
 #include "frei0r_math.h"
+#include "frei0r_histogram.h"
 
 static const float bbWB[][3] = 
 {
@@ -543,6 +544,7 @@ typedef struct balanc0r_instance
 	double temperature;
 	double	green;
 	float mr, mg, mb;
+	uint8_t lut[3][256];	// gains as per channel tables
 } balanc0r_instance_t;
 
 int f0r_init()
@@ -562,7 +564,7 @@ void f0r_get_plugin_info(f0r_plugin_info_t* colordistance_info)
 	colordistance_info->color_model = F0R_COLOR_MODEL_RGBA8888;
 	colordistance_info->frei0r_version = FREI0R_MAJOR_VERSION;
 	colordistance_info->major_version = 0; 
-	colordistance_info->minor_version = 3; 
+	colordistance_info->minor_version = 4; 
 	colordistance_info->num_params = 2; 
 	colordistance_info->explanation = "Adjust the white balance / color temperature";
 }
@@ -584,6 +586,17 @@ void f0r_get_param_info(f0r_param_info_t* info, int param_index)
 
 }
 
+// out = (int)(in * gain), clipped, as CLAMP0255(in * gain)
+static void setLut(balanc0r_instance_t *o)
+{
+	const float gain[3] = {o->mr, o->mg, o->mb};
+	int i, k;
+
+	for (k = 0; k < 3; k++)
+		for (i = 0; i < 256; i++)
+			o->lut[k][i] = CLAMP0255(i * gain[k]);
+}
+
 f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 {
 	balanc0r_instance_t* inst = (balanc0r_instance_t*)calloc(1, sizeof(*inst));
@@ -593,6 +606,7 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 	inst->color.b = 1.0;
 	inst->temperature = 4750.0;
 	inst->green = 1.2;
+	setLut(inst);
 	return (f0r_instance_t)inst;
 }
 
@@ -616,6 +630,7 @@ static void setRGBmult(balanc0r_instance_t *o)
 	o->mr /= mi;
 	o->mg /= mi;
 	o->mb /= mi;
+	setLut(o);
 }
 
 void f0r_set_param_value(f0r_instance_t instance, 
@@ -689,15 +704,7 @@ void f0r_update(f0r_instance_t instance, double time,
 {
 	assert(instance);
 	balanc0r_instance_t* inst = (balanc0r_instance_t*)instance;
-	unsigned int         len  = inst->width * inst->height + 1;
-	unsigned char*       dst = (unsigned char*)outframe;
-	const unsigned char* src = (unsigned char*)inframe;
 
-	while (--len) {
-		*dst++ = CLAMP0255(*src++ * inst->mr);
-		*dst++ = CLAMP0255(*src++ * inst->mg);
-		*dst++ = CLAMP0255(*src++ * inst->mb);
-		*dst++ = *src++;  // copy alpha
-	}
+	histo_lut_apply(inframe, outframe, inst->width * inst->height,
+	                inst->lut[0], inst->lut[1], inst->lut[2]);
 }
-
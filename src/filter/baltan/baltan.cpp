@@ -27,13 +27,22 @@
 #include <string.h>
 
 #include <frei0r.hpp>
+#include "frei0r_threads.h"
 
-#define PLANES 32
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define STRIDE 8
 #define STRIDE2 16 /* (STRIDE*2) */
 #define STRIDE3 24 /* (STRIDE*3) */
 
+// frames 8, 16 and 24 back are read, so 24 planes are enough
+#define HISTORY STRIDE3
+
+// pixels below which a band of rows is not worth a thread
+#define MIN_JOB_PIXELS 65536
+
 // freej compat facilitator
 typedef struct {
   int16_t w;
@@ -58,22 +67,22 @@ private:
 
   void _init(int wdt, int hgt);
   
-  uint32_t *planebuf;
-  uint32_t *planetable[PLANES];
+  // planes hold (pixel & 0xfcfcfc)>>2 as 3 bytes per pixel,
+  // each row split into its R, G and B bytes
+  uint8_t *planebuf;
+  uint8_t *planetable[HISTORY];
   int plane;
   int pixels;
 };
 
 Baltan::Baltan(int wdt, int hgt) {
-  int i;
-    
   _init(wdt, hgt);
   pixels = geo.w*geo.h;
   
-  planebuf =  (uint32_t*)calloc(geo.size, PLANES);
-    
-  for(i=0;i<PLANES;i++)
-    planetable[i] = &planebuf[pixels*i];
+  planebuf = (uint8_t*)calloc((size_t)pixels*3, HISTORY);
+
+  for(int i=0;i<HISTORY;i++)
+    planetable[i] = planebuf + (size_t)pixels*3*i;
 
   plane = 0;
 }
@@ -82,34 +91,120 @@ Baltan::~Baltan() {
   free(planebuf);
 }
 
+// One row: out = src/4 + the values of the frames 8, 16 and 24 back,
+// and the new history value out/4 into p, which may be h24.
+// Each value is at most 63, so the sums fit in a byte per channel and
+// the channels can be added without carries.
+static void baltan_row(const uint32_t *src, uint32_t *dst,
+                       const uint8_t *h8, const uint8_t *h16, const uint8_t *h24,
+                       uint8_t *p, int w) {
+  int i = 0, k;
+  uint32_t d;
+
+#if defined(__SSE2__)
+  const __m128i m6 = _mm_set1_epi32(0x3f3f3f);
+  const __m128i am = _mm_set1_epi32(0xFF000000);
+  const __m128i lo = _mm_set1_epi32(0xFF);
+  const __m128i z = _mm_setzero_si128();
+  __m128i r, g, b, rg, b0, s, v[4];
+
+  for(; i+16<=w; i+=16) {
+    r = _mm_add_epi8(_mm_add_epi8(_mm_loadu_si128((const __m128i*)(h8+i)),
+                                  _mm_loadu_si128((const __m128i*)(h16+i))),
+                     _mm_loadu_si128((const __m128i*)(h24+i)));
+    g = _mm_add_epi8(_mm_add_epi8(_mm_loadu_si128((const __m128i*)(h8+w+i)),
+                                  _mm_loadu_si128((const __m128i*)(h16+w+i))),
+                     _mm_loadu_si128((const __m128i*)(h24+w+i)));
+    b = _mm_add_epi8(_mm_add_epi8(_mm_loadu_si128((const __m128i*)(h8+2*w+i)),
+                                  _mm_loadu_si128((const __m128i*)(h16+2*w+i))),
+                     _mm_loadu_si128((const __m128i*)(h24+2*w+i)));
+    // back to packed pixels
+    rg = _mm_unpacklo_epi8(r, g);
+    b0 = _mm_unpacklo_epi8(b, z);
+    v[0] = _mm_unpacklo_epi16(rg, b0);
+    v[1] = _mm_unpackhi_epi16(rg, b0);
+    rg = _mm_unpackhi_epi8(r, g);
+    b0 = _mm_unpackhi_epi8(b, z);
+    v[2] = _mm_unpacklo_epi16(rg, b0);
+    v[3] = _mm_unpackhi_epi16(rg, b0);
+
+    for(k=0; k<4; k++) {
+      s = _mm_loadu_si128((const __m128i*)(src+i+4*k));
+      v[k] = _mm_or_si128(_mm_add_epi8(v[k], _mm_and_si128(_mm_srli_epi32(s, 2), m6)),
+                          _mm_and_si128(s, am));
+      _mm_storeu_si128((__m128i*)(dst+i+4*k), v[k]);
+      v[k] = _mm_and_si128(_mm_srli_epi32(v[k], 2), m6);
+    }
+
+    // and split again for the history
+    _mm_storeu_si128((__m128i*)(p+i), _mm_packus_epi16(
+      _mm_packs_epi32(_mm_and_si128(v[0], lo), _mm_and_si128(v[1], lo)),
+      _mm_packs_epi32(_mm_and_si128(v[2], lo), _mm_and_si128(v[3], lo))));
+    for(k=0; k<4; k++) v[k] = _mm_srli_epi32(v[k], 8);
+    _mm_storeu_si128((__m128i*)(p+w+i), _mm_packus_epi16(
+      _mm_packs_epi32(_mm_and_si128(v[0], lo), _mm_and_si128(v[1], lo)),
+      _mm_packs_epi32(_mm_and_si128(v[2], lo), _mm_and_si128(v[3], lo))));
+    for(k=0; k<4; k++) v[k] = _mm_srli_epi32(v[k], 8);
+    _mm_storeu_si128((__m128i*)(p+2*w+i), _mm_packus_epi16(
+      _mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+  }
+#endif
+  for(; i<w; i++) {
+    d = (src[i]&0xFF000000)
+      |(((src[i] & 0xfcfcfc)>>2)
+        + (h8[i] + h16[i] + h24[i])
+        + ((h8[w+i] + h16[w+i] + h24[w+i])<<8)
+        + ((h8[2*w+i] + h16[2*w+i] + h24[2*w+i])<<16));
+    dst[i] = d;
+    d = (d&0xfcfcfc)>>2;
+    p[i] = d;
+    p[w+i] = d>>8;
+    p[2*w+i] = d>>16;
+  }
+}
+
+// A row only touches its own pixels and history, so bands of rows
+// can go to separate threads.
+typedef struct {
+  const uint32_t *in;
+  uint32_t *out;
+  const uint8_t *s8, *s16;
+  uint8_t *s24;
+  int w, h, jobs;
+} BaltanBands;
+
+static void baltan_band(void *arg, int k) {
+  const BaltanBands *b = (const BaltanBands*)arg;
+  size_t pitch = (size_t)b->w*3;
+  int y, y0, y1;
+
+  thr_band(b->h, b->jobs, k, &y0, &y1);
+  for(y=y0; y<y1; y++)
+    baltan_row(b->in + (size_t)y*b->w, b->out + (size_t)y*b->w,
+               b->s8 + y*pitch, b->s16 + y*pitch, b->s24 + y*pitch,
+               b->s24 + y*pitch, b->w);
+}
+
 void Baltan::update(double time,
                     uint32_t* out,
                     const uint32_t* in) {
-  int i, cf;
-
-  uint32_t *src = (uint32_t*)in;
-  uint32_t *dst = (uint32_t*)out;
-
-  
-  for(i=0; i<pixels; i++)
-    planetable[plane][i] = (src[i] & 0xfcfcfc)>>2;
-  
-
-  cf = plane & (STRIDE-1);
-  
-  for(i=0; i<pixels; i++) {
-    dst[i] = (src[i]&0xFF000000)
-      |(planetable[cf][i]
-	+ planetable[cf+STRIDE][i]
-	+ planetable[cf+STRIDE2][i]
-	+ planetable[cf+STRIDE3][i]);
-    planetable[plane][i] = (dst[i]&0xfcfcfc)>>2;
-  }
-
+  BaltanBands b;
+
+  // planes of the frames 8, 16 and 24 back; the last one is
+  // overwritten with this frame
+  b.s8 = planetable[(plane+HISTORY-STRIDE) % HISTORY];
+  b.s16 = planetable[(plane+HISTORY-STRIDE2) % HISTORY];
+  b.s24 = planetable[plane];
+  b.in = in;
+  b.out = out;
+  b.w = geo.w;
+  b.h = geo.h;
+  b.jobs = thr_jobs(pixels, MIN_JOB_PIXELS);
+  if(b.jobs > b.h) b.jobs = b.h;
+  thr_run(b.jobs, baltan_band, &b);
 
   plane++;
-  plane = plane & (PLANES-1);
-  
+  if(plane == HISTORY) plane = 0;
 }
 
 void Baltan::_init(int wdt, int hgt) {
@@ -122,4 +217,4 @@ void Baltan::_init(int wdt, int hgt) {
 frei0r::construct<Baltan> plugin("Baltan",
 				  "delayed alpha smoothed blit of time",
 				  "Kentaro, Jaromil",
-				  3,1);
+				  3,2);
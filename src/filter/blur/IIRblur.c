@@ -63,12 +63,8 @@ typedef struct
     int ty;		//type of blur [0..2]
     int ec;		//edge compensation (BOOL)
 
-    //video buffers
-    float_rgba *img;
-
-    //internal variables
-    float a1,a2,a3;
-    float rd1,rd2,rs1,rs2,rc1,rc2;
+    //blur engine (line buffers and taps)
+    fibe_lines fl;
 
 } inst;
 
@@ -142,6 +138,60 @@ double map_value_backward_log(float v, float min, float max)
     return logf(v/sr)/k+0.5;
 }
 
+//-----------------------------------------------------
+//calculate the IIR taps for the current type and amount
+void calc_taps(inst *p)
+{
+    float a0,a1,a2,a3,b0,b1,b2,f,q,s;
+
+    float am1[]={0.499999,0.7,1.0,1.5,2.0,3.0,4.0,5.0,7.0,10.0,
+                 15.0,20.0,30.0,40.0,50.0,70.0,100.0,150.0,200.00001};
+    //float iir2f[]={0.448,0.4,0.31,0.25,0.21,0.15,0.1,0.075,
+    //	0.055,0.039,0.026,0.02,0.013,0.01,0.008,0.006,
+    //	0.0042,0.0029,0.00205};
+    //float iir2q[]={0.53,0.53,0.54,0.54,0.54,0.55,0.6,0.7,0.7,
+    //	0.7,0.7,0.7,0.7,0.7,0.7,0.7,0.7,0.7,0.7};
+    float iir2q[]={0.53,0.53,0.54,0.54,0.54,0.55,0.6,0.6,0.6,
+                   0.6,0.6,0.6,0.6,0.6,0.6,0.6,0.6,0.6,0.6};
+    //float iir1a1[]={0.167,0.3,0.5,0.65,0.7,0.8,0.88,0.92,0.95,
+    //	0.96,0.97,0.98,0.985,0.988,0.99,0.992,0.993,0.9955,
+    //	0.997};
+
+    float iir1a1[]={0.138,0.24,0.34,0.45,0.55, 0.65,0.728,0.775,0.834,0.88,
+                    0.92,0.937,0.958,0.968,0.9745,
+                    0.98,0.986,0.991,0.9931};		//po sigmi
+
+    float iir2f[]={0.475,0.39,0.325,0.26,0.21,
+                   0.155,0.112,0.0905,0.065,0.0458,
+                   0.031,0.0234,0.01575,0.0118,0.0093,
+                   0.00725,0.00505,0.0033,0.0025};		//po sigmi
+
+    float iir3si[]={0.5,0.7,1.0,1.5,2.0,
+                    3.0,4.0,5.0,7.0,10.0,
+                    15.0,20.0,30.0,40.0,50.0,
+                    70.0,100.0,150.0,186.5};
+
+
+    switch(p->ty)
+    {
+    case 0:		//FIBE-1
+        a1=AitNev3(19, am1, iir1a1, p->am);
+        fibe_set(&p->fl, -a1, 0.0, 0.0);
+        break;
+    case 1:		//FIBE-2
+        f=AitNev3(19, am1, iir2f, p->am);
+        q=AitNev3(19, am1, iir2q, p->am);
+        calcab_lp1(f, q, &a0, &a1, &a2, &b0, &b1, &b2);
+        fibe_set(&p->fl, a1/a0, a2/a0, 0.0);
+        break;
+    case 2:		//FIBE-3
+        s=AitNev3(19, am1, iir3si, p->am);
+        young_vliet(s, &a0, &a1, &a2, &a3);
+        fibe_set(&p->fl, -a1/a0, -a2/a0, -a3/a0);
+        break;
+    }
+}
+
 //***********************************************
 // OBVEZNE FREI0R FUNKCIJE
 
@@ -166,7 +216,7 @@ void f0r_get_plugin_info(f0r_plugin_info_t* info)
     info->color_model=F0R_COLOR_MODEL_RGBA8888;
     info->frei0r_version=FREI0R_MAJOR_VERSION;
     info->major_version=0;
-    info->minor_version=2;
+    info->minor_version=3;
     info->num_params=3;
     info->explanation="Three types of fast IIR blurring";
 }
@@ -200,15 +250,20 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
     inst *in;
 
     in=calloc(1,sizeof(inst));
+    if (in==NULL) return 0;
     in->w=width;
     in->h=height;
 
-    in->img=calloc(width*height*4,sizeof(float));
+    if (fibe_alloc(&in->fl, width, height)==0)
+    {
+        free(in);
+        return 0;
+    }
 
     in->am=map_value_forward_log(0.2, 0.5, 100.0);
-    in->a1=-0.796093; in->a2=0.186308;
     in->ty=1;
     in->ec=1;
+    calc_taps(in);
 
     return (f0r_instance_t)in;
 }
@@ -220,7 +275,7 @@ void f0r_destruct(f0r_instance_t instance)
 
     in=(inst*)instance;
 
-    free(in->img);
+    fibe_free(&in->fl);
 
     free(instance);
 }
@@ -231,35 +286,6 @@ void f0r_set_param_value(f0r_instance_t instance, f0r_param_t parm, int param_in
     inst *p;
     double tmpf;
     int chg,tmpi;
-    float a0,b0,b1,b2,f,q,s;
-
-    float am1[]={0.499999,0.7,1.0,1.5,2.0,3.0,4.0,5.0,7.0,10.0,
-                 15.0,20.0,30.0,40.0,50.0,70.0,100.0,150.0,200.00001};
-    //float iir2f[]={0.448,0.4,0.31,0.25,0.21,0.15,0.1,0.075,
-    //	0.055,0.039,0.026,0.02,0.013,0.01,0.008,0.006,
-    //	0.0042,0.0029,0.00205};
-    //float iir2q[]={0.53,0.53,0.54,0.54,0.54,0.55,0.6,0.7,0.7,
-    //	0.7,0.7,0.7,0.7,0.7,0.7,0.7,0.7,0.7,0.7};
-    float iir2q[]={0.53,0.53,0.54,0.54,0.54,0.55,0.6,0.6,0.6,
-                   0.6,0.6,0.6,0.6,0.6,0.6,0.6,0.6,0.6,0.6};
-    //float iir1a1[]={0.167,0.3,0.5,0.65,0.7,0.8,0.88,0.92,0.95,
-    //	0.96,0.97,0.98,0.985,0.988,0.99,0.992,0.993,0.9955,
-    //	0.997};
-
-    float iir1a1[]={0.138,0.24,0.34,0.45,0.55, 0.65,0.728,0.775,0.834,0.88,
-                    0.92,0.937,0.958,0.968,0.9745,
-                    0.98,0.986,0.991,0.9931};		//po sigmi
-
-    float iir2f[]={0.475,0.39,0.325,0.26,0.21,
-                   0.155,0.112,0.0905,0.065,0.0458,
-                   0.031,0.0234,0.01575,0.0118,0.0093,
-                   0.00725,0.00505,0.0033,0.0025};		//po sigmi
-
-    float iir3si[]={0.5,0.7,1.0,1.5,2.0,
-                    3.0,4.0,5.0,7.0,10.0,
-                    15.0,20.0,30.0,40.0,50.0,
-                    70.0,100.0,150.0,186.5};
-
 
     p=(inst*)instance;
 
@@ -292,31 +318,7 @@ void f0r_set_param_value(f0r_instance_t instance, f0r_param_t parm, int param_in
 
     if (chg==0) return;
 
-    switch(p->ty)
-    {
-    case 0:		//FIBE-1
-        p->a1=AitNev3(19, am1, iir1a1, p->am);
-        //printf("Set parm FIBE-1 a1=%f (p->am=%f)\n",p->a1,p->am);
-        break;
-    case 1:		//FIBE-2
-        f=AitNev3(19, am1, iir2f, p->am);
-        q=AitNev3(19, am1, iir2q, p->am);
-        calcab_lp1(f, q, &a0, &p->a1, &p->a2, &b0, &b1, &b2);
-        p->a1=p->a1/a0; p->a2=p->a2/a0;
-        rep(-0.5, 0.5, 0.0, &p->rd1, &p->rd2, 256, p->a1, p->a2);
-        rep(1.0, 1.0, 0.0, &p->rs1, &p->rs2, 256, p->a1, p->a2);
-        rep(0.0, 0.0, 1.0, &p->rc1, &p->rc2, 256, p->a1, p->a2);
-        //printf("Set parm FIBE-2 a1=%f a2=%f\n",p->a1,p->a2);
-        break;
-    case 2:		//FIBE-3
-        s=AitNev3(19, am1, iir3si, p->am);
-        young_vliet(s, &a0, &p->a1, &p->a2, &p->a3);
-        p->a1=-p->a1/a0;
-        p->a2=-p->a2/a0;
-        p->a3=-p->a3/a0;
-        //printf("Set parm FIBE-3 a1=%f a2=%f a3=%f\n",p->a1,p->a2,p->a3);
-        break;
-    }
+    calc_taps(p);
 }
 
 //--------------------------------------------------
@@ -356,22 +358,8 @@ void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, u
         return;
     }
     //do the blur
-    switch(in->ty)
-    {
-    case 0:
-        fibe1o_8(inframe, outframe, in->img, in->w, in->h, in->a1, in->ec);
-        break;
-    case 1:
-        fibe2o_8(inframe, outframe, in->img, in->w, in->h, in->a1, in->a2, in->rd1, in->rd2, in->rs1, in->rs2, in->rc1, in->rc2, in->ec);
-        break;
-    case 2:
-        fibe3_8(inframe, outframe, in->img, in->w, in->h, in->a1, in->a2, in->a3, in->ec);
-        // The bottom 3 lines were not updated, and outframe may be initialized with garbage.
-        // Copy the 4th line from the bottom to the bottom 3 lines.
-        for (i = 0; i < 3; i++)
-            memcpy(&outframe[in->w * (in->h - 3 + i)], &outframe[in->w * (in->h - 4)], in->w * 4);
-        break;
-    }
+    fibe_8(inframe, outframe, &in->fl, in->ec);
+
     //copy alpha
     for (i=0;i<in->w*in->h;i++)
     {
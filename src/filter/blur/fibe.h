@@ -41,24 +41,25 @@ calcab_lp1()	auxilliary function to calculate lowpass
 young_vliet()	auxilliary function to calculate tap coefs
         for Gauss approximation with FIBE-3
 
-rep()		auxilliary function to calculate wraparound
-        values for FIBE-2
+fibe_alloc()	allocate the buffers of a fibe_lines
+fibe_free()	engine for a given frame size
 
-fibe1o_8()	one tap quadrilateral IIR filter
-        speed optimized C function
-        includes 8bit/float conversions
-
-fibe2o_8()	two tap quadrilateral IIR filter
-        speed optimized C function
-        includes 8bit/float conversions
+fibe_set()	set the (up to three) feedback taps and
+        precalculate the right/bottom edge start values
 
-fibe3_8()	three tap quadrilateral IIR filter
+fibe_8()	quadrilateral IIR filter of order 1..3
         includes 8bit/float conversions
 
-The functions work internally with floats. I have included
-the 8bit/float conversion into the first and last
-processing loops, to avoid two additional cache polluting
-and therefore time consuming "walks" through memory.
+The filter is run in four directions. The horizontal
+passes are done in a single float line buffer, the vertical
+ones are streamed through a small ring of float rows, so
+no full frame float copy is needed: memory use is six lines
+of float_rgba and two bytes per pixel.
+The top-down result of the vertical recursion is parked with
+16 bits per channel, (v-128)*128 so 1/128 level steps from
+-128 to 384, and read back by the bottom-up pass: red and
+green in the output frame, blue in a side buffer. This adds
+at most 1/256 of a level, the output rounds as from floats.
 
 */
 
@@ -68,9 +69,14 @@ and therefore time consuming "walks" through memory.
 #define EDGEAVG 8
 
 #include <sys/types.h>
+#include <stdlib.h>
 #include <string.h>
 #include "frei0r_math.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 //---------------------------------------------------------
 //koeficienti za biquad lowpass  iz f in q
 // f v Nyquistih    0.0 < f < 0.5
@@ -114,939 +120,493 @@ void young_vliet(float s, float *a0, float *a1, float *a2, float *a3)
     *a3 = 0.422205*q*q*q;
 }
 
-//---------------------------------------------------
-//kompenzacija na desni
-//c=0.0 "odziv na zacetno stanje" (zunaj crno)
-//gain ni kompenziran
-void rep(float v1, float v2, float c, float *i1, float *i2, int n,  float a1, float a2)
+//how many samples the causal filter is run past the right
+//(bottom) edge, when calculating the anticausal start values
+#define FIBE_CEZ 2048
+
+//-------------------------------------------------------
+//state of the fast IIR blur engine
+//recursion:  y[i] = g*x[i] - c[0]*y[i-1] - c[1]*y[i-2] - c[2]*y[i-3]
+//with g = 1+c[0]+c[1]+c[2], so the DC gain of each pass is one
+typedef struct
 {
-    int i;
-    float lb[8192];
+    int w,h;
 
-    lb[0]=v1;lb[1]=v2;
-    for (i=2;i<n-2;i++)
-    {
-        lb[i]=c-a1*lb[i-1]-a2*lb[i-2];
-    }
+    float g;
+    float c[3];
+    double rep[3][4];	//anticausal start values from y[n-1],y[n-2],y[n-3] and edge value
 
-    lb[n-2]=0.0;lb[n-1]=0.0;
-    for (i=n-3;i>=0;i--)
-    {
-        lb[i]=lb[i]-a1*lb[i+1]-a2*lb[i+2];
-    }
+    float_rgba *lb;		//line buffer (w)
+    float_rgba *ring;	//last three rows of the vertical recursion (3*w)
+    float_rgba *ctop;	//column averages at the top edge (w)
+    float_rgba *cbot;	//column averages at the bottom edge (w)
+    int16_t *vb;	//blue of the top-down vertical pass (w*h)
+} fibe_lines;
 
-    *i1=lb[0]; *i2=lb[1];
+//---------------------------------------------------------
+void fibe_free(fibe_lines *f)
+{
+    free(f->lb);
+    free(f->vb);
+    f->lb=NULL;
+    f->vb=NULL;
 }
 
 //---------------------------------------------------------
-// 1-tap IIR v 4 smereh
-//optimized for speed
-//loops rearanged for more locality (better cache hit ratio)
-//outer (vertical) loop 2x unroll to break dependency chain
-//simplified indexes
-void fibe1o_8(const uint32_t* inframe, uint32_t* outframe, float_rgba *s, int w, int h, float a, int ec)
+int fibe_alloc(fibe_lines *f, int w, int h)
 {
-    int i,j;
-    float b,g,g4,avg,avg1,cr,cg,cb,g4a,g4b;
-    int p,pw,pj,pwj,pww,pmw;
+    f->w=w; f->h=h;
+    f->lb=(float_rgba*)calloc(6*w,sizeof(float_rgba));
+    f->ring=f->lb+w;
+    f->ctop=f->ring+3*w;
+    f->cbot=f->ctop+w;
+    f->vb=(int16_t*)malloc(sizeof(int16_t)*w*h);
+    if ((f->lb==NULL)||(f->vb==NULL))
+    {
+        fibe_free(f);
+        return 0;
+    }
+    return 1;
+}
 
-    avg=EDGEAVG;	//koliko vzorcev za povprecje pri edge comp
-    avg1=1.0/avg;
 
-    g=1.0/(1.0-a);
-    g4=1.0/g/g/g/g;
+//---------------------------------------------------------
+//sets the taps and calculates the right edge compensation
+//the causal filter is continued past the edge with a constant
+//input, and the anticausal one is started in steady state far
+//out and run back to the edge. Everything is linear, so the
+//start values at the edge are a linear combination of the last
+//three causal outputs and the edge value.
+void fibe_set(fibe_lines *f, float c1, float c2, float c3)
+{
+    double lb[FIBE_CEZ+3];
+    double g,z1,z2,z3,t;
+    int i,k;
 
-    //predpostavimo, da je "zunaj" crnina (nicle)
-    b=1.0/(1.0-a)/(1.0+a);
+    //double, the start values are large and of alternating sign
+    //when the poles are close to one
+    f->c[0]=c1; f->c[1]=c2; f->c[2]=c3;
+    g=1.0+(double)c1+(double)c2+(double)c3;
+    f->g=g;
 
-    //prvih avg vrstic
-    for (i=0;i<avg;i++)
+    for (k=0;k<4;k++)
     {
-        p=i*w;pw=p+w;
-        if (ec!=0)
-        {
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=0;j<avg;j++)
-            {
-                s[p+j].r=(float)(inframe[p+j]&0xFF);
-                s[p+j].g=(float)((inframe[p+j]&0xFF00)>>8);
-                s[p+j].b=(float)((inframe[p+j]&0xFF0000)>>16);
-                cr=cr+s[p+j].r;
-                cg=cg+s[p+j].g;
-                cb=cb+s[p+j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[p].r=cr*g+b*(s[p].r-cr);
-            s[p].g=cg*g+b*(s[p].g-cg);
-            s[p].b=cb*g+b*(s[p].b-cb);
-        }
-        else
-            for (j=0;j<avg;j++)
-            {
-                s[p+j].r=(float)(inframe[p+j]&0xFF);
-                s[p+j].g=(float)((inframe[p+j]&0xFF00)>>8);
-                s[p+j].b=(float)((inframe[p+j]&0xFF0000)>>16);
-            }
+        //lb[2]=y[n-1], lb[1]=y[n-2], lb[0]=y[n-3]
+        lb[0]=(k==2); lb[1]=(k==1); lb[2]=(k==0);
+        t=(k==3);
+        for (i=3;i<FIBE_CEZ+3;i++)	//naprej cez rob
+            lb[i]=g*t-c1*lb[i-1]-c2*lb[i-2]-c3*lb[i-3];
+        z1=t; z2=t; z3=t;
+        for (i=FIBE_CEZ+2;i>=3;i--)	//nazaj do roba
+        {
+            lb[i]=g*lb[i]-c1*z1-c2*z2-c3*z3;
+            z3=z2; z2=z1; z1=lb[i];
+        }
+        f->rep[0][k]=lb[3];
+        f->rep[1][k]=lb[4];
+        f->rep[2][k]=lb[5];
+    }
+}
 
-        for (j=1;j<avg;j++)	//tja  (ze pretvorjeni)
-        {
-            s[p+j].r=s[p+j].r+a*s[p+j-1].r;
-            s[p+j].g=s[p+j].g+a*s[p+j-1].g;
-            s[p+j].b=s[p+j].b+a*s[p+j-1].b;
-        }
-        for (j=avg;j<w;j++)	//tja  (s pretvorbo)
-        {
-            s[p+j].r=(float)(inframe[p+j]&0xFF);
-            s[p+j].g=(float)((inframe[p+j]&0xFF00)>>8);
-            s[p+j].b=(float)((inframe[p+j]&0xFF0000)>>16);
-            s[p+j].r=s[p+j].r+a*s[p+j-1].r;
-            s[p+j].g=s[p+j].g+a*s[p+j-1].g;
-            s[p+j].b=s[p+j].b+a*s[p+j-1].b;
-        }
+//---------------------------------------------------------
+//one step of the recursion, all three colors
+//the y[i-1] term is subtracted last, it is on the critical path
+static inline float_rgba fibe_tap(const fibe_lines *f, float_rgba x, float_rgba p1, float_rgba p2, float_rgba p3)
+{
+    float_rgba y;
 
-        if (ec!=0)
-        {
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=w-avg;j<w;j++)
-            {
-                cr=cr+s[p+j].r;
-                cg=cg+s[p+j].g;
-                cb=cb+s[p+j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[pw-1].r=cr*g+b*(s[pw-1].r-cr);
-            s[pw-1].g=cg*g+b*(s[pw-1].g-cg);
-            s[pw-1].b=cb*g+b*(s[pw-1].b-cb);
-        }
-        else
-        {
-            s[pw-1].r=b*s[pw-1].r;
-            s[pw-1].g=b*s[pw-1].g;
-            s[pw-1].b=b*s[pw-1].b;
-        }
-        for (j=w-2;j>=0;j--)	//nazaj
-        {
-            s[p+j].r=a*s[p+j+1].r+s[p+j].r;
-            s[p+j].g=a*s[p+j+1].g+s[p+j].g;
-            s[p+j].b=a*s[p+j+1].b+s[p+j].b;
-        }
-    }
+    y.r=f->g*x.r-f->c[2]*p3.r-f->c[1]*p2.r-f->c[0]*p1.r;
+    y.g=f->g*x.g-f->c[2]*p3.g-f->c[1]*p2.g-f->c[0]*p1.g;
+    y.b=f->g*x.b-f->c[2]*p3.b-f->c[1]*p2.b-f->c[0]*p1.b;
+    y.a=0.0;
+    return y;
+}
+
+//---------------------------------------------------------
+//anticausal start value, j-th sample past the edge
+//in double, small errors here excite the slow modes of the filter
+static inline float_rgba fibe_rep(const fibe_lines *f, int j, float_rgba y1, float_rgba y2, float_rgba y3, float_rgba c)
+{
+    float_rgba z;
+    const double *r=f->rep[j];
+
+    z.r=r[0]*y1.r+r[1]*y2.r+r[2]*y3.r+r[3]*c.r;
+    z.g=r[0]*y1.g+r[1]*y2.g+r[2]*y3.g+r[3]*c.g;
+    z.b=r[0]*y1.b+r[1]*y2.b+r[2]*y3.b+r[3]*c.b;
+    z.a=0.0;
+    return z;
+}
 
-    //prvih avg vrstic samo navzdol (nazaj so ze)
-    for (i=0;i<w;i++)
+//---------------------------------------------------------
+//average of n samples, or black if no edge compensation
+static inline float_rgba fibe_avg(const float_rgba *s, int n, int ec)
+{
+    float_rgba c={0.0,0.0,0.0,0.0};
+    int i;
+
+    if (ec==0) return c;
+    for (i=0;i<n;i++)
     {
-        if (ec!=0)
-        {
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=0;j<avg;j++)
-            {
-                cr=cr+s[i+w*j].r;
-                cg=cg+s[i+w*j].g;
-                cb=cb+s[i+w*j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[i].r=cr*g+b*(s[i].r-cr);
-            s[i].g=cg*g+b*(s[i].g-cg);
-            s[i].b=cb*g+b*(s[i].b-cb);
-        }
-        for (j=1;j<avg;j++)	//dol
-        {
-            s[i+j*w].r=s[i+j*w].r+a*s[i+w*(j-1)].r;
-            s[i+j*w].g=s[i+j*w].g+a*s[i+w*(j-1)].g;
-            s[i+j*w].b=s[i+j*w].b+a*s[i+w*(j-1)].b;
-        }
+        c.r=c.r+s[i].r;
+        c.g=c.g+s[i].g;
+        c.b=c.b+s[i].b;
     }
+    c.r=c.r/n; c.g=c.g/n; c.b=c.b/n;
+    return c;
+}
 
-    for (i=avg;i<h-1;i=i+2)	//po vrsticah navzdol
-    {
-        p=i*w; pw=p+w; pww=pw+w; pmw=p-w;
-        if (ec!=0)
-        {
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=0;j<avg;j++)
-            {
-                s[p+j].r=(float)(inframe[p+j]&0xFF);
-                s[p+j].g=(float)((inframe[p+j]&0xFF00)>>8);
-                s[p+j].b=(float)((inframe[p+j]&0xFF0000)>>16);
-                cr=cr+s[p+j].r;
-                cg=cg+s[p+j].g;
-                cb=cb+s[p+j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[p].r=cr*g+b*(s[p].r-cr);
-            s[p].g=cg*g+b*(s[p].g-cg);
-            s[p].b=cb*g+b*(s[p].b-cb);
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=0;j<avg;j++)
-            {
-                s[pw+j].r=(float)(inframe[pw+j]&0xFF);
-                s[pw+j].g=(float)((inframe[pw+j]&0xFF00)>>8);
-                s[pw+j].b=(float)((inframe[pw+j]&0xFF0000)>>16);
-                cr=cr+s[pw+j].r;
-                cg=cg+s[pw+j].g;
-                cb=cb+s[pw+j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[pw].r=cr*g+b*(s[pw].r-cr);
-            s[pw].g=cg*g+b*(s[pw].g-cg);
-            s[pw].b=cb*g+b*(s[pw].b-cb);
-        }
-        else
-        {
-            for (j=0;j<avg;j++)
-            {
-                s[p+j].r=(float)(inframe[p+j]&0xFF);
-                s[p+j].g=(float)((inframe[p+j]&0xFF00)>>8);
-                s[p+j].b=(float)((inframe[p+j]&0xFF0000)>>16);
-            }
-            for (j=0;j<avg;j++)
-            {
-                s[pw+j].r=(float)(inframe[pw+j]&0xFF);
-                s[pw+j].g=(float)((inframe[pw+j]&0xFF00)>>8);
-                s[pw+j].b=(float)((inframe[pw+j]&0xFF0000)>>16);
-            }
-        }
-        for (j=1;j<avg;j++)	//tja  (ze pretvojeni)
-        {
-            pj=p+j;pwj=pw+j;
-            s[pj].r=s[pj].r+a*s[pj-1].r;
-            s[pj].g=s[pj].g+a*s[pj-1].g;
-            s[pj].b=s[pj].b+a*s[pj-1].b;
-            s[pwj].r=s[pwj].r+a*s[pwj-1].r;
-            s[pwj].g=s[pwj].g+a*s[pwj-1].g;
-            s[pwj].b=s[pwj].b+a*s[pwj-1].b;
-        }
-        for (j=avg;j<w;j++)	//tja  (s pretvorbo)
-        {
-            pj=p+j;pwj=pw+j;
-            s[pj].r=(float)(inframe[pj]&0xFF);
-            s[pj].g=(float)((inframe[pj]&0xFF00)>>8);
-            s[pj].b=(float)((inframe[pj]&0xFF0000)>>16);
-            s[pj].r=s[pj].r+a*s[pj-1].r;
-            s[pj].g=s[pj].g+a*s[pj-1].g;
-            s[pj].b=s[pj].b+a*s[pj-1].b;
-            s[pwj].r=(float)(inframe[pwj]&0xFF);
-            s[pwj].g=(float)((inframe[pwj]&0xFF00)>>8);
-            s[pwj].b=(float)((inframe[pwj]&0xFF0000)>>16);
-            s[pwj].r=s[pwj].r+a*s[pwj-1].r;
-            s[pwj].g=s[pwj].g+a*s[pwj-1].g;
-            s[pwj].b=s[pwj].b+a*s[pwj-1].b;
-        }
+#if defined(__SSE2__)
 
-        if (ec!=0)
-        {
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=w-avg;j<w;j++)
-            {
-                cr=cr+s[p+j].r;
-                cg=cg+s[p+j].g;
-                cb=cb+s[p+j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[pw-1].r=cr*g+b*(s[pw-1].r-cr);
-            s[pw-1].g=cg*g+b*(s[pw-1].g-cg);
-            s[pw-1].b=cb*g+b*(s[pw-1].b-cb);
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=w-avg;j<w;j++)
-            {
-                cr=cr+s[pw+j].r;
-                cg=cg+s[pw+j].g;
-                cb=cb+s[pw+j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[pww-1].r=cr*g+b*(s[pww-1].r-cr);
-            s[pww-1].g=cg*g+b*(s[pww-1].g-cg);
-            s[pww-1].b=cb*g+b*(s[pww-1].b-cb);
-        }
-        else
-        {
-            s[pw-1].r=b*s[pw-1].r;	//rep H
-            s[pw-1].g=b*s[pw-1].g;
-            s[pw-1].b=b*s[pw-1].b;
-            s[pww-1].r=b*s[pww-1].r;
-            s[pww-1].g=b*s[pww-1].g;
-            s[pww-1].b=b*s[pww-1].b;
-        }
+//---------------------------------------------------------
+//causal and anticausal pass over one line, in place
+//one float_rgba is one SSE register
+void fibe_line(const fibe_lines *f, float_rgba *s, int n, int ec)
+{
+    float_rgba cl,cr,z1,z2,z3;
+    __m128 g,c0,c1,c2,y1,y2,y3,t;
+    int i,avg;
 
-        //zacetek na desni
-        s[pw-2].r=s[pw-2].r+a*s[pw-1].r;	//nazaj
-        s[pw-2].g=s[pw-2].g+a*s[pw-1].g;
-        s[pw-2].b=s[pw-2].b+a*s[pw-1].b;
-        s[pw-1].r=s[pw-1].r+a*s[p-1].r;		//dol
-        s[pw-1].g=s[pw-1].g+a*s[p-1].g;
-        s[pw-1].b=s[pw-1].b+a*s[p-1].b;
+    avg=MIN(EDGEAVG,n);
+    cl=fibe_avg(s,avg,ec);
+    cr=fibe_avg(s+n-avg,avg,ec);
 
-        for (j=w-2;j>=1;j--)	//nazaj
-        {
-            pj=p+j;pwj=pw+j;
-            s[pj-1].r=a*s[pj].r+s[pj-1].r;
-            s[pj-1].g=a*s[pj].g+s[pj-1].g;
-            s[pj-1].b=a*s[pj].b+s[pj-1].b;
-            s[pwj].r=a*s[pwj+1].r+s[pwj].r;
-            s[pwj].g=a*s[pwj+1].g+s[pwj].g;
-            s[pwj].b=a*s[pwj+1].b+s[pwj].b;
-            //zdaj naredi se en piksel vertikalno dol, za vse stolpce
-            //dva nazaj, da ne vpliva na H nazaj
-            s[pj].r=s[pj].r+a*s[pmw+j].r;
-            s[pj].g=s[pj].g+a*s[pmw+j].g;
-            s[pj].b=s[pj].b+a*s[pmw+j].b;
-            s[pwj+1].r=s[pwj+1].r+a*s[pj+1].r;
-            s[pwj+1].g=s[pwj+1].g+a*s[pj+1].g;
-            s[pwj+1].b=s[pwj+1].b+a*s[pj+1].b;
-        }
-        //konec levo
-        s[pw].r=s[pw].r+a*s[pw+1].r;	//nazaj
-        s[pw].g=s[pw].g+a*s[pw+1].g;
-        s[pw].b=s[pw].b+a*s[pw+1].b;
-        s[p].r=s[p].r+a*s[pmw].r;	//dol
-        s[p].g=s[p].g+a*s[pmw].g;
-        s[p].b=s[p].b+a*s[pmw].b;
-        s[pw+1].r=s[pw+1].r+a*s[p+1].r;	//dol
-        s[pw+1].g=s[pw+1].g+a*s[p+1].g;
-        s[pw+1].b=s[pw+1].b+a*s[p+1].b;
-        s[pw].r=s[pw].r+a*s[p].r;	//dol
-        s[pw].g=s[pw].g+a*s[p].g;
-        s[pw].b=s[pw].b+a*s[p].b;
+    g=_mm_set1_ps(f->g);
+    c0=_mm_set1_ps(f->c[0]); c1=_mm_set1_ps(f->c[1]); c2=_mm_set1_ps(f->c[2]);
+
+    y1=_mm_loadu_ps(&cl.r); y2=y1; y3=y1;
+    for (i=0;i<n;i++)	//tja
+    {
+        t=_mm_mul_ps(g,_mm_loadu_ps(&s[i].r));
+        t=_mm_sub_ps(_mm_sub_ps(t,_mm_mul_ps(c2,y3)),_mm_mul_ps(c1,y2));
+        t=_mm_sub_ps(t,_mm_mul_ps(c0,y1));
+        _mm_storeu_ps(&s[i].r,t);
+        y3=y2; y2=y1; y1=t;
     }
 
-    //ce je sodo stevilo vrstic, moras zadnjo posebej
-    if (i!=h)
+    _mm_storeu_ps(&z1.r,y1); _mm_storeu_ps(&z2.r,y2); _mm_storeu_ps(&z3.r,y3);
+    cl=fibe_rep(f,0,z1,z2,z3,cr);
+    y1=_mm_loadu_ps(&cl.r);
+    cl=fibe_rep(f,1,z1,z2,z3,cr);
+    y2=_mm_loadu_ps(&cl.r);
+    cl=fibe_rep(f,2,z1,z2,z3,cr);
+    y3=_mm_loadu_ps(&cl.r);
+    for (i=n-1;i>=0;i--)	//nazaj
     {
-        p=i*w; pw=p+w;
-        for (j=1;j<w;j++)	//tja
-        {
-            s[p+j].r=s[p+j].r+a*s[p+j-1].r;
-            s[p+j].g=s[p+j].g+a*s[p+j-1].g;
-            s[p+j].b=s[p+j].b+a*s[p+j-1].b;
-        }
+        t=_mm_mul_ps(g,_mm_loadu_ps(&s[i].r));
+        t=_mm_sub_ps(_mm_sub_ps(t,_mm_mul_ps(c2,y3)),_mm_mul_ps(c1,y2));
+        t=_mm_sub_ps(t,_mm_mul_ps(c0,y1));
+        _mm_storeu_ps(&s[i].r,t);
+        y3=y2; y2=y1; y1=t;
+    }
+}
 
-        s[pw-1].r=b*s[pw-1].r;	//rep H
-        s[pw-1].g=b*s[pw-1].g;
-        s[pw-1].b=b*s[pw-1].b;
+//---------------------------------------------------------
+//one row of the vertical recursion
+//y holds y[i-3] on entry and y[i] on exit
+static inline void fibe_row(const fibe_lines *f, float_rgba *y, const float_rgba *x, const float_rgba *p1, const float_rgba *p2, int n)
+{
+    __m128 g,c0,c1,c2,t;
+    int j;
 
-        for (j=w-2;j>=0;j--)	//nazaj in dol
-        {
-            s[p+j].r=a*s[p+j+1].r+s[p+j].r;
-            s[p+j].g=a*s[p+j+1].g+s[p+j].g;
-            s[p+j].b=a*s[p+j+1].b+s[p+j].b;
-
-            //zdaj naredi se en piksel vertikalno dol, za vse stolpce
-            //dva nazaj, da ne vpliva na H nazaj
-            s[p+j+1].r=s[p+j+1].r+a*s[p-w+j+1].r;
-            s[p+j+1].g=s[p+j+1].g+a*s[p-w+j+1].g;
-            s[p+j+1].b=s[p+j+1].b+a*s[p-w+j+1].b;
-        }
-        //levi piksel vert
-        s[p].r=s[p].r+a*s[p-w].r;
-        s[p].g=s[p].g+a*s[p-w].g;
-        s[p].b=s[p].b+a*s[p-w].b;
+    g=_mm_set1_ps(f->g);
+    c0=_mm_set1_ps(f->c[0]); c1=_mm_set1_ps(f->c[1]); c2=_mm_set1_ps(f->c[2]);
+    for (j=0;j<n;j++)
+    {
+        t=_mm_mul_ps(g,_mm_loadu_ps(&x[j].r));
+        t=_mm_sub_ps(t,_mm_mul_ps(c2,_mm_loadu_ps(&y[j].r)));
+        t=_mm_sub_ps(t,_mm_mul_ps(c1,_mm_loadu_ps(&p2[j].r)));
+        t=_mm_sub_ps(t,_mm_mul_ps(c0,_mm_loadu_ps(&p1[j].r)));
+        _mm_storeu_ps(&y[j].r,t);
     }
+}
 
-    //zadnja vrstica (h-1)
-    g4b=g4*b;
-    g4a=g4/(1.0-a);
-    p=(h-1)*w;
-    if (ec!=0)
+//---------------------------------------------------------
+//8 bit RGB to float line, four pixels at a time
+static inline void fibe_unpack8(const uint32_t *p, float_rgba *s, int n)
+{
+    const __m128i zero=_mm_setzero_si128();
+    const __m128i mask=_mm_set1_epi32(0x00FFFFFF);
+    __m128i v,lo,hi;
+    int i;
+
+    for (i=0;i+4<=n;i=i+4)
     {
-        for (i=0;i<w;i++)	//po stolpcih
-        {
-            cr=0.0;cg=0.0;cb=0.0;
-            for (j=h-avg;j<h;j++)
-            {
-                cr=cr+s[i+w*j].r;
-                cg=cg+s[i+w*j].g;
-                cb=cb+s[i+w*j].b;
-            }
-            cr=cr*avg1; cg=cg*avg1; cb=cb*avg1;
-            s[i+p].r=g4a*cr+g4b*(s[i+p].r-cr);
-            s[i+p].g=g4a*cg+g4b*(s[i+p].g-cg);
-            s[i+p].b=g4a*cb+g4b*(s[i+p].b-cb);
-            outframe[p+i]=((uint32_t)s[p+i].r&0xFF) + (((uint32_t)s[p+i].g&0xFF)<<8) + (((uint32_t)s[p+i].b&0xFF)<<16);
-        }
+        v=_mm_and_si128(_mm_loadu_si128((const __m128i*)(p+i)),mask);
+        lo=_mm_unpacklo_epi8(v,zero);
+        hi=_mm_unpackhi_epi8(v,zero);
+        _mm_storeu_ps(&s[i].r,_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo,zero)));
+        _mm_storeu_ps(&s[i+1].r,_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo,zero)));
+        _mm_storeu_ps(&s[i+2].r,_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi,zero)));
+        _mm_storeu_ps(&s[i+3].r,_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi,zero)));
     }
-    else
+    for (;i<n;i++)
     {
-        for (j=0;j<w;j++)	//po stolpcih
-        {
-            s[j+p].r=g4b*s[j+p].r;	//rep V
-            s[j+p].g=g4b*s[j+p].g;
-            s[j+p].b=g4b*s[j+p].b;
-            outframe[p+j]=((uint32_t)s[p+j].r&0xFF) + (((uint32_t)s[p+j].g&0xFF)<<8) + (((uint32_t)s[p+j].b&0xFF)<<16);
-        }
+        s[i].r=(float)(p[i]&0xFF);
+        s[i].g=(float)((p[i]&0xFF00)>>8);
+        s[i].b=(float)((p[i]&0xFF0000)>>16);
+        s[i].a=0.0;
     }
+}
+
+//---------------------------------------------------------
+//float line to 8 bit RGB, alpha is left at zero
+//the saturating packs do the clamping
+static inline void fibe_pack8(const float_rgba *s, uint32_t *p, int n)
+{
+    const __m128i mask=_mm_set1_epi32(0x00FFFFFF);
+    __m128i v0,v1,v2,v3;
+    int i;
 
-    for (i=h-2;i>=0;i--)	//po vrsticah navzgor
+    for (i=0;i+4<=n;i=i+4)
     {
-        p=i*w; pw=p+w;
-        for (j=0;j<w;j++)	//po stolpcih
-        {
-            s[p+j].r=a*s[pw+j].r+g4*s[p+j].r;
-            s[p+j].g=a*s[pw+j].g+g4*s[p+j].g;
-            s[p+j].b=a*s[pw+j].b+g4*s[p+j].b;
-            outframe[p+j]=((uint32_t)s[p+j].r&0xFF) + (((uint32_t)s[p+j].g&0xFF)<<8) + (((uint32_t)s[p+j].b&0xFF)<<16);
-        }
+        v0=_mm_cvtps_epi32(_mm_loadu_ps(&s[i].r));
+        v1=_mm_cvtps_epi32(_mm_loadu_ps(&s[i+1].r));
+        v2=_mm_cvtps_epi32(_mm_loadu_ps(&s[i+2].r));
+        v3=_mm_cvtps_epi32(_mm_loadu_ps(&s[i+3].r));
+        v0=_mm_packus_epi16(_mm_packs_epi32(v0,v1),_mm_packs_epi32(v2,v3));
+        _mm_storeu_si128((__m128i*)(p+i),_mm_and_si128(v0,mask));
     }
-
+    for (;i<n;i++)
+        p[i]=(uint32_t)(int)CLAMP(s[i].r+0.5f,0.0f,255.0f)
+             + ((uint32_t)(int)CLAMP(s[i].g+0.5f,0.0f,255.0f)<<8)
+             + ((uint32_t)(int)CLAMP(s[i].b+0.5f,0.0f,255.0f)<<16);
 }
 
-//-------------------------------------------------------
-// 2-tap IIR v stirih smereh   a only verzija, a0=1.0
-//desno kompenzacijo izracuna direktno (rdx,rsx,rcx)
-//optimized for speed
-void fibe2o_8(const uint32_t* inframe, uint32_t* outframe, float_rgba s[], int w, int h, float a1, float a2,  float rd1, float rd2, float rs1, float rs2, float rc1, float rc2, int ec)
+//---------------------------------------------------------
+//intermediate 16 bits per channel, (v-128)*128 in an int16:
+//red and green in a frame line, blue in the side buffer
+static inline void fibe_pack16(const float_rgba *s, uint32_t *p, int16_t *q, int n)
 {
-    float cr,cg,cb,g,g4,avg,gavg,avgg,iavg;
-    float_rgba rep1,rep2;
-    int i,j;
-    int jw,jww,h1w,h2w,iw,i1w,i2w;
-
-    g=1.0/(1.0+a1+a2);
-    g4=1.0/g/g/g/g;
-    avg=EDGEAVG;	//koliko vzorcev za povprecje pri edge comp
-    gavg=g4/avg;
-    avgg=1.0/g/avg;
-    iavg=1.0/avg;
+    const __m128 k=_mm_set1_ps(128.0f);
+    __m128 r,g,b,a;
+    __m128i vr,vg,vb;
+    int i;
 
-    for (j=0;j<avg;j++)	//prvih avg vrstic tja in nazaj
+    for (i=0;i+4<=n;i=i+4)
     {
-        jw=j*w; jww=jw+w;
-        cr=0.0;cg=0.0;cb=0.0;
-        if (ec!=0)
-        {	//edge comp (popvprecje prvih)
-            for (i=0;i<avg;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-                cr=cr+s[jw+i].r;
-                cg=cg+s[jw+i].g;
-                cb=cb+s[jw+i].b;
-            }
-            cr=cr*gavg; cg=cg*gavg; cb=cb*gavg;
-        }
-        else
-            for (i=0;i<avg;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-            }
-
-        s[jw].r=g4*s[jw].r-(a1+a2)*g*cr;
-        s[jw].g=g4*s[jw].g-(a1+a2)*g*cg;
-        s[jw].b=g4*s[jw].b-(a1+a2)*g*cb;
-        s[jw+1].r=g4*s[jw+1].r-a1*s[jw].r-a2*g*cr;
-        s[jw+1].g=g4*s[jw+1].g-a1*s[jw].g-a2*g*cg;
-        s[jw+1].b=g4*s[jw+1].b-a1*s[jw].b-a2*g*cb;
-
-        if (ec!=0)
-        {	//edge comp za nazaj
-            cr=0.0;cg=0.0;cb=0.0;
-            for (i=w-avg;i<w;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-                cr=cr+s[jw+i].r;
-                cg=cg+s[jw+i].g;
-                cb=cb+s[jw+i].b;
-            }
-            cr=cr*gavg; cg=cg*gavg; cb=cb*gavg;
-        }
-        else
-            for (i=w-avg;i<w;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-            }
-
-        for (i=2;i<avg;i++)	//tja (ze pretv. levo)
-        {
-            s[jw+i].r=g4*s[jw+i].r-a1*s[jw+i-1].r-a2*s[jw+i-2].r;
-            s[jw+i].g=g4*s[jw+i].g-a1*s[jw+i-1].g-a2*s[jw+i-2].g;
-            s[jw+i].b=g4*s[jw+i].b-a1*s[jw+i-1].b-a2*s[jw+i-2].b;
-        }
-
-        for (i=avg;i<w-avg;i++)	//tja (s pretvorbo)
-        {
-            s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-            s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-            s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-            s[jw+i].r=g4*s[jw+i].r-a1*s[jw+i-1].r-a2*s[jw+i-2].r;
-            s[jw+i].g=g4*s[jw+i].g-a1*s[jw+i-1].g-a2*s[jw+i-2].g;
-            s[jw+i].b=g4*s[jw+i].b-a1*s[jw+i-1].b-a2*s[jw+i-2].b;
-        }
+        r=_mm_loadu_ps(&s[i].r);
+        g=_mm_loadu_ps(&s[i+1].r);
+        b=_mm_loadu_ps(&s[i+2].r);
+        a=_mm_loadu_ps(&s[i+3].r);
+        _MM_TRANSPOSE4_PS(r,g,b,a);
+        //the saturating packs do the clamping
+        vr=_mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(r,k),k));
+        vg=_mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(g,k),k));
+        vb=_mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(b,k),k));
+        vr=_mm_packs_epi32(vr,vr);
+        vg=_mm_packs_epi32(vg,vg);
+        _mm_storeu_si128((__m128i*)(p+i),_mm_unpacklo_epi16(vr,vg));
+        _mm_storel_epi64((__m128i*)(q+i),_mm_packs_epi32(vb,vb));
+    }
+    for (;i<n;i++)
+    {
+        p[i]=(uint16_t)(int16_t)CLAMP(floorf((s[i].r-128.0f)*128.0f+0.5f),-32768.0f,32767.0f)
+             + ((uint32_t)(uint16_t)(int16_t)CLAMP(floorf((s[i].g-128.0f)*128.0f+0.5f),-32768.0f,32767.0f)<<16);
+        q[i]=(int16_t)CLAMP(floorf((s[i].b-128.0f)*128.0f+0.5f),-32768.0f,32767.0f);
+    }
+}
 
-        for (i=w-avg;i<w;i++)	//tja (ze pretv. desno)
-        {
-            s[jw+i].r=g4*s[jw+i].r-a1*s[jw+i-1].r-a2*s[jw+i-2].r;
-            s[jw+i].g=g4*s[jw+i].g-a1*s[jw+i-1].g-a2*s[jw+i-2].g;
-            s[jw+i].b=g4*s[jw+i].b-a1*s[jw+i-1].b-a2*s[jw+i-2].b;
-        }
+//---------------------------------------------------------
+static inline void fibe_unpack16(const uint32_t *p, const int16_t *q, float_rgba *s, int n)
+{
+    const __m128 k=_mm_set1_ps(128.0f);
+    const __m128 m=_mm_set1_ps(1.0f/128.0f);
+    __m128 r,g,b,a;
+    __m128i v,vb;
+    int i;
 
-        rep1.r=(s[jww-1].r+s[jww-2].r)*0.5*rs1+(s[jww-1].r-s[jww-2].r)*rd1;
-        rep1.g=(s[jww-1].g+s[jww-2].g)*0.5*rs1+(s[jww-1].g-s[jww-2].g)*rd1;
-        rep1.b=(s[jww-1].b+s[jww-2].b)*0.5*rs1+(s[jww-1].b-s[jww-2].b)*rd1;
-        rep2.r=(s[jww-1].r+s[jww-2].r)*0.5*rs2+(s[jww-1].r-s[jww-2].r)*rd2;
-        rep2.g=(s[jww-1].g+s[jww-2].g)*0.5*rs2+(s[jww-1].g-s[jww-2].g)*rd2;
-        rep2.b=(s[jww-1].b+s[jww-2].b)*0.5*rs2+(s[jww-1].b-s[jww-2].b)*rd2;
+    for (i=0;i+4<=n;i=i+4)
+    {
+        v=_mm_loadu_si128((const __m128i*)(p+i));
+        vb=_mm_loadl_epi64((const __m128i*)(q+i));
+        r=_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(v,16),16));
+        g=_mm_cvtepi32_ps(_mm_srai_epi32(v,16));
+        b=_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(vb,vb),16));
+        r=_mm_add_ps(_mm_mul_ps(r,m),k);
+        g=_mm_add_ps(_mm_mul_ps(g,m),k);
+        b=_mm_add_ps(_mm_mul_ps(b,m),k);
+        a=_mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(r,g,b,a);
+        _mm_storeu_ps(&s[i].r,r);
+        _mm_storeu_ps(&s[i+1].r,g);
+        _mm_storeu_ps(&s[i+2].r,b);
+        _mm_storeu_ps(&s[i+3].r,a);
+    }
+    for (;i<n;i++)
+    {
+        s[i].r=(float)(int16_t)(p[i]&0xFFFF)/128.0f+128.0f;
+        s[i].g=(float)(int16_t)(p[i]>>16)/128.0f+128.0f;
+        s[i].b=(float)q[i]/128.0f+128.0f;
+        s[i].a=0.0;
+    }
+}
 
-        if (ec!=0)
-        {
-            rep1.r=rep1.r+rc1*cr;
-            rep1.g=rep1.g+rc1*cg;
-            rep1.b=rep1.b+rc1*cb;
-            rep2.r=rep2.r+rc2*cr;
-            rep2.g=rep2.g+rc2*cg;
-            rep2.b=rep2.b+rc2*cb;
-        }
+#else
 
-        s[jww-1].r=s[jww-1].r-a1*rep1.r-a2*rep2.r;
-        s[jww-1].g=s[jww-1].g-a1*rep1.g-a2*rep2.g;
-        s[jww-1].b=s[jww-1].b-a1*rep1.b-a2*rep2.b;
-        s[jww-2].r=s[jww-2].r-a1*s[jww-1].r-a2*rep1.r;
-        s[jww-2].g=s[jww-2].g-a1*s[jww-1].g-a2*rep1.g;
-        s[jww-2].b=s[jww-2].b-a1*s[jww-1].b-a2*rep1.b;
+//---------------------------------------------------------
+//causal and anticausal pass over one line, in place
+void fibe_line(const fibe_lines *f, float_rgba *s, int n, int ec)
+{
+    float_rgba cl,cr,y1,y2,y3,z1,z2,z3;
+    int i,avg;
 
-        for (i=w-3;i>=0;i--)		//nazaj
-        {
-            s[jw+i].r=s[jw+i].r-a1*s[jw+i+1].r-a2*s[jw+i+2].r;
-            s[jw+i].g=s[jw+i].g-a1*s[jw+i+1].g-a2*s[jw+i+2].g;
-            s[jw+i].b=s[jw+i].b-a1*s[jw+i+1].b-a2*s[jw+i+2].b;
-        }
-    }	//prvih avg vrstic
+    avg=MIN(EDGEAVG,n);
+    cl=fibe_avg(s,avg,ec);
+    cr=fibe_avg(s+n-avg,avg,ec);
 
-    //edge comp zgoraj za navzdol
-    for (j=0;j<w;j++)	//po stolpcih
+    y1=cl; y2=cl; y3=cl;
+    for (i=0;i<n;i++)	//tja
     {
-        cr=0.0;cg=0.0;cb=0.0;
-        if (ec!=0)
-        {	//edge comp (popvprecje prvih)
-            for (i=0;i<avg;i++)
-            {
-                cr=cr+s[j+w*i].r;
-                cg=cg+s[j+w*i].g;
-                cb=cb+s[j+w*i].b;
-            }
-            cr=cr*iavg; cg=cg*iavg; cb=cb*iavg;
-        }
-
-        //zgornji vrstici
-        s[j].r=s[j].r-(a1+a2)*g*cr;
-        s[j].g=s[j].g-(a1+a2)*g*cg;
-        s[j].b=s[j].b-(a1+a2)*g*cb;
-        s[j+w].r=s[j+w].r-a1*s[j].r-a2*g*cr;
-        s[j+w].g=s[j+w].g-a1*s[j].g-a2*g*cg;
-        s[j+w].b=s[j+w].b-a1*s[j].b-a2*g*cb;
+        s[i]=fibe_tap(f,s[i],y1,y2,y3);
+        y3=y2; y2=y1; y1=s[i];
     }
 
-    //tretja do avg, samo navzdol (nazaj so ze)
-    for (i=2;i<avg;i++)
+    z1=fibe_rep(f,0,y1,y2,y3,cr);
+    z2=fibe_rep(f,1,y1,y2,y3,cr);
+    z3=fibe_rep(f,2,y1,y2,y3,cr);
+    y1=z1; y2=z2; y3=z3;
+    for (i=n-1;i>=0;i--)	//nazaj
     {
-        iw=i*w; i1w=iw-w;
-        for (j=0;j<w;j++)	//po stolpcih
-        {
-            s[j+iw].r=s[j+iw].r-a1*s[j+i1w].r-a2*s[j+i1w-w].r;
-            s[j+iw].g=s[j+iw].g-a1*s[j+i1w].g-a2*s[j+i1w-w].g;
-            s[j+iw].b=s[j+iw].b-a1*s[j+i1w].b-a2*s[j+i1w-w].b;
-        }
+        s[i]=fibe_tap(f,s[i],y1,y2,y3);
+        y3=y2; y2=y1; y1=s[i];
     }
+}
 
-    for (j=avg;j<h;j++)	//po vrsticah tja, nazaj in dol
-    {
-        jw=j*w; jww=jw+w;
-        cr=0.0;cg=0.0;cb=0.0;
-        if (ec!=0)
-        {	//edge comp (popvprecje prvih)
-            for (i=0;i<avg;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-                cr=cr+s[jw+i].r;
-                cg=cg+s[jw+i].g;
-                cb=cb+s[jw+i].b;
-            }
-            cr=cr*gavg; cg=cg*gavg; cb=cb*gavg;
-        }
-        else
-            for (i=0;i<avg;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-            }
-        s[jw].r=g4*s[jw].r-(a1+a2)*g*cr;
-        s[jw].g=g4*s[jw].g-(a1+a2)*g*cg;
-        s[jw].b=g4*s[jw].b-(a1+a2)*g*cb;
-        s[jw+1].r=g4*s[jw+1].r-a1*s[jw].r-a2*g*cr;
-        s[jw+1].g=g4*s[jw+1].g-a1*s[jw].g-a2*g*cg;
-        s[jw+1].b=g4*s[jw+1].b-a1*s[jw].b-a2*g*cb;
-
-        if (ec!=0)
-        {	//edge comp za nazaj
-            cr=0.0;cg=0.0;cb=0.0;
-            for (i=w-avg;i<w;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-                cr=cr+s[jw+i].r;
-                cg=cg+s[jw+i].g;
-                cb=cb+s[jw+i].b;
-            }
-            cr=cr*gavg; cg=cg*gavg; cb=cb*gavg;
-        }
-        else
-            for (i=w-avg;i<w;i++)
-            {
-                s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-                s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-                s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-            }
-
-        for (i=2;i<avg;i++)	//tja  (ze pretv. levo)
-        {
-            s[jw+i].r=g4*s[jw+i].r-a1*s[jw+i-1].r-a2*s[jw+i-2].r;
-            s[jw+i].g=g4*s[jw+i].g-a1*s[jw+i-1].g-a2*s[jw+i-2].g;
-            s[jw+i].b=g4*s[jw+i].b-a1*s[jw+i-1].b-a2*s[jw+i-2].b;
-        }
+//---------------------------------------------------------
+//one row of the vertical recursion
+//y holds y[i-3] on entry and y[i] on exit
+static inline void fibe_row(const fibe_lines *f, float_rgba *y, const float_rgba *x, const float_rgba *p1, const float_rgba *p2, int n)
+{
+    int j;
 
-        for (i=avg;i<w-avg;i++)	//tja  (s retvorbo)
-        {
-            s[jw+i].r=(float)(inframe[jw+i]&0xFF);
-            s[jw+i].g=(float)((inframe[jw+i]&0xFF00)>>8);
-            s[jw+i].b=(float)((inframe[jw+i]&0xFF0000)>>16);
-            s[jw+i].r=g4*s[jw+i].r-a1*s[jw+i-1].r-a2*s[jw+i-2].r;
-            s[jw+i].g=g4*s[jw+i].g-a1*s[jw+i-1].g-a2*s[jw+i-2].g;
-            s[jw+i].b=g4*s[jw+i].b-a1*s[jw+i-1].b-a2*s[jw+i-2].b;
-        }
+    for (j=0;j<n;j++)
+        y[j]=fibe_tap(f,x[j],p1[j],p2[j],y[j]);
+}
 
-        for (i=w-avg;i<w;i++)	//tja  (ze pretv. desno)
-        {
-            s[jw+i].r=g4*s[jw+i].r-a1*s[jw+i-1].r-a2*s[jw+i-2].r;
-            s[jw+i].g=g4*s[jw+i].g-a1*s[jw+i-1].g-a2*s[jw+i-2].g;
-            s[jw+i].b=g4*s[jw+i].b-a1*s[jw+i-1].b-a2*s[jw+i-2].b;
-        }
+//---------------------------------------------------------
+//8 bit RGB to float line
+static inline void fibe_unpack8(const uint32_t *p, float_rgba *s, int n)
+{
+    int i;
 
-        rep1.r=(s[jww-1].r+s[jww-2].r)*0.5*rs1+(s[jww-1].r-s[jww-2].r)*rd1;
-        rep1.g=(s[jww-1].g+s[jww-2].g)*0.5*rs1+(s[jww-1].g-s[jww-2].g)*rd1;
-        rep1.b=(s[jww-1].b+s[jww-2].b)*0.5*rs1+(s[jww-1].b-s[jww-2].b)*rd1;
-        rep2.r=(s[jww-1].r+s[jww-2].r)*0.5*rs2+(s[jww-1].r-s[jww-2].r)*rd2;
-        rep2.g=(s[jww-1].g+s[jww-2].g)*0.5*rs2+(s[jww-1].g-s[jww-2].g)*rd2;
-        rep2.b=(s[jww-1].b+s[jww-2].b)*0.5*rs2+(s[jww-1].b-s[jww-2].b)*rd2;
+    for (i=0;i<n;i++)
+    {
+        s[i].r=(float)(p[i]&0xFF);
+        s[i].g=(float)((p[i]&0xFF00)>>8);
+        s[i].b=(float)((p[i]&0xFF0000)>>16);
+        s[i].a=0.0;
+    }
+}
 
-        if (ec!=0)
-        {
-            rep1.r=rep1.r+rc1*cr;
-            rep1.g=rep1.g+rc1*cg;
-            rep1.b=rep1.b+rc1*cb;
-            rep2.r=rep2.r+rc2*cr;
-            rep2.g=rep2.g+rc2*cg;
-            rep2.b=rep2.b+rc2*cb;
-        }
+//---------------------------------------------------------
+//float line to 8 bit RGB, alpha is left at zero
+static inline void fibe_pack8(const float_rgba *s, uint32_t *p, int n)
+{
+    int i;
 
-        s[jww-1].r=s[jww-1].r-a1*rep1.r-a2*rep2.r;
-        s[jww-1].g=s[jww-1].g-a1*rep1.g-a2*rep2.g;
-        s[jww-1].b=s[jww-1].b-a1*rep1.b-a2*rep2.b;
-        s[jww-2].r=s[jww-2].r-a1*s[jww-1].r-a2*rep1.r;
-        s[jww-2].g=s[jww-2].g-a1*s[jww-1].g-a2*rep1.g;
-        s[jww-2].b=s[jww-2].b-a1*s[jww-1].b-a2*rep1.b;
-
-        for (i=w-3;i>=0;i--)	//po stolpcih
-        { //nazaj
-            s[jw+i].r=s[jw+i].r-a1*s[jw+i+1].r-a2*s[jw+i+2].r;
-            s[jw+i].g=s[jw+i].g-a1*s[jw+i+1].g-a2*s[jw+i+2].g;
-            s[jw+i].b=s[jw+i].b-a1*s[jw+i+1].b-a2*s[jw+i+2].b;
-            //dol
-            s[jw+i+2].r=s[jw+i+2].r-a1*s[jw-w+i+2].r-a2*s[jw-w-w+i+2].r;
-            s[jw+i+2].g=s[jw+i+2].g-a1*s[jw-w+i+2].g-a2*s[jw-w-w+i+2].g;
-            s[jw+i+2].b=s[jw+i+2].b-a1*s[jw-w+i+2].b-a2*s[jw-w-w+i+2].b;
-        }
+    for (i=0;i<n;i++)
+        p[i]=(uint32_t)(int)CLAMP(s[i].r+0.5f,0.0f,255.0f)
+             + ((uint32_t)(int)CLAMP(s[i].g+0.5f,0.0f,255.0f)<<8)
+             + ((uint32_t)(int)CLAMP(s[i].b+0.5f,0.0f,255.0f)<<16);
+}
 
-        //se leva stolpca dol
-        s[jw+1].r=s[jw+1].r-a1*s[jw-w+1].r-a2*s[jw-w-w+1].r;
-        s[jw+1].g=s[jw+1].g-a1*s[jw-w+1].g-a2*s[jw-w-w+1].g;
-        s[jw+1].b=s[jw+1].b-a1*s[jw-w+1].b-a2*s[jw-w-w+1].b;
-        s[jw].r=s[jw].r-a1*s[jw-w].r-a2*s[jw-w-w].r;
-        s[jw].g=s[jw].g-a1*s[jw-w].g-a2*s[jw-w-w].g;
-        s[jw].b=s[jw].b-a1*s[jw-w].b-a2*s[jw-w-w].b;
+//---------------------------------------------------------
+//intermediate 16 bits per channel, (v-128)*128 in an int16:
+//red and green in a frame line, blue in the side buffer
+static inline int16_t fibe_fix16(float v)
+{
+    return (int16_t)CLAMP(floorf((v-128.0f)*128.0f+0.5f),-32768.0f,32767.0f);
+}
 
-    }	//po vrsticah
+static inline void fibe_pack16(const float_rgba *s, uint32_t *p, int16_t *q, int n)
+{
+    int i;
 
-    //pa se navzgor
-    //spodnji dve vrstici
-    h1w=(h-1)*w; h2w=(h-2)*w;
-    for (j=0;j<w;j++)	//po stolpcih
+    for (i=0;i<n;i++)
     {
-        if (ec!=0)
-        {	//edge comp za gor
-            cr=0.0;cg=0.0;cb=0.0;
-            for (i=h-avg;i<h;i++)
-            {
-                cr=cr+s[j+w*i].r;
-                cg=cg+s[j+w*i].g;
-                cb=cb+s[j+w*i].b;
-            }
-            cr=cr*avgg; cg=cg*avgg; cb=cb*avgg;
-        }
-
-        rep1.r=(s[j+h1w].r+s[j+h2w].r)*0.5*rs1+(s[j+h1w].r-s[j+h2w].r)*rd1;
-        rep1.g=(s[j+h1w].g+s[j+h2w].g)*0.5*rs1+(s[j+h1w].g-s[j+h2w].g)*rd1;
-        rep1.b=(s[j+h1w].b+s[j+h2w].b)*0.5*rs1+(s[j+h1w].b-s[j+h2w].b)*rd1;
-        rep2.r=(s[j+h1w].r+s[j+h2w].r)*0.5*rs2+(s[j+h1w].r-s[j+h2w].r)*rd2;
-        rep2.g=(s[j+h1w].g+s[j+h2w].g)*0.5*rs2+(s[j+h1w].g-s[j+h2w].g)*rd2;
-        rep2.b=(s[j+h1w].b+s[j+h2w].b)*0.5*rs2+(s[j+h1w].b-s[j+h2w].b)*rd2;
-
-        if (ec!=0)
-        {	//edge comp
-            rep1.r=rep1.r+rc1*cr;
-            rep1.g=rep1.g+rc1*cg;
-            rep1.b=rep1.b+rc1*cb;
-            rep2.r=rep2.r+rc2*cr;
-            rep2.g=rep2.g+rc2*cg;
-            rep2.b=rep2.b+rc2*cb;
-        }
-
-        s[j+h1w].r=s[j+h1w].r-a1*rep1.r-a2*rep2.r;
-        s[j+h1w].g=s[j+h1w].g-a1*rep1.g-a2*rep2.g;
-        s[j+h1w].b=s[j+h1w].b-a1*rep1.b-a2*rep2.b;
-        if (s[j+h1w].r>255) s[j+h1w].r=255.0;
-        if (s[j+h1w].r<0.0) s[j+h1w].r=0.0;
-        if (s[j+h1w].g>255) s[j+h1w].g=255.0;
-        if (s[j+h1w].g<0.0) s[j+h1w].g=0.0;
-        if (s[j+h1w].b>255) s[j+h1w].b=255.0;
-        if (s[j+h1w].b<0.0) s[j+h1w].b=0.0;
-        outframe[j+h1w]=((uint32_t)s[j+h1w].r&0xFF) + (((uint32_t)s[j+h1w].g&0xFF)<<8) + (((uint32_t)s[j+h1w].b&0xFF)<<16);
-        s[j+h2w].r=s[j+h2w].r-a1*s[j+h1w].r-a2*rep1.r;
-        s[j+h2w].g=s[j+h2w].g-a1*s[j+h1w].g-a2*rep1.g;
-        s[j+h2w].b=s[j+h2w].b-a1*s[j+h1w].b-a2*rep1.b;
-        if (s[j+h2w].r>255) s[j+h2w].r=255.0;
-        if (s[j+h2w].r<0.0) s[j+h2w].r=0.0;
-        if (s[j+h2w].g>255) s[j+h2w].g=255.0;
-        if (s[j+h2w].g<0.0) s[j+h2w].g=0.0;
-        if (s[j+h2w].b>255) s[j+h2w].b=255.0;
-        if (s[j+h2w].b<0.0) s[j+h2w].b=0.0;
-        outframe[j+h2w]=((uint32_t)s[j+h2w].r&0xFF) + (((uint32_t)s[j+h2w].g&0xFF)<<8) + (((uint32_t)s[j+h2w].b&0xFF)<<16);
+        p[i]=(uint16_t)fibe_fix16(s[i].r) + ((uint32_t)(uint16_t)fibe_fix16(s[i].g)<<16);
+        q[i]=fibe_fix16(s[i].b);
     }
+}
 
-    //ostale vrstice
-    for (i=h-3;i>=0;i--)		//gor
+//---------------------------------------------------------
+static inline void fibe_unpack16(const uint32_t *p, const int16_t *q, float_rgba *s, int n)
+{
+    int i;
+
+    for (i=0;i<n;i++)
     {
-        iw=i*w; i1w=iw+w; i2w=i1w+w;
-        for (j=0;j<w;j++)
-        {
-            s[j+iw].r=s[j+iw].r-a1*s[j+i1w].r-a2*s[j+i2w].r;
-            s[j+iw].g=s[j+iw].g-a1*s[j+i1w].g-a2*s[j+i2w].g;
-            s[j+iw].b=s[j+iw].b-a1*s[j+i1w].b-a2*s[j+i2w].b;
-            if (s[j+iw].r>255) s[j+iw].r=255.0;
-            if (s[j+iw].r<0.0) s[j+iw].r=0.0;
-            if (s[j+iw].g>255) s[j+iw].g=255.0;
-            if (s[j+iw].g<0.0) s[j+iw].g=0.0;
-            if (s[j+iw].b>255) s[j+iw].b=255.0;
-            if (s[j+iw].b<0.0) s[j+iw].b=0.0;
-            outframe[j+iw]=((uint32_t)s[j+iw].r&0xFF) + (((uint32_t)s[j+iw].g&0xFF)<<8) + (((uint32_t)s[j+iw].b&0xFF)<<16);
-        }
+        s[i].r=(float)(int16_t)(p[i]&0xFFFF)/128.0f+128.0f;
+        s[i].g=(float)(int16_t)(p[i]>>16)/128.0f+128.0f;
+        s[i].b=(float)q[i]/128.0f+128.0f;
+        s[i].a=0.0;
     }
-
 }
 
-//-------------------------------------------------------
-// 3-tap IIR v stirih smereh
-//a only verzija, a0=1.0
-//edge efekt na desni kompenzira tako, da racuna 256 vzorcev
-//cez rob in in gre potem nazaj
-void fibe3_8(const uint32_t* inframe, uint32_t* outframe, float_rgba s[], int w, int h, float a1, float a2, float a3, int ec)
+#endif
+
+//---------------------------------------------------------
+//quadrilateral IIR filter, taps set by fibe_set()
+//horizontal passes in the line buffer, vertical passes
+//streamed row by row through the ring (top-down into
+//outframe and vb at 16 bits, then bottom-up to 8 bits)
+void fibe_8(const uint32_t* inframe, uint32_t* outframe, fibe_lines *f, int ec)
 {
-    float cr,cg,cb,g,g4;
+    const int w=f->w, h=f->h;
+    const int avg=MIN(EDGEAVG,h);
+    float_rgba *lb=f->lb, *r0=f->ring, *r1=f->ring+w, *r2=f->ring+2*w, *rt;
+    float_rgba z1,z2,z3;
     int i,j;
-    const float avg = EDGEAVG; // how many samples for average at edge comp
-    const int cez = 256; // how many samples go right
-    float_rgba *lb = malloc((MAX(w, h) + cez) * sizeof(*lb));
-
-    g=1.0/(1.0+a1+a2+a3); g4=1.0/g/g/g/g;
-
-    for (j=0;j<h;j++)	//po vrsticah
-    {
-        cr=0.0;cg=0.0;cb=0.0;
-        if (ec!=0)
-        {	//edge comp (popvprecje prvih)
-            for (i=0;i<avg;i++)
-            {
-                s[j*w+i].r=(float)(inframe[j*w+i]&0xFF);
-                s[j*w+i].g=(float)((inframe[j*w+i]&0xFF00)>>8);
-                s[j*w+i].b=(float)((inframe[j*w+i]&0xFF0000)>>16);
-                cr=cr+s[j*w+i].r;
-                cg=cg+s[j*w+i].g;
-                cb=cb+s[j*w+i].b;
-            }
-            cr=g4*cr/avg; cg=g4*cg/avg; cb=g4*cb/avg;
-        }
-        else
-            for (i=0;i<avg;i++)
-            {
-                s[j*w+i].r=(float)(inframe[j*w+i]&0xFF);
-                s[j*w+i].g=(float)((inframe[j*w+i]&0xFF00)>>8);
-                s[j*w+i].b=(float)((inframe[j*w+i]&0xFF0000)>>16);
-            }
-        lb[0].r=g4*s[j*w].r-(a1+a2+a3)*g*cr;
-        lb[0].g=g4*s[j*w].g-(a1+a2+a3)*g*cg;
-        lb[0].b=g4*s[j*w].b-(a1+a2+a3)*g*cb;
-        lb[1].r=g4*s[j*w+1].r-a1*lb[0].r-(a2+a3)*g*cr;
-        lb[1].g=g4*s[j*w+1].g-a1*lb[0].g-(a2+a3)*g*cg;
-        lb[1].b=g4*s[j*w+1].b-a1*lb[0].b-(a2+a3)*g*cb;
-        lb[2].r=g4*s[j*w+2].r-a1*lb[1].r-a2*lb[0].r-a3*g*cr;
-        lb[2].g=g4*s[j*w+2].g-a1*lb[1].g-a2*lb[0].g-a3*g*cg;
-        lb[2].b=g4*s[j*w+2].b-a1*lb[1].b-a2*lb[0].b-a3*g*cb;
-
-        for (i=3;i<avg;i++)	//tja  (ze pretvorjeni)
-        {
-            lb[i].r=g4*s[j*w+i].r-a1*lb[i-1].r-a2*lb[i-2].r-a3*lb[i-3].r;
-            lb[i].g=g4*s[j*w+i].g-a1*lb[i-1].g-a2*lb[i-2].g-a3*lb[i-3].g;
-            lb[i].b=g4*s[j*w+i].b-a1*lb[i-1].b-a2*lb[i-2].b-a3*lb[i-3].b;
-        }
 
-        for (i=avg;i<w;i++)	//tja  (s pretvorbo)
+    //column averages of the first avg (horizontally blurred) rows
+    memset(f->ctop, 0, w*sizeof(float_rgba));
+    memset(f->cbot, 0, w*sizeof(float_rgba));
+    if (ec!=0)
+        for (i=0;i<avg;i++)
         {
-            s[j*w+i].r=(float)(inframe[j*w+i]&0xFF);
-            s[j*w+i].g=(float)((inframe[j*w+i]&0xFF00)>>8);
-            s[j*w+i].b=(float)((inframe[j*w+i]&0xFF0000)>>16);
-            lb[i].r=g4*s[j*w+i].r-a1*lb[i-1].r-a2*lb[i-2].r-a3*lb[i-3].r;
-            lb[i].g=g4*s[j*w+i].g-a1*lb[i-1].g-a2*lb[i-2].g-a3*lb[i-3].g;
-            lb[i].b=g4*s[j*w+i].b-a1*lb[i-1].b-a2*lb[i-2].b-a3*lb[i-3].b;
-        }
-
-        cr=0.0;cg=0.0;cb=0.0;
-        if (ec!=0)
-        {	//edge comp
-            for (i=w-avg;i<w;i++)
+            fibe_unpack8(inframe+i*w, lb, w);
+            fibe_line(f, lb, w, ec);
+            for (j=0;j<w;j++)
             {
-                cr=cr+s[j*w+i].r;
-                cg=cg+s[j*w+i].g;
-                cb=cb+s[j*w+i].b;
+                f->ctop[j].r=f->ctop[j].r+lb[j].r/avg;
+                f->ctop[j].g=f->ctop[j].g+lb[j].g/avg;
+                f->ctop[j].b=f->ctop[j].b+lb[j].b/avg;
             }
-            cr=g4*cr/avg; cg=g4*cg/avg; cb=g4*cb/avg;
-        }
-
-        for (i=w;i<(w+cez);i++)	//naprej cez rob
-        {
-            lb[i].r=cr-a1*lb[i-1].r-a2*lb[i-2].r-a3*lb[i-3].r;
-            lb[i].g=cr-a1*lb[i-1].g-a2*lb[i-2].g-a3*lb[i-3].g;
-            lb[i].b=cr-a1*lb[i-1].b-a2*lb[i-2].b-a3*lb[i-3].b;
-        }
-        //nazaj do roba
-        lb[w+cez-2].r=lb[w+cez-2].r-a1*lb[w+cez-1].r;
-        lb[w+cez-2].g=lb[w+cez-2].g-a1*lb[w+cez-1].g;
-        lb[w+cez-2].b=lb[w+cez-2].b-a1*lb[w+cez-1].b;
-        lb[w+cez-3].r=lb[w+cez-3].r-a1*lb[w+cez-2].r-a2*lb[w+cez-1].r;
-        lb[w+cez-3].g=lb[w+cez-3].g-a1*lb[w+cez-2].g-a2*lb[w+cez-1].g;
-        lb[w+cez-3].b=lb[w+cez-3].b-a1*lb[w+cez-2].b-a2*lb[w+cez-1].b;
-        for (i=(w+cez-4);i>=w;i--)
-        {
-            lb[i].r=lb[i].r-a1*lb[i+1].r-a2*lb[i+2].r-a3*lb[i+3].r;
-            lb[i].g=lb[i].g-a1*lb[i+1].g-a2*lb[i+2].g-a3*lb[i+3].g;
-            lb[i].b=lb[i].b-a1*lb[i+1].b-a2*lb[i+2].b-a3*lb[i+3].b;
         }
-
-        s[j*w+w-1].r=lb[w-1].r-a1*lb[w].r-a2*lb[w+1].r-a3*lb[w+2].r;
-        s[j*w+w-1].g=lb[w-1].g-a1*lb[w].g-a2*lb[w+1].g-a3*lb[w+2].g;
-        s[j*w+w-1].b=lb[w-1].b-a1*lb[w].b-a2*lb[w+1].b-a3*lb[w+2].b;
-        s[j*w+w-2].r=lb[w-2].r-a1*s[j*w+w-1].r-a2*lb[w].r-a3*lb[w+1].r;
-        s[j*w+w-2].g=lb[w-2].g-a1*s[j*w+w-1].g-a2*lb[w].g-a3*lb[w+1].g;
-        s[j*w+w-2].b=lb[w-2].b-a1*s[j*w+w-1].b-a2*lb[w].b-a3*lb[w+1].b;
-        s[j*w+w-3].r=lb[w-3].r-a1*s[j*w+w-2].r-a2*s[j*w+w-1].r-a3*lb[w].r;
-        s[j*w+w-3].g=lb[w-3].g-a1*s[j*w+w-2].g-a2*s[j*w+w-1].g-a3*lb[w].g;
-        s[j*w+w-3].b=lb[w-3].b-a1*s[j*w+w-2].b-a2*s[j*w+w-1].b-a3*lb[w].b;
-
-        for (i=w-4;i>=0;i--)		//nazaj
-        {
-            s[j*w+i].r=lb[i].r-a1*s[j*w+i+1].r-a2*s[j*w+i+2].r-a3*s[j*w+i+3].r;
-            s[j*w+i].g=lb[i].g-a1*s[j*w+i+1].g-a2*s[j*w+i+2].g-a3*s[j*w+i+3].g;
-            s[j*w+i].b=lb[i].b-a1*s[j*w+i+1].b-a2*s[j*w+i+2].b-a3*s[j*w+i+3].b;
-        }
-    }	//po vrsticah
-
-    for (j=0;j<w;j++)	//po stolpcih
+    for (j=0;j<w;j++)
     {
-        cr=0.0;cg=0.0;cb=0.0;
-        if (ec!=0)
-        {	//edge comp (popvprecje prvih)
-            for (i=0;i<avg;i++)
-            {
-                cr=cr+s[j+w*i].r;
-                cg=cg+s[j+w*i].g;
-                cb=cb+s[j+w*i].b;
-            }
-            cr=cr/avg; cg=cg/avg; cb=cb/avg;
-        }
-        lb[0].r=s[j].r-(a1+a2+a3)*g*cr;
-        lb[0].g=s[j].g-(a1+a2+a3)*g*cg;
-        lb[0].b=s[j].b-(a1+a2+a3)*g*cb;
-        lb[1].r=s[j+w].r-a1*lb[0].r-(a2+a3)*g*cr;
-        lb[1].g=s[j+w].g-a1*lb[0].g-(a2+a3)*g*cg;
-        lb[1].b=s[j+w].b-a1*lb[0].b-(a2+a3)*g*cb;
-        lb[2].r=s[j+2*w].r-a1*lb[1].r-a2*lb[0].r-a3*g*cr;
-        lb[2].g=s[j+2*w].g-a1*lb[1].g-a2*lb[0].g-a3*g*cg;
-        lb[2].b=s[j+2*w].b-a1*lb[1].b-a2*lb[0].b-a3*g*cb;
-
-        for (i=3;i<h;i++)		//dol
-        {
-            lb[i].r=s[j+w*i].r-a1*lb[i-1].r-a2*lb[i-2].r-a3*lb[i-3].r;
-            lb[i].g=s[j+w*i].g-a1*lb[i-1].g-a2*lb[i-2].g-a3*lb[i-3].g;
-            lb[i].b=s[j+w*i].b-a1*lb[i-1].b-a2*lb[i-2].b-a3*lb[i-3].b;
-        }
+        r0[j]=f->ctop[j]; r1[j]=f->ctop[j]; r2[j]=f->ctop[j];
+    }
 
-        cr=0.0;cg=0.0;cb=0.0;
-        if (ec!=0)
-        {	//edge comp
-            for (i=h-avg;i<h;i++)
+    for (i=0;i<h;i++)	//po vrsticah navzdol
+    {
+        fibe_unpack8(inframe+i*w, lb, w);
+        fibe_line(f, lb, w, ec);
+        if ((ec!=0)&&(i>=h-avg))
+            for (j=0;j<w;j++)
             {
-                cr=cr+s[j+w*i].r;
-                cg=cg+s[j+w*i].g;
-                cb=cb+s[j+w*i].b;
+                f->cbot[j].r=f->cbot[j].r+lb[j].r/avg;
+                f->cbot[j].g=f->cbot[j].g+lb[j].g/avg;
+                f->cbot[j].b=f->cbot[j].b+lb[j].b/avg;
             }
-            cr=cr/avg; cg=cg/avg; cb=cb/avg;
-        }
-
-        for (i=h;i<(h+cez);i++)	//naprej cez rob
-        {
-            lb[i].r=cr-a1*lb[i-1].r-a2*lb[i-2].r-a3*lb[i-3].r;
-            lb[i].g=cg-a1*lb[i-1].g-a2*lb[i-2].g-a3*lb[i-3].g;
-            lb[i].b=cb-a1*lb[i-1].b-a2*lb[i-2].b-a3*lb[i-3].b;
-        }
-        //nazaj do roba
-        lb[h+cez-2].r=lb[h+cez-2].r-a1*lb[h+cez-1].r;
-        lb[h+cez-2].g=lb[h+cez-2].g-a1*lb[h+cez-1].g;
-        lb[h+cez-2].b=lb[h+cez-2].b-a1*lb[h+cez-1].b;
-        lb[h+cez-3].r=lb[h+cez-3].r-a1*lb[h+cez-2].r-a2*lb[h+cez-1].r;
-        lb[h+cez-3].g=lb[h+cez-3].g-a1*lb[h+cez-2].g-a2*lb[h+cez-1].g;
-        lb[h+cez-3].b=lb[h+cez-3].b-a1*lb[h+cez-2].b-a2*lb[h+cez-1].b;
-        for (i=(h+cez-4);i>=h;i--)
-        {
-            lb[i].r=lb[i].r-a1*lb[i+1].r-a2*lb[i+2].r-a3*lb[i+3].r;
-            lb[i].g=lb[i].g-a1*lb[i+1].g-a2*lb[i+2].g-a3*lb[i+3].g;
-            lb[i].b=lb[i].b-a1*lb[i+1].b-a2*lb[i+2].b-a3*lb[i+3].b;
-        }
+        fibe_row(f, r2, lb, r0, r1, w);	//dol
+        rt=r2; r2=r1; r1=r0; r0=rt;
+        fibe_pack16(r0, outframe+i*w, f->vb+i*w, w);
+    }
 
-        s[j+(h-1)*w].r=lb[h-1].r-a1*lb[h].r-a2*lb[h+1].r-a3*lb[h+2].r;
-        s[j+(h-1)*w].g=lb[h-1].g-a1*lb[h].g-a2*lb[h+1].g-a3*lb[h+2].g;
-        s[j+(h-1)*w].b=lb[h-1].b-a1*lb[h].b-a2*lb[h+1].b-a3*lb[h+2].b;
-        s[j+(h-2)*w].r=lb[h-2].r-a1*s[j+(h-1)*w].r-a2*lb[h].r-a3*lb[h+1].r;
-        s[j+(h-2)*w].g=lb[h-2].g-a1*s[j+(h-1)*w].g-a2*lb[h].g-a3*lb[h+1].g;
-        s[j+(h-2)*w].b=lb[h-2].b-a1*s[j+(h-1)*w].b-a2*lb[h].b-a3*lb[h+1].b;
-        s[j+(h-3)*w].r=lb[h-3].r-a1*s[j+(h-2)*w].r-a2*s[j+(h-1)*w].r-a3*lb[h].r;
-        s[j+(h-3)*w].g=lb[h-3].g-a1*s[j+(h-2)*w].g-a2*s[j+(h-1)*w].g-a3*lb[h].g;
-        s[j+(h-3)*w].b=lb[h-3].b-a1*s[j+(h-2)*w].b-a2*s[j+(h-1)*w].b-a3*lb[h].b;
-
-        for (i=h-4;i>=0;i--)		//gor
-        {
-            s[j+w*i].r=lb[i].r-a1*s[j+w*(i+1)].r-a2*s[j+w*(i+2)].r-a3*s[j+w*(i+3)].r;
-            s[j+w*i].g=lb[i].g-a1*s[j+w*(i+1)].g-a2*s[j+w*(i+2)].g-a3*s[j+w*(i+3)].g;
-            s[j+w*i].b=lb[i].b-a1*s[j+w*(i+1)].b-a2*s[j+w*(i+2)].b-a3*s[j+w*(i+3)].b;
-            outframe[j+w*i]=((uint32_t)s[j+w*i].r&0xFF) + (((uint32_t)s[j+w*i].g&0xFF)<<8) + (((uint32_t)s[j+w*i].b&0xFF)<<16);
-        }
-    }	//po stolpcih
+    for (j=0;j<w;j++)	//zacetek spodaj
+    {
+        z1=fibe_rep(f,0,r0[j],r1[j],r2[j],f->cbot[j]);
+        z2=fibe_rep(f,1,r0[j],r1[j],r2[j],f->cbot[j]);
+        z3=fibe_rep(f,2,r0[j],r1[j],r2[j],f->cbot[j]);
+        r0[j]=z1; r1[j]=z2; r2[j]=z3;
+    }
 
-    free(lb);
+    for (i=h-1;i>=0;i--)	//po vrsticah navzgor
+    {
+        fibe_unpack16(outframe+i*w, f->vb+i*w, lb, w);
+        fibe_row(f, r2, lb, r0, r1, w);	//gor
+        rt=r2; r2=r1; r1=r0; r0=rt;
+        fibe_pack8(r0, outframe+i*w, w);
+    }
 }
@@ -29,7 +29,7 @@
 #include <string.h>
 #include <math.h>
 #include "frei0r_math.h"
-#include "interp.h"
+#include "frei0r_remap.h"
 
 //----------------------------------------
 //structure for Frei0r instance
@@ -53,8 +53,7 @@ typedef struct
 	float feath;
         int op;
 
-	interpp interp;
-	float *map;
+	remap_map map;
 	unsigned char *amap;
 	int mapIsDirty;
 } inst;
@@ -172,7 +171,7 @@ int presecisce2(premica2 p1, premica2 p2, tocka2 *t)
 // vog [] = the four corners
 // str: 0 = no stretch 1 = do stretch
 // strx, stry: stretch values ​​[0 ... 1] 0.5 = no stretch
-void cetverokotnik4(int wi, int hi, int wo, int ho, tocka2 vog[], int str, float strx, float stry, float *map)
+void cetverokotnik4(int wi, int hi, int wo, int ho, tocka2 vog[], int str, float strx, float stry, remap_map *map)
 {
 	double a,b,c,d,e,f,g,h,a2,b2,c2,u,v,aa,bb,de,sde,v1,v2,u1,u2;
 	tocka2 T;
@@ -281,13 +280,11 @@ void cetverokotnik4(int wi, int hi, int wo, int ho, tocka2 vog[], int str, float
 			//zdaj samo se vpise izracunana (u,v) v map[]
 			if ((u>=0.0)&&(u<=1.0)&&(v>=0.0)&&(v<=1.0))
 			{	//ce smo znotraj orig slike
-				map[2*(y*wo+x)]=u*(wi-1);
-				map[2*(y*wo+x)+1]=v*(hi-1);
+				remap_set(map, y*wo+x, u*(wi-1), v*(hi-1));
 			}
 			else
 			{
-				map[2*(y*wo+x)]=-1;
-				map[2*(y*wo+x)+1]=-1;
+				remap_set_bg(map, y*wo+x);
 			}
 
 		}
@@ -297,7 +294,7 @@ void cetverokotnik4(int wi, int hi, int wo, int ho, tocka2 vog[], int str, float
 
 //---------------------------------------------------------------
 //generate mapping for a triangle
-void trikotnik1(int wi, int hi, int wo, int ho, tocka2 vog[], tocka2 R, tocka2 S, premica2 p12, premica2 p23, premica2 p34, premica2 p41, int t12, int t23, int str, float strx, float stry, float *map)
+void trikotnik1(int wi, int hi, int wo, int ho, tocka2 vog[], tocka2 R, tocka2 S, premica2 p12, premica2 p23, premica2 p34, premica2 p41, int t12, int t23, int str, float strx, float stry, remap_map *map)
 {
 	int x,y;
 	tocka2 T,A,B;
@@ -367,13 +364,11 @@ void trikotnik1(int wi, int hi, int wo, int ho, tocka2 vog[], tocka2 R, tocka2 S
 			//zdaj samo se vpise izracunana (u,v) v map[]
 			if ((u>=0.0)&&(u<=1.0)&&(v>=0.0)&&(v<=1.0))
 			{	//ce smo znotraj orig slike
-				map[2*(y*wo+x)]=u*(wi-1);
-				map[2*(y*wo+x)+1]=v*(hi-1);
+				remap_set(map, y*wo+x, u*(wi-1), v*(hi-1));
 			}
 			else
 			{
-				map[2*(y*wo+x)]=-1;
-				map[2*(y*wo+x)+1]=-1;
+				remap_set_bg(map, y*wo+x);
 			}
 		}
 	}
@@ -387,7 +382,7 @@ void trikotnik1(int wi, int hi, int wo, int ho, tocka2 vog[], tocka2 R, tocka2 S
 //map = map generated by geom4c_b()
 //nots[] = flags for inner sides
 //for now it does not feather caustics on concaves an crossed sides
-void make_alphamap(unsigned char *amap, tocka2 vog[], int wo, int ho, float *map, float feath, int nots[])
+void make_alphamap(unsigned char *amap, tocka2 vog[], int wo, int ho, remap_map *map, float feath, int nots[])
 {
 	float r12, r23, r34, r41, rmin;
 	tocka2 t;
@@ -412,7 +407,7 @@ void make_alphamap(unsigned char *amap, tocka2 vog[], int wo, int ho, float *map
 		if ((r23<rmin) && (nots[1]!=1)) rmin=r23;
 		if ((r34<rmin) && (nots[2]!=1)) rmin=r34;
 		if ((r41<rmin) && (nots[3]!=1)) rmin=r41;
-		if ((map[2*(i*wo+j)]>=0.0)&&(map[2*(i*wo+j)+1]>=0.0))
+		if (map->pt[i*wo+j].x>=0)
 		{	//inside
 			if (rmin<=feath) //border area
 				amap[i*wo+j]=255*(rmin/feath);
@@ -484,7 +479,7 @@ void apply_alphamap(uint32_t* frame, int w, int h, unsigned char *amap, int oper
 // wo, ho output image size
 // vog [] the four corners
 // nots [] "inner" sides (for alpha feathering)
-int geom4c_b(int wi, int hi, int wo, int ho, tocka2 vog[], int str, float strx, float stry, float *map, int nots[])
+int geom4c_b(int wi, int hi, int wo, int ho, tocka2 vog[], int str, float strx, float stry, remap_map *map, int nots[])
 {
 	premica2 p12,p23,p34,p41;
 	tocka2 R,S;
@@ -622,23 +617,6 @@ int geom4c_b(int wi, int hi, int wo, int ho, tocka2 vog[], int str, float strx,
 	return 0;
 }
 
-//-------------------------------------------------------
-interpp set_intp(inst p)
-{
-	switch (p.intp)	//katero interpolacijo bo uporabil
-	{
-		//	case -1:return interpNNpr_b;	//nearest neighbor+print
-	case 0:	return interpNN_b32;	//nearest neighbor
-	case 1: return interpBL_b32;	//bilinear
-	case 2:	return interpBC_b32;	//bicubic smooth
-	case 3:	return interpBC2_b32;	//bicibic sharp
-	case 4:	return interpSP4_b32;	//spline 4x4
-	case 5:	return interpSP6_b32;	//spline 6x6
-	case 6: return interpSC16_b32;	//lanczos 8x8
-	default: return NULL;
-	}
-}
-
 //-----------------------------------------------------
 //stretch [0...1] to parameter range [min...max] linear
 float map_value_forward(double v, float min, float max)
@@ -772,6 +750,7 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 	inst *in;
 
 	in=(inst*)calloc(1, sizeof(inst));
+	if (in==NULL) return 0;
 	in->w=width;
 	in->h=height;
 	in->x1=0.333333;
@@ -790,9 +769,19 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 	in->feath=1.0;
         in->op=0;
 
-	in->map=(float*)calloc(1, sizeof(float)*(in->w*in->h*2+2));
+	if (!remap_alloc(&in->map, in->w, in->h, in->w, in->h))
+	{
+		free(in);
+		return 0;
+	}
+	remap_set_interp(&in->map, in->intp);
 	in->amap=(unsigned char*)calloc(1, sizeof(char)*(in->w*in->h*2+2));
-	in->interp=set_intp(*in);
+	if (in->amap==NULL)
+	{
+		remap_free(&in->map);
+		free(in);
+		return 0;
+	}
 	in->mapIsDirty=1;
 
 	return (f0r_instance_t)in;
@@ -805,7 +794,7 @@ void f0r_destruct(f0r_instance_t instance)
 
 	p=(inst*)instance;
 
-	free(p->map);
+	remap_free(&p->map);
 	free(p->amap);
 	free(instance);
 }
@@ -899,7 +888,7 @@ void f0r_set_param_value(f0r_instance_t instance, f0r_param_t parm, int param_in
 
 	if (chg!=0)
 	{
-		p->interp=set_intp(*p);
+		remap_set_interp(&p->map, p->intp);
 		p->mapIsDirty = 1;
 	}
 
@@ -1011,15 +1000,16 @@ void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, u
 		vog[2].y=(p->y3*3-1)*p->h;
 		vog[3].x=(p->x4*3-1)*p->w;
 		vog[3].y=(p->y4*3-1)*p->h;
-		geom4c_b(p->w, p->h, p->w, p->h, vog, p->stretchON, p->stretchx, p->stretchy, p->map, nots);
-		make_alphamap(p->amap, vog, p->w, p->h, p->map, p->feath, nots);
+		geom4c_b(p->w, p->h, p->w, p->h, vog, p->stretchON, p->stretchx, p->stretchy, &p->map, nots);
+		remap_tiles(&p->map);
+		make_alphamap(p->amap, vog, p->w, p->h, &p->map, p->feath, nots);
 		p->mapIsDirty = 0;
 	}
 
 	//if (p->transb==0) bkgr=0xFF000000; else bkgr=0;
 	bkgr=0xFF000000;
 
-	remap32(p->w, p->h, p->w, p->h, (unsigned char*) inframe, (unsigned char *) outframe, p->map, bkgr, p->interp);
+	remap32(&p->map, inframe, outframe, bkgr);
 
 	if (p->transb!=0)
 		apply_alphamap(outframe, p->w, p->h, p->amap, p->op);
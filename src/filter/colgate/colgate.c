@@ -55,40 +55,22 @@
  * We use fixed point, since conversion back and forth to floating-point is
  * slow. (This also enables us to use LUTs in an efficient way for lookup
  * to and from sRGB, as opposed to a pow()-based solution, which is very slow.)
- *
- * We need to think a bit about the range and precision of the different
- * elements to get the best results here, since linear RGB can span quite
- * some range. So:
- *
- *  - Input pixels (which are in linear RGB, always 0..1) are stored as 1.15.
- *  - Matrix elements are s4.10.
- *
- * Matrix elements up to +/- 16 should give us some headroom; extreme color
- * adjustments typically have elements of 5-6.
- *
- * Our standard operation is input_pixel * matrix_element, which becomes s5.25.
- * We add three of them, which would seem to be able to overflow, but doesn't,
- * since the largest pixel is 1.0 (represented as 2^15):
- *
- *   3 * 2^15 * (2^14 - 1) ~= 3 * 2^29 < 2^31.
- *
- * It _is_ larger than 2^30, though, so we don't have any bits to spare here.
+ * The matrix kernel, and the choice of ranges and precision, is in
+ * frei0r_colormatrix.h.
  */
-#define INPUT_PIXEL_BITS 15
-#define MATRIX_ELEMENT_FRAC_BITS 10
-#define MATRIX_ELEMENT_BITS (4 + MATRIX_ELEMENT_FRAC_BITS)
 
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
 
-#ifdef __SSE2__
-#include <emmintrin.h>
-#endif
-
 #include "frei0r.h"
 #include "frei0r_math.h"
+#include "frei0r_colormatrix.h"
+#include "frei0r_threads.h"
+
+// Pixels below which a band of rows is not worth a thread.
+#define MIN_JOB_PIXELS 65536
 
 enum ParamIndex {
 	NEUTRAL_COLOR,
@@ -105,61 +87,9 @@ typedef struct colgate_instance
 	f0r_param_color_t neutral_color;
 	double color_temperature;
 
-#ifdef __SSE2__
-	__m128i premult_r[256];
-	__m128i premult_g[256];
-	__m128i premult_b[256];
-#else
-	int premult_r[256][3];
-	int premult_g[256][3];
-	int premult_b[256][3];
-#endif
+	cmat cm;
 } colgate_instance_t;
 
-// Assumes input value in [0..255]; output value is normalized.
-static float convert_srgb_to_linear_rgb(float x)
-{
-	if (x < 255.0f * 0.04045f) {
-		return x * (1.0f / (255.0f * 12.92f));
-	} else {
-		return pow((x + 255.0f * 0.055) * (1.0 / (255.0f * 1.055f)), 2.4);
-	}
-}
-
-// Assumes normalized input value; output value in [0..255].
-static float convert_linear_rgb_to_srgb(float x)
-{
-	if (x < 0.0031308f) {
-		return (255.0f * 12.92f) * x;
-	} else {
-		return ((255.0f * 1.055f) * pow(x, 1.0f / 2.4f)) - (0.055 * 255.0f);
-	}
-}
-
-/*
- * For linear -> sRGB, we need at least 13 bits to be able to distinguish all
- * input values; we go for 14 to get some extra accuracy. This results in an 16
- * kB LUT, but we generally don't need the L1 cache for a lot of other things
- * anyway, so hopefully the LUT can mostly stay in L1 cache.
- */
-#define REVERSE_LUT_BITS 14
-#define REVERSE_LUT_SIZE (1 << REVERSE_LUT_BITS)
-
-static uint8_t linear_rgb_to_srgb_lut[REVERSE_LUT_SIZE];
-
-static void fill_srgb_lut()
-{
-	int i;
-	for (i = 0; i < REVERSE_LUT_SIZE; ++i) {
-		// Subtract 0.5 to compensate for the fact that we don't round
-		// (which, for our purposes, would entail _adding_ 0.5) at lookup time.
-		float x = (i - 0.5) / (float)(REVERSE_LUT_SIZE);
-		int srgb = lrintf(convert_linear_rgb_to_srgb(x));
-		assert(srgb >= 0 && srgb <= 255);
-		linear_rgb_to_srgb_lut[i] = srgb;
-	}
-}
-
 // Multiply two 3x3 matrices.
 static void multiply_3x3_matrices(const Matrix3x3 a, const Matrix3x3 b, Matrix3x3 result)
 {
@@ -184,18 +114,6 @@ static void multiply_3x3_matrix_float3(const Matrix3x3 M, float x0, float x1, fl
 	*y2 = M[6] * x0 + M[7] * x1 + M[8] * x2;
 }
 
-// Convert a linear RGB value in s6.25 fixed-point to sRGB (between 0 to 255, inclusive).
-static inline uint8_t convert_linear_rgb_to_srgb_fp(int x)
-{
-	if (x < 0) {
-		return 0;
-	}
-	if (x >= (REVERSE_LUT_SIZE << (INPUT_PIXEL_BITS + MATRIX_ELEMENT_FRAC_BITS - REVERSE_LUT_BITS))) {
-		return 255;
-	}
-	return linear_rgb_to_srgb_lut[((unsigned)x) >> (INPUT_PIXEL_BITS + MATRIX_ELEMENT_FRAC_BITS - REVERSE_LUT_BITS)];
-}
-
 // Temperature is in Kelvin. Formula from http://en.wikipedia.org/wiki/Planckian_locus#Approximation .
 void convert_color_temperature_to_xyz(float T, float *x, float *y, float *z)
 {
@@ -296,8 +214,6 @@ static void compute_lms_scaling_factors(float x, float y, float z, float *scale_
 
 static void compute_correction_matrix(colgate_instance_t *o)
 {
-	int i;
-
 	/*
 	 * Find out what the given neutral color would be in LMS space,
 	 * and use that value to build a correction factor for each component
@@ -307,9 +223,9 @@ static void compute_correction_matrix(colgate_instance_t *o)
 	float ref_g = o->neutral_color.g * 255.0f;
 	float ref_b = o->neutral_color.b * 255.0f;
 
-	float linear_r = convert_srgb_to_linear_rgb(ref_r);
-	float linear_g = convert_srgb_to_linear_rgb(ref_g);
-	float linear_b = convert_srgb_to_linear_rgb(ref_b);
+	float linear_r = cmat_srgb_to_linear(ref_r);
+	float linear_g = cmat_srgb_to_linear(ref_g);
+	float linear_b = cmat_srgb_to_linear(ref_b);
 
 	float x, y, z;
 	convert_linear_rgb_to_linear_xyz(linear_r, linear_g, linear_b, &x, &y, &z);
@@ -356,61 +272,11 @@ static void compute_correction_matrix(colgate_instance_t *o)
 	multiply_3x3_matrices(temp2, xyz_to_lms_matrix, temp);
 	multiply_3x3_matrices(temp, rgb_to_xyz_matrix, corr_matrix);
 
-	// Scale for fixed-point, and clamp. We clamp the matrix elements
-	// instead of the actual fixed-point numbers below, to make sure
-	// we get consistent results over the entire range.
-	for (i = 0; i < 9; ++i) {
-		corr_matrix[i] *= (float)(1 << MATRIX_ELEMENT_FRAC_BITS);
-		if (corr_matrix[i] < -(1 << MATRIX_ELEMENT_BITS)) {
-			corr_matrix[i] = -(1 << MATRIX_ELEMENT_BITS);
-		}
-		if (corr_matrix[i] > (1 << MATRIX_ELEMENT_BITS) - 1) {
-			corr_matrix[i] = (1 << MATRIX_ELEMENT_BITS) - 1;
-		}
-	}
-
-	// Precompute some of the multiplications (after conversion from sRGB)
-	// to save some time per-pixel later. Each of these contain the given color
-	// converted to linear space and then multiplied by three different factors,
-	// given by the matrix.
-	for (i = 0; i < 256; ++i) {
-		int x = convert_srgb_to_linear_rgb(i) * (float)(1 << INPUT_PIXEL_BITS);
-
-		int r0 = lrintf(x * corr_matrix[0]);
-		int r1 = lrintf(x * corr_matrix[3]);
-		int r2 = lrintf(x * corr_matrix[6]);
-
-		int g0 = lrintf(x * corr_matrix[1]);
-		int g1 = lrintf(x * corr_matrix[4]);
-		int g2 = lrintf(x * corr_matrix[7]);
-
-		int b0 = lrintf(x * corr_matrix[2]);
-		int b1 = lrintf(x * corr_matrix[5]);
-		int b2 = lrintf(x * corr_matrix[8]);
-
-#if __SSE2__
-		o->premult_r[i] = _mm_setr_epi32(r0, r1, r2, 0);
-		o->premult_g[i] = _mm_setr_epi32(g0, g1, g2, 0);
-		o->premult_b[i] = _mm_setr_epi32(b0, b1, b2, 0);
-#else
-		o->premult_r[i][0] = r0;
-		o->premult_r[i][1] = r1;
-		o->premult_r[i][2] = r2;
-
-		o->premult_g[i][0] = g0;
-		o->premult_g[i][1] = g1;
-		o->premult_g[i][2] = g2;
-
-		o->premult_b[i][0] = b0;
-		o->premult_b[i][1] = b1;
-		o->premult_b[i][2] = b2;
-#endif
-	}
+	cmat_set_matrix(&o->cm, corr_matrix);
 }
 
 int f0r_init()
 {
-	fill_srgb_lut();
 	return 1;
 }
 
@@ -426,7 +292,7 @@ void f0r_get_plugin_info(f0r_plugin_info_t *colordistance_info)
 	colordistance_info->color_model = F0R_COLOR_MODEL_RGBA8888;
 	colordistance_info->frei0r_version = FREI0R_MAJOR_VERSION;
 	colordistance_info->major_version = 0;
-	colordistance_info->minor_version = 1;
+	colordistance_info->minor_version = 2;
 	colordistance_info->num_params = 2;
 	colordistance_info->explanation = "Do simple color correction, in a physically meaningful way";
 }
@@ -506,56 +372,37 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	}
 }
 
+// One band of rows per job; cmat_apply works on any span of pixels.
+typedef struct colgate_job
+{
+	const colgate_instance_t *inst;
+	const uint32_t *inframe;
+	uint32_t *outframe;
+	int jobs;
+} colgate_job_t;
+
+static void colgate_band(void *arg, int k)
+{
+	const colgate_job_t *job = (const colgate_job_t *)arg;
+	const colgate_instance_t *inst = job->inst;
+	int y0, y1;
+
+	thr_band(inst->height, job->jobs, k, &y0, &y1);
+	cmat_apply(&inst->cm, job->inframe + (size_t)y0 * inst->width,
+	           job->outframe + (size_t)y0 * inst->width, (y1 - y0) * inst->width);
+}
+
 void f0r_update(f0r_instance_t instance, double time, const uint32_t *inframe, uint32_t *outframe)
 {
 	assert(instance);
 	colgate_instance_t *inst = (colgate_instance_t *)instance;
-	unsigned len = inst->width * inst->height;
-	unsigned char *dst = (unsigned char *)outframe;
-	const unsigned char *src = (unsigned char *)inframe;
-	unsigned i;
-
-#ifdef __SSE2__
-	__m128i zero = _mm_setzero_si128();
-	__m128i max = _mm_set1_epi16(REVERSE_LUT_SIZE - 1);
-	for (i = 0; i < len; ++i) {
-		__m128i l1 = inst->premult_r[*src++];
-		__m128i l2 = inst->premult_g[*src++];
-		__m128i l3 = inst->premult_b[*src++];
-		__m128i result = _mm_add_epi32(l3, _mm_add_epi32(l1, l2));
-
-		// Shift into the right range, and then clamp to [min, max].
-		// We convert to 16-bit values since we have min/max instructions
-		// there (without needing SSE4), and because it allows us
-		// to extract the values with one less SSE shift/move.
-		result = _mm_srai_epi32(result, INPUT_PIXEL_BITS + MATRIX_ELEMENT_FRAC_BITS - REVERSE_LUT_BITS);
-		result = _mm_packs_epi32(result, result);
-		result = _mm_max_epi16(result, zero);
-		result = _mm_min_epi16(result, max);
-
-		unsigned new_rg = _mm_cvtsi128_si32(result);
-		result = _mm_srli_si128(result, 4);
-		unsigned new_b = _mm_cvtsi128_si32(result);
-
-		*dst++ = linear_rgb_to_srgb_lut[new_rg & 0xffff];
-		*dst++ = linear_rgb_to_srgb_lut[new_rg >> 16];
-		*dst++ = linear_rgb_to_srgb_lut[new_b];
-		*dst++ = *src++;  // Copy alpha.
-	}
-#else
-	for (i = 0; i < len; ++i) {
-		unsigned old_r = *src++;
-		unsigned old_g = *src++;
-		unsigned old_b = *src++;
-
-		int new_r = inst->premult_r[old_r][0] + inst->premult_g[old_g][0] + inst->premult_b[old_b][0];
-		int new_g = inst->premult_r[old_r][1] + inst->premult_g[old_g][1] + inst->premult_b[old_b][1];
-		int new_b = inst->premult_r[old_r][2] + inst->premult_g[old_g][2] + inst->premult_b[old_b][2];
-
-		*dst++ = convert_linear_rgb_to_srgb_fp(new_r);
-		*dst++ = convert_linear_rgb_to_srgb_fp(new_g);
-		*dst++ = convert_linear_rgb_to_srgb_fp(new_b);
-		*dst++ = *src++;  // Copy alpha.
-	}
-#endif
+	colgate_job_t job;
+
+	job.inst = inst;
+	job.inframe = inframe;
+	job.outframe = outframe;
+	job.jobs = thr_jobs((long)inst->width * inst->height, MIN_JOB_PIXELS);
+	if (job.jobs > (int)inst->height)
+		job.jobs = inst->height;
+	thr_run(job.jobs, colgate_band, &job);
 }
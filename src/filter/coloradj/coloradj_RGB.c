@@ -33,6 +33,7 @@ Copyright (C) 2010  Marko Cebokli    http://lea.hamradio.si/~s57uuu
 #include <assert.h>
 
 #include <frei0r.h>
+#include "frei0r_histogram.h"
 
 //------------------------------------------------------
 //computes x to the power p
@@ -241,13 +242,7 @@ uint32_t r,g,b,a;
 
 if (ac==0)
 	{
-	for (i=0;i<size;i++)
-		{
-		outframe[i] = lut->r[inframe[i]&255];
-		outframe[i] = outframe[i] + ((lut->g[(inframe[i]>>8)&255])<<8);
-		outframe[i] = outframe[i] + ((lut->b[(inframe[i]>>16)&255])<<16);
-		outframe[i] = outframe[i] + (inframe[i]&0xFF000000);
-		}
+	histo_lut_apply(inframe,outframe,size,lut->r,lut->g,lut->b);
 	}
 else		//alpha controlled
 	{
@@ -315,7 +310,7 @@ info->plugin_type=F0R_PLUGIN_TYPE_FILTER;
 info->color_model=F0R_COLOR_MODEL_RGBA8888;
 info->frei0r_version=FREI0R_MAJOR_VERSION;
 info->major_version=0;
-info->minor_version=2;
+info->minor_version=3;
 info->num_params=7;
 info->explanation="Simple color adjustment";
 }
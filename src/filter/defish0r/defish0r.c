@@ -32,7 +32,7 @@
 
 #include <frei0r.h>
 
-#include "interp.h"
+#include "frei0r_remap.h"
 
 
 double PI=3.14159265358979;
@@ -148,7 +148,7 @@ float defish(int n, float r, float f, float mr)
 //scal = scaling factor
 //pari, paro = pixel aspect ratio (input / output)
 //dx, dy   offset on input (for non-cosited chroma subsampling)
-void fishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float pari, float paro, float dx, float dy, float *map
+void fishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float pari, float paro, float dx, float dy, remap_map *map
 	, float stretchFactor, float yScale)
 {
 	float rmax,maxr,r,kot,x,y,imax;
@@ -173,11 +173,10 @@ void fishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float p
 			r=hypotf(ii,jj);
 			kot=atan2f(ii,jj);
 			r=fish(n,r/rmax*scal,f)*sc;
-			ww=2*(wo*i+j);
+			ww=wo*i+j;
 			if (r<0.0)
 			{
-				map[ww]=-1;
-				map[ww+1]=-1;
+				remap_set_bg(map, ww);
 			}
 			else
 			{
@@ -187,13 +186,11 @@ void fishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float p
 				{
 					if (stretchFactor != 0.0f)
 						x += stretchWidth(wo, wiMid, x, stretchFactor);	//add stretch
-					map[ww]=x+dx;
-					map[ww+1]=y+dy;
+					remap_set(map, ww, x+dx, y+dy);
 				}
 				else
 				{
-					map[ww]=-1;
-					map[ww+1]=-1;
+					remap_set_bg(map, ww);
 				}
 			}
 		}
@@ -215,7 +212,7 @@ void fishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float p
 //lbox = letterbox
 //stretch = dymanic stretch, convert between 4:3 and 16:9
 //yScale = -0.5.. 0.5 change aspect ratio on y acess only
-void defishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float pari, float paro, float dx, float dy, float *map
+void defishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float pari, float paro, float dx, float dy, remap_map *map
 	, int lbox, float stretchFactor, float yScale)
 {
 	float rmax,maxr,r,kot,x,y,imax;
@@ -239,12 +236,11 @@ void defishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float
 			jj=(j-wiMid)*paro; //aspect....
 			r=hypotf(ii,jj)/scal;
 			kot=atan2f(ii,jj);
-			ww=2*(wi*i+j);
+			ww=wi*i+j;
 			r=defish(n,r/sc,f,1.0)*imax;
 			if (r<0.0)
 			{
-				map[ww]=-1;
-				map[ww+1]=-1;
+				remap_set_bg(map, ww);
 			}
 			else
 			{
@@ -256,13 +252,11 @@ void defishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float
 					if (stretchFactor != 0.0f)
 						x += stretchWidth(wi, wiMid, x, stretchFactor);	//add stretch
 
-					map[ww]=x;
-					map[ww+1]=y;
+					remap_set(map, ww, x, y);
 				}
 				else
 				{
-					map[ww]=-1;
-					map[ww+1]=-1;
+					remap_set_bg(map, ww);
 				}
 			}
 		}
@@ -273,28 +267,26 @@ void defishmap(int wi, int hi, int wo, int ho, int n, float f, float scal, float
 	{	//top/bottom
 		for (i = 0; i < hi; i++)
 		{
-			ww = 2 * (wi*i + wiMid);
-			if (map[ww] <= 0)
+			ww = wi*i + wiMid;
+			if (map->pt[ww].x < 0)
 			{
 				for (j = 0; j < wi; j++)
 				{ //clear entire row
-					ww = 2 * (wi*i + j);
-					map[ww] = -1;
-					map[ww + 1] = -1;
+					ww = wi*i + j;
+					remap_set_bg(map, ww);
 				}
 			}
 		}
 		//left/right
 		for (i = 0; i < wi; i++)
 		{
-			ww = 2 * (wi*hiMid +i);
-			if (map[ww] <= 0)
+			ww = wi*hiMid + i;
+			if (map->pt[ww].x < 0)
 			{
 				for (j = 0; j < hi; j++)
 				{ //clear entire column
-					ww = 2 * (wi*j + i);
-					map[ww] = -1;
-					map[ww + 1] = -1;
+					ww = wi*j + i;
+					remap_set_bg(map, ww);
 				}
 			}
 		}
@@ -326,32 +318,14 @@ typedef struct
 	int aspt;
 	float mpar;
 	float par;
-	float *map;
+	remap_map map;
 	int lbox;
 	float stretch;
 	float yScale;
-	interpp interpol;
 } param;
 
 
 
-//-------------------------------------------------------
-interpp set_intp(param p)
-{
-	switch (p.intp)	//katero interpolacijo bo uporabil
-	{
-		//	case -1:return interpNNpr_b;	//nearest neighbor+print
-	case 0:	return interpNN_b32;	//nearest neighbor
-	case 1: return interpBL_b32;	//bilinear
-	case 2:	return interpBC_b32;	//bicubic smooth
-	case 3:	return interpBC2_b32;	//bicibic sharp
-	case 4:	return interpSP4_b32;	//spline 4x4
-	case 5:	return interpSP6_b32;	//spline 6x6
-	case 6: return interpSC16_b32;	//lanczos 8x8
-	default: return NULL;
-	}
-}
-
 //--------------------------------------------------------
 void make_map(param p)
 {
@@ -376,7 +350,7 @@ void make_map(param p)
 		case 3:		//manual
 			dscal=p.mscale; break;
 		}
-		defishmap(p.w ,p.h ,p.w ,p.h, p.type, p.f, dscal, p.par, p.par, 0.0, 0.0,  p.map, p.lbox, p.stretch, p.yScale);
+		defishmap(p.w ,p.h ,p.w ,p.h, p.type, p.f, dscal, p.par, p.par, 0.0, 0.0,  &p.map, p.lbox, p.stretch, p.yScale);
     }
 	else		//fish
     {
@@ -394,7 +368,7 @@ void make_map(param p)
 		case 3:		//manual
 			fscal=1.0/p.mscale; break;
 		}
-		fishmap(p.w, p.h, p.w ,p.h, p.type, p.f, fscal, p.par, p.par, 0.0, 0.0,  p.map, p.stretch, p.yScale);
+		fishmap(p.w, p.h, p.w ,p.h, p.type, p.f, fscal, p.par, p.par, 0.0, 0.0,  &p.map, p.stretch, p.yScale);
     }
 
 }
@@ -499,6 +473,7 @@ f0r_instance_t  f0r_construct(unsigned int width, unsigned int height)
 	param *p;
 
 	p=(param*)calloc(1, sizeof(param));
+	if (p==NULL) return 0;
 
 	p->w=width;
 	p->h=height;
@@ -515,10 +490,15 @@ f0r_instance_t  f0r_construct(unsigned int width, unsigned int height)
 	p->stretch = 0.0f;	//dynamic stretch
 	p->yScale = 1.0f;	//seperate Y stretch
 
-	p->map=(float*)calloc(1, sizeof(float)*(p->w*p->h*2+2));
-	p->interpol=set_intp(*p);
+	if (!remap_alloc(&p->map, p->w, p->h, p->w, p->h))
+	{
+		free(p);
+		return 0;
+	}
+	remap_set_interp(&p->map, p->intp);
 
 	make_map(*p);
+	remap_tiles(&p->map);
 
 	//printf("Construct, w=%d h=%d\n",width,height);
 
@@ -531,7 +511,7 @@ void f0r_destruct(f0r_instance_t instance)
 	param *p;
 	p=(param*)instance;
 
-	free(p->map);
+	remap_free(&p->map);
 	free(instance);
 }
 
@@ -547,14 +527,20 @@ void change_param(param *p, int w, int h, float f, int dir, int type, int scal,
 
 	if ((w!=p->w)||(h!=p->h))
 	{
-		free(p->map);
-		p->map=(float*)calloc(1, sizeof(float)*(w*h*2+2));
+		remap_free(&p->map);
+		if (!remap_alloc(&p->map, w, h, w, h))
+		{
+			p->w=0;
+			p->h=0;
+			return;
+		}
 		p->w=w;
 		p->h=h;
 	}
 
-	p->interpol=set_intp(*p);
+	remap_set_interp(&p->map, p->intp);
 	make_map(*p);
+	remap_tiles(&p->map);
 }
 
 //-----------------------------------------------------
@@ -702,8 +688,9 @@ void f0r_set_param_value(f0r_instance_t instance, f0r_param_t parm, int param_in
 		case 3: p->par=1.333;break;		//HDV
 		case 4: p->par=p->mpar;break;	//manual
 		}
-		p->interpol=set_intp(*p);
+		remap_set_interp(&p->map, p->intp);
 		make_map(*p);
+		remap_tiles(&p->map);
 	}
 
 	//print_param(*p);
@@ -764,6 +751,6 @@ void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, u
 
 	p=(param*)instance;
 
-	remap32(p->w, p->h, p->w, p->h, (unsigned char*) inframe, (unsigned char*) outframe, p->map, 0, p->interpol);
+	remap32(&p->map, inframe, outframe, 0);
 
 }
@@ -2,80 +2,136 @@
 
 #include <algorithm>
 #include <vector>
-#include <utility>
 #include <cassert>
 
+// The history is a ring of frame slots, oldest first. Slots are
+// allocated once and reused. MaxMemory (0: no limit, the default) caps
+// their number; when the cap is reached the oldest frame is dropped,
+// which shortens the delay instead of growing without bound.
 class delay0r : public frei0r::filter
 {
 public:
   delay0r(unsigned int width, unsigned int height)
   {
     delay = 0.0;
+    maxmemory = 0.0;
     register_param(delay,"DelayTime","the delay time");
+    register_param(maxmemory,"MaxMemory","maximum size of the frame history in megabytes, 0 for no limit");
+    head = 0;
+    count = 0;
   }
-  
+
   ~delay0r()
   {
-    for (std::list< std::pair< double, unsigned int* > >::iterator i=buffer.begin(); i != buffer.end(); ++i)
-    {
-       delete[] i->second;
-       i=buffer.erase(i);
-    }
+    for (size_t i=0; i<slots.size(); ++i)
+      delete[] slots[i].data;
   }
-  
+
   virtual void update(double time,
                       uint32_t* out,
                       const uint32_t* in)
   {
-    unsigned int* reusable = 0;
-    // remove old frames
-    for (std::list< std::pair< double, unsigned int* > >::iterator i=buffer.begin(); i != buffer.end(); ++i)
+    if (delay <= 0.0)
       {
-	if (i->first < (time - delay) || i->first >= time)
-	  {
-	    // remove me
-	    if (reusable != 0)
-	      delete[] i->second;
-	    else
-	      reusable = i->second;
-
-	    i=buffer.erase(i);
-	  }
+	// nothing to keep
+	count = 0;
+	std::copy(in, in+size, out);
+	return;
       }
-    
-    // add new frame
-    if (reusable == 0)
-      reusable = new unsigned int[width*height];
-
-    std::copy(in, in+width*height,reusable);
-    buffer.push_back(std::make_pair(time,reusable));
 
-    // copy best
-    unsigned int* best_data=0;
-    double best_time=0;
+    // forget frames from the future (after a seek back) and frames
+    // older than the delay
+    count = lower_bound(time);
+    pop_front(lower_bound(time - delay));
 
-    assert (buffer.size() >0);
-    for (std::list< std::pair< double, unsigned int* > >::iterator i=buffer.begin(); i != buffer.end(); ++i)
+    // add new frame
+    size_t limit = max_frames();
+    if (count >= limit)
+      pop_front(count - limit + 1);
+    if (slots.size() > limit)
+      shrink(limit);
+    if (count == slots.size())
       {
-	if (best_data==0 || (i->first < best_time))
-	  {
-	    best_time=i->first;
-	    best_data=i->second;
-	  }
+	// ring is full, grow it by one slot in front of the oldest frame
+	slot s;
+	s.data = new uint32_t[size];
+	slots.insert(slots.begin() + head, s);
+	head = (head + 1) % slots.size();
       }
+    slot& s = at(count);
+    s.time = time;
+    std::copy(in, in+size, s.data);
+    ++count;
 
-    assert(best_data != 0);
-    std::copy(best_data,best_data+width*height,out);
+    // the oldest frame is the delayed one
+    assert(count > 0);
+    std::copy(at(0).data, at(0).data+size, out);
   }
-  
+
 private:
+  struct slot
+  {
+    double time;
+    uint32_t* data;
+  };
+
   double delay;
-  std::list< std::pair< double, unsigned int* > > buffer;
+  double maxmemory;
+  std::vector<slot> slots;
+  size_t head;   // index of the oldest frame in slots
+  size_t count;  // number of frames in the ring
+
+  slot& at(size_t i)
+  {
+    return slots[(head + i) % slots.size()];
+  }
+
+  // number of frames with a time stamp earlier than t
+  // (stamps increase from the oldest frame on)
+  size_t lower_bound(double t)
+  {
+    size_t lo = 0, hi = count;
+    while (lo < hi)
+      {
+	size_t mid = (lo + hi) / 2;
+	if (at(mid).time < t)
+	  lo = mid + 1;
+	else
+	  hi = mid;
+      }
+    return lo;
+  }
+
+  void pop_front(size_t n)
+  {
+    if (n == 0)
+      return;
+    head = (head + n) % slots.size();
+    count -= n;
+  }
+
+  size_t max_frames() const
+  {
+    if (maxmemory <= 0.0)
+      return (size_t)-1;
+    double frames = maxmemory * 1048576.0 / (size * sizeof(uint32_t));
+    return frames < 1.0 ? 1 : (size_t)frames;
+  }
+
+  // frees slots beyond limit, keeping the frames in order
+  void shrink(size_t limit)
+  {
+    std::rotate(slots.begin(), slots.begin() + head, slots.end());
+    head = 0;
+    for (size_t i = limit; i < slots.size(); ++i)
+      delete[] slots[i].data;
+    slots.resize(limit);
+  }
 };
 
 
 frei0r::construct<delay0r> plugin("delay0r",
 				  "video delay",
 				  "Martin Bayer",
-				  0,2);
+				  0,3);
 
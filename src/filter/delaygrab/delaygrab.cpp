@@ -35,12 +35,14 @@
 #include <inttypes.h>
 
 #include <frei0r.hpp>
+#include "frei0r_history.h"
 
 
 
 
 #define QUEUEDEPTH 71 /* was 76 */
 #define MODES 4
+#define KEYINT 16 /* queued frames per key frame in the history */
 
 // freej compat facilitator
 typedef struct {
@@ -80,10 +82,10 @@ private:
   void fastsrand(uint32_t seed) { randval = seed; };
 
   int x,y,i,xyoff,v;
-  uint8_t *imagequeue,*curqueue;
+  frei0r_history hist;
   int curqueuenum;
   uint32_t *curdelaymap;
-  uint8_t *curpos,*curimage;
+  uint32_t *curimage;
   int curposnum;
   void *delaymap;
 
@@ -117,14 +119,14 @@ DelayGrab::DelayGrab(int wdt, int hgt) {
   delaymap = NULL;
   _init(wdt, hgt);
 
-  imagequeue = (uint8_t *) malloc(QUEUEDEPTH*(geo.size));
+  if(!hist_init(&hist, QUEUEDEPTH, geo.w, geo.h, KEYINT))
+    fprintf(stderr,"ERROR: delaygrab plugin can't allocate needed memory\n");
 
   /* starting mode */
   current_mode = 4;
   /* starting blocksize */
   set_blocksize(2);
   
-  curqueue=imagequeue;
   curqueuenum=0;
 
   fastsrand(::time(NULL));
@@ -132,7 +134,7 @@ DelayGrab::DelayGrab(int wdt, int hgt) {
 
 DelayGrab::~DelayGrab() {
   free(delaymap);
-  free(imagequeue);
+  hist_free(&hist);
 }
 
 
@@ -144,38 +146,34 @@ void DelayGrab::update(double time,
   /* Update queue pointer */
   if (curqueuenum==0) {
     curqueuenum=QUEUEDEPTH-1;
-    curqueue = imagequeue;
-    curqueue += (geo.size*(QUEUEDEPTH-1));
   } else {
     curqueuenum--;
-    curqueue -= geo.size;
   }
 
-   /* Copy image to queue */
-  memcpy(curqueue,in,geo.size);
+  /* Copy image to queue, as the difference to a recent frame */
+  hist_put(&hist, curqueuenum, in);
 
-     /* Copy image blockwise to screenbuffer */
-  curdelaymap= (uint32_t *)delaymap;
+  /* Copy image blockwise to screenbuffer, a row at a time so that
+     each queued frame decodes its pixels only once per row */
   for (y=0; y<delaymapheight; y++) {
-    for (x=0; x<delaymapwidth; x++) {
-
-      curposnum=((curqueuenum + (*curdelaymap)) % QUEUEDEPTH);
-      
-      xyoff= (x*block_per_bytespp) + (y*block_per_pitch);
-      /* source */
-      curpos= imagequeue;
-      curpos += (geo.size*curposnum);
-      curpos += xyoff;
-      /* target */
-      curimage = (uint8_t *)out;
-      curimage += xyoff;
-      /* copy block */
-      for (i=0; i<blocksize; i++) {
-	memcpy(curimage,curpos,block_per_res);
-	curpos += geo.pitch;
-	curimage += geo.pitch;
+    for (i=0; i<blocksize; i++) {
+      int row = y*blocksize+i;
+      curdelaymap = (uint32_t *)delaymap + y*delaymapwidth;
+      curimage = out + row*geo.w;
+      for (x=0; x<delaymapwidth; x++) {
+
+	curposnum=((curqueuenum + (*curdelaymap)) % QUEUEDEPTH);
+
+	/* copy one row of the block */
+	for (int k=0, n; k<blocksize; k+=n) {
+	  const uint32_t *curpos = hist_span(&hist, curposnum, row,
+					     x*blocksize+k, &n);
+	  if (n > blocksize-k) n = blocksize-k;
+	  memcpy(curimage, curpos, n*sizeof(uint32_t));
+	  curimage += n;
+	}
+	curdelaymap++;
       }
-      curdelaymap++;
     }
   }
 
@@ -290,4 +288,4 @@ int DelayGrab::isqrt(unsigned int x) {
 frei0r::construct<DelayGrab> plugin("Delaygrab",
 				  "delayed frame blitting mapped on a time bitmap",
 				  "Bill Spinhover, Andreas Schiffler, Jaromil",
-				  3,1);
+				  3,2);
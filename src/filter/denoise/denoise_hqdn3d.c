@@ -44,7 +44,7 @@ Copyright (C) 2010  Marko Cebokli    http://lea.hamradio.si/~s57uuu
 typedef struct {
         int Coefs[4][512*16];
         unsigned int *Line;
-	unsigned short *Frame[3];
+	unsigned short *Frame;	//deNoisePacked() history, R,G,B interleaved
 }vf_priv_s;
 
 //----------------------------------------
@@ -56,14 +56,11 @@ int w;
 
 double LumSpac,LumTmp;
 vf_priv_s vps;
-
-unsigned char *Rplani,*Gplani,*Bplani,*Rplano,*Gplano,*Bplano;
 } inst;
 
 
 //========================================================
-//functions LowPassMul, deNoiseTemporal, deNoiseSpacial,
-//deNoise and PrecalaCoefs  are from Mplayer "hqdn3d" filter
+//functions LowPassMul and PrecalaCoefs are from Mplayer "hqdn3d" filter
 //by Daniel Moreno <comac@comac.darktech.org>
 
 static inline unsigned int LowPassMul(unsigned int PrevMul, unsigned int CurrMul, int* Coef){
@@ -73,139 +70,6 @@ static inline unsigned int LowPassMul(unsigned int PrevMul, unsigned int CurrMul
     return CurrMul + Coef[d];
 }
 
-void deNoiseTemporal(
-                    unsigned char *Frame,        // mpi->planes[x]
-                    unsigned char *FrameDest,    // dmpi->planes[x]
-                    unsigned short *FrameAnt,
-                    int W, int H, int sStride, int dStride,
-                    int *Temporal)
-{
-    long X, Y;
-    unsigned int PixelDst;
-
-    for (Y = 0; Y < H; Y++){
-        for (X = 0; X < W; X++){
-            PixelDst = LowPassMul(FrameAnt[X]<<8, Frame[X]<<16, Temporal);
-            FrameAnt[X] = ((PixelDst+0x1000007F)>>8);
-            FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
-        }
-        Frame += sStride;
-        FrameDest += dStride;
-        FrameAnt += W;
-    }
-}
-
-void deNoiseSpacial(
-                    unsigned char *Frame,        // mpi->planes[x]
-                    unsigned char *FrameDest,    // dmpi->planes[x]
-                    unsigned int *LineAnt,       // vf->priv->Line (width bytes)
-                    int W, int H, int sStride, int dStride,
-                    int *Horizontal, int *Vertical)
-{
-    long X, Y;
-    long sLineOffs = 0, dLineOffs = 0;
-    unsigned int PixelAnt;
-    unsigned int PixelDst;
-
-    /* First pixel has no left nor top neighbor. */
-    PixelDst = LineAnt[0] = PixelAnt = Frame[0]<<16;
-    FrameDest[0]= ((PixelDst+0x10007FFF)>>16);
-
-    /* First line has no top neighbor, only left. */
-    for (X = 1; X < W; X++){
-        PixelDst = LineAnt[X] = LowPassMul(PixelAnt, Frame[X]<<16, Horizontal);
-        FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
-    }
-
-    for (Y = 1; Y < H; Y++){
-	unsigned int PixelAnt;
-	sLineOffs += sStride, dLineOffs += dStride;
-        /* First pixel on each line doesn't have previous pixel */
-        PixelAnt = Frame[sLineOffs]<<16;
-        PixelDst = LineAnt[0] = LowPassMul(LineAnt[0], PixelAnt, Vertical);
-        FrameDest[dLineOffs]= ((PixelDst+0x10007FFF)>>16);
-
-        for (X = 1; X < W; X++){
-            unsigned int PixelDst;
-            /* The rest are normal */
-            PixelAnt = LowPassMul(PixelAnt, Frame[sLineOffs+X]<<16, Horizontal);
-            PixelDst = LineAnt[X] = LowPassMul(LineAnt[X], PixelAnt, Vertical);
-            FrameDest[dLineOffs+X]= ((PixelDst+0x10007FFF)>>16);
-        }
-    }
-}
-
-void deNoise(unsigned char *Frame,        // mpi->planes[x]
-                    unsigned char *FrameDest,    // dmpi->planes[x]
-                    unsigned int *LineAnt,      // vf->priv->Line (width bytes)
-		    unsigned short **FrameAntPtr,
-                    int W, int H, int sStride, int dStride,
-                    int *Horizontal, int *Vertical, int *Temporal)
-{
-    long X, Y;
-    long sLineOffs = 0, dLineOffs = 0;
-    unsigned int PixelAnt;
-    unsigned int PixelDst;
-    unsigned short* FrameAnt=(*FrameAntPtr);
-
-    if(!FrameAnt){
-	(*FrameAntPtr)=FrameAnt=malloc(W*H*sizeof(unsigned short));
-	for (Y = 0; Y < H; Y++){
-	    unsigned short* dst=&FrameAnt[Y*W];
-	    unsigned char* src=Frame+Y*sStride;
-	    for (X = 0; X < W; X++) dst[X]=src[X]<<8;
-	}
-    }
-
-    if(!Horizontal[0] && !Vertical[0]){
-        deNoiseTemporal(Frame, FrameDest, FrameAnt,
-                        W, H, sStride, dStride, Temporal);
-        return;
-    }
-    if(!Temporal[0]){
-        deNoiseSpacial(Frame, FrameDest, LineAnt,
-                       W, H, sStride, dStride, Horizontal, Vertical);
-        return;
-    }
-
-    /* First pixel has no left nor top neighbor. Only previous frame */
-    LineAnt[0] = PixelAnt = Frame[0]<<16;
-    PixelDst = LowPassMul(FrameAnt[0]<<8, PixelAnt, Temporal);
-    FrameAnt[0] = ((PixelDst+0x1000007F)>>8);
-    FrameDest[0]= ((PixelDst+0x10007FFF)>>16);
-
-    /* First line has no top neighbor. Only left one for each pixel and
-     * last frame */
-    for (X = 1; X < W; X++){
-        LineAnt[X] = PixelAnt = LowPassMul(PixelAnt, Frame[X]<<16, Horizontal);
-        PixelDst = LowPassMul(FrameAnt[X]<<8, PixelAnt, Temporal);
-        FrameAnt[X] = ((PixelDst+0x1000007F)>>8);
-        FrameDest[X]= ((PixelDst+0x10007FFF)>>16);
-    }
-
-    for (Y = 1; Y < H; Y++){
-	unsigned int PixelAnt;
-	unsigned short* LinePrev=&FrameAnt[Y*W];
-	sLineOffs += sStride, dLineOffs += dStride;
-        /* First pixel on each line doesn't have previous pixel */
-        PixelAnt = Frame[sLineOffs]<<16;
-        LineAnt[0] = LowPassMul(LineAnt[0], PixelAnt, Vertical);
-	PixelDst = LowPassMul(LinePrev[0]<<8, LineAnt[0], Temporal);
-        LinePrev[0] = ((PixelDst+0x1000007F)>>8);
-        FrameDest[dLineOffs]= ((PixelDst+0x10007FFF)>>16);
-
-        for (X = 1; X < W; X++){
-            unsigned int PixelDst;
-            /* The rest are normal */
-            PixelAnt = LowPassMul(PixelAnt, Frame[sLineOffs+X]<<16, Horizontal);
-            LineAnt[X] = LowPassMul(LineAnt[X], PixelAnt, Vertical);
-	    PixelDst = LowPassMul(LinePrev[X]<<8, LineAnt[X], Temporal);
-            LinePrev[X] = ((PixelDst+0x1000007F)>>8);
-            FrameDest[dLineOffs+X]= ((PixelDst+0x10007FFF)>>16);
-        }
-    }
-}
-
 #define ABS(A) ( (A) > 0 ? (A) : -(A) )
 
 static void PrecalcCoefs(int *Ct, double Dist25)
@@ -228,6 +92,89 @@ static void PrecalcCoefs(int *Ct, double Dist25)
 //end of hqdn3d functions
 //===============================================
 
+//-----------------------------------------------
+//one channel of one pixel of deNoisePacked()
+//first = first column, top = first row
+static inline unsigned int hq_channel(unsigned int Pixel, unsigned int *PixelAnt,
+		unsigned int *LineAnt, unsigned short *FrameAnt,
+		int first, int top, int spatial, int temporal,
+		int *Horizontal, int *Vertical, int *Temporal)
+{
+if (spatial)
+	{
+	if (!first) Pixel=LowPassMul(*PixelAnt, Pixel, Horizontal);
+	//as in Mplayer's deNoiseSpacial(), the first row of the
+	//spatial only filter keeps smoothing towards the first pixel
+	if (first || !top || temporal) *PixelAnt=Pixel;
+	if (!top) Pixel=LowPassMul(*LineAnt, Pixel, Vertical);
+	*LineAnt=Pixel;
+	}
+if (temporal)
+	{
+	Pixel=LowPassMul(*FrameAnt<<8, Pixel, Temporal);
+	*FrameAnt=((Pixel+0x1000007F)>>8);
+	}
+return ((Pixel+0x10007FFF)>>16)&255;
+}
+
+//-----------------------------------------------
+//one row of deNoisePacked(), R,G,B interleaved
+static inline void hq_row(const uint32_t *src, uint32_t *dst,
+		unsigned int *LineAnt, unsigned short *LinePrev,
+		int W, int top, int spatial, int temporal,
+		int *Horizontal, int *Vertical, int *Temporal)
+{
+int X,c;
+unsigned int PixelAnt[3];
+
+for (X=0;X<W;X++)
+	{
+	uint32_t out=src[X]&0xFF000000;
+	for (c=0;c<3;c++)
+		out|=hq_channel(((src[X]>>(8*c))&255)<<16, &PixelAnt[c],
+			&LineAnt[3*X+c], &LinePrev[3*X+c], X==0, top,
+			spatial, temporal, Horizontal, Vertical, Temporal)<<(8*c);
+	dst[X]=out;
+	}
+}
+
+//-----------------------------------------------
+//Mplayer's deNoise() on packed RGBA, all three color
+//channels in one pass, without planar copies
+//same arithmetic as deNoise() on each channel plane
+//LineAnt = 3*W, *FrameAntPtr = 3*W*H, interleaved R,G,B
+void deNoisePacked(const uint32_t *Frame, uint32_t *FrameDest,
+		unsigned int *LineAnt, unsigned short **FrameAntPtr,
+		int W, int H,
+		int *Horizontal, int *Vertical, int *Temporal)
+{
+int i,Y;
+unsigned short *FrameAnt=(*FrameAntPtr);
+
+if (!FrameAnt)
+	{
+	(*FrameAntPtr)=FrameAnt=malloc(3*W*H*sizeof(unsigned short));
+	for (i=0;i<W*H;i++)
+		{
+		FrameAnt[3*i]=(Frame[i]&255)<<8;
+		FrameAnt[3*i+1]=((Frame[i]>>8)&255)<<8;
+		FrameAnt[3*i+2]=((Frame[i]>>16)&255)<<8;
+		}
+	}
+
+//the mode is a constant in each call, so hq_row()
+//is compiled into three specialised loops
+for (Y=0;Y<H;Y++)
+	{
+	if (!Horizontal[0] && !Vertical[0])
+		hq_row(Frame+Y*W, FrameDest+Y*W, LineAnt, FrameAnt+3*Y*W, W, Y==0, 0, 1, Horizontal, Vertical, Temporal);
+	else if (!Temporal[0])
+		hq_row(Frame+Y*W, FrameDest+Y*W, LineAnt, FrameAnt+3*Y*W, W, Y==0, 1, 0, Horizontal, Vertical, Temporal);
+	else
+		hq_row(Frame+Y*W, FrameDest+Y*W, LineAnt, FrameAnt+3*Y*W, W, Y==0, 1, 1, Horizontal, Vertical, Temporal);
+	}
+}
+
 
 
 //-----------------------------------------------------
@@ -268,7 +215,7 @@ info->plugin_type=F0R_PLUGIN_TYPE_FILTER;
 info->color_model=F0R_COLOR_MODEL_RGBA8888;
 info->frei0r_version=FREI0R_MAJOR_VERSION;
 info->major_version=0;
-info->minor_version=1;
+info->minor_version=2;
 info->num_params=2;
 info->explanation="High quality 3D denoiser from Mplayer";
 }
@@ -302,13 +249,7 @@ in->h=height;
 
 in->LumSpac=4;
 in->LumTmp=6;
-in->vps.Line=calloc(width,sizeof(int));
-in->Rplani=calloc(width*height,sizeof(unsigned char));
-in->Gplani=calloc(width*height,sizeof(unsigned char));
-in->Bplani=calloc(width*height,sizeof(unsigned char));
-in->Rplano=calloc(width*height,sizeof(unsigned char));
-in->Gplano=calloc(width*height,sizeof(unsigned char));
-in->Bplano=calloc(width*height,sizeof(unsigned char));
+in->vps.Line=calloc(3*width,sizeof(int));
 
 PrecalcCoefs(in->vps.Coefs[0],in->LumSpac);
 PrecalcCoefs(in->vps.Coefs[1],in->LumTmp);
@@ -324,15 +265,7 @@ inst *in;
 in=(inst*)instance;
 
 free(in->vps.Line);
-free(in->vps.Frame[0]);
-free(in->vps.Frame[1]);
-free(in->vps.Frame[2]);
-free(in->Rplani);
-free(in->Gplani);
-free(in->Bplani);
-free(in->Rplano);
-free(in->Gplano);
-free(in->Bplano);
+free(in->vps.Frame);
 
 free(instance);
 }
@@ -390,32 +323,15 @@ switch(param_index)
 void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)
 {
 inst *in;
-int i;
 
 assert(instance);
 in=(inst*)instance;
 
 //Frei0r works with packed color, Mplayer with planar color
-//I decided to copy data rather than modify the hqdn3d functions
-//this takes some time, but future inmprovements in hqdn3d
-//functions can be simply copied here without modification
-
-for (i=0;i<(in->w*in->h);i++)	//copy to planar
-	{
-	in->Rplani[i]=inframe[i]&255;
-	in->Gplani[i]=(inframe[i]>>8)&255;
-	in->Bplani[i]=(inframe[i]>>16)&255;
-	}
-
-deNoise(in->Rplani, in->Rplano, in->vps.Line, &in->vps.Frame[0], in->w, in->h, in->w, in->w, in->vps.Coefs[0], in->vps.Coefs[0], in->vps.Coefs[1]);
-deNoise(in->Gplani, in->Gplano, in->vps.Line, &in->vps.Frame[1], in->w, in->h, in->w, in->w, in->vps.Coefs[0], in->vps.Coefs[0], in->vps.Coefs[1]);
-deNoise(in->Bplani, in->Bplano, in->vps.Line, &in->vps.Frame[2], in->w, in->h, in->w, in->w, in->vps.Coefs[0], in->vps.Coefs[0], in->vps.Coefs[1]);
-
-for (i=0;i<(in->w*in->h);i++)	//copy to packed, preserve alpha
-	{
-	outframe[i]=((uint32_t)in->Rplano[i])|((uint32_t)in->Gplano[i]<<8)|((uint32_t)in->Bplano[i]<<16)|(inframe[i]&0xFF000000);
-	}
+//deNoisePacked() does the same as Mplayer's deNoise() on
+//each plane, directly on the packed frame, alpha is preserved
 
+deNoisePacked(inframe, outframe, in->vps.Line, &in->vps.Frame, in->w, in->h, in->vps.Coefs[0], in->vps.Coefs[0], in->vps.Coefs[1]);
 
 }
 
@@ -19,10 +19,15 @@
 
 #include "frei0r.hpp"
 #include "frei0r_math.h"
-#include <string.h>
-
-#include <cstring>
+#include "frei0r_histogram.h"
 
+// With Smoothing above zero the tables are built from a histogram
+// that decays over the frames instead of the histogram of the frame
+// alone, which removes the flicker of per-frame equalisation. With
+// Threshold above zero the tables are only rebuilt when the
+// cumulative histogram has moved by more than that fraction of the
+// pixels since they were last built. Sampling counts only every n-th
+// row. At the defaults every frame is equalised on its own, as before.
 class equaliz0r : public frei0r::filter
 {
   // Look-up tables for equaliz0r values.
@@ -30,36 +35,27 @@ class equaliz0r : public frei0r::filter
   unsigned char glut[256];
   unsigned char blut[256];
   
-  // Intensity histograms.
-  unsigned int rhist[256];
-  unsigned int ghist[256];
-  unsigned int bhist[256];
+  // Intensity histograms (R, G, B).
+  uint32_t hist[3][256];
 
-  void updateLookUpTables(const uint32_t* in)
-  {
-    unsigned int size = width*height;
-    
-    // First pass : build histograms.
-    
-    // Reset histograms.
-    memset(rhist, 0, 256*sizeof(unsigned int));
-    memset(ghist, 0, 256*sizeof(unsigned int));
-    memset(bhist, 0, 256*sizeof(unsigned int));
+  // Decayed histograms as fractions of the pixels, and the cumulative
+  // histograms the tables were last built from.
+  float decayed[3][256];
+  float built[3][256];
+  bool primed;
 
-    // Update histograms.
-    const unsigned char *in_ptr = (const unsigned char*) in;
-    for (unsigned int i=0; i<size; ++i)
-    {
-      // update 'em
-      rhist[*in_ptr++]++;
-      ghist[*in_ptr++]++;
-      bhist[*in_ptr++]++;
-      in_ptr++; // skip alpha
-    }
+  double smoothing;
+  double threshold;
+  double sampling;
 
-    // Second pass : update look-up tables.
-    in_ptr = (const unsigned char*) in;
+  // every 1st...16th row
+  int rowStep()
+  {
+    return 1 + (int)(CLAMP(sampling, 0.0, 1.0) * 15);
+  }
 
+  void buildLookUpTables(unsigned int size)
+  {
     // Cumulative intensities of histograms.
     unsigned int
       rcum = 0,
@@ -69,41 +65,80 @@ class equaliz0r : public frei0r::filter
     for (int i=0; i<256; ++i)
     {
       // update cumulatives
-      rcum += rhist[i];
-      gcum += ghist[i];
-      bcum += bhist[i];
+      rcum += hist[0][i];
+      gcum += hist[1][i];
+      bcum += hist[2][i];
       
       // update 'em
       rlut[i] = CLAMP0255( (rcum << 8) / size ); // = 256 * rcum / size
       glut[i] = CLAMP0255( (gcum << 8) / size ); // = 256 * gcum / size
       blut[i] = CLAMP0255( (bcum << 8) / size ); // = 256 * bcum / size
-      
-      in_ptr++; // skip alpha
+    }
+  }
+
+  void updateLookUpTables(const uint32_t* in)
+  {
+    int step = rowStep();
+    unsigned int size = width*((height + step - 1)/step);
+    
+    // First pass : build histograms.
+    histo_rgb(in, width, height, step, hist);
+
+    // Second pass : update look-up tables.
+    if (smoothing <= 0.0 && threshold <= 0.0)
+    {
+      buildLookUpTables(size);
+      primed = false;
+      return;
     }
 
+    float k = primed ? CLAMP(smoothing, 0.0, 0.99) : 0.0;
+    float f = (1.0f - k) / size;
+    float cum[3][256];
+    float drift = 0;
+    for (int c=0; c<3; ++c)
+    {
+      float sum = 0;
+      for (int i=0; i<256; ++i)
+      {
+        decayed[c][i] = k*decayed[c][i] + f*hist[c][i];
+        sum += decayed[c][i];
+        cum[c][i] = sum;
+        float d = sum - built[c][i];
+        drift = MAX(drift, d < 0 ? -d : d);
+      }
+    }
+
+    if (primed && drift <= threshold)
+      return;
+    for (int i=0; i<256; ++i)
+    {
+      rlut[i] = CLAMP0255( (int)(cum[0][i]*256) );
+      glut[i] = CLAMP0255( (int)(cum[1][i]*256) );
+      blut[i] = CLAMP0255( (int)(cum[2][i]*256) );
+    }
+    std::copy(&cum[0][0], &cum[0][0] + 3*256, &built[0][0]);
+    primed = true;
   }
   
 public:
   equaliz0r(unsigned int width, unsigned int height)
   {
+    smoothing = 0.0;
+    threshold = 0.0;
+    sampling = 0.0;
+    register_param(smoothing, "Smoothing", "weight of the past frames in the histogram, 0 is the current frame only");
+    register_param(threshold, "Threshold", "change of the cumulative histogram, as a fraction of the pixels, that rebuilds the tables");
+    register_param(sampling, "Sampling", "count every row (0) up to every 16th row (1)");
+    primed = false;
   }
   
   virtual void update(double time,
                       uint32_t* out,
                       const uint32_t* in)
   {
-    std::copy(in, in + width*height, out);
     updateLookUpTables(in);
-    unsigned int size = width*height;
-    const unsigned char *in_ptr = (const unsigned char*) in;
-    unsigned char *out_ptr = (unsigned char*) out;
-    for (unsigned int i=0; i<size; ++i)
-    {
-      *out_ptr++ = rlut[*in_ptr++];
-      *out_ptr++ = glut[*in_ptr++];
-      *out_ptr++ = blut[*in_ptr++];
-      *out_ptr++ = *in_ptr++; // copy alpha
-    }
+    histo_lut_apply(in, out, width*height, rlut, glut, blut);
   }
 };
 
@@ -111,6 +146,6 @@ public:
 frei0r::construct<equaliz0r> plugin("Equaliz0r",
                                     "Equalizes the intensity histograms",
                                     "Jean-Sebastien Senecal (Drone)",
-                                    0,2,
+                                    0,4,
                                     F0R_COLOR_MODEL_RGBA8888);
 
@@ -38,52 +38,10 @@ Copyright (C) 2012  Marko Cebokli    http://lea.hamradio.si/~s57uuu
 #include <math.h>
 #include <assert.h>
 #include <string.h>
+#include "frei0r_cfc.h"
 
 double PI=3.14159265358979;
 
-typedef struct
-{
-	float r;
-	float g;
-	float b;
-	float a;
-} float_rgba;
-
-//----------------------------------------------------
-void RGBA8888_2_float(const uint32_t* in, float_rgba *out, int w, int h)
-{
-	uint8_t *cin;
-	int i;
-	float f1;
-	
-	cin=(uint8_t *)in;
-	f1=1.0/255.0;
-	for (i=0;i<w*h;i++)
-	{
-		out[i].r=f1*(float)*cin++;
-		out[i].g=f1*(float)*cin++;
-		out[i].b=f1*(float)*cin++;
-		out[i].a=f1*(float)*cin++;
-	}
-}
-
-//------------------------------------------------------------------
-void float_2_RGBA8888(const float_rgba *in, uint32_t* out, int w, int h)
-{
-	uint8_t *cout;
-	int i;
-	
-	cout=(uint8_t *)out;
-	
-	for (i=0;i<w*h;i++)
-	{
-		*cout++=(uint8_t)(in[i].r*255.0);
-		*cout++=(uint8_t)(in[i].g*255.0);
-		*cout++=(uint8_t)(in[i].b*255.0);
-		*cout++=(uint8_t)(in[i].a*255.0);
-	}
-}
-
 //------------------------------------------------
 //color coeffs according to rec 601 or rec 701
 void cocos(int cm, float *kr, float *kg, float *kb)
@@ -507,22 +465,36 @@ void hue_mask(float_rgba *s, int w, int h, float *mask, float_rgba k, float t, f
 }
 
 //----------------------------------------------------------
-//mask values [0...1]
-void edge_mask(float_rgba *s, int w, int h, float *mask, float wd, int io)
+//blurred fully opaque areas, for the edge mask
+//the whole frame, straight from the 8 bit input
+//(the blur is the only stage that needs more than a strip)
+void edge_blur(const uint32_t *in, int w, int h, float *mask, float wd)
 {
 	int i;
 	float a;
 	float lim;
+	float sc=1.0/255.0;	//as the float conversion
 	
 	lim=0.05;	//clear mask below this value (good for speed)
 	
 	//fully opaque areas
 	for (i=0;i<w*h;i++)
-		if (s[i].a>0.996) mask[i]=1.0; else mask[i]=0.0;
+		if (sc*(float)(in[i]>>24)>0.996) mask[i]=1.0; else mask[i]=0.0;
 	
 	//blur mask
 	a=expf(logf(lim)/wd);
 	fibe1o_f(mask, w, h, a, 1);
+}
+
+//----------------------------------------------------------
+//mask values [0...1]
+//selects the edge from the blurred mask (edge_blur)
+void edge_mask(int w, int h, float *mask, int io)
+{
+	int i;
+	float lim;
+	
+	lim=0.05;	//clear mask below this value (good for speed)
 	
 	//select edge
 	if (io==-1)	//inside
@@ -681,6 +653,12 @@ typedef struct
 	float_rgba trgb;
 	char *liststr;
 	
+	//buffers
+	float_rgba *sl;		//float strip, see cfc_stream()
+	int rows;		//rows per strip
+	float *mask;		//mask of a strip
+	float *emask;		//edge mask, whole frame (edge types only)
+	
 } inst;
 
 //-----------------------------------------------------
@@ -833,6 +811,11 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 	in->liststr = (char*)malloc( strlen(sval) + 1 );
 	strcpy( in->liststr, sval );
 	
+	in->rows=cfc_strip_rows(width);
+	in->sl=malloc(in->rows * width * sizeof(float_rgba));
+	in->mask=malloc(in->rows * width * sizeof(float));
+	in->emask=NULL;
+	
 	return (f0r_instance_t)in;
 }
 
@@ -841,6 +824,9 @@ void f0r_destruct(f0r_instance_t instance)
 {
 	inst* in = (inst*)instance;
 	free(in->liststr);
+	free(in->sl);
+	free(in->mask);
+	free(in->emask);
 	free(instance);
 }
 
@@ -1018,110 +1004,123 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 }
 
 //==============================================================
-void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)
+//one of the operations on a strip
+void operation(inst *in, float_rgba *sl, int w, int h, float *mask, int op, float am)
 {
-	inst *in;
-	//video buffers
-	float *mask;
-	float_rgba *sl;
-	
-	assert(instance);
-	in=(inst*)instance;
-	
-	sl = calloc(in->w * in->h, sizeof(float_rgba));
-	mask = calloc(in->w * in->h, sizeof(float));
-	
-	RGBA8888_2_float(inframe, sl, in->w, in->h);
-	
-	switch(in->maskType)		//GENERATE MASK
-	{
-	case 0:		//Color distance based mask
-	{
-		rgb_mask(sl, in->w, in->h, mask, in->krgb, in->tol, in->slope, in->fo);
-		break;
-	}
-	case 1:		//Transparency based mask
-	{
-		trans_mask(sl, in->w, in->h, mask, in->tol);
-		break;
-	}
-	case 2:		//Edge based mask inwards
-	{
-		edge_mask(sl, in->w, in->h, mask, in->tol*200.0, -1);
-		break;
-	}
-	case 3:		//Edge based mask outwards
-	{
-		edge_mask(sl, in->w, in->h, mask, in->tol*200.0, 1);
-		break;
-	}
-	}
-	
-	hue_gate(sl, in->w, in->h, mask, in->krgb, in->Hgate, 0.5*in->Hgate);
-	sat_thres(sl, in->w, in->h, mask, in->Sthresh);
-	
-	switch(in->op1)		//OPERATION 1
+	switch(op)
 	{
 	case 0: break;
 	case 1:	//De-Key
 	{
-		clean_rad_m(sl, in->w, in->h, in->krgb, mask, in->am1);
+		clean_rad_m(sl, w, h, in->krgb, mask, am);
 		break;
 	}
 	case 2:	//Target
 	{
-		clean_tgt_m(sl, in->w, in->h, in->krgb, mask, in->am1, in->trgb);
+		clean_tgt_m(sl, w, h, in->krgb, mask, am, in->trgb);
 		break;
 	}
 	case 3:	//Desaturate
 	{
-		desat_m(sl, in->w, in->h, mask, in->am1, in->cm);
+		desat_m(sl, w, h, mask, am, in->cm);
 		break;
 	}
 	case 4:	//Luma adjust
 	{
-		luma_m(sl, in->w, in->h, mask, in->am1, in->cm);
+		luma_m(sl, w, h, mask, am, in->cm);
 		break;
 	}
 	}
+}
+
+//--------------------------------------------------------------
+typedef struct
+{
+	inst *in;
+	float *emask;	//edge mask rows of the next strip
+} spill_args;
+
+//--------------------------------------------------------------
+//all the point-wise stages on a strip of n rows, in float
+//(converted back by cfc_stream)
+void spill_strip(float_rgba *sl, int w, int n, const uint32_t *inframe, uint32_t *outframe, void *arg)
+{
+	spill_args *sa;
+	inst *in;
+	float *mask;
+	
+	(void)inframe; (void)outframe;
+	sa=(spill_args*)arg;
+	in=sa->in;
+	mask=in->mask;
 	
-	switch(in->op2)		//OPERATION 2
+	switch(in->maskType)		//GENERATE MASK
 	{
-	case 0: break;
-	case 1:	//De-Key
+	case 0:		//Color distance based mask
 	{
-		clean_rad_m(sl, in->w, in->h, in->krgb, mask, in->am2);
+		rgb_mask(sl, w, n, mask, in->krgb, in->tol, in->slope, in->fo);
 		break;
 	}
-	case 2:	//Target
+	case 1:		//Transparency based mask
 	{
-		clean_tgt_m(sl, in->w, in->h, in->krgb, mask, in->am2, in->trgb);
+		trans_mask(sl, w, n, mask, in->tol);
 		break;
 	}
-	case 3:	//Desaturate
+	case 2:		//Edge based mask inwards
 	{
-		desat_m(sl, in->w, in->h, mask, in->am2, in->cm);
+		mask=sa->emask;
+		sa->emask+=w*n;
+		edge_mask(w, n, mask, -1);
 		break;
 	}
-	case 4:	//Luma adjust
+	case 3:		//Edge based mask outwards
 	{
-		luma_m(sl, in->w, in->h, mask, in->am2, in->cm);
+		mask=sa->emask;
+		sa->emask+=w*n;
+		edge_mask(w, n, mask, 1);
 		break;
 	}
 	}
 	
+	hue_gate(sl, w, n, mask, in->krgb, in->Hgate, 0.5*in->Hgate);
+	sat_thres(sl, w, n, mask, in->Sthresh);
+	
+	operation(in, sl, w, n, mask, in->op1, in->am1);	//OPERATION 1
+	operation(in, sl, w, n, mask, in->op2, in->am2);	//OPERATION 2
+	
 	if (in->showmask)	//REPLACE IMAGE WITH THE MASK
 	{
-		copy_mask_i(sl, in->w, in->h, mask);
+		copy_mask_i(sl, w, n, mask);
 	}
 	
 	if (in->m2a)		//REPLACE ALPHA WITH THE MASK
 	{
-		copy_mask_a(sl, in->w, in->h, mask);
+		copy_mask_a(sl, w, n, mask);
 	}      
+}
+
+//==============================================================
+void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)
+{
+	inst *in;
+	spill_args sa;
 	
+	assert(instance);
+	in=(inst*)instance;
+	
+	sa.in=in;
+	sa.emask=NULL;
+	
+	//the edge masks need the blur over the whole frame first
+	if ((in->maskType==2)||(in->maskType==3))
+	{
+		if (in->emask==NULL)
+			in->emask=malloc(in->w * in->h * sizeof(float));
+		if (in->emask==NULL) return;
+		edge_blur(inframe, in->w, in->h, in->emask, in->tol*200.0);
+		sa.emask=in->emask;
+	}
 	
-	float_2_RGBA8888(sl, outframe, in->w, in->h);
-	free(mask);
-	free(sl);
+	//everything else in strips, while they are in cache
+	cfc_stream(inframe, outframe, in->w, in->h, in->sl, in->rows, 1.0/255.0, 1, spill_strip, &sa);
 }
@@ -18,11 +18,13 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
 #include "frei0r.h"
 #include "frei0r_math.h"
+#include "frei0r_remap.h"
 
 typedef struct lenscorrection_instance
 {
@@ -33,6 +35,8 @@ typedef struct lenscorrection_instance
   double correctionnearcenter;
   double correctionnearedges;
   double brightness;
+  remap_map map;
+  int map_dirty;
 } lenscorrection_instance_t;
 
 
@@ -52,7 +56,7 @@ void f0r_get_plugin_info(f0r_plugin_info_t* lenscorrection_info)
   lenscorrection_info->color_model = F0R_COLOR_MODEL_RGBA8888;
   lenscorrection_info->frei0r_version = FREI0R_MAJOR_VERSION;
   lenscorrection_info->major_version = 0; 
-  lenscorrection_info->minor_version = 2; 
+  lenscorrection_info->minor_version = 3; 
   lenscorrection_info->num_params =  5; 
   lenscorrection_info->explanation = "Allows compensation of lens distortion";
 }
@@ -92,6 +96,7 @@ void f0r_get_param_info(f0r_param_info_t* info, int param_index)
 f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 {
   lenscorrection_instance_t* inst = (lenscorrection_instance_t*)calloc(1, sizeof(*inst));
+  if (!inst) return 0;
   inst->width = width; inst->height = height;
 
   inst->xcenter = 0.5;
@@ -99,11 +104,19 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
   inst->correctionnearcenter = 0.5;
   inst->correctionnearedges = 0.5;
   inst->brightness = 0.5;
+  if (!remap_alloc(&inst->map, width, height, width, height)) {
+    free(inst);
+    return 0;
+  }
+  remap_set_interp(&inst->map, REMAP_BL);
+  inst->map_dirty = 1;
   return (f0r_instance_t)inst;
 }
 
 void f0r_destruct(f0r_instance_t instance)
 {
+  lenscorrection_instance_t* inst = (lenscorrection_instance_t*)instance;
+  remap_free(&inst->map);
   free(instance);
 }
 
@@ -118,18 +131,22 @@ void f0r_set_param_value(f0r_instance_t instance,
 		double val;
 		case 0:
 			val = *((double*)param);
+			if (val != inst->xcenter) inst->map_dirty = 1;
 			inst->xcenter = val;
 			break;
 		case 1:
 			val = *((double*)param);
+			if (val != inst->ycenter) inst->map_dirty = 1;
 			inst->ycenter = val;
 			break;
 		case 2:
 			val = *((double*)param);
+			if (val != inst->correctionnearcenter) inst->map_dirty = 1;
 			inst->correctionnearcenter = val;
 			break;
 		case 3:
 			val = *((double*)param);
+			if (val != inst->correctionnearedges) inst->map_dirty = 1;
 			inst->correctionnearedges = val;
 			break;
 		case 4:
@@ -165,13 +182,13 @@ void f0r_get_param_value(f0r_instance_t instance,
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time,
-		const uint32_t* inframe, uint32_t* outframe)
+/* The correction depends only on the parameters, so the source
+ * position of every pixel is computed once per parameter change and
+ * each frame is just a bilinear remap through that map. */
+static void make_map(lenscorrection_instance_t* inst)
 {
 	//Algorithm fetched from Krita
-	int x, y;
-	assert(instance);
-	lenscorrection_instance_t* inst = (lenscorrection_instance_t*)instance;
+	unsigned int x, y;
 
 	double xcenter = inst->xcenter;
 	double ycenter = inst->ycenter;
@@ -199,51 +216,32 @@ void f0r_update(f0r_instance_t instance, double time,
 
 			/* double brighten = 1.0 + mag * brightness; */
 				// Disabled to avoid compiler warnings
-			
-			int sx;
-			int sy;
-			sx = srcX;
-			sy = srcY;
-			if ( sx < 0 || sy < 0 || sx >= inst->width || sy >= inst->height ) {
-				outframe[x + y * inst->width] =	0x00000000;
+
+			if ( srcX < 0 || srcY < 0 || srcX >= inst->width || srcY >= inst->height ) {
+				remap_set_bg(&inst->map, x + y * inst->width);
 				continue;
 			}
-			//FIXME: interpolate pixel!!
-			outframe[x + y * inst->width] = inframe[sx + sy * inst->width];
+			remap_set(&inst->map, x + y * inst->width, srcX, srcY);
 		}
 	}
+	remap_tiles(&inst->map);
+	inst->map_dirty = 0;
 }
 
-uint32_t interpolate_pixel( uint8_t* frame, int w, int h, double x, double y ) {
-/*
-	+--+--+
-	|  |  |
-	+--+--+
-	|  |  |
-	+--+--+
-
-
-	0.5 is full pixel value
-
-	0.25 interpolate to left pixel
-	0.75 interpolate to right pixel
-*/
-
-/*  //Disabled to avoid warnings when compiling
-double xoff = x - floor(x);
-
-int xc = (int)floor(x);
-int yc = (int)floor(y);
-
-int i = (xc+yc*w)*4;
-uint8_t color1_r = (uint8_t)( xoff * frame[i] + ( 1.0 - xoff ) * frame[i] );
-uint8_t color1_g = (uint8_t)( xoff * frame[i+1] + ( 1.0 - xoff ) * frame[i+1] );
-uint8_t color1_b = (uint8_t)( xoff * frame[i+2] + ( 1.0 - xoff ) * frame[i+2] );
-uint8_t color1_a = (uint8_t)( xoff * frame[i+3] + ( 1.0 - xoff ) * frame[i+3] );
-*/
+void f0r_update(f0r_instance_t instance, double time,
+		const uint32_t* inframe, uint32_t* outframe)
+{
+	assert(instance);
+	lenscorrection_instance_t* inst = (lenscorrection_instance_t*)instance;
 
+	if (inst->correctionnearcenter == 0.5 && inst->correctionnearedges == 0.5) {
+		/* no correction */
+		memcpy(outframe, inframe, inst->width * inst->height * 4);
+		return;
+	}
 
+	if (inst->map_dirty)
+		make_map(inst);
 
-return 0;
+	remap32(&inst->map, inframe, outframe, 0x00000000);
 }
-
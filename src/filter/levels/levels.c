@@ -25,6 +25,7 @@
 
 #include "frei0r.h"
 #include "frei0r_math.h"
+#include "frei0r_histogram.h"
 
 enum ChannelChoice
 {
@@ -86,7 +87,7 @@ void f0r_get_plugin_info(f0r_plugin_info_t* levels_instance_t)
   levels_instance_t->color_model = F0R_COLOR_MODEL_RGBA8888;
   levels_instance_t->frei0r_version = FREI0R_MAJOR_VERSION;
   levels_instance_t->major_version = 0;
-  levels_instance_t->minor_version = 4;
+  levels_instance_t->minor_version = 5;
   levels_instance_t->num_params = PARAMETER_COUNT;
   levels_instance_t->explanation = "Adjust luminance or color channel intensity";
 }
@@ -241,12 +242,12 @@ void f0r_update(f0r_instance_t instance, double time,
   unsigned int len = inst->width * inst->height;
   unsigned int maxHisto = 0;
 
-  unsigned char* dst = (unsigned char*)outframe;
-  const unsigned char* src = (unsigned char*)inframe;
-  int r, g, b;
+  unsigned char* dst;
+  const unsigned char* src;
 
-  double levels[256];
-  unsigned int map[256];
+  uint32_t levels[256];
+  unsigned char map[256];
+  unsigned char same[256];
 
   double inScale = inst->inputMax != inst->inputMin?inst->inputMax - inst->inputMin:1;
   double exp = inst->gamma == 0?1:1/inst->gamma;
@@ -259,55 +260,23 @@ void f0r_update(f0r_instance_t instance, double time,
 	}
 	double w = pow(v / inScale, exp) * outScale + inst->outputMin;
 	map[i] = CLAMP0255(lrintf(w * 255.0));
+	same[i] = i;
   }
 
-  if (inst->showHistogram)
-	for(int i = 0; i < 256; i++)
-	  levels[i] = 0;
-
-  while (len--)
-  {
-	r = *src++;
-	g = *src++;
-	b = *src++;
-
-	if (inst->showHistogram) {
-	  int intensity =
-	    inst->channel == CHANNEL_RED?r:
-	    inst->channel == CHANNEL_GREEN?g:
-	    inst->channel == CHANNEL_BLUE?b:
-	        CLAMP0255(b * .114 + g * .587 + r * .299);
-	  int index = CLAMP0255(intensity);
-	  levels[index]++;
-	  if (levels[index] > maxHisto)
-		maxHisto = levels[index];
-	}
+  // histogram of the input, before the frame is mapped
+  if (inst->showHistogram) {
+	if (inst->channel == CHANNEL_LUMA)
+	  histo_luma(inframe, inst->width, inst->height, 1, levels);
+	else
+	  histo_channel(inframe, inst->width, inst->height, 1, 8 * inst->channel, levels);
+	maxHisto = histo_peak(levels);
+  }
 
-	switch (inst->channel) {
-	case CHANNEL_RED:
-	  *dst++ = map[r];
-	  *dst++ = g;
-	  *dst++ = b;
-	  break;
-	case CHANNEL_GREEN:
-	  *dst++ = r;
-	  *dst++ = map[g];
-	  *dst++ = b;
-	  break;
-	case CHANNEL_BLUE:
-	  *dst++ = r;
-	  *dst++ = g;
-	  *dst++ = map[b];
-	  break;
-	case CHANNEL_LUMA:
-	  *dst++ = map[r];
-	  *dst++ = map[g];
-	  *dst++ = map[b];
-	  break;
-	}
+  histo_lut_apply(inframe, outframe, len,
+		  inst->channel == CHANNEL_RED || inst->channel == CHANNEL_LUMA?map:same,
+		  inst->channel == CHANNEL_GREEN || inst->channel == CHANNEL_LUMA?map:same,
+		  inst->channel == CHANNEL_BLUE || inst->channel == CHANNEL_LUMA?map:same);
 
-	*dst++ = *src++;  // copy alpha
-  }
   if (inst->showHistogram) {
 	dst = (unsigned char *)outframe;
 	src = (unsigned char *)inframe;
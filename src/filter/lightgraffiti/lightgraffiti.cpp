@@ -77,7 +77,10 @@
 #include <climits>
 #include <algorithm>
 
-#define LG_ADV
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 //#define LG_NO_OVERLAY // Not really working yet
 //#define LG_DEBUG
 
@@ -119,37 +122,100 @@
                       float b;
                   };
 
+// Entries of the nonlinear dimming table over [0,1]
+#define DIM_TABLE 1024
+
+// Natural logarithm for x > 0 in float, good to about 1e-7 relative.
+// log(x) = e*log(2) + 2*atanh(s) with the mantissa m in [sqrt(.5),sqrt(2)], s = (m-1)/(m+1).
+// The SSE2 version below does the same operations in the same order.
+static inline float lg_log(float x)
+{
+    union { float f; int32_t i; } u;
+    u.f = x;
+    int e = ((u.i >> 23) & 0xFF) - 127;
+    u.i = (u.i & 0x7FFFFF) | 0x3F800000;
+    float m = u.f;
+    if (m > 1.41421356f) {
+        m *= .5f;
+        e++;
+    }
+    float s = (m-1) / (m+1);
+    float s2 = s*s;
+    return (float)e * 0.693147181f + 2*s*(1 + s2*(1/3.f + s2*(1/5.f + s2*(1/7.f + s2*(1/9.f)))));
+}
+
+// Moves the 8.8 fixed point background mean m towards the pixel value x by alpha.
+// Steps that would round to 0 are made 1 (1/256) so that the mean still settles for small alphas.
+static inline int lg_mean_step(int m, unsigned int x, float alpha)
+{
+    int d = (int)(x << 8) - m;
+    int step = (int)lrintf(alpha * (float)d);
+    if (step == 0) {
+        step = (d > 0) - (d < 0);
+    }
+    return m + step;
+}
+
+#if defined(__SSE2__)
+static inline __m128 lg_log_sse2(__m128 x)
+{
+    __m128i i = _mm_castps_si128(x);
+    __m128i e = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(i, 23), _mm_set1_epi32(0xFF)), _mm_set1_epi32(127));
+    __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(i, _mm_set1_epi32(0x7FFFFF)), _mm_set1_epi32(0x3F800000)));
+    __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+    m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(.5f))), _mm_andnot_ps(big, m));
+    e = _mm_sub_epi32(e, _mm_castps_si128(big));
+    __m128 one = _mm_set1_ps(1);
+    __m128 s = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    __m128 s2 = _mm_mul_ps(s, s);
+    __m128 p = _mm_add_ps(_mm_set1_ps(1/7.f), _mm_mul_ps(s2, _mm_set1_ps(1/9.f)));
+    p = _mm_add_ps(_mm_set1_ps(1/5.f), _mm_mul_ps(s2, p));
+    p = _mm_add_ps(_mm_set1_ps(1/3.f), _mm_mul_ps(s2, p));
+    p = _mm_add_ps(one, _mm_mul_ps(s2, p));
+    return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(e), _mm_set1_ps(0.693147181f)),
+                      _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2), s), p));
+}
+
+// 8.8 means (0...65280) back to 16 bit; SSE2 only has a signed pack
+static inline __m128i lg_pack_mean(__m128i m)
+{
+    __m128i bias = _mm_set1_epi32(32768);
+    return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(m, bias), _mm_sub_epi32(m, bias)), _mm_set1_epi16((short)0x8000));
+}
+#endif
+
 class LightGraffiti : public frei0r::filter
 {
 
 public:
 
     LightGraffiti(unsigned int width, unsigned int height) :
-            m_lightMask(width*height, 0),
-            m_alphaMap(4*width*height, 0),
-            m_meanInitialized(false)
+            m_meanInitialized(false),
+            m_dimTableDim(-1)
 
     {
         m_mode = Graffiti_LongAvgAlphaCumC;
         m_dimMode = Dim_Mult;
 
-#ifdef LG_ADV
-        RGBFloat rgb0;
-        rgb0.r = 0;
-        rgb0.g = 0;
-        rgb0.b = 0;
-        m_rgbLightMask = std::vector<RGBFloat>(width*height, rgb0);
+        for (int c = 0; c < 3; c++) {
+            m_longMeanImage[c] = std::vector<uint16_t>(width*height, 0);
+        }
 
-#ifdef LG_DEBUG
-        for (int i = 0; i < width*height; i++) {
-            if (m_rgbLightMask[i].r != 0 || m_rgbLightMask[i].g != 0 || m_rgbLightMask[i].b != 0) {
-                std::cout << "ERROR: " << m_rgbLightMask[i].r;
-            }
+        for (int c = 0; c < 3; c++) {
+            m_rgbLightMask[c] = std::vector<float>(width*height, 0);
+        }
+
+        // The light mask and alpha map are only used by the testing modes.
+        if (m_mode != Graffiti_LongAvgAlphaCumC) {
+            m_lightMask = std::vector<uint32_t>(width*height, 0);
+            m_alphaMap = std::vector<float>(4*width*height, 0);
         }
-#endif
-#endif
 
 #ifdef LG_NO_OVERLAY
+        RGBFloat rgb0;
+        rgb0.r = 0;
+        rgb0.g = 0;
+        rgb0.b = 0;
         m_prevMask = std::vector<RGBFloat>(width*height, rgb0);
 #endif
 
@@ -218,16 +284,14 @@ public:
         double saturation = m_pSaturation * 4;
         double lowerOverexposure = m_pLowerOverexposure * 10;
 
+        // The light graffiti pass reads the input and writes every output pixel itself.
+        bool lightPass = (m_mode == Graffiti_LongAvgAlphaCumC);
+
         // Copy everything to the output image.
         // Most of the image will very likely not change at all.
-        std::copy(in, in + width*height, out);
-
-#ifdef LG_ADV
-        RGBFloat rgb0;
-        rgb0.r = 0;
-        rgb0.g = 0;
-        rgb0.b = 0;
-#endif
+        if (!lightPass) {
+            std::copy(in, in + width*height, out);
+        }
 
         if (m_pNonlinearDim) {
             m_dimMode = Dim_Sin;
@@ -239,28 +303,32 @@ public:
         /*
          Refresh the background image
          */
+        bool average = false;
         if (!m_meanInitialized || m_pReset) {
             if (m_pBlackReference) {
                 // Do not use the first frame from the movie as background image but plain black
                 // to calculate the added light. Useful e.g. when dealing with still images.
-                m_longMeanImage = std::vector<float>(width*height*3, 0);
+                for (int c = 0; c < 3; c++) {
+                    std::fill(m_longMeanImage[c].begin(), m_longMeanImage[c].end(), 0);
+                }
             } else {
-                m_longMeanImage = std::vector<float>(width*height*3);
                 for (unsigned int pixel = 0; pixel < width*height; pixel++) {
-                    m_longMeanImage[3*pixel+0] = GETR(in[pixel]);
-                    m_longMeanImage[3*pixel+1] = GETG(in[pixel]);
-                    m_longMeanImage[3*pixel+2] = GETB(in[pixel]);
+                    m_longMeanImage[0][pixel] = GETR(in[pixel]) << 8;
+                    m_longMeanImage[1][pixel] = GETG(in[pixel]) << 8;
+                    m_longMeanImage[2][pixel] = GETB(in[pixel]) << 8;
                 }
             }
             m_meanInitialized = true;
         } else {
             // Calculate the mean image to estimate the background. If alpha is set > 0, bright light sources
             // moving into the image and standing still will eventually be treated as background.
-            if (m_pLongAlpha > 0) {
+            // (The light pass does this on its way through the image.)
+            average = (m_pLongAlpha > 0);
+            if (average && !lightPass) {
                 for (unsigned int pixel = 0; pixel < width*height; pixel++) {
-                    m_longMeanImage[3*pixel+0] = (1-m_pLongAlpha) * m_longMeanImage[3*pixel+0] + m_pLongAlpha * GETR(in[pixel]);
-                    m_longMeanImage[3*pixel+1] = (1-m_pLongAlpha) * m_longMeanImage[3*pixel+1] + m_pLongAlpha * GETG(in[pixel]);
-                    m_longMeanImage[3*pixel+2] = (1-m_pLongAlpha) * m_longMeanImage[3*pixel+2] + m_pLongAlpha * GETB(in[pixel]);
+                    m_longMeanImage[0][pixel] = lg_mean_step(m_longMeanImage[0][pixel], GETR(in[pixel]), m_pLongAlpha);
+                    m_longMeanImage[1][pixel] = lg_mean_step(m_longMeanImage[1][pixel], GETG(in[pixel]), m_pLongAlpha);
+                    m_longMeanImage[2][pixel] = lg_mean_step(m_longMeanImage[2][pixel], GETB(in[pixel]), m_pLongAlpha);
                 }
             }
         }
@@ -269,10 +337,11 @@ public:
         /*
          Light mask dimming
          */
-        if (m_pDim > 0) {
+        bool dim = (m_pDim > 0);
+        float factor = 1-m_pDim;
+        if (dim) {
             // Dims the light mask. Lights will leave fainting trails.
-
-            float factor = 1-m_pDim;
+            // (The light pass dims the mask; only the table is prepared here.)
 
             /* Gnu Octave:
                range=linspace(0,1,100);
@@ -280,70 +349,12 @@ public:
                plot(range,sin(range*pi/2).^.5)
                plot(range,sin(range*pi/2).^.25)
             */
-
-            switch (m_dimMode) {
-
-                case Dim_Mult:
-#ifdef LG_ADV
-                    for (size_t i = 0; i < m_rgbLightMask.size(); i++) {
-                        m_rgbLightMask[i].r *= factor;
-                        m_rgbLightMask[i].g *= factor;
-                        m_rgbLightMask[i].b *= factor;
-                    }
-#else
-                    for (unsigned int i = 0; i < width*height; i++) {
-                        m_alphaMap[4*i + 0] *= factor;
-                        m_alphaMap[4*i + 1] *= factor;
-                        m_alphaMap[4*i + 2] *= factor;
-                        m_alphaMap[4*i + 3] *= factor;
-                    }
-#endif
-                    break;
-
-
-                case Dim_Sin:
-#ifdef LG_ADV
-                    for (size_t i = 0; i < m_rgbLightMask.size(); i++) {
-                        // Red
-                        if (m_rgbLightMask[i].r < 1) {
-                            m_rgbLightMask[i].r *= pow(sin(m_rgbLightMask[i].r * M_PI/2), m_pDim) - .01;
-                        } else {
-                            m_rgbLightMask[i].r *= factor;
-                        }
-                        if (m_rgbLightMask[i].r < 0) { m_rgbLightMask[i].r = 0; }
-
-                        // Green
-                        if (m_rgbLightMask[i].g < 1) {
-                            m_rgbLightMask[i].g *= pow(sin(m_rgbLightMask[i].g * M_PI/2), m_pDim) - .01;
-                        } else {
-                            m_rgbLightMask[i].g *= factor;
-                        }
-                        if (m_rgbLightMask[i].g < 0) { m_rgbLightMask[i].g = 0; }
-
-                        // Blue
-                        if (m_rgbLightMask[i].b < 1) {
-                            m_rgbLightMask[i].b *= pow(sin(m_rgbLightMask[i].b * M_PI/2), m_pDim) - .01;
-                        } else {
-                            m_rgbLightMask[i].b *= factor;
-                        }
-                        if (m_rgbLightMask[i].b < 0) { m_rgbLightMask[i].b = 0; }
-                    }
-#else
-                    // Attention: Since Graffiti_LongAvgAlphaCumC only makes use of the first alpha channel
-                    // the other channels are not calculated here due to efficiency reasons.
-                    // May have to be adjusted if required.
-                    for (int i = 0; i < width*height; i++) {
-                        if (m_alphaMap[4*i + 0] < 1) {
-                            m_alphaMap[4*i + 0] *= pow(sin(m_alphaMap[4*i + 0] * M_PI/2), m_pDim) - .01;
-                        } else {
-                            m_alphaMap[4*i + 0] *= factor;
-                        }
-                        if (m_alphaMap[4*i + 0] < 0) { m_alphaMap[4*i + 0] = 0; }
-                    }
-#endif
-                    break;
+            if (m_dimMode == Dim_Sin && m_dimTableDim != m_pDim) {
+                for (int i = 0; i <= DIM_TABLE; i++) {
+                    m_dimTable[i] = pow(sin((double)i/DIM_TABLE * M_PI/2), m_pDim) - .01;
+                }
+                m_dimTableDim = m_pDim;
             }
-
         }
 
 
@@ -353,22 +364,19 @@ public:
          (mainly for parameter adjustments when working in the NLE)
          */
         if (m_pReset) {
-#ifdef LG_ADV
-            m_rgbLightMask = std::vector<RGBFloat>(width*height, rgb0);
-#else
-            std::fill(&m_lightMask[0], &m_lightMask[width*height - 1], 0);
-            std::fill(&m_alphaMap[0], &m_alphaMap[width*height*4 - 1], 0);
-#endif
+            for (int c = 0; c < 3; c++) {
+                std::fill(m_rgbLightMask[c].begin(), m_rgbLightMask[c].end(), 0);
+            }
+            dim = false;
             // m_longMeanImage has been handled above already (set to the current image).
         }
 
 
         int r, g, b;
-        int maxDiff, temp, sum;
+        int maxDiff, temp;
         unsigned int min;
         unsigned int max;
         float f;
-        float fr, fg, fb, sr, sg, sb, fy, fsat;
 
 #ifdef LG_DEBUG
         int deCount = 0;
@@ -494,12 +502,12 @@ public:
                         temp = CLAMP(temp);
                         sat = RGBA(temp, temp, temp, 0xFF);
                     }
-                    min = m_longMeanImage[3*pixel+0];
-                    max = m_longMeanImage[3*pixel+0];
-                    if (m_longMeanImage[3*pixel+1] < min) min = m_longMeanImage[3*pixel+1];
-                    if (m_longMeanImage[3*pixel+1] > max) max = m_longMeanImage[3*pixel+1];
-                    if (m_longMeanImage[3*pixel+2] < min) min = m_longMeanImage[3*pixel+2];
-                    if (m_longMeanImage[3*pixel+2] > max) max = m_longMeanImage[3*pixel+2];
+                    min = mean(pixel, 0);
+                    max = mean(pixel, 0);
+                    if (mean(pixel, 1) < min) min = mean(pixel, 1);
+                    if (mean(pixel, 1) > max) max = mean(pixel, 1);
+                    if (mean(pixel, 2) < min) min = mean(pixel, 2);
+                    if (mean(pixel, 2) > max) max = mean(pixel, 2);
                     if (min == 0) { out[pixel] = 0; }
                     else {
                         temp = 255.0*(max-min)/(float)max;
@@ -529,12 +537,12 @@ public:
                     if (max < 0x80) {
                         out[pixel] = RGBA(0,0,0,0xFF);
                     } else {
-                        min = m_longMeanImage[3*pixel+0];
-                        max = m_longMeanImage[3*pixel+0];
-                        if (m_longMeanImage[3*pixel+1] < min) min = m_longMeanImage[3*pixel+1];
-                        if (m_longMeanImage[3*pixel+1] > max) max = m_longMeanImage[3*pixel+1];
-                        if (m_longMeanImage[3*pixel+2] < min) min = m_longMeanImage[3*pixel+2];
-                        if (m_longMeanImage[3*pixel+2] > max) max = m_longMeanImage[3*pixel+2];
+                        min = mean(pixel, 0);
+                        max = mean(pixel, 0);
+                        if (mean(pixel, 1) < min) min = mean(pixel, 1);
+                        if (mean(pixel, 1) > max) max = mean(pixel, 1);
+                        if (mean(pixel, 2) < min) min = mean(pixel, 2);
+                        if (mean(pixel, 2) > max) max = mean(pixel, 2);
                         if (min == 0) { out[pixel] = 0; }
                         else {
                             temp = 255.0*(max-min)/(float)max;
@@ -567,11 +575,11 @@ public:
                 maxDiff = 0;
                 temp = 0;
                 for (unsigned int pixel = 0; pixel < width*height; pixel++) {
-                    r = 0x7f + (GETR(out[pixel]) - m_longMeanImage[3*pixel+0])/2;
+                    r = 0x7f + (GETR(out[pixel]) - mean(pixel, 0))/2;
                     r = CLAMP(r);
-                    g = 0x7f + (GETG(out[pixel]) - m_longMeanImage[3*pixel+1])/2;
+                    g = 0x7f + (GETG(out[pixel]) - mean(pixel, 1))/2;
                     g = CLAMP(g);
-                    b = 0x7f + (GETB(out[pixel]) - m_longMeanImage[3*pixel+2])/2;
+                    b = 0x7f + (GETB(out[pixel]) - mean(pixel, 2))/2;
                     b = CLAMP(b);
 
                     out[pixel] = RGBA(r,g,b,0xFF);
@@ -580,19 +588,19 @@ public:
             case Graffiti_LongAvg:
                 for (unsigned int pixel = 0; pixel < width*height; pixel++) {
 
-                    r = 0x7f + (GETR(out[pixel]) - m_longMeanImage[3*pixel+0]);
+                    r = 0x7f + (GETR(out[pixel]) - mean(pixel, 0));
                     r = CLAMP(r);
                     max = GETR(out[pixel]);
                     maxDiff = r;
                     temp = r;
 
-                    g = 0x7f + (GETG(out[pixel]) - m_longMeanImage[3*pixel+1]);
+                    g = 0x7f + (GETG(out[pixel]) - mean(pixel, 1));
                     g = CLAMP(g);
                     if (maxDiff < g) maxDiff = g;
                     if (max < GETG(out[pixel])) max = GETG(out[pixel]);
                     temp += g;
 
-                    b = 0x7f + (GETB(out[pixel]) - m_longMeanImage[3*pixel+2]);
+                    b = 0x7f + (GETB(out[pixel]) - mean(pixel, 2));
                     b = CLAMP(b);
                     if (maxDiff < b) maxDiff = b;
                     if (max < GETB(out[pixel])) max = GETB(out[pixel]);
@@ -601,13 +609,13 @@ public:
                     if (maxDiff > 0xe0 && temp > 0xe0 + 0xd0 + 0x80) {
                         m_lightMask[pixel] = MAX(m_lightMask[pixel], out[pixel]);
 
-                        m_alphaMap[4*pixel+0] = 2*(GETR(out[pixel])-m_longMeanImage[3*pixel+0]);
+                        m_alphaMap[4*pixel+0] = 2*(GETR(out[pixel])-mean(pixel, 0));
                         m_alphaMap[4*pixel+0] = CLAMP(m_alphaMap[4*pixel+0])/255.0;
 
-                        m_alphaMap[4*pixel+1] = 2*(GETG(out[pixel])-m_longMeanImage[3*pixel+1]);
+                        m_alphaMap[4*pixel+1] = 2*(GETG(out[pixel])-mean(pixel, 1));
                         m_alphaMap[4*pixel+1] = CLAMP(m_alphaMap[4*pixel+1])/255.0;
 
-                        m_alphaMap[4*pixel+2] = 2*(GETB(out[pixel])-m_longMeanImage[3*pixel+2]);
+                        m_alphaMap[4*pixel+2] = 2*(GETB(out[pixel])-mean(pixel, 2));
                         m_alphaMap[4*pixel+2] = CLAMP(m_alphaMap[4*pixel+2])/255.0;
 
                         m_alphaMap[4*pixel+3] = 1;
@@ -627,19 +635,19 @@ public:
             case Graffiti_LongAvgAlpha_Stat:
                 for (unsigned int pixel = 0; pixel < width*height; pixel++) {
 
-                    r = 0x7f + (GETR(out[pixel]) - m_longMeanImage[3*pixel+0]);
+                    r = 0x7f + (GETR(out[pixel]) - mean(pixel, 0));
                     r = CLAMP(r);
                     max = GETR(out[pixel]);
                     maxDiff = r;
                     temp = r;
 
-                    g = 0x7f + (GETG(out[pixel]) - m_longMeanImage[3*pixel+1]);
+                    g = 0x7f + (GETG(out[pixel]) - mean(pixel, 1));
                     g = CLAMP(g);
                     if (maxDiff < g) maxDiff = g;
                     if (max < GETG(out[pixel])) max = GETG(out[pixel]);
                     temp += g;
 
-                    b = 0x7f + (GETB(out[pixel]) - m_longMeanImage[3*pixel+2]);
+                    b = 0x7f + (GETB(out[pixel]) - mean(pixel, 2));
                     b = CLAMP(b);
                     if (maxDiff < b) maxDiff = b;
                     if (max < GETB(out[pixel])) max = GETB(out[pixel]);
@@ -648,15 +656,15 @@ public:
                     if (maxDiff > 0xe0 && temp > 0xe0 + 0xd0 + 0x80) {
                         m_lightMask[pixel] = MAX(m_lightMask[pixel], out[pixel]);
 
-                        f = 2*(GETR(out[pixel])-m_longMeanImage[3*pixel+0]);
+                        f = 2*(GETR(out[pixel])-mean(pixel, 0));
                         f = CLAMP(f)/255.0;
                         if (f > m_alphaMap[4*pixel+0]) m_alphaMap[4*pixel+0] = f;
 
-                        f = 2*(GETG(out[pixel])-m_longMeanImage[3*pixel+1]);
+                        f = 2*(GETG(out[pixel])-mean(pixel, 1));
                         f = CLAMP(f)/255.0;
                         if (f > m_alphaMap[4*pixel+1]) m_alphaMap[4*pixel+1] = f;
 
-                        f = 2*(GETB(out[pixel])-m_longMeanImage[3*pixel+2]);
+                        f = 2*(GETB(out[pixel])-mean(pixel, 2));
                         f = CLAMP(f)/255.0;
                         if (f > m_alphaMap[4*pixel+2]) m_alphaMap[4*pixel+2] = f;
 
@@ -671,19 +679,19 @@ public:
             case Graffiti_LongAvgAlpha:
                 for (unsigned int pixel = 0; pixel < width*height; pixel++) {
 
-                    r = 0x7f + (GETR(out[pixel]) - m_longMeanImage[3*pixel+0]);
+                    r = 0x7f + (GETR(out[pixel]) - mean(pixel, 0));
                     r = CLAMP(r);
                     max = GETR(out[pixel]);
                     maxDiff = r;
                     temp = r;
 
-                    g = 0x7f + (GETG(out[pixel]) - m_longMeanImage[3*pixel+1]);
+                    g = 0x7f + (GETG(out[pixel]) - mean(pixel, 1));
                     g = CLAMP(g);
                     if (maxDiff < g) maxDiff = g;
                     if (max < GETG(out[pixel])) max = GETG(out[pixel]);
                     temp += g;
 
-                    b = 0x7f + (GETB(out[pixel]) - m_longMeanImage[3*pixel+2]);
+                    b = 0x7f + (GETB(out[pixel]) - mean(pixel, 2));
                     b = CLAMP(b);
                     if (maxDiff < b) maxDiff = b;
                     if (max < GETB(out[pixel])) max = GETB(out[pixel]);
@@ -692,17 +700,17 @@ public:
                     if (maxDiff > 0xe0 && temp > 0xe0 + 0xd0 + 0x80) {
                         m_lightMask[pixel] = MAX(m_lightMask[pixel], out[pixel]);
 
-                        f = 2*(GETR(out[pixel])-m_longMeanImage[3*pixel+0]);
+                        f = 2*(GETR(out[pixel])-mean(pixel, 0));
                         f = CLAMP(f)/255.0;
                         f *= f;
                         if (f > m_alphaMap[4*pixel+0]) m_alphaMap[4*pixel+0] = f;
 
-                        f = 2*(GETG(out[pixel])-m_longMeanImage[3*pixel+1]);
+                        f = 2*(GETG(out[pixel])-mean(pixel, 1));
                         f = CLAMP(f)/255.0;
                         f *= f;
                         if (f > m_alphaMap[4*pixel+1]) m_alphaMap[4*pixel+1] = f;
 
-                        f = 2*(GETB(out[pixel])-m_longMeanImage[3*pixel+2]);
+                        f = 2*(GETB(out[pixel])-mean(pixel, 2));
                         f = CLAMP(f)/255.0;
                         f *= f;
                         if (f > m_alphaMap[4*pixel+2]) m_alphaMap[4*pixel+2] = f;
@@ -730,316 +738,455 @@ public:
                     Maybe: Logarithmic scale? → Overexposure becomes harder
                     log(alpha/factor + 1) or sqrt(alpha/factor)
                   */
-                for (unsigned int pixel = 0; pixel < width*height; pixel++) {
+                {
+                    // One pass over the image doing background averaging, dimming,
+                    // light detection and painting for each pixel.
+                    LightParams p;
+                    p.average = average;
+                    p.alpha = m_pLongAlpha;
+                    p.dim = dim;
+                    p.dimSin = (m_dimMode == Dim_Sin);
+                    p.factor = factor;
+                    p.sensitivity = sensitivity;
+                    p.saturation = saturation;
+                    p.lowerOverexposure = lowerOverexposure;
+                    p.backgroundWeight = m_pBackgroundWeight;
+                    // Sums and differences are integers, so they can be compared to the thresholds' floor.
+                    p.thresholdBrightness = (int) floor(thresholdBrightness);
+                    p.thresholdDifference = (int) floor(thresholdDifference);
+                    p.thresholdDiffSum = (int) floor(thresholdDiffSum);
+
+                    unsigned int pixel = 0;
+#if defined(__SSE2__) && !defined(LG_NO_OVERLAY)
+                    if (!m_pStatsBrightness && !m_pStatsDiff && !m_pStatsDiffSum) {
+                        for (; pixel + 4 <= width*height; pixel += 4) {
+                            lightPixels4(pixel, in, out, p);
+                        }
+                    }
+#endif
+                    for (; pixel < width*height; pixel++) {
+                        lightPixel(pixel, in, out, p);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
 
-                    /*
-                     Light detection
-                     */
+private:
+    struct LightParams {
+        bool average;                   // Move the background mean towards the image
+        float alpha;
+        bool dim;
+        bool dimSin;
+        float factor;
+        float sensitivity;
+        float saturation;
+        float lowerOverexposure;
+        float backgroundWeight;
+        int thresholdBrightness;
+        int thresholdDifference;
+        int thresholdDiffSum;
+    };
+
+    float mean(unsigned int pixel, int c) const
+    {
+        return m_longMeanImage[c][pixel] * (1/256.f);
+    }
 
-                    // maxDiff: Maximum difference to the mean image
-                    //          {-255,...,255}
-                    // max:     Maximum pixel value
-                    //          {0,...,255}
-                    // temp:    Sum of all differences
-                    //          {-3*255,...,3*255}
-                    // sum:     Sum of all pixel values
-                    //          {0,...,3*255}
+    // Nonlinear dimming, pow(sin(x*pi/2), dim) - .01 interpolated from the table.
+    // Below the first table step the curve is too steep for that; those values
+    // are about to vanish and are rare, so they are calculated.
+    float dimSin(float x, float factor) const
+    {
+        if (x <= 0) {
+            return 0;
+        }
+        if (x < 1.f/DIM_TABLE) {
+            x *= pow(sin(x * M_PI/2), m_dimTableDim) - .01;
+        } else if (x < 1) {
+            float t = x * DIM_TABLE;
+            int i = (int) t;
+            x *= m_dimTable[i] + (t - i) * (m_dimTable[i+1] - m_dimTable[i]);
+        } else {
+            x *= factor;
+        }
+        if (x < 0) { x = 0; }
+        return x;
+    }
 
-                    r = GETR(out[pixel]) - m_longMeanImage[3*pixel+0];
-                    maxDiff = r;
-                    max = GETR(out[pixel]);
-                    temp = r;
+    void showStats(uint32_t &px, int sum, int maxDiff, int temp,
+                   double thresholdBrightness, double thresholdDifference, double thresholdDiffSum) const
+    {
+        int r = 0, g = 0, b = 0;
+
+        if (m_pStatsBrightness) {
+            // Show the image's brightness and highlight the threshold set by the user
+
+            // Limit maximum brightness to 80% for still being able to distinguish
+            // between «bright spot» (light grey) and «over the threshold» (blue)
+            r = .8*sum/3;
+            g = .8*sum/3;
+            b = .8*sum/3;
+            if (sum > thresholdBrightness) {
+                b = 255;
+            }
+            px = RGBA(r,g,b,0xFF);
+        }
 
-                    g = GETG(out[pixel]) - m_longMeanImage[3*pixel+1];
-                    if (max < GETG(out[pixel])) {
-                        max = GETG(out[pixel]);
-                    }
-                    if (maxDiff < g) {
-                        maxDiff = g;
-                    }
-                    temp += g;
+        if (m_pStatsDiff) {
+            // As above, but for the brightness difference relative to the background.
+            r = .8*CLAMP(maxDiff);
+            g = r;
+            if (!m_pStatsBrightness) {
+                b = r;
+            }
 
-                    b = GETB(out[pixel]) - m_longMeanImage[3*pixel+2];
-                    if (max < GETB(out[pixel])) {
-                        max = GETB(out[pixel]);
-                    }
-                    if (maxDiff < b) {
-                        maxDiff = b;
-                    }
-                    temp += b;
+            if (maxDiff > thresholdDifference) {
+                g = 255;
+            }
+            px = RGBA(r,g,b,0xFF);
+        }
 
-                    sum = GETR(out[pixel]) + GETG(out[pixel]) + GETB(out[pixel]);
+        if (m_pStatsDiffSum) {
+            // As above, for the sum of the differences in each color channel.
+            r = .8*CLAMP(temp/3.0);
+            if (!m_pStatsDiff) {
+                g = r;
+            }
+            if (!m_pStatsBrightness) {
+                b = r;
+            }
+            if (temp > thresholdDiffSum) {
+                r = 255;
+            }
+            px = RGBA(r,g,b,0xFF);
+        }
+    }
 
-                    if (
-                            maxDiff > thresholdDifference
-                            && temp > thresholdDiffSum
-                            && sum > thresholdBrightness
-                            // If all requirements are met, then this should be a light source.
-                        )
-                    {
-#ifdef LG_ADV
-                        // Just add values as float. Overflows are highly unlikely (3.4E38+ frames ...).
-                        fr = CLAMP(r)/255.0;
-                        fg = CLAMP(g)/255.0;
-                        fb = CLAMP(b)/255.0;
-
-                        f = (fr + fg + fb) / 3 * sensitivity;
-                        fr *= f;
-                        fg *= f;
-                        fb *= f;
+    // Light graffiti for one pixel (Graffiti_LongAvgAlphaCumC)
+    void lightPixel(unsigned int pixel, const uint32_t *in, uint32_t *out, const LightParams &p)
+    {
+        uint32_t px = in[pixel];
+        unsigned int x[3] = { GETR(px), GETG(px), GETB(px) };
+        float mf[3], fc[3];
+        int d[3];
+
+        for (int c = 0; c < 3; c++) {
+            int m = m_longMeanImage[c][pixel];
+            if (p.average) {
+                m = lg_mean_step(m, x[c], p.alpha);
+                m_longMeanImage[c][pixel] = m;
+            }
+            mf[c] = m * (1/256.f);
+            d[c] = (int) ((float) x[c] - mf[c]);
 
-#ifdef LG_NO_OVERLAY
-//                        std::cout << "fr: " << fr << "; fg: " << fg << "; fb: " << fb << "\n";
-                        fr -= m_prevMask[pixel].r;
-                        fg -= m_prevMask[pixel].g;
-                        fb -= m_prevMask[pixel].b;
-                        m_prevMask[pixel].r += fr;
-                        m_prevMask[pixel].g += fg;
-                        m_prevMask[pixel].b += fb;
-//                        std::cout << "fr2: " << fr << "; fg2: " << fg << "; fb2: " << fb << "\n";
-                        if (fr < 0) { fr = 0; }
-                        if (fg < 0) { fg = 0; }
-                        if (fb < 0) { fb = 0; }
-#endif
+            fc[c] = m_rgbLightMask[c][pixel];
+            if (p.dim) {
+                fc[c] = p.dimSin ? dimSin(fc[c], p.factor) : fc[c] * p.factor;
+            }
+        }
 
-                        m_rgbLightMask[pixel].r += fr;
-                        m_rgbLightMask[pixel].g += fg;
-                        m_rgbLightMask[pixel].b += fb;
+        /*
+         Light detection
+         */
 
-#else
-                        // Store the «additional» light delivered by the light source in the light mask.
-                        color = RGBA(CLAMP(r), CLAMP(g), CLAMP(b),0xFF);
-                        m_lightMask[pixel] = MAX(m_lightMask[pixel], color);
+        // maxDiff: Maximum difference to the mean image
+        //          {-255,...,255}
+        // temp:    Sum of all differences
+        //          {-3*255,...,3*255}
+        // sum:     Sum of all pixel values
+        //          {0,...,3*255}
+        int maxDiff = std::max(d[0], std::max(d[1], d[2]));
+        int temp = d[0] + d[1] + d[2];
+        int sum = x[0] + x[1] + x[2];
+
+        if (
+                maxDiff > p.thresholdDifference
+                && temp > p.thresholdDiffSum
+                && sum > p.thresholdBrightness
+                // If all requirements are met, then this should be a light source.
+            )
+        {
+            // Just add values as float. Overflows are highly unlikely (3.4E38+ frames ...).
+            float fr = CLAMP(d[0]) / 255.f;
+            float fg = CLAMP(d[1]) / 255.f;
+            float fb = CLAMP(d[2]) / 255.f;
+
+            float f = (fr + fg + fb) / 3 * p.sensitivity;
+            fr *= f;
+            fg *= f;
+            fb *= f;
 
-                        // Add the brightness of the light source to the brightness map (alpha map)
-                        y = REC709Y(CLAMP(r), CLAMP(g), CLAMP(b)) / 255.0;
-                        y = y * sensitivity;
-                        m_alphaMap[4*pixel] += y;
-#endif
-                    } else {
 #ifdef LG_NO_OVERLAY
-                        m_prevMask[pixel] = rgb0;
+            fr -= m_prevMask[pixel].r;
+            fg -= m_prevMask[pixel].g;
+            fb -= m_prevMask[pixel].b;
+            m_prevMask[pixel].r += fr;
+            m_prevMask[pixel].g += fg;
+            m_prevMask[pixel].b += fb;
+            if (fr < 0) { fr = 0; }
+            if (fg < 0) { fg = 0; }
+            if (fb < 0) { fb = 0; }
 #endif
-                    }
-
-
-
-                    /*
-                     Background weight
-                     */
-                    if (m_pBackgroundWeight > 0) {
-                        // Use part of the background mean. This allows one to have only lights appearing in the video
-                        // if people or other objects walk into the video after the first frame (darker, therefore not in the light mask).
-                        out[pixel] = RGBA((int) (m_pBackgroundWeight*m_longMeanImage[3*pixel+0] + (1-m_pBackgroundWeight)*GETR(out[pixel])),
-                                          (int) (m_pBackgroundWeight*m_longMeanImage[3*pixel+1] + (1-m_pBackgroundWeight)*GETG(out[pixel])),
-                                          (int) (m_pBackgroundWeight*m_longMeanImage[3*pixel+2] + (1-m_pBackgroundWeight)*GETB(out[pixel])),
-                                          0xFF);
-                    }
 
+            fc[0] += fr;
+            fc[1] += fg;
+            fc[2] += fb;
+        } else {
+#ifdef LG_NO_OVERLAY
+            m_prevMask[pixel].r = 0;
+            m_prevMask[pixel].g = 0;
+            m_prevMask[pixel].b = 0;
+#endif
+        }
 
-                    /*
-                     Adding light mask
-                     */
-#ifdef LG_ADV
-                    if (
-                            (m_rgbLightMask[pixel].r != 0 || m_rgbLightMask[pixel].g != 0 || m_rgbLightMask[pixel].b != 0)
-                            && !m_pStatsBrightness && !m_pStatsDiff && !m_pStatsDiffSum
-                       )
-                    {
-
-                        fr = m_rgbLightMask[pixel].r;
-                        fg = m_rgbLightMask[pixel].g;
-                        fb = m_rgbLightMask[pixel].b;
-
-                        if (lowerOverexposure > 0) {
-                            // Comparisation of plots with octave:
-                            // clf;hold on;plot([0 1],[0 1],'k');plot(range,ones(length(range),1),'k');plot(range,sqrt(range));plot(range,log(1+range),'k');plot(range,log(1+range),'g');plot(range,(log(1+range)/3).^.5,'r');axis equal
-                            fr = pow( log(1+fr)/lowerOverexposure, .5 );
-                            fg = pow( log(1+fg)/lowerOverexposure, .5 );
-                            fb = pow( log(1+fb)/lowerOverexposure, .5 );
-                        }
+        for (int c = 0; c < 3; c++) {
+            m_rgbLightMask[c][pixel] = fc[c];
+        }
 
 
-                        // Calculate overflow between different colours:
-                        // A very bright red light source will eventually overflow into other channels.
-                        sr = 0;
-                        sg = 0;
-                        sb = 0;
-                        if (fr > 1) {
-                            sr += fr - 1;
-                        }
-                        if (fg > 1) {
-                            sg += fg - 1;
-                        }
-                        if (fb > 1) {
-                            sb += fb - 1;
-                        }
-                        fr += (sg + sb)/2;
-                        fg += (sr + sb)/2;
-                        fb += (sg + sb)/2;
-                        if (fr > 1) {
-                            fr = 1;
-                        }
-                        if (fg > 1) {
-                            fg = 1;
-                        }
-                        if (fb > 1) {
-                            fb = 1;
-                        }
+        /*
+         Background weight
+         */
+        if (p.backgroundWeight > 0) {
+            // Use part of the background mean. This allows one to have only lights appearing in the video
+            // if people or other objects walk into the video after the first frame (darker, therefore not in the light mask).
+            px = RGBA((int) (p.backgroundWeight*mf[0] + (1-p.backgroundWeight)*(float) x[0]),
+                      (int) (p.backgroundWeight*mf[1] + (1-p.backgroundWeight)*(float) x[1]),
+                      (int) (p.backgroundWeight*mf[2] + (1-p.backgroundWeight)*(float) x[2]),
+                      0xFFu);
+        }
 
-                        // Increase the saturation if the average brightness is below a certain level
-                        // Do not use Rec709 Luma since we want to consider all colours to equal parts.
-                        fy = (fr + fg + fb) / 3;
-                        if (fy < 1 && saturation > 0) {
-                            fsat = 1 + saturation*(1-fy);
 
-                            fr = fy + fsat * (fr-fy);
-                            fg = fy + fsat * (fg-fy);
-                            fb = fy + fsat * (fb-fy);
-                        }
+        /*
+         Adding light mask
+         */
+        if (
+                (fc[0] != 0 || fc[1] != 0 || fc[2] != 0)
+                && !m_pStatsBrightness && !m_pStatsDiff && !m_pStatsDiffSum
+           )
+        {
+            float fr = fc[0];
+            float fg = fc[1];
+            float fb = fc[2];
+
+            if (p.lowerOverexposure > 0) {
+                // Comparisation of plots with octave:
+                // clf;hold on;plot([0 1],[0 1],'k');plot(range,ones(length(range),1),'k');plot(range,sqrt(range));plot(range,log(1+range),'k');plot(range,log(1+range),'g');plot(range,(log(1+range)/3).^.5,'r');axis equal
+                fr = sqrtf(lg_log(1+fr) / p.lowerOverexposure);
+                fg = sqrtf(lg_log(1+fg) / p.lowerOverexposure);
+                fb = sqrtf(lg_log(1+fb) / p.lowerOverexposure);
+            }
 
-                        // Paint the light on top of the image using addition
-                        // Since brightness is equidistant in sRGB, this works fine.
-                        r = 255*fr + GETR(out[pixel]);
-                        g = 255*fg + GETG(out[pixel]);
-                        b = 255*fb + GETB(out[pixel]);
-                        r = CLAMP(r);
-                        g = CLAMP(g);
-                        b = CLAMP(b);
-                        out[pixel] = RGBA(r,g,b,0xFF);
+            // Calculate overflow between different colours:
+            // A very bright red light source will eventually overflow into other channels.
+            float sr = 0, sg = 0, sb = 0;
+            if (fr > 1) {
+                sr = fr - 1;
+            }
+            if (fg > 1) {
+                sg = fg - 1;
+            }
+            if (fb > 1) {
+                sb = fb - 1;
+            }
+            fr += (sg + sb)/2;
+            fg += (sr + sb)/2;
+            fb += (sg + sb)/2;
+            if (fr > 1) {
+                fr = 1;
+            }
+            if (fg > 1) {
+                fg = 1;
+            }
+            if (fb > 1) {
+                fb = 1;
+            }
 
-#ifdef LG_DEBUG
-                        deCount++;
-                        if (deCount < 10) {
-                            std::cout << "r: " << m_rgbLightMask[pixel].r << ", fy: " << fy << ", fr: " << fr << ", sr: " << sr << ", R: " << r << ", inR: " << GETR(in[pixel]) << "\n";
-                        }
-#endif
+            // Increase the saturation if the average brightness is below a certain level
+            // Do not use Rec709 Luma since we want to consider all colours to equal parts.
+            float fy = (fr + fg + fb) / 3;
+            if (fy < 1 && p.saturation > 0) {
+                float fsat = 1 + p.saturation*(1-fy);
 
-                    } else if (m_pTransparentBackground) {
-                        // Transparent background
-                        out[pixel] &= RGBA(0xFF, 0xFF, 0xFF, 0);
-                    }
-#else
-                    if (
-                            m_lightMask[pixel] != 0  && m_alphaMap[4*pixel + 0] != 0
-                            && !m_pStatsBrightness && !m_pStatsDiff && !m_pStatsDiffSum
-                        )
-                    {
-
-                        f = sqrt(m_alphaMap[4*pixel]);
-
-                        r = f * GETR(m_lightMask[pixel]);
-                        g = f * GETG(m_lightMask[pixel]);
-                        b = f * GETB(m_lightMask[pixel]);
-
-                        if (f > 1) {
-                            // Simulate overexposure
-                            sum = 0;
-                            if (r > 255) {
-                                sum += r-255;
-                            }
-                            if (g > 255) {
-                                sum += g-255;
-                            }
-                            if (b > 255) {
-                                sum += g-255;
-                            }
-
-                            if (sum > 0) {
-                                sum = sum/10.0;
-                                r += sum;
-                                g += sum;
-                                b += sum;
-                            }
-                        } else if (f < 1) {
-                            // Lower exposure: Stronger colors
-                            y = REC709Y(r,g,b);
-                            float sat = 2.0;
-
-                            r = y + sat * (r-y);
-                            g = y + sat * (g-y);
-                            b = y + sat * (b-y);
-                        }
+                fr = fy + fsat * (fr-fy);
+                fg = fy + fsat * (fg-fy);
+                fb = fy + fsat * (fb-fy);
+            }
 
+            // Paint the light on top of the image using addition
+            // Since brightness is equidistant in sRGB, this works fine.
+            int r = 255*fr + GETR(px);
+            int g = 255*fg + GETG(px);
+            int b = 255*fb + GETB(px);
+            r = CLAMP(r);
+            g = CLAMP(g);
+            b = CLAMP(b);
+            px = RGBA(r,g,b,0xFF);
+
+        } else if (m_pTransparentBackground) {
+            // Transparent background
+            px &= RGBA(0xFF, 0xFF, 0xFF, 0);
+        }
 
-                        // Add the light map as additional light to the image
-                        r += GETR(out[pixel]);
-                        g += GETG(out[pixel]);
-                        b += GETB(out[pixel]);
-                        r = CLAMP(r);
-                        g = CLAMP(g);
-                        b = CLAMP(b);
-                        out[pixel] = RGBA(r,g,b,0xFF);
-                    } else if (m_pTransparentBackground) {
-                        // Transparent background
-                        out[pixel] &= RGBA(0xFF, 0xFF, 0xFF, 0);
-                    }
-#endif
+        /*
+         In-video statistics for easier parameter adjustment (thresholds)
+         */
+        showStats(px, sum, maxDiff, temp, p.thresholdBrightness, p.thresholdDifference, p.thresholdDiffSum);
 
+        out[pixel] = px;
+    }
 
-                    /*
-                     In-video statistics for easier parameter adjustment (thresholds)
-                     */
-                    if (m_pStatsBrightness) {
-                        // Show the image's brightness and highlight the threshold set by the user
+#if defined(__SSE2__)
+    // lightPixel() for 4 pixels, without statistics; same results
+    void lightPixels4(unsigned int pixel, const uint32_t *in, uint32_t *out, const LightParams &p)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i cm = _mm_set1_epi32(0xFF);
+        const __m128 fzero = _mm_setzero_ps();
+        const __m128 fone = _mm_set1_ps(1);
+        const __m128 f255 = _mm_set1_ps(255);
+        __m128i px = _mm_loadu_si128((const __m128i*) (in + pixel));
+        __m128i x[3], d[3];
+        __m128 mf[3], fc[3];
+
+        for (int c = 0; c < 3; c++) {
+            x[c] = _mm_and_si128(_mm_srli_epi32(px, 8*c), cm);
+
+            __m128i m = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*) &m_longMeanImage[c][pixel]), zero);
+            if (p.average) {
+                __m128i dm = _mm_sub_epi32(_mm_slli_epi32(x[c], 8), m);
+                __m128i step = _mm_cvtps_epi32(_mm_mul_ps(_mm_set1_ps(p.alpha), _mm_cvtepi32_ps(dm)));
+                __m128i z = _mm_cmpeq_epi32(step, zero);
+                step = _mm_sub_epi32(step, _mm_and_si128(z, _mm_cmpgt_epi32(dm, zero)));
+                step = _mm_add_epi32(step, _mm_and_si128(z, _mm_cmpgt_epi32(zero, dm)));
+                m = _mm_add_epi32(m, step);
+                _mm_storel_epi64((__m128i*) &m_longMeanImage[c][pixel], lg_pack_mean(m));
+            }
+            mf[c] = _mm_mul_ps(_mm_cvtepi32_ps(m), _mm_set1_ps(1/256.f));
+            d[c] = _mm_cvttps_epi32(_mm_sub_ps(_mm_cvtepi32_ps(x[c]), mf[c]));
+
+            fc[c] = _mm_loadu_ps(&m_rgbLightMask[c][pixel]);
+            if (p.dim) {
+                if (p.dimSin) {
+                    // No gather in SSE2, the table is read per value
+                    float v[4];
+                    _mm_storeu_ps(v, fc[c]);
+                    fc[c] = _mm_setr_ps(dimSin(v[0], p.factor), dimSin(v[1], p.factor),
+                                        dimSin(v[2], p.factor), dimSin(v[3], p.factor));
+                } else {
+                    fc[c] = _mm_mul_ps(fc[c], _mm_set1_ps(p.factor));
+                }
+            }
+        }
 
-                        // Limit maximum brightness to 80% for still being able to distinguish
-                        // between «bright spot» (light grey) and «over the threshold» (blue)
-                        r = .8*sum/3;
-                        g = .8*sum/3;
-                        b = .8*sum/3;
-                        if (sum > thresholdBrightness) {
-                            b = 255;
-                        }
-                        out[pixel] = RGBA(r,g,b,0xFF);
-                    }
+        // Light detection
+        __m128i maxDiff = d[0];
+        for (int c = 1; c < 3; c++) {
+            __m128i gt = _mm_cmpgt_epi32(d[c], maxDiff);
+            maxDiff = _mm_or_si128(_mm_and_si128(gt, d[c]), _mm_andnot_si128(gt, maxDiff));
+        }
+        __m128i temp = _mm_add_epi32(_mm_add_epi32(d[0], d[1]), d[2]);
+        __m128i sum = _mm_add_epi32(_mm_add_epi32(x[0], x[1]), x[2]);
+        __m128 light = _mm_castsi128_ps(_mm_and_si128(_mm_and_si128(
+                        _mm_cmpgt_epi32(maxDiff, _mm_set1_epi32(p.thresholdDifference)),
+                        _mm_cmpgt_epi32(temp, _mm_set1_epi32(p.thresholdDiffSum))),
+                        _mm_cmpgt_epi32(sum, _mm_set1_epi32(p.thresholdBrightness))));
+
+        if (_mm_movemask_ps(light)) {
+            __m128 fl[3];
+            for (int c = 0; c < 3; c++) {
+                fl[c] = _mm_min_ps(_mm_max_ps(_mm_cvtepi32_ps(d[c]), fzero), f255);
+                fl[c] = _mm_div_ps(fl[c], f255);
+            }
+            __m128 f = _mm_div_ps(_mm_add_ps(_mm_add_ps(fl[0], fl[1]), fl[2]), _mm_set1_ps(3));
+            f = _mm_mul_ps(f, _mm_set1_ps(p.sensitivity));
+            for (int c = 0; c < 3; c++) {
+                fc[c] = _mm_add_ps(fc[c], _mm_and_ps(light, _mm_mul_ps(fl[c], f)));
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            _mm_storeu_ps(&m_rgbLightMask[c][pixel], fc[c]);
+        }
 
-                    if (m_pStatsDiff) {
-                        // As above, but for the brightness difference relative to the background.
-                        r = .8*CLAMP(maxDiff);
-                        g = r;
-                        if (!m_pStatsBrightness) {
-                            b = r;
-                        }
+        // Background weight
+        if (p.backgroundWeight > 0) {
+            __m128 w = _mm_set1_ps(p.backgroundWeight);
+            __m128 w1 = _mm_set1_ps(1-p.backgroundWeight);
+            for (int c = 0; c < 3; c++) {
+                x[c] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(w, mf[c]), _mm_mul_ps(w1, _mm_cvtepi32_ps(x[c]))));
+            }
+            px = _mm_or_si128(_mm_or_si128(x[0], _mm_slli_epi32(x[1], 8)),
+                              _mm_or_si128(_mm_slli_epi32(x[2], 16), _mm_set1_epi32(0xFF000000)));
+        }
 
-                        if (maxDiff > thresholdDifference) {
-                            g = 255;
-                        }
-                        out[pixel] = RGBA(r,g,b,0xFF);
-                    }
+        // Adding light mask
+        __m128 nz = _mm_or_ps(_mm_or_ps(_mm_cmpneq_ps(fc[0], fzero), _mm_cmpneq_ps(fc[1], fzero)),
+                              _mm_cmpneq_ps(fc[2], fzero));
+        __m128i lit = px;
+        if (_mm_movemask_ps(nz)) {
+            __m128 fs[3];
+            if (p.lowerOverexposure > 0) {
+                __m128 lo = _mm_set1_ps(p.lowerOverexposure);
+                for (int c = 0; c < 3; c++) {
+                    fc[c] = _mm_sqrt_ps(_mm_div_ps(lg_log_sse2(_mm_add_ps(fone, fc[c])), lo));
+                }
+            }
+            for (int c = 0; c < 3; c++) {
+                fs[c] = _mm_max_ps(_mm_sub_ps(fc[c], fone), fzero);
+            }
+            __m128 half = _mm_set1_ps(.5f);
+            fc[0] = _mm_add_ps(fc[0], _mm_mul_ps(_mm_add_ps(fs[1], fs[2]), half));
+            fc[1] = _mm_add_ps(fc[1], _mm_mul_ps(_mm_add_ps(fs[0], fs[2]), half));
+            fc[2] = _mm_add_ps(fc[2], _mm_mul_ps(_mm_add_ps(fs[1], fs[2]), half));
+            for (int c = 0; c < 3; c++) {
+                fc[c] = _mm_min_ps(fc[c], fone);
+            }
 
-                    if (m_pStatsDiffSum) {
-                        // As above, for the sum of the differences in each color channel.
-                        r = .8*CLAMP(temp/3.0);
-                        if (!m_pStatsDiff) {
-                            g = r;
-                        }
-                        if (!m_pStatsBrightness) {
-                            b = r;
-                        }
-                        if (temp > thresholdDiffSum) {
-                            r = 255;
-                        }
-                        out[pixel] = RGBA(r,g,b,0xFF);
-                    }
+            if (p.saturation > 0) {
+                __m128 fy = _mm_div_ps(_mm_add_ps(_mm_add_ps(fc[0], fc[1]), fc[2]), _mm_set1_ps(3));
+                __m128 dark = _mm_cmplt_ps(fy, fone);
+                __m128 fsat = _mm_add_ps(fone, _mm_mul_ps(_mm_set1_ps(p.saturation), _mm_sub_ps(fone, fy)));
+                for (int c = 0; c < 3; c++) {
+                    __m128 v = _mm_add_ps(fy, _mm_mul_ps(fsat, _mm_sub_ps(fc[c], fy)));
+                    fc[c] = _mm_or_ps(_mm_and_ps(dark, v), _mm_andnot_ps(dark, fc[c]));
                 }
-                break;
-            default:
-                break;
+            }
+
+            for (int c = 0; c < 3; c++) {
+                __m128 v = _mm_add_ps(_mm_mul_ps(f255, fc[c]), _mm_cvtepi32_ps(x[c]));
+                x[c] = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(v, fzero), f255));
+            }
+            lit = _mm_or_si128(_mm_or_si128(x[0], _mm_slli_epi32(x[1], 8)),
+                               _mm_or_si128(_mm_slli_epi32(x[2], 16), _mm_set1_epi32(0xFF000000)));
+        }
+        if (m_pTransparentBackground) {
+            // Transparent background
+            px = _mm_and_si128(px, _mm_set1_epi32(0x00FFFFFF));
         }
+        __m128i m = _mm_castps_si128(nz);
+        _mm_storeu_si128((__m128i*) (out + pixel), _mm_or_si128(_mm_and_si128(m, lit), _mm_andnot_si128(m, px)));
     }
+#endif
 
-private:
     std::vector<uint32_t> m_lightMask;
-    std::vector<float> m_longMeanImage;
+    // Background mean as R, G, B planes in 8.8 fixed point
+    std::vector<uint16_t> m_longMeanImage[3];
     std::vector<float> m_alphaMap;
     bool m_meanInitialized;
     GraffitiMode m_mode;
     DimMode m_dimMode;
 
-#ifdef LG_ADV
-    std::vector<RGBFloat> m_rgbLightMask;
-#endif
+    // pow(sin(x*pi/2), dim) - .01 for x in [0,1], for nonlinear dimming
+    float m_dimTable[DIM_TABLE+1];
+    double m_dimTableDim;
+
+    // Summed up light as R, G, B planes. Stays float: the sums grow over
+    // the whole session and are dimmed by factors close to 1, which half
+    // floats or 16 bit fixed point would round away.
+    std::vector<float> m_rgbLightMask[3];
 #ifdef LG_NO_OVERLAY
     std::vector<RGBFloat> m_prevMask;
 #endif
@@ -1068,5 +1215,5 @@ private:
 frei0r::construct<LightGraffiti> plugin("Light Graffiti",
                 "Creates light graffitis from a video by keeping the brightest spots.",
                 "Simon A. Eugster (Granjow)",
-                0,3,
+                0,4,
                 F0R_COLOR_MODEL_RGBA8888);
@@ -37,6 +37,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+#include "frei0r_threads.h"
 
 /* Intrinsic declarations */
 #if defined(__SSE2__) || defined(__MMX__)
@@ -171,6 +175,18 @@ static inline void histogram_sub( const uint16_t x[16], uint16_t y[16] )
 }
 #endif
 
+/**
+ * Adds \a a times histogram \a x to \a y. Makes use of SSE2, if available.
+ */
+#if defined(__SSE2__)
+static inline void histogram_muladd( const uint16_t a, const uint16_t x[16],
+        uint16_t y[16] )
+{
+    const __m128i f = _mm_set1_epi16( a );
+    *(__m128i*) &y[0] = _mm_add_epi16( *(__m128i*) &y[0], _mm_mullo_epi16( f, *(__m128i*) &x[0] ) );
+    *(__m128i*) &y[8] = _mm_add_epi16( *(__m128i*) &y[8], _mm_mullo_epi16( f, *(__m128i*) &x[8] ) );
+}
+#else
 static inline void histogram_muladd( const uint16_t a, const uint16_t x[16],
         uint16_t y[16] )
 {
@@ -179,13 +195,20 @@ static inline void histogram_muladd( const uint16_t a, const uint16_t x[16],
         y[i] += a * x[i];
     }
 }
+#endif
 
+/**
+ * Filters rows \a i0 to \a i1-1 of one stripe. The column histograms
+ * start out with the rows above \a i0, so the rows of a stripe can be
+ * split into bands that are done independently, with the same result.
+ */
 static void ctmf_helper(
         const unsigned char* const src, unsigned char* const dst,
         const int width, const int height,
         const int src_step, const int dst_step,
-        const int r, const int cn,
-        const int pad_left, const int pad_right
+        const int r, const int cn, const int ps,
+        const int pad_left, const int pad_right,
+        const int i0, const int i1
         )
 {
     const int m = height, n = width;
@@ -214,36 +237,34 @@ static void ctmf_helper(
     h_fine   = (uint16_t*) calloc( 16 * 16 * n * cn, sizeof(uint16_t) );
 #endif
 
-    /* First row initialization */
-    for ( j = 0; j < n; ++j ) {
-        for ( c = 0; c < cn; ++c ) {
-            COP( c, j, src[cn*j+c], += r+1 );
-        }
-    }
-    for ( i = 0; i < r; ++i ) {
+    /* First row initialization: rows i0-r-1 to i0+r-1, the ones above the
+     * image repeating the first (the loop below drops i0-r-1 and adds
+     * i0+r) */
+    for ( i = i0-r-1; i < i0+r; ++i ) {
+        p = src + src_step * MIN( m-1, MAX( 0, i ) );
         for ( j = 0; j < n; ++j ) {
             for ( c = 0; c < cn; ++c ) {
-                COP( c, j, src[src_step*i+cn*j+c], ++ );
+                COP( c, j, p[ps*j+c], ++ );
             }
         }
     }
 
-    for ( i = 0; i < m; ++i ) {
+    for ( i = i0; i < i1; ++i ) {
 
         /* Update column histograms for entire row. */
         p = src + src_step * MAX( 0, i-r-1 );
-        q = p + cn * n;
-        for ( j = 0; p != q; ++j ) {
-            for ( c = 0; c < cn; ++c, ++p ) {
-                COP( c, j, *p, -- );
+        q = p + ps * n;
+        for ( j = 0; p != q; ++j, p += ps ) {
+            for ( c = 0; c < cn; ++c ) {
+                COP( c, j, p[c], -- );
             }
         }
 
         p = src + src_step * MIN( m-1, i+r );
-        q = p + cn * n;
-        for ( j = 0; p != q; ++j ) {
-            for ( c = 0; c < cn; ++c, ++p ) {
-                COP( c, j, *p, ++ );
+        q = p + ps * n;
+        for ( j = 0; p != q; ++j, p += ps ) {
+            for ( c = 0; c < cn; ++c ) {
+                COP( c, j, p[c], ++ );
             }
         }
 
@@ -309,7 +330,7 @@ static void ctmf_helper(
                 for ( b = 0; b < 16 ; ++b ) {
                     sum += segment[b];
                     if ( sum > t ) {
-                        dst[dst_step*i+cn*j+c] = 16*k + b;
+                        dst[dst_step*i+ps*j+c] = 16*k + b;
                         break;
                     }
                 }
@@ -328,6 +349,47 @@ static void ctmf_helper(
 #endif
 }
 
+/**
+ * Returns the size of the L2 cache in bytes, as reported by the system, or
+ * \a fallback if it is not known. Meant as the \a memsize of ctmf().
+ */
+static long unsigned int ctmf_cache_size( const long unsigned int fallback )
+{
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    long size = sysconf( _SC_LEVEL2_CACHE_SIZE );
+    if ( size > 0 ) {
+        return (long unsigned int) size;
+    }
+#endif
+    return fallback;
+}
+
+/**
+ * The stripes of one ctmf() call, and its arguments. Job k is band
+ * k / stripes of stripe k % stripes.
+ */
+typedef struct
+{
+    const unsigned char *src;
+    unsigned char *dst;
+    int width, height, src_step, dst_step, r, cn, ps;
+    int stripes, bands;
+    int *start, *size;
+} ctmf_jobs;
+
+static void ctmf_job( void *arg, int k )
+{
+    const ctmf_jobs *jb = (const ctmf_jobs*) arg;
+    const int s = k % jb->stripes, i = jb->start[s];
+    const int b = k / jb->stripes;
+    const int i0 = (int) ( (long) jb->height * b / jb->bands );
+    const int i1 = (int) ( (long) jb->height * (b+1) / jb->bands );
+
+    ctmf_helper( jb->src + jb->ps*i, jb->dst + jb->ps*i, jb->size[s], jb->height,
+            jb->src_step, jb->dst_step, jb->r, jb->cn, jb->ps,
+            i == 0, jb->size[s] == jb->width - i, i0, i1 );
+}
+
 /**
  * \brief Constant-time median filtering
  *
@@ -359,17 +421,23 @@ static void ctmf_helper(
  *                      2*r+1 square.
  * \param cn            Number of channels. For example, a grayscale image would
  *                      have cn=1 while an RGB image would have cn=3.
+ * \param ps            Distance between adjacent pixels on the same row, in
+ *                      bytes. Normally cn; larger values skip the channels
+ *                      after the first cn, e.g. cn=3, ps=4 leaves alpha
+ *                      of an RGBA image alone.
  * \param memsize       Maximum amount of memory to use, in bytes. Set this to
  *                      the size of the L2 cache, then vary it slightly and
  *                      measure the processing time to find the optimal value.
  *                      For example, a 512 kB L2 cache would have
- *                      memsize=512*1024 initially.
+ *                      memsize=512*1024 initially. ctmf_cache_size() gives
+ *                      the L2 size of the machine we run on.
  */
 void ctmf(
         const unsigned char* const src, unsigned char* const dst,
         const int width, const int height,
         const int src_step, const int dst_step,
-        const int r, const int cn, const long unsigned int memsize
+        const int r, const int cn, const int ps,
+        const long unsigned int memsize
         )
 {
     /*
@@ -400,9 +468,29 @@ void ctmf(
      * Also, note that the leftmost and rightmost stripes don't need overlap.
      * A flag is passed to ctmf_helper() so that it treats these cases as if the
      * image was zero-padded.
+     *
+     * Every column keeps one histogram per channel. The stripes are
+     * independent of each other, each with its own column and kernel
+     * histograms, and so are bands of rows within a stripe; they are
+     * handed out to threads as separate jobs. A band restarts the
+     * column histograms with 2r+1 rows, so bands are kept at least
+     * that high.
      */
-    int stripes = (int) ceil( (double) (width - 2*r) / (memsize / sizeof(Histogram) - 2*r) );
-    int stripe_size = (int) ceil( (double) ( width + stripes*2*r - 2*r ) / stripes );
+    int columns = (int) ( memsize / (cn * sizeof(Histogram)) );
+    int stripes, stripe_size, bands;
+    ctmf_jobs jobs;
+
+    /* At least half of every stripe should be output, not overlap. */
+    columns = MAX( columns, 4*r+2 );
+    stripes = (int) ceil( (double) (width - 2*r) / (columns - 2*r) );
+    stripe_size = (int) ceil( (double) ( width + stripes*2*r - 2*r ) / stripes );
+
+    jobs.start = (int*) malloc( 2 * (stripes + 1) * sizeof(int) );
+    if ( !jobs.start ) {
+        return;
+    }
+    jobs.size = jobs.start + stripes + 1;
+    jobs.stripes = 0;
 
     int i;
 
@@ -413,11 +501,30 @@ void ctmf(
             stripe = width - i;
         }
 
-        ctmf_helper( src + cn*i, dst + cn*i, stripe, height, src_step, dst_step, r, cn,
-                i == 0, stripe == width - i );
+        assert( jobs.stripes <= stripes );
+        jobs.start[jobs.stripes] = i;
+        jobs.size[jobs.stripes++] = stripe;
 
         if ( stripe == width - i ) {
             break;
         }
     }
+
+    /* Enough jobs for every thread, none shorter than 2r+1 rows. */
+    bands = ( thr_count() + jobs.stripes - 1 ) / jobs.stripes;
+    bands = MAX( 1, MIN( bands, height / MAX( 2*r+1, 16 ) ) );
+
+    jobs.src = src;
+    jobs.dst = dst;
+    jobs.width = width;
+    jobs.height = height;
+    jobs.src_step = src_step;
+    jobs.dst_step = dst_step;
+    jobs.r = r;
+    jobs.cn = cn;
+    jobs.ps = ps;
+    jobs.bands = bands;
+    thr_run( jobs.stripes * bands, ctmf_job, &jobs );
+
+    free( jobs.start );
 }
@@ -40,6 +40,11 @@ Copyright (C) 2013  Marko Cebokli    http://lea.hamradio.si/~s57uuu
 #include "small_medians.h"
 #include "ctmf.h"
 
+#if defined(__SSE2__)
+#define LD(p) _mm_loadu_si128((const __m128i*)(p))
+#define ST(p,v) _mm_storeu_si128((__m128i*)(p),(v))
+#endif
+
 
 /* ******************************************
 //The following functions implement these median type filters:
@@ -81,9 +86,25 @@ void cross5(const uint32_t *vs, int w, int h, uint32_t *is)
 {
 int i,j,p;
 uint32_t m[8];
+#if defined(__SSE2__)
+__m128i v[8];
+#endif
 
 for (i=1;i<h-1;i++)
-    for (j=1;j<w-1;j++)
+    {
+    j=1;
+#if defined(__SSE2__)
+    for (;j<w-4;j+=4)
+	{
+	p=i*w+j;
+
+	v[0]=LD(vs+p-w); v[1]=LD(vs+p-1); v[2]=LD(vs+p);
+	v[3]=LD(vs+p+1); v[4]=LD(vs+p+w);
+
+	ST(is+p,median5_sse2(v));
+	}
+#endif
+    for (;j<w-1;j++)
 	{
 	p=i*w+j;
 
@@ -92,6 +113,7 @@ for (i=1;i<h-1;i++)
 
 	is[p]=median5(m);
 	}
+    }
 }
 
 //------------------------------------------------------------
@@ -102,9 +124,26 @@ void sq3x3(const uint32_t *vs, int w, int h, uint32_t *is)
 {
 int i,j,p;
 uint32_t m[16];
+#if defined(__SSE2__)
+__m128i v[16];
+#endif
 
 for (i=1;i<h-1;i++)
-    for (j=1;j<w-1;j++)
+    {
+    j=1;
+#if defined(__SSE2__)
+    for (;j<w-4;j+=4)
+	{
+	p=i*w+j;
+
+	v[0]=LD(vs+p-w-1); v[1]=LD(vs+p-w); v[2]=LD(vs+p-w+1);
+	v[3]=LD(vs+p-1);   v[4]=LD(vs+p);   v[5]=LD(vs+p+1);
+	v[6]=LD(vs+p+w-1); v[7]=LD(vs+p+w); v[8]=LD(vs+p+w+1);
+
+	ST(is+p,median9_sse2(v));
+	}
+#endif
+    for (;j<w-1;j++)
 	{
 	p=i*w+j;
 
@@ -114,6 +153,7 @@ for (i=1;i<h-1;i++)
 
 	is[p]=median9(m);
 	}
+    }
 }
 
 //------------------------------------------------------------
@@ -124,9 +164,30 @@ void bilevel(const uint32_t *vs, int w, int h, uint32_t *is)
 {
 int i,j,p;
 uint32_t m[8],mm[4];
+#if defined(__SSE2__)
+__m128i v[8],vv[4];
+#endif
 
 for (i=1;i<h-1;i++)
-    for (j=1;j<w-1;j++)
+    {
+    j=1;
+#if defined(__SSE2__)
+    for (;j<w-4;j+=4)
+	{
+	p=i*w+j;
+
+	v[0]=LD(vs+p-w-1); v[1]=LD(vs+p-w+1); v[2]=LD(vs+p);
+	v[3]=LD(vs+p+w-1); v[4]=LD(vs+p+w+1);
+	vv[0]=median5_sse2(v);
+	vv[1]=LD(vs+p);
+	v[0]=LD(vs+p-w); v[1]=LD(vs+p-1); v[2]=LD(vs+p);
+	v[3]=LD(vs+p+1); v[4]=LD(vs+p+w);
+	vv[2]=median5_sse2(v);
+
+	ST(is+p,median3_sse2(vv));
+	}
+#endif
+    for (;j<w-1;j++)
 	{
 	p=i*w+j;
 
@@ -140,6 +201,7 @@ for (i=1;i<h-1;i++)
 
 	is[p]=median3(mm);
 	}
+    }
 }
 
 //------------------------------------------------------------
@@ -150,9 +212,27 @@ void dia3x3(const uint32_t *vs, int w, int h, uint32_t *is)
 {
 int i,j,p;
 uint32_t m[16];
+#if defined(__SSE2__)
+__m128i v[16];
+#endif
 
 for (i=2;i<h-2;i++)
-    for (j=2;j<w-2;j++)
+    {
+    j=2;
+#if defined(__SSE2__)
+    for (;j<w-5;j+=4)
+	{
+	p=i*w+j;
+	v[0]=LD(vs+p-2*w); v[1]=LD(vs+p-w-1); v[2]=LD(vs+p-w);
+	v[3]=LD(vs+p-w+1); v[4]=LD(vs+p-2); v[5]=LD(vs+p-1);
+	v[6]=LD(vs+p); v[7]=LD(vs+p+1); v[8]=LD(vs+p+2);
+	v[9]=LD(vs+p+w-1); v[10]=LD(vs+p+w); v[11]=LD(vs+p+w+1);
+	v[12]=LD(vs+p+2*w);
+
+	ST(is+p,median13_sse2(v));
+	}
+#endif
+    for (;j<w-2;j++)
 	{
 	p=i*w+j;
 	m[0]=vs[p-2*w]; m[1]=vs[p-w-1]; m[2]=vs[p-w];
@@ -163,6 +243,7 @@ for (i=2;i<h-2;i++)
 
 	is[p]=median13(m);
 	}
+    }
 }
 
 //------------------------------------------------------------
@@ -173,9 +254,26 @@ void sq5x5(const uint32_t *vs, int w, int h, uint32_t *is)
 {
 int i,j,p;
 uint32_t m[32];
+#if defined(__SSE2__)
+__m128i v[32];
+int k;
+#endif
 
 for (i=2;i<h-2;i++)
-    for (j=2;j<w-2;j++)
+    {
+    j=2;
+#if defined(__SSE2__)
+    for (;j<w-5;j+=4)
+	{
+	p=i*w+j;
+
+	for (k=0;k<25;k++)
+		v[k]=LD(vs+p+(k/5-2)*w+k%5-2);
+
+	ST(is+p,median25_sse2(v));
+	}
+#endif
+    for (;j<w-2;j++)
 	{
 	p=i*w+j;
 
@@ -191,6 +289,7 @@ for (i=2;i<h-2;i++)
 
 	is[p]=median25(m);
 	}
+    }
 }
 
 
@@ -200,8 +299,19 @@ void temp3(uint32_t *s1, uint32_t *s2, uint32_t *s3, int w, int h, uint32_t *is)
 {
 int i;
 uint32_t m[32];
+#if defined(__SSE2__)
+__m128i v[4];
+#endif
 
-for (i=0;i<w*h;i++)
+i=0;
+#if defined(__SSE2__)
+for (;i<w*h-3;i+=4)
+    {
+    v[0]=LD(s1+i); v[1]=LD(s2+i); v[2]=LD(s3+i);
+    ST(is+i,median3_sse2(v));
+    }
+#endif
+for (;i<w*h;i++)
     {
     m[0]=s1[i]; m[1]=s2[i]; m[2]=s3[i];
     is[i]=median3(m);
@@ -215,8 +325,19 @@ void temp5(uint32_t *s1, uint32_t *s2, uint32_t *s3, uint32_t *s4, uint32_t *s5,
 {
 int i;
 uint32_t m[32];
+#if defined(__SSE2__)
+__m128i v[8];
+#endif
 
-for (i=0;i<w*h;i++)
+i=0;
+#if defined(__SSE2__)
+for (;i<w*h-3;i+=4)
+    {
+    v[0]=LD(s1+i); v[1]=LD(s2+i); v[2]=LD(s3+i); v[3]=LD(s4+i); v[4]=LD(s5+i);
+    ST(is+i,median5_sse2(v));
+    }
+#endif
+for (;i<w*h;i++)
     {
     m[0]=s1[i]; m[1]=s2[i]; m[2]=s3[i]; m[3]=s4[i]; m[4]=s5[i];
     is[i]=median5(m);
@@ -225,6 +346,25 @@ for (i=0;i<w*h;i++)
 }
 
 
+#if defined(__SSE2__)
+//------------------------------------------------------------
+//whole pixel max/min of ArceBI, compared as in the scalar
+//code (alpha is equal there, so it is left out of the compare)
+static inline __m128i max_px(__m128i a, __m128i b)
+{
+__m128i rgb=_mm_set1_epi32(0x00FFFFFF);
+__m128i gt=_mm_cmpgt_epi32(_mm_and_si128(b,rgb),_mm_and_si128(a,rgb));
+return _mm_or_si128(_mm_and_si128(gt,b),_mm_andnot_si128(gt,a));
+}
+
+static inline __m128i min_px(__m128i a, __m128i b)
+{
+__m128i rgb=_mm_set1_epi32(0x00FFFFFF);
+__m128i lt=_mm_cmplt_epi32(_mm_and_si128(b,rgb),_mm_and_si128(a,rgb));
+return _mm_or_si128(_mm_and_si128(lt,b),_mm_andnot_si128(lt,a));
+}
+#endif
+
 //------------------------------------------------------------
 //Arce BI	packed char RGB image (uint32_t)
 //s1,s2,s3 = previous, current, next frame
@@ -233,9 +373,44 @@ void ArceBI(uint32_t *s1, uint32_t *s2, uint32_t *s3, int w, int h, uint32_t *is
 {
 int i,j,p;
 uint32_t mm[8],m[16];
+#if defined(__SSE2__)
+__m128i vv[8],v[8];
+#endif
 
 for (i=1;i<h-1;i++)
-    for (j=1;j<w-1;j++)
+    {
+    j=1;
+#if defined(__SSE2__)
+    for (;j<w-4;j+=4)
+	{
+	p=i*w+j;
+//grupa C
+	vv[0]=LD(s1+p);
+//GRUPA W1
+	v[0]=LD(s1+p); v[1]=LD(s2+p-w-1); v[2]=LD(s2+p);
+	v[3]=LD(s2+p+w+1); v[4]=LD(s3+p);
+	vv[3]=median5_sse2(v);
+//grupa W2
+	v[0]=LD(s1+p); v[1]=LD(s2+p-w); v[2]=LD(s2+p);
+	v[3]=LD(s2+p+w); v[4]=LD(s3+p);
+	vv[4]=median5_sse2(v);
+//grupa W3
+	v[0]=LD(s1+p); v[1]=LD(s2+p-1); v[2]=LD(s2+p);
+	v[3]=LD(s2+p+1); v[4]=LD(s3+p);
+	vv[5]=median5_sse2(v);
+//grupa W4
+	v[0]=LD(s1+p); v[1]=LD(s2+p-w+1); v[2]=LD(s2+p);
+	v[3]=LD(s2+p+w-1); v[4]=LD(s3+p);
+	vv[6]=median5_sse2(v);
+//max
+	vv[1]=max_px(max_px(vv[3],vv[4]),max_px(vv[5],vv[6]));
+//min
+	vv[2]=min_px(min_px(vv[3],vv[4]),min_px(vv[5],vv[6]));
+//izhod
+	ST(is+p,median3_sse2(vv));
+	}
+#endif
+    for (;j<w-1;j++)
 	{
 	p=i*w+j;
 //grupa C
@@ -267,6 +442,7 @@ for (i=1;i<h-1;i++)
 //izhod
 	is[p]=median3(mm);
 	}
+    }
 }
 
 
@@ -278,9 +454,34 @@ void ml3d(uint32_t *s1, uint32_t *s2, uint32_t *s3, int w, int h, uint32_t *is)
 {
 int i,j,p;
 uint32_t mm[8],m[16];
+#if defined(__SSE2__)
+__m128i vv[8],v[8];
+#endif
 
 for (i=1;i<h-1;i++)
-    for (j=1;j<w-1;j++)
+    {
+    j=1;
+#if defined(__SSE2__)
+    for (;j<w-4;j+=4)
+	{
+	p=i*w+j;
+//grupa C
+	vv[0]=LD(s1+p);
+//grupa W6
+	v[0]=LD(s1+p); v[1]=LD(s2+p-w-1); v[2]=LD(s2+p-w+1);
+	v[3]=LD(s2+p); v[4]=LD(s2+p+w-1); v[5]=LD(s2+p+w+1);
+	v[6]=LD(s3+p);
+	vv[1]=median7_sse2(v);
+//grupa W5
+	v[0]=LD(s1+p); v[1]=LD(s2+p-w); v[2]=LD(s2+p-1);
+	v[3]=LD(s2+p); v[4]=LD(s2+p+1); v[5]=LD(s2+p+w);
+	v[6]=LD(s3+p);
+	vv[2]=median7_sse2(v);
+//izhod = median medianov
+	ST(is+p,median3_sse2(vv));
+	}
+#endif
+    for (;j<w-1;j++)
 	{
 	p=i*w+j;
 //grupa C
@@ -298,6 +499,7 @@ for (i=1;i<h-1;i++)
 //izhod = median medianov
 	is[p]=median3(mm);
 	}
+    }
 }
 
 //------------------------------------------------------------
@@ -308,9 +510,47 @@ void ml3dex(uint32_t *s1, uint32_t *s2, uint32_t *s3, int w, int h, uint32_t *is
 {
 int i,j,p;
 uint32_t mm[8],m[16];
+#if defined(__SSE2__)
+__m128i vv[8],v[16];
+#endif
 
 for (i=1;i<h-1;i++)
-    for (j=1;j<w-1;j++)
+    {
+    j=1;
+#if defined(__SSE2__)
+    for (;j<w-4;j+=4)
+	{
+	p=i*w+j;
+//grupa W9
+	v[0]=LD(s1+p-w-1); v[1]=LD(s1+p-w+1); v[2]=LD(s1+p);
+	v[3]=LD(s1+p+w-1); v[4]=LD(s1+p+w+1); v[5]=LD(s2+p);
+	v[6]=LD(s3+p-w-1); v[7]=LD(s3+p-w+1); v[8]=LD(s3+p);
+	v[9]=LD(s3+p+w-1); v[10]=LD(s3+p+w+1);
+	vv[0]=median11_sse2(v);
+//grupa W8
+	v[0]=LD(s1+p-w); v[1]=LD(s1+p-1); v[2]=LD(s1+p);
+	v[3]=LD(s1+p+w); v[4]=LD(s1+p+1); v[5]=LD(s2+p);
+	v[6]=LD(s3+p-w); v[7]=LD(s3+p-1); v[8]=LD(s3+p);
+	v[9]=LD(s3+p+w); v[10]=LD(s3+p+1);
+	vv[1]=median11_sse2(v);
+//grupa W7
+	v[0]=LD(s1+p); v[1]=LD(s2+p); v[2]=LD(s3+p);
+	vv[2]=median3_sse2(v);
+//grupa W6
+	v[0]=LD(s1+p); v[1]=LD(s2+p-w-1); v[2]=LD(s2+p-w+1);
+	v[3]=LD(s2+p); v[4]=LD(s2+p+w-1); v[5]=LD(s2+p+w+1);
+	v[6]=LD(s3+p);
+	vv[3]=median7_sse2(v);
+//grupa W5
+	v[0]=LD(s1+p); v[1]=LD(s2+p-w); v[2]=LD(s2+p-1);
+	v[3]=LD(s2+p); v[4]=LD(s2+p+1); v[5]=LD(s2+p+w);
+	v[6]=LD(s3+p);
+	vv[4]=median7_sse2(v);
+//izhod = median medianov
+	ST(is+p,median5_sse2(vv));
+	}
+#endif
+    for (;j<w-1;j++)
 	{
 	p=i*w+j;
 //grupa W9
@@ -341,6 +581,7 @@ for (i=1;i<h-1;i++)
 //izhod = median medianov
 	is[p]=median5(mm);
 	}
+    }
 }
 
 //****************************************************
@@ -355,11 +596,12 @@ int w;
 //parameters
 int type;
 int size;
+long unsigned int memsize;	//for ctmf, L2 cache size
 
 //internal variables
 uint32_t *ppf,*pf,*cf,*nf,*nnf;
 
-//image buffers
+//image buffers, only for the temporal types
 uint32_t *f1;
 uint32_t *f2;
 uint32_t *f3;
@@ -385,6 +627,56 @@ double map_value_backward(float v, float min, float max)
 return (v-min)/(max-min);
 }
 
+//-----------------------------------------------------
+//types 5...9 (Temp3 ... ML3dEX) look at previous frames
+int temporal(int type)
+{
+return (type>=5)&&(type<=9);
+}
+
+//-----------------------------------------------------
+void history_free(inst *in)
+{
+free(in->f1);
+free(in->f2);
+free(in->f3);
+free(in->f4);
+free(in->f5);
+in->f1=in->f2=in->f3=in->f4=in->f5=NULL;
+}
+
+//-----------------------------------------------------
+//allocate the five frame history, all frames set to
+//the current one
+int history_alloc(inst *in, const uint32_t *frame)
+{
+int s;
+
+s=in->w*in->h*sizeof(uint32_t);
+in->f1=malloc(s);
+in->f2=malloc(s);
+in->f3=malloc(s);
+in->f4=malloc(s);
+in->f5=malloc(s);
+if ((in->f1==NULL)||(in->f2==NULL)||(in->f3==NULL)||(in->f4==NULL)||(in->f5==NULL))
+	{
+	history_free(in);
+	return 0;
+	}
+memcpy(in->f1,frame,s);
+memcpy(in->f2,frame,s);
+memcpy(in->f3,frame,s);
+memcpy(in->f4,frame,s);
+memcpy(in->f5,frame,s);
+
+in->ppf=in->f1;
+in->pf=in->f2;
+in->cf=in->f3;
+in->nf=in->f4;
+in->nnf=in->f5;
+return 1;
+}
+
 //***********************************************
 // OBVEZNE FREI0R FUNKCIJE
 
@@ -409,7 +701,7 @@ info->plugin_type=F0R_PLUGIN_TYPE_FILTER;
 info->color_model=F0R_COLOR_MODEL_RGBA8888;
 info->frei0r_version=FREI0R_MAJOR_VERSION;
 info->major_version=0;
-info->minor_version=1;
+info->minor_version=2;
 info->num_params=2;
 info->explanation="Implements several median-type filters";
 }
@@ -450,18 +742,10 @@ in->type=1;
 in->liststr=calloc(1,strlen("Square3x3")+1);
 strcpy(in->liststr,"Square3x3");
 in->size=5;
+in->memsize=ctmf_cache_size(512*1024);
 
-in->f1=calloc(in->w*in->h,sizeof(uint32_t));
-in->f2=calloc(in->w*in->h,sizeof(uint32_t));
-in->f3=calloc(in->w*in->h,sizeof(uint32_t));
-in->f4=calloc(in->w*in->h,sizeof(uint32_t));
-in->f5=calloc(in->w*in->h,sizeof(uint32_t));
-
-in->ppf=in->f1;
-in->pf=in->f2;
-in->cf=in->f3;
-in->nf=in->f4;
-in->nnf=in->f5;
+//history is allocated on first use
+in->f1=NULL;
 
 return (f0r_instance_t)in;
 }
@@ -473,11 +757,7 @@ inst *in;
 
 in=(inst*)instance;
 
-free(in->f1);
-free(in->f2);
-free(in->f3);
-free(in->f4);
-free(in->f5);
+history_free(in);
 
 free(in->liststr);
 free(instance);
@@ -544,13 +824,25 @@ uint32_t *tmpp;
 uint8_t *cin,*cout;
 int step,i;
 
-memcpy(in->ppf, inframe, 4*in->w*in->h);
-tmpp=in->nnf;
-in->nnf=in->ppf;
-in->ppf=in->pf;
-in->pf=in->cf;
-in->cf=in->nf;
-in->nf=tmpp;
+//only the temporal types need previous frames
+if (temporal(in->type))
+	{
+	if (in->f1==NULL)
+		if (!history_alloc(in, inframe))
+			{
+			memcpy(outframe, inframe, 4*in->w*in->h);
+			return;
+			}
+	memcpy(in->ppf, inframe, 4*in->w*in->h);
+	tmpp=in->nnf;
+	in->nnf=in->ppf;
+	in->ppf=in->pf;
+	in->pf=in->cf;
+	in->cf=in->nf;
+	in->nf=tmpp;
+	}
+else if (in->f1!=NULL)
+	history_free(in);
 
 cin=(uint8_t*)inframe;
 cout=(uint8_t*)outframe;
@@ -590,7 +882,8 @@ switch (in->type)
 	case 10:
 		//varsize
 		step=in->w*4;
-		ctmf(cin,cout,in->w,in->h,step,step,in->size,4,512*1024);
+		//alpha is copied below, filter RGB only
+		ctmf(cin,cout,in->w,in->h,step,step,in->size,3,4,in->memsize);
 		break;
 	default:
 		break;
@@ -289,4 +289,139 @@ return mm[12];
 #undef P_MA
 #undef P_MI
 
+//============================================================
+//SSE2 versions of the same networks
+//every m[] element holds one tap of 4 neighbouring pixels, so
+//one network sorts 16 bytes at once, branch free
+//alpha is sorted too, the caller restores it
+#if defined(__SSE2__)
+#include <emmintrin.h>
 
+#define V_SO(a,b) { __m128i temp=_mm_min_epu8((a),(b)); (b)=_mm_max_epu8((a),(b)); (a)=temp; }
+#define V_MA(a,b) { (b)=_mm_max_epu8((a),(b)); }
+#define V_MI(a,b) { (a)=_mm_min_epu8((a),(b)); }
+
+//------------------------------------------------------------
+//scrambles the input array!
+static inline __m128i median3_sse2(__m128i *m)
+{
+V_SO(m[0],m[1]);     V_MI(m[1],m[2]);     V_MA(m[0],m[1]);
+return m[1];
+}
+
+//------------------------------------------------------------
+//scrambles the input array!
+static inline __m128i median5_sse2(__m128i *m)
+{
+V_SO(m[0],m[1]);     V_SO(m[3],m[4]);     V_MI(m[1],m[4]);
+V_MA(m[0],m[3]);     V_SO(m[1],m[2]);     V_MI(m[2],m[3]);
+V_MA(m[1],m[2]);
+return m[2];
+}
+
+//------------------------------------------------------------
+//scrambles the input array!
+static inline __m128i median7_sse2(__m128i *m)
+{
+V_SO(m[0],m[5]);     V_SO(m[2],m[4]);     V_SO(m[0],m[3]);
+V_SO(m[1],m[6]);     V_SO(m[3],m[5]);     V_MA(m[0],m[1]);
+V_SO(m[2],m[6]);     V_MA(m[2],m[3]);     V_MI(m[4],m[5]);
+V_MI(m[3],m[6]);     V_SO(m[1],m[4]);     V_MA(m[1],m[3]);
+V_MI(m[3],m[4]);
+return m[3];
+}
+
+//------------------------------------------------------------
+//scrambles the input array!
+static inline __m128i median9_sse2(__m128i *m)
+{
+V_SO(m[1],m[2]);     V_SO(m[4],m[5]);     V_SO(m[7],m[8]);
+V_SO(m[0],m[1]);     V_SO(m[3],m[4]);     V_SO(m[6],m[7]);
+V_SO(m[1],m[2]);     V_SO(m[4],m[5]);     V_SO(m[7],m[8]);
+V_MA(m[0],m[3]);     V_MI(m[5],m[8]);     V_SO(m[4],m[7]);
+V_MA(m[3],m[6]);     V_MA(m[1],m[4]);     V_MI(m[2],m[5]);
+V_MI(m[4],m[7]);     V_SO(m[4],m[2]);     V_MA(m[6],m[4]);
+V_MI(m[4],m[2]);
+return m[4];
+}
+
+//------------------------------------------------------------
+//scrambles the input array!
+static inline __m128i median11_sse2(__m128i *m)
+{
+V_SO(m[3],m[7]);     V_SO(m[0],m[10]);    V_SO(m[7],m[10]);
+V_SO(m[4],m[9]);     V_SO(m[0],m[3]);     V_SO(m[8],m[3]);
+V_SO(m[1],m[6]);     V_SO(m[3],m[9]);     V_SO(m[5],m[6]);
+V_MI(m[6],m[10]);    V_SO(m[2],m[6]);     V_SO(m[1],m[5]);
+V_MA(m[0],m[1]);     V_SO(m[8],m[4]);     V_SO(m[4],m[1]);
+V_MA(m[4],m[8]);     V_MI(m[6],m[1]);     V_MI(m[5],m[9]);
+V_MA(m[2],m[8]);     V_SO(m[8],m[3]);     V_SO(m[7],m[5]);
+V_MI(m[5],m[3]);     V_MA(m[7],m[8]);     V_SO(m[8],m[6]);
+V_MA(m[8],m[5]);     V_MI(m[5],m[6]);
+return m[5];
+}
+
+//------------------------------------------------------------
+//scrambles the input array!
+static inline __m128i median13_sse2(__m128i *m)
+{
+V_SO(m[10],m[3]);    V_SO(m[6],m[10]);    V_SO(m[11],m[1]);
+V_SO(m[5],m[4]);     V_SO(m[0],m[8]);     V_SO(m[1],m[3]);
+V_SO(m[5],m[0]);     V_SO(m[7],m[1]);     V_SO(m[8],m[10]);
+V_SO(m[8],m[12]);    V_SO(m[4],m[12]);    V_SO(m[3],m[12]);
+V_SO(m[7],m[11]);    V_SO(m[9],m[2]);     V_SO(m[0],m[2]);
+V_SO(m[4],m[1]);     V_SO(m[11],m[0]);    V_SO(m[4],m[9]);
+V_MA(m[7],m[5]);     V_MI(m[2],m[1]);     V_MA(m[4],m[6]);
+V_SO(m[5],m[9]);     V_SO(m[9],m[0]);     V_MI(m[3],m[0]);
+V_MA(m[5],m[6]);     V_SO(m[2],m[3]);     V_MA(m[11],m[6]);
+V_SO(m[9],m[2]);     V_MA(m[8],m[9]);     V_MI(m[10],m[2]);
+V_SO(m[9],m[10]);    V_MA(m[9],m[6]);     V_MI(m[10],m[3]);
+V_MI(m[6],m[10]);
+return m[6];
+}
+
+//------------------------------------------------------------
+//scrambles the input array!
+static inline __m128i median25_sse2(__m128i *m)
+{
+V_SO(m[0],m[1]);     V_SO(m[3],m[4]);     V_SO(m[2],m[4]);
+V_SO(m[2],m[3]);     V_SO(m[6],m[7]);     V_SO(m[5],m[7]);
+V_SO(m[5],m[6]);     V_SO(m[9],m[10]);    V_SO(m[8],m[10]);
+V_SO(m[8],m[9]);     V_SO(m[12],m[13]);   V_SO(m[11],m[13]);
+V_SO(m[11],m[12]);   V_SO(m[15],m[16]);   V_SO(m[14],m[16]);
+V_SO(m[14],m[15]);   V_SO(m[18],m[19]);   V_SO(m[17],m[19]);
+V_SO(m[17],m[18]);   V_SO(m[21],m[22]);   V_SO(m[20],m[22]);
+V_SO(m[20],m[21]);   V_SO(m[23],m[24]);   V_SO(m[2],m[5]);
+V_SO(m[3],m[6]);     V_SO(m[0],m[6]);     V_SO(m[0],m[3]);
+V_SO(m[4],m[7]);     V_SO(m[1],m[7]);     V_SO(m[1],m[4]);
+V_SO(m[11],m[14]);   V_SO(m[8],m[14]);    V_SO(m[8],m[11]);
+V_SO(m[12],m[15]);   V_SO(m[9],m[15]);    V_SO(m[9],m[12]);
+V_SO(m[13],m[16]);   V_SO(m[10],m[16]);   V_SO(m[10],m[13]);
+V_SO(m[20],m[23]);   V_SO(m[17],m[23]);   V_SO(m[17],m[20]);
+V_SO(m[21],m[24]);   V_SO(m[18],m[24]);   V_SO(m[18],m[21]);
+V_SO(m[19],m[22]);   V_MA(m[8],m[17]);    V_SO(m[9],m[18]);
+V_SO(m[0],m[18]);    V_MA(m[0],m[9]);     V_SO(m[10],m[19]);
+V_SO(m[1],m[19]);    V_SO(m[1],m[10]);    V_SO(m[11],m[20]);
+V_SO(m[2],m[20]);    V_MA(m[2],m[11]);    V_SO(m[12],m[21]);
+V_SO(m[3],m[21]);    V_SO(m[3],m[12]);    V_SO(m[13],m[22]);
+V_MI(m[4],m[22]);    V_SO(m[4],m[13]);    V_SO(m[14],m[23]);
+V_SO(m[5],m[23]);    V_SO(m[5],m[14]);    V_SO(m[15],m[24]);
+V_MI(m[6],m[24]);    V_SO(m[6],m[15]);    V_MI(m[7],m[16]);
+V_MI(m[7],m[19]);    V_MI(m[13],m[21]);   V_MI(m[15],m[23]);
+V_MI(m[7],m[13]);    V_MI(m[7],m[15]);    V_MA(m[1],m[9]);
+V_MA(m[3],m[11]);    V_MA(m[5],m[17]);    V_MA(m[11],m[17]);
+V_MA(m[9],m[17]);    V_SO(m[4],m[10]);    V_SO(m[6],m[12]);
+V_SO(m[7],m[14]);    V_SO(m[4],m[6]);     V_MA(m[4],m[7]);
+V_SO(m[12],m[14]);   V_MI(m[10],m[14]);   V_SO(m[6],m[7]);
+V_SO(m[10],m[12]);   V_SO(m[6],m[10]);    V_MA(m[6],m[17]);
+V_SO(m[12],m[17]);   V_MI(m[7],m[17]);    V_SO(m[7],m[10]);
+V_SO(m[12],m[18]);   V_MA(m[7],m[12]);    V_MI(m[10],m[18]);
+V_SO(m[12],m[20]);   V_MI(m[10],m[20]);   V_MA(m[10],m[12]);
+return m[12];
+}
+
+#undef V_SO
+#undef V_MA
+#undef V_MI
+
+#endif
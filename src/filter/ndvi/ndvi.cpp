@@ -22,6 +22,8 @@
 #include "frei0r_math.h"
 #include "gradientlut.hpp"
 #include <string>
+#include <vector>
+#include <string.h>
 #include <stdlib.h>
 
 /**
@@ -54,10 +56,12 @@ public:
                         const uint32_t* in);
 
 private:
-    void initLut();
-    double getComponent(uint8_t *sample, unsigned int chan, double offset, double scale);
+    bool initLut();
+    void initIndexLut(bool force, double visOffset, double visScale, double nirOffset, double nirScale);
+    double getComponent(uint8_t value, double offset, double scale);
     void setColor(uint8_t *sample, double index);
     void drawLegend(uint32_t *out);
+    void renderLegend();
     void drawRect( uint32_t* out, uint8_t r, uint8_t g, uint8_t b, unsigned int x, unsigned int y, unsigned int w, unsigned int h );
     void drawGradient( uint32_t* out, unsigned int x, unsigned int y, unsigned int w, unsigned int h );
     void drawText( uint32_t* out, std::string text, unsigned int x, unsigned int y, unsigned int textHeight );
@@ -75,6 +79,19 @@ private:
     unsigned int lutLevels;
     std::string colorMap;
     GradientLut gradient;
+
+    // False color (RGBA) of every (vis, nir) byte pair, at vis * 256 + nir,
+    // and the parameters it was built for.
+    std::vector<uint32_t> indexLut;
+    double lutVisOffset;
+    double lutVisScale;
+    double lutNirOffset;
+    double lutNirScale;
+    std::string lutIndex;
+
+    // The legend rows at the bottom of the frame, rendered once.
+    std::vector<uint32_t> legend;
+    std::string legendIndex;
 };
 
 Ndvi::Ndvi(unsigned int width, unsigned int height)
@@ -91,6 +108,14 @@ Ndvi::Ndvi(unsigned int width, unsigned int height)
  , lutLevels(0)
  , colorMap("")
  , gradient()
+ , indexLut(65536)
+ , lutVisOffset(0.0)
+ , lutVisScale(0.0)
+ , lutNirOffset(0.0)
+ , lutNirScale(0.0)
+ , lutIndex("")
+ , legend()
+ , legendIndex("")
 {
     register_param(paramColorMap,  "Color Map",
             "The color map to use. One of 'earth', 'grayscale', 'heat' or 'rainbow'.");
@@ -117,50 +142,40 @@ Ndvi::Ndvi(unsigned int width, unsigned int height)
 void Ndvi::update(double time,
                   uint32_t* out,
                   const uint32_t* in) {
-    uint8_t *inP = (uint8_t*)in;
-    uint8_t *outP = (uint8_t*)out;
     double visScale = paramVisScale * 10.0;
     double visOffset =  (paramVisOffset * 510) - 255;
     double nirScale = paramNirScale * 10.0;
     double nirOffset = (paramNirOffset * 510) - 255;
-    unsigned int visChan = ColorIndex(paramVisChan);
-    unsigned int nirChan = ColorIndex(paramNirChan);
+    unsigned int visShift = 8 * ColorIndex(paramVisChan);
+    unsigned int nirShift = 8 * ColorIndex(paramNirChan);
 
-    initLut();
+    bool gradientChanged = initLut();
+    initIndexLut(gradientChanged, visOffset, visScale, nirOffset, nirScale);
 
-    if (paramIndex == "vi") {
-        for (unsigned int i = 0; i < size; i++) {
-            double vis =  getComponent(inP, visChan, visOffset, visScale);
-            double nir =  getComponent(inP, nirChan, nirOffset, nirScale);
-            double vi = (nir - vis) / 255.0;
-            setColor(outP, vi);
-            inP += 4;
-            outP += 4;
-        }
-    } else { // ndvi
-        for (unsigned int i = 0; i < size; i++) {
-            double vis =  getComponent(inP, visChan, visOffset, visScale);
-            double nir =  getComponent(inP, nirChan, nirOffset, nirScale);
-            double ndvi = (nir - vis) / (nir + vis);
-            setColor(outP, ndvi);
-            inP += 4;
-            outP += 4;
-        }
+    // The index depends only on the two components, look it up.
+    const uint32_t* lut = &indexLut[0];
+    for (unsigned int i = 0; i < size; i++) {
+        uint32_t p = in[i];
+        out[i] = lut[(((p >> visShift) & 0xff) << 8) | ((p >> nirShift) & 0xff)];
     }
 
     if( paramLegend == "bottom" ) {
+        if (gradientChanged || legendIndex != paramIndex || legend.empty()) {
+            legendIndex = paramIndex;
+            renderLegend();
+        }
         drawLegend(out);
     }
 }
 
-void Ndvi::initLut() {
+bool Ndvi::initLut() {
     // Only update the LUT if a parameter has changed.
     unsigned int paramLutLevelsInt = paramLutLevels * 1000.0 + 0.5;
     if (paramLutLevelsInt < 2) paramLutLevelsInt = 2;
     if (paramLutLevelsInt > 1000) paramLutLevelsInt = 1000;
     if (lutLevels == paramLutLevelsInt &&
         colorMap == paramColorMap) {
-        return;
+        return false;
     } else {
         lutLevels = paramLutLevelsInt;
         colorMap = paramColorMap;
@@ -217,11 +232,42 @@ void Ndvi::initLut() {
         GradientLut::Color white = {0xff, 0xff, 0xff};
         gradient.fillRange( N2P(-1.0), black, N2P( 1.0), white );
     }
+    return true;
 }
 
-inline double Ndvi::getComponent(uint8_t *sample, unsigned int chan, double offset, double scale)
+void Ndvi::initIndexLut(bool force, double visOffset, double visScale, double nirOffset, double nirScale)
 {
-    double c =  sample[chan];
+    // Only update the table if the gradient or a parameter has changed.
+    if (!force &&
+        lutVisOffset == visOffset && lutVisScale == visScale &&
+        lutNirOffset == nirOffset && lutNirScale == nirScale &&
+        lutIndex == paramIndex) {
+        return;
+    }
+    lutVisOffset = visOffset;
+    lutVisScale = visScale;
+    lutNirOffset = nirOffset;
+    lutNirScale = nirScale;
+    lutIndex = paramIndex;
+
+    for (unsigned int v = 0; v < 256; v++) {
+        double vis = getComponent(v, visOffset, visScale);
+        for (unsigned int n = 0; n < 256; n++) {
+            double nir = getComponent(n, nirOffset, nirScale);
+            double index;
+            if (paramIndex == "vi") {
+                index = (nir - vis) / 255.0;
+            } else { // ndvi
+                index = (nir - vis) / (nir + vis);
+            }
+            setColor((uint8_t*)&indexLut[(v << 8) | n], index);
+        }
+    }
+}
+
+inline double Ndvi::getComponent(uint8_t value, double offset, double scale)
+{
+    double c =  value;
     c = (c + offset) * scale;
     c = CLAMP(c, 0.0, 255.0);
     return c;
@@ -239,21 +285,36 @@ inline void Ndvi::setColor(uint8_t *sample, double index)
 
 void Ndvi::drawLegend(uint32_t* out)
 {
+    // frames under 20 rows have no legend
+    if (legend.empty()) {
+        return;
+    }
+    unsigned int legendHeight = legend.size() / width;
+    memcpy(out + (height - legendHeight) * width, &legend[0], legend.size() * sizeof(uint32_t));
+}
+
+void Ndvi::renderLegend()
+{
+    // The legend covers the bottom rows of the frame completely, so it is
+    // drawn into its own rows once and copied over every frame.
     unsigned int legendHeight = height / 20;
+    legend.assign(legendHeight * width, 0xff000000);
+    if (legendHeight == 0) {
+        return;
+    }
+    uint32_t* out = &legend[0];
 
     // Black border above legend
     unsigned int borderHeight = legendHeight / 15;
-    unsigned int borderY = height - legendHeight;
-    drawRect( out, 0, 0, 0, 0, borderY, width, borderHeight );
+    drawRect( out, 0, 0, 0, 0, 0, width, borderHeight );
 
     // Gradient
     unsigned int gradientHeight = legendHeight - borderHeight;
-    unsigned int gradientY = height - gradientHeight;
-    drawGradient( out, 0, gradientY, width, gradientHeight );
+    drawGradient( out, 0, borderHeight, width, gradientHeight );
 
     // Text
     unsigned int textHeight = gradientHeight * 8 / 10;
-    unsigned int textY = height - ( gradientHeight - textHeight ) / 2;
+    unsigned int textY = legendHeight - ( gradientHeight - textHeight ) / 2;
     unsigned int textX = width / 25;
     if (paramIndex == "vi") {
         drawText( out, "0", textX, textY , textHeight );
@@ -294,14 +355,18 @@ void Ndvi::drawGradient( uint32_t* out, unsigned int x, unsigned int y, unsigned
     }
 }
 
+// Text needs HAVE_CAIRO, which the CMake build does not define (it only
+// links cairo when found), so CMake builds draw the legend without text.
 void Ndvi::drawText( uint32_t* out, std::string text, unsigned int x, unsigned int y, unsigned int textHeight )
 {
 #ifdef HAVE_CAIRO
+    // out is the legend buffer
+    unsigned int outHeight = legend.size() / width;
     int stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width);
     cairo_surface_t* surface = cairo_image_surface_create_for_data((unsigned char*)out,
                                                                    CAIRO_FORMAT_ARGB32,
                                                                    width,
-                                                                   height,
+                                                                   outHeight,
                                                                    stride);
     cairo_t *cr = cairo_create(surface);
     cairo_text_extents_t te;
@@ -332,5 +397,5 @@ void Ndvi::drawText( uint32_t* out, std::string text, unsigned int x, unsigned i
 frei0r::construct<Ndvi> plugin("NDVI filter",
             "This filter creates a false image from a visible + infrared source.",
             "Brian Matherly",
-            0,2,
+            0,3,
             F0R_COLOR_MODEL_RGBA8888);
@@ -35,9 +35,11 @@
 #include <string.h>
 
 #include <frei0r.hpp>
+#include "frei0r_history.h"
 
 
 #define PLANES 32
+#define KEYINT 8 /* planes per key frame in the history */
 
 // freej compat facilitator
 typedef struct {
@@ -66,8 +68,7 @@ private:
   ScreenGeometry geo;
 
   void _init(int wdt, int hgt);
-  int32_t *buffer;
-  int32_t *planetable[PLANES];
+  frei0r_history hist;
   int mode;
   int plane, stock, timer, stride, readplane;
 
@@ -79,17 +80,12 @@ private:
 };
 
 Nervous::Nervous(int wdt, int hgt) {
-    int c;
     _init(wdt, hgt);
     
-    buffer = (int32_t*) calloc(geo.size, PLANES);
-    if(!buffer) {
-      fprintf(stderr,"ERROR: nervous plugin can't allocate needed memory: %u bytes\n",
-	      geo.size*PLANES);
+    if(!hist_init(&hist, PLANES, geo.w, geo.h, KEYINT)) {
+      fprintf(stderr,"ERROR: nervous plugin can't allocate needed memory\n");
       return;
     }
-    for(c=0;c<PLANES;c++)
-      planetable[c] = &buffer[geo.w*geo.h*c];
     
     plane = 0;
     stock = 0;
@@ -99,7 +95,7 @@ Nervous::Nervous(int wdt, int hgt) {
 }
 
 Nervous::~Nervous() {
-  free(buffer);
+  hist_free(&hist);
 }
 
 void Nervous::_init(int wdt, int hgt) {
@@ -115,7 +111,8 @@ void Nervous::_init(int wdt, int hgt) {
 void Nervous::update(double time,
                      uint32_t* out,
                      const uint32_t* in) {
-  memcpy(planetable[plane],in,geo.size);
+  // kept as the difference to a recent frame, see frei0r_history.h
+  hist_put(&hist, plane, in);
 
   if(stock<PLANES) stock++;
 
@@ -138,7 +135,7 @@ void Nervous::update(double time,
   plane++;
   if(plane==PLANES) plane=0;
 
-  memcpy(out,planetable[readplane],geo.size);
+  hist_get(&hist, readplane, out);
 
 }
 
@@ -147,4 +144,4 @@ void Nervous::update(double time,
 frei0r::construct<Nervous> plugin("Nervous",
 				"flushes frames in time in a nervous way",
 				"Tannenbaum, Kentaro, Jaromil",
-				3,1);
+				3,2);
@@ -42,7 +42,7 @@
  * Finally the overall strength of the filter can be adjusted, from no effect
  * to full normalization.
  *
- * The 5 user parameters are:
+ * The 7 user parameters are:
  *   BlackPt,   Colors which define the output range.  The minimum input value
  *   WhitePt    is mapped to the BlackPt.  The maximum input value is mapped to
  *              the WhitePt.  The defaults are black and white respectively.
@@ -67,6 +67,14 @@
  *              a rather expensive no-op.  Values in between can give a gentle
  *              boost to low-contrast video without creating an artificial
  *              over-processed look.  The default is full strength.
+ *
+ *   Threshold  The lookup table of a channel is kept from frame to frame
+ *              until its input or output range has moved by more than this
+ *              fraction of the full range.  Defaults to 0.0 (rebuilt on
+ *              every frame).
+ *
+ *   Sampling   The input range is found from every row (0.0, the default)
+ *              up to every 16th row (1.0) of the frame.
  */
 
 #include <assert.h>
@@ -75,11 +83,15 @@
 
 #include "frei0r.h"
 #include "frei0r_math.h"
+#include "frei0r_histogram.h"
 
 #define MAX_HISTORY_LEN     128
 
+#define DISTANCE(a, b)      ((a) > (b) ? (a) - (b) : (b) - (a))
+
 typedef struct
 {
+  int width, height;  // Frame size.
   int num_pixels;     // Number of pixels in a frame.
   int frame_num;      // Increments on each frame, starting from 0.
 
@@ -96,6 +108,14 @@ typedef struct
                         // temporal smoothing.  [1,MAX_HISTORY_LEN].
   float independence;   // Ratio of independent vs linked normalization [0,1].
   float strength;       // Mixing strength for the normalization [0,1].
+  float threshold;      // Range change that rebuilds a lookup table [0,1].
+  int row_step;         // Rows between those scanned for the range [1,16].
+
+  // Lookup tables, and the smoothed input and output ranges
+  // (min.smoothed, max.smoothed, min.out, max.out) they were built from.
+  uint8_t lut[3][256];
+  float built[3][4];
+  int rebuild;          // Params changed, rebuild all tables.
 } normaliz0r_instance_t;
 
 int
@@ -118,8 +138,8 @@ f0r_get_plugin_info (f0r_plugin_info_t* info)
   info->color_model = F0R_COLOR_MODEL_RGBA8888;
   info->frei0r_version = FREI0R_MAJOR_VERSION;
   info->major_version = 0;
-  info->minor_version = 1;
-  info->num_params = 5;
+  info->minor_version = 3;
+  info->num_params = 7;
   info->explanation = "Normalize (aka histogram stretch, contrast stretch)";
 }
 
@@ -130,6 +150,8 @@ static char *param_infos[] =
   "Smoothing",    "Amount of temporal smoothing of the input range, to reduce flicker (default 0.0)",
   "Independence", "Proportion of independent to linked channel normalization (default 1.0)",
   "Strength",     "Strength of filter, from no effect to full normalization (default 1.0)",
+  "Threshold",    "Change of the range, as a fraction of the full range, that rebuilds the lookup tables (default 0.0)",
+  "Sampling",     "Find the input range from every row (0.0) up to every 16th row (1.0) (default 0.0)",
 };
 
 void
@@ -145,6 +167,8 @@ f0r_construct (unsigned int width, unsigned int height)
 {
   normaliz0r_instance_t* inst = (normaliz0r_instance_t*)calloc(1, sizeof(*inst));
   int c;
+  inst->width = width;
+  inst->height = height;
   inst->num_pixels = width * height;
   inst->frame_num = 0;
   for (c = 0; c < 3; c++)
@@ -159,6 +183,9 @@ f0r_construct (unsigned int width, unsigned int height)
   inst->history_len = 1;        // [1,MAX_HISTORY_LEN]; default is no smoothing
   inst->independence = 1.0;     // [0,1]; default is fully independent
   inst->strength = 1.0;         // [0,1]; default is full strength
+  inst->threshold = 0.0;        // [0,1]; default is rebuilt every frame
+  inst->row_step = 1;           // [1,16]; default is every row
+  inst->rebuild = 1;
   return (f0r_instance_t)inst;
 }
 
@@ -174,33 +201,55 @@ f0r_set_param_value (f0r_instance_t instance, f0r_param_t param,
 {
   assert(instance);
   normaliz0r_instance_t* inst = (normaliz0r_instance_t*)instance;
-  float val;
+  float val, c[3];
+  int i, len;
 
+  // Hosts set every param on every frame; only a changed value forces
+  // new tables. Threshold and Sampling don't touch the mapping.
   switch (param_index)
     {
     case 0:
-      inst->min[0].param = ((f0r_param_color_t*)param)->r * 255.0;
-      inst->min[1].param = ((f0r_param_color_t*)param)->g * 255.0;
-      inst->min[2].param = ((f0r_param_color_t*)param)->b * 255.0;
-      break;
     case 1:
-      inst->max[0].param = ((f0r_param_color_t*)param)->r * 255.0;
-      inst->max[1].param = ((f0r_param_color_t*)param)->g * 255.0;
-      inst->max[2].param = ((f0r_param_color_t*)param)->b * 255.0;
+      c[0] = ((f0r_param_color_t*)param)->r * 255.0;
+      c[1] = ((f0r_param_color_t*)param)->g * 255.0;
+      c[2] = ((f0r_param_color_t*)param)->b * 255.0;
+      for (i = 0; i < 3; i++)
+        {
+          float *p = param_index == 0 ? &inst->min[i].param : &inst->max[i].param;
+          if (*p != c[i])
+            inst->rebuild = 1;
+          *p = c[i];
+        }
       break;
     case 2:
       val = (float)CLAMP(*((double* )param), 0.0, 1.0);
       // Map [0,1] <-> [1,MAX_HISTORY_LEN]
-      inst->history_len = (int)(val * (MAX_HISTORY_LEN - 1)) + 1;
+      len = (int)(val * (MAX_HISTORY_LEN - 1)) + 1;
+      if (len != inst->history_len)
+        inst->rebuild = 1;
+      inst->history_len = len;
       break;
     case 3:
       val = (float)CLAMP(*((double* )param), 0.0, 1.0);
+      if (val != inst->independence)
+        inst->rebuild = 1;
       inst->independence = val;
       break;
     case 4:
       val = (float)CLAMP(*((double* )param), 0.0, 1.0);
+      if (val != inst->strength)
+        inst->rebuild = 1;
       inst->strength = val;
       break;
+    case 5:
+      val = (float)CLAMP(*((double* )param), 0.0, 1.0);
+      inst->threshold = val;
+      break;
+    case 6:
+      val = (float)CLAMP(*((double* )param), 0.0, 1.0);
+      // Map [0,1] <-> [1,16]
+      inst->row_step = (int)(val * 15) + 1;
+      break;
     }
 }
 
@@ -232,6 +281,13 @@ f0r_get_param_value (f0r_instance_t instance, f0r_param_t param,
     case 4:
       *((double*)param) = inst->strength;
       break;
+    case 5:
+      *((double*)param) = inst->threshold;
+      break;
+    case 6:
+      // Map [0,1] <-> [1,16]
+      *((double*)param) = (double)(inst->row_step - 1) / 15;
+      break;
     }
 }
 
@@ -251,26 +307,18 @@ f0r_update (f0r_instance_t instance, double time, const uint32_t* inframe,
     float out;                  // Output value [0,255].
   } min[3], max[3];             // Min and max for each channel in {R,G,B}.
 
-  // First, scan the input frame to find, for each channel, the minimum
-  // (min.in) and maximum (max.in) values present in the channel.
+  // First, count the values of each channel of the input frame (or of every
+  // row_step-th row).  The minimum (min.in) and maximum (max.in) values
+  // present in the channel are the lowest and highest values with a non-zero
+  // count.
   {
-    const uint8_t *in = (const uint8_t*)inframe;
+    uint32_t hist[3][256];
 
-#define INIT(c)     (min[c].in = max[c].in = in[c])
-#define EXTEND(c)   (min[c].in = MIN(min[c].in, in[c])), \
-                    (max[c].in = MAX(max[c].in, in[c]))
-    INIT(0);
-    INIT(1);
-    INIT(2);
-    in += 4;
-    // Process (num_pixels - 1), as we used the first pixel to initialize
-    unsigned int num_pixels = inst->num_pixels - 1;
-    while (num_pixels--)
+    histo_rgb(inframe, inst->width, inst->height, inst->row_step, hist);
+    for (c = 0; c < 3; c++)
     {
-      EXTEND(0);
-      EXTEND(1);
-      EXTEND(2);
-      in += 4;
+      min[c].in = histo_low(hist[c]);
+      max[c].in = histo_high(hist[c]);
     }
   }
 
@@ -314,7 +362,7 @@ f0r_update (f0r_instance_t instance, double time, const uint32_t* inframe,
 
   // Now, process each channel to determine the input and output range and
   // build the lookup tables.
-  uint8_t lut[3][256];
+  uint8_t (*lut)[256] = inst->lut;
   for (c = 0; c < 3; c++)
   {
     // Adjust the input range for this channel [min.smoothed,max.smoothed] by
@@ -333,6 +381,22 @@ f0r_update (f0r_instance_t instance, double time, const uint32_t* inframe,
     max[c].out = (inst->max[c].param * inst->strength)
         + ((float)max[c].in * (1.0 - inst->strength));
 
+    // Keep the table while the ranges stay within the threshold of those it
+    // was built from.
+    if (!inst->rebuild && inst->threshold > 0.0)
+    {
+      float drift = DISTANCE(min[c].smoothed, inst->built[c][0]);
+      drift = MAX(drift, DISTANCE(max[c].smoothed, inst->built[c][1]));
+      drift = MAX(drift, DISTANCE(min[c].out, inst->built[c][2]));
+      drift = MAX(drift, DISTANCE(max[c].out, inst->built[c][3]));
+      if (drift <= inst->threshold * 255.0)
+        continue;
+    }
+    inst->built[c][0] = min[c].smoothed;
+    inst->built[c][1] = max[c].smoothed;
+    inst->built[c][2] = min[c].out;
+    inst->built[c][3] = max[c].out;
+
     // Now, build a lookup table which linearly maps the adjusted input range
     // [min.smoothed,max.smoothed] to the output range [min.out,max.out].
     // Perform the linear interpolation for each x:
@@ -342,18 +406,18 @@ f0r_update (f0r_instance_t instance, double time, const uint32_t* inframe,
     {
       // There is no dynamic range to expand.  No mapping for this channel.
       int in_val;
-      for (in_val = min[c].in; in_val <= max[c].in; in_val++)
+      for (in_val = 0; in_val < 256; in_val++)
         lut[c][in_val] = min[c].out;
     }
     else
     {
-      // We must set lookup values for all values in the original input range
-      // [min.in,max.in].  Since the original input range may be larger than
-      // [min.smoothed,max.smoothed], some output values may fall outside the
-      // [0,255] dynamic range.  We need to CLAMP() them.
+      // We must set lookup values for all input values, as the table may be
+      // kept for later frames with a different input range.  Since that range
+      // may be larger than [min.smoothed,max.smoothed], some output values may
+      // fall outside the [0,255] dynamic range.  We need to CLAMP() them.
       float scale = (max[c].out - min[c].out) / (max[c].smoothed - min[c].smoothed);
       int in_val;
-      for (in_val = min[c].in; in_val <= max[c].in; in_val++)
+      for (in_val = 0; in_val < 256; in_val++)
       {
         int out_val = ROUND((in_val - min[c].smoothed) * scale + min[c].out);
         lut[c][in_val] = CLAMP(out_val, 0, 255);
@@ -363,23 +427,8 @@ f0r_update (f0r_instance_t instance, double time, const uint32_t* inframe,
 
   // Finally, process the pixels of the input frame using the lookup tables.
   // Copy alpha as-is.
-  {
-    const uint8_t *in = (const uint8_t*)inframe;
-    uint8_t *out = (uint8_t*)outframe;
-
-#define MAP(c)      (out[c] = lut[c][in[c]])
-
-    unsigned int num_pixels = inst->num_pixels;
-    while (num_pixels--)
-    {
-      MAP(0);
-      MAP(1);
-      MAP(2);
-      out[3] = in[3];  // copy alpha
-      in += 4;
-      out += 4;
-    }
-  }
+  histo_lut_apply(inframe, outframe, inst->num_pixels, lut[0], lut[1], lut[2]);
 
+  inst->rebuild = 0;
   inst->frame_num++;
 }
@@ -18,7 +18,12 @@
  */
 
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "frei0r.h"
+#include "frei0r_remap.h"
 
 
 void sub_vec2( f0r_param_position_t* r, f0r_param_position_t* a, f0r_param_position_t* b ) 
@@ -26,46 +31,72 @@ void sub_vec2( f0r_param_position_t* r, f0r_param_position_t* a, f0r_param_posit
 	r->x = a->x - b->x;
 	r->y = a->y - b->y;
 }
-void add_vec2( f0r_param_position_t* r, f0r_param_position_t* a, f0r_param_position_t* b ) 
-{
-	r->x = a->x + b->x;
-	r->y = a->y + b->y;
-}
 
-void mul_vec2( f0r_param_position_t* r, f0r_param_position_t* a, double scalar )
+double cross_vec2( f0r_param_position_t* a, f0r_param_position_t* b )
 {
-	r->x = a->x * scalar;
-	r->y = a->y * scalar;
+	return a->x * b->y - a->y * b->x;
 }
 
-void get_pixel_position( f0r_param_position_t* r, f0r_param_position_t* t, f0r_param_position_t* b, f0r_param_position_t* tl, f0r_param_position_t* bl,f0r_param_position_t* in )
+/* The image is mapped onto the quad tl,tr,br,bl as a bilinear patch:
+ *   r = tl + in.x * top + in.y * (bl - tl + in.x * (bot - top))
+ * This inverts that mapping for output position r, returning 1 and the
+ * source position in, or 0 when r lies outside the patch. */
+int get_source_position( f0r_param_position_t* in, f0r_param_position_t* top, f0r_param_position_t* bot, f0r_param_position_t* tl, f0r_param_position_t* bl, f0r_param_position_t* r )
 {
-	f0r_param_position_t t_x;
-	f0r_param_position_t b_x;
-	f0r_param_position_t k;
-	mul_vec2( &t_x, t, in->x );
-	mul_vec2( &b_x, b, in->x );
-
-	add_vec2( &t_x, &t_x, tl );
-	add_vec2( &b_x, &b_x, bl );
+	f0r_param_position_t e = *top;
+	f0r_param_position_t f;
+	f0r_param_position_t g;
+	f0r_param_position_t h;
+	double k0, k1, k2, d, v, u, dx, dy;
+	int pass;
 
-	sub_vec2( &k, &b_x, &t_x );
-	mul_vec2( &k, &k, in->y );
+	sub_vec2( &f, bl, tl );
+	sub_vec2( &g, bot, top );
+	sub_vec2( &h, r, tl );
 
-	add_vec2( r, &k, &t_x );
+	k2 = cross_vec2( &g, &f );
+	k1 = cross_vec2( &e, &f ) + cross_vec2( &h, &g );
+	k0 = cross_vec2( &h, &e );
 
+	for ( pass = 0; pass < 2; pass++ ) {
+		if ( fabs( k2 ) < 1.0e-9 ) {
+			/* parallel sides, linear */
+			if ( pass || k1 == 0.0 )
+				return 0;
+			v = -k0 / k1;
+		} else {
+			d = k1 * k1 - 4.0 * k0 * k2;
+			if ( d < 0.0 )
+				return 0;
+			d = sqrt( d );
+			v = pass ? ( -k1 + d ) / ( 2.0 * k2 ) : ( -k1 - d ) / ( 2.0 * k2 );
+		}
+		dx = e.x + g.x * v;
+		dy = e.y + g.y * v;
+		if ( fabs( dx ) > fabs( dy ) )
+			u = ( h.x - f.x * v ) / dx;
+		else if ( dy != 0.0 )
+			u = ( h.y - f.y * v ) / dy;
+		else
+			continue;
+		if ( u >= 0.0 && u <= 1.0 && v >= 0.0 && v <= 1.0 ) {
+			in->x = u;
+			in->y = v;
+			return 1;
+		}
+	}
+	return 0;
 }
 
 
-#include <math.h>
-#include <stdlib.h>
-
 typedef struct perspective_instance {
 	int w, h;
 	f0r_param_position_t tl;
 	f0r_param_position_t tr;
 	f0r_param_position_t bl;
 	f0r_param_position_t br;
+	remap_map map;
+	int map_dirty;
 } perspective_instance_t;
 
 
@@ -84,7 +115,7 @@ void f0r_get_plugin_info( f0r_plugin_info_t* info )
 	info->color_model = F0R_COLOR_MODEL_RGBA8888;
 	info->frei0r_version = FREI0R_MAJOR_VERSION;
 	info->major_version = 0; 
-	info->minor_version = 1; 
+	info->minor_version = 2; 
 	info->num_params =  4; 
 	info->explanation = "Distorts the image for a pseudo perspective";
 
@@ -118,6 +149,7 @@ void f0r_get_param_info( f0r_param_info_t* info, int param_index )
 f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 {
 	perspective_instance_t* inst = (perspective_instance_t*)calloc(1, sizeof(*inst));
+	if (!inst) return 0;
 	inst->w = width;
 	inst->h = height;
 	inst->tl.x = 0.0;
@@ -128,31 +160,48 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 	inst->bl.y = 1.0;
 	inst->br.x = 1.0;
 	inst->br.y = 1.0;
+	if ( !remap_alloc( &inst->map, width, height, width, height ) ) {
+		free(inst);
+		return 0;
+	}
+	remap_set_interp( &inst->map, REMAP_BL );
+	inst->map_dirty = 1;
 	return (f0r_instance_t)inst;
 }
 void f0r_destruct(f0r_instance_t instance)
 {
 	perspective_instance_t* inst = (perspective_instance_t*)instance;
+	remap_free( &inst->map );
 	free(inst);
 }
 void f0r_set_param_value(f0r_instance_t instance, 
                          f0r_param_t param, int param_index)
 {
 	perspective_instance_t* inst = (perspective_instance_t*)instance;
+	f0r_param_position_t* corner;
+	f0r_param_position_t val;
 	switch ( param_index ) {
 		case 0:
-			inst->tl = *((f0r_param_position_t*)param);
+			corner = &inst->tl;
 			break;
 		case 1:
-			inst->tr = *((f0r_param_position_t*)param);
+			corner = &inst->tr;
 			break;
 		case 2:
-			inst->bl = *((f0r_param_position_t*)param);
+			corner = &inst->bl;
 			break;
 		case 3:
-			inst->br = *((f0r_param_position_t*)param);
+			corner = &inst->br;
 			break;
+		default:
+			return;
 		}
+	/* hosts set every param on every frame, only a moved corner
+	 * invalidates the map */
+	val = *((f0r_param_position_t*)param);
+	if (val.x != corner->x || val.y != corner->y)
+		inst->map_dirty = 1;
+	*corner = val;
 }
 void f0r_get_param_value(f0r_instance_t instance,
                          f0r_param_t param, int param_index)
@@ -174,27 +223,12 @@ void f0r_get_param_value(f0r_instance_t instance,
 	}
 }
 
-void f0r_update(f0r_instance_t instance, double time,
-                const uint32_t* inframe, uint32_t* outframe)
+/* The corners are usually static for a whole clip, so the source
+ * position of each output pixel is computed only when they change. */
+static void make_map( perspective_instance_t* inst )
 {
-	perspective_instance_t* inst = (perspective_instance_t*)instance;
-
-	uint32_t* dst = outframe;
-	const uint32_t* src = inframe;
-	int len = inst->w * inst->h;
-	
-	int i;
-	for ( i = 0; i < len; i++ ) {
-		*dst = 0x00000000;
-		dst++;
-	}
-	dst = outframe;
-
 	int w = inst->w;
 	int h = inst->h;
-	
-	int rx;
-	int ry;
 	int x;
 	int y;
 	f0r_param_position_t top;
@@ -205,19 +239,33 @@ void f0r_update(f0r_instance_t instance, double time,
 	sub_vec2( &bot, &inst->br, &inst->bl );
 	for( y = 0; y < h; y++ ) {
 		for ( x = 0; x < w; x++ ) {
-			in.x = (double)x / (double)w;
-			in.y = (double)y / (double)h;
-			get_pixel_position( &r, &top, &bot, &inst->tl, &inst->bl, &in );
-			rx = lrint(r.x * (float)w);
-			ry = lrint(r.y * (float)h);
-			if ( rx < 0 || rx >= w || ry < 0 || ry >= h ) {
-				src++;
+			r.x = (double)x / (double)w;
+			r.y = (double)y / (double)h;
+			if ( !get_source_position( &in, &top, &bot, &inst->tl, &inst->bl, &r ) ||
+			     in.x * w > w - 1 || in.y * h > h - 1 ) {
+				remap_set_bg( &inst->map, x + w * y );
 				continue;
 			}
-			dst[rx + w * ry] = *src;
-			src++;
+			remap_set( &inst->map, x + w * y, in.x * w, in.y * h );
 		}
 	}
-
+	remap_tiles( &inst->map );
+	inst->map_dirty = 0;
 }
 
+void f0r_update(f0r_instance_t instance, double time,
+                const uint32_t* inframe, uint32_t* outframe)
+{
+	perspective_instance_t* inst = (perspective_instance_t*)instance;
+
+	if ( inst->tl.x == 0.0 && inst->tl.y == 0.0 && inst->tr.x == 1.0 && inst->tr.y == 0.0 &&
+	     inst->bl.x == 0.0 && inst->bl.y == 1.0 && inst->br.x == 1.0 && inst->br.y == 1.0 ) {
+		memcpy( outframe, inframe, inst->w * inst->h * 4 );
+		return;
+	}
+
+	if ( inst->map_dirty )
+		make_map( inst );
+
+	remap32( &inst->map, inframe, outframe, 0x00000000 );
+}
@@ -56,6 +56,11 @@ public:
 			factorTot = 3;
 		}
 		
+		// the threshold only depends on the sum of the channels
+		unsigned char meanOf[3*255+1];
+		for (int s = 0; s <= 3*255; s++)
+			meanOf[s] = (s + factor127)/factorTot;
+		
 		for (unsigned int i = 0; i < size; i++) {
 			px_t pi;
 			pi.u = in[i];
@@ -63,7 +68,7 @@ public:
 			if (f > 32) // influence of mean color value does hardly change after this value
 				mean = 127;
 			else 
-				mean = (pi.c[0] + pi.c[1] + pi.c[2] + factor127)/factorTot;
+				mean = meanOf[pi.c[0] + pi.c[1] + pi.c[2]];
 			pi.c[0] = (pi.c[0] > mean ? 255 : 0);
 			pi.c[1] = (pi.c[1] > mean ? 255 : 0);
 			pi.c[2] = (pi.c[2] > mean ? 255 : 0);
@@ -77,5 +82,5 @@ public:
 frei0r::construct<primaries> plugin("primaries",
 									"Reduce image to primary colors",
 									"Hedde Bosman",
-									0,2);
+									0,3);
 
@@ -33,14 +33,7 @@ Copyright (C) 2010  Marko Cebokli    http://lea.hamradio.si/~s57uuu
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
-
-typedef struct
-{
-	float r;
-	float g;
-	float b;
-	float a;
-} float_rgba;
+#include "frei0r_cfc.h"
 
 typedef struct
 {
@@ -666,6 +659,12 @@ typedef struct
 	int soft;
 	int inv;
 	int op;
+	int cache;
+	float_rgba *sl;	//float strip, see cfc_stream()
+	int rows;	//rows per strip
+	uint8_t *sel;	//selection of a strip, as bytes
+	uint8_t *tab;	//selection of every color (cache mode)
+	int dirty;	//tab needs to be rebuilt
 } inst;
 
 //-----------------------------------------------------
@@ -706,8 +705,8 @@ void f0r_get_plugin_info(f0r_plugin_info_t* info)
 	info->color_model=F0R_COLOR_MODEL_RGBA8888;
 	info->frei0r_version=FREI0R_MAJOR_VERSION;
 	info->major_version=0;
-	info->minor_version=6;
-	info->num_params=10;
+	info->minor_version=7;
+	info->num_params=11;
 	info->explanation="Color based alpha selection";
 }
 
@@ -766,6 +765,11 @@ void f0r_get_param_info(f0r_param_info_t* info, int param_index)
 		info->type = F0R_PARAM_DOUBLE;
 		info->explanation = "";
 		break;
+	case 10:
+		info->name = "Cache selection";
+		info->type = F0R_PARAM_BOOL;
+		info->explanation = "Keep the selection of every color in a 16 MB table, rebuilt when the parameters change";
+		break;
 	}
 }
 
@@ -791,12 +795,29 @@ f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
 	in->inv=0;
 	in->op=0;
 	
+	in->cache=0;
+	
+	//the strip also holds 256x256 colors when the table is built
+	in->rows=cfc_strip_rows(width);
+	if ((unsigned int)in->rows*width < (unsigned int)cfc_strip_rows(256)*256)
+		in->rows=(cfc_strip_rows(256)*256+width-1)/width;
+	in->sl=malloc(in->rows * width * sizeof(float_rgba));
+	in->sel=malloc(in->rows * width);
+	in->tab=NULL;
+	in->dirty=1;
+	
 	return (f0r_instance_t)in;
 }
 
 //---------------------------------------------------
 void f0r_destruct(f0r_instance_t instance)
 {
+	inst *in;
+	
+	in=(inst*)instance;
+	free(in->sl);
+	free(in->sel);
+	free(in->tab);
 	free(instance);
 }
 
@@ -861,13 +882,22 @@ void f0r_set_param_value(f0r_instance_t instance, f0r_param_t parm, int param_in
 		break;
 	case 9:		//operation
 		tmpi = map_value_forward(*(double*)parm, 0.0, 4.9999); //N-0.0001		if ((tmpi<0)||(tmpi>2.0)) break;
-		if (p->op != tmpi) chg=1;
-		p->op = tmpi;
+		p->op = tmpi;	//does not change the selection
+		break;
+	case 10:	//cache
+		tmpi=map_value_forward(*((double*)parm), 0.0, 1.0); //BOOL!!
+		p->cache=tmpi;
+		if ((p->cache==0)&&(p->tab!=NULL))
+		{
+			free(p->tab);
+			p->tab=NULL;
+		}
 		break;
 	}
 	
 	if (chg==0) return;
 	
+	p->dirty=1;
 }
 
 //--------------------------------------------------
@@ -909,59 +939,42 @@ void f0r_get_param_value(f0r_instance_t instance, f0r_param_t param, int param_i
 	case 9:
 		*((double*)param)=map_value_backward(p->op, 0.0, 4.9999);
 		break;
+	case 10:
+		*((double*)param)=map_value_backward(p->cache, 0.0, 1.0);//BOOL!!
+		break;
 	}
 }
 
 //-------------------------------------------------
-//RGBA8888 little endian
-void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)
+//selection parameters for one frame
+typedef struct
 {
 	inst *in;
 	float_rgba key;
 	triplet d,n;
+} sel_args;
+
+//-------------------------------------------------
+//makes the selection on n pixels in float,
+//returns it as bytes in sel
+void select_alpha(float_rgba *sl, int w, int n, sel_args *sa, uint8_t *sel)
+{
+	inst *in;
 	int i;
-	uint32_t t;
-	uint8_t *cin, *cout;
-	float f1=1.0/256.0;
-	uint8_t a1,a2;
-	float_rgba *sl;
 
-	assert(instance);
-	in=(inst*)instance;
-	
-	key.r=in->col.r;
-	key.g=in->col.g;
-	key.b=in->col.b;
-	key.a=1.0;
-	d.x=in->del1;
-	d.y=in->del2;
-	d.z=in->del3;
-	n.x=in->nud1;
-	n.y=in->nud2;
-	n.z=in->nud3;
-	
-	//convert to float
-	sl = calloc(in->w * in->h, sizeof(float_rgba));
-	cin=(uint8_t *)inframe;
-	for (i=0;i<in->h*in->w;i++)
-	{
-		sl[i].r=f1*(float)*cin++;
-		sl[i].g=f1*(float)*cin++;
-		sl[i].b=f1*(float)*cin++;
-		cin++;
-	}
+	in=sa->in;
 	
 	//make the selection
 	switch (in->subsp)
 	{
 	case 0:
-		sel_rgb(sl, in->w, in->h, key, d, n, in->slp, in->sshape, in->soft);
+		sel_rgb(sl, w, n, sa->key, sa->d, sa->n, in->slp, in->sshape, in->soft);
 		break;
 	case 1:
-		sel_abi(sl, in->w, in->h, key, d, n, in->slp, in->sshape, in->soft);
+		sel_abi(sl, w, n, sa->key, sa->d, sa->n, in->slp, in->sshape, in->soft);
 		break;
 	case 2:
-		sel_hci(sl, in->w, in->h, key, d, n, in->slp, in->sshape, in->soft);
+		sel_hci(sl, w, n, sa->key, sa->d, sa->n, in->slp, in->sshape, in->soft);
 		break;
 	default:
 		break;
@@ -969,73 +982,182 @@ void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, u
 	
 	//invert selection if required
 	if (in->inv==1)
-		for (i=0;i<in->h*in->w;i++)
+		for (i=0;i<n*w;i++)
 			sl[i].a = 1.0 - sl[i].a;
 	
-	//apply alpha
-	cin=(uint8_t *)inframe;
-	cout=(uint8_t *)outframe;
-	switch (in->op)
+	for (i=0;i<n*w;i++)
+		sel[i] = (uint8_t)(sl[i].a*255.0);
+}
+
+//-------------------------------------------------
+//applies the selection sel (bytes) to the alpha of n pixels
+void apply_alpha(const uint8_t *cin, uint8_t *cout, const uint8_t *sel, int n, int op)
+{
+	int i;
+	uint32_t t;
+	uint8_t a1,a2;
+
+	switch (op)
 	{
 	case 0:		//write on clear
-		for (i=0;i<in->h*in->w;i++)
+		for (i=0;i<n;i++)
 		{
 			*cout++ = *cin++;	//copy R
 			*cout++ = *cin++;	//copy G
 			*cout++ = *cin++;	//copy B
-			*cout++ = (uint8_t)(sl[i].a*255.0);
+			*cout++ = sel[i];
 			cin++;
 		}
 		break;
 	case 1:		//max
-		for (i=0;i<in->h*in->w;i++)
+		for (i=0;i<n;i++)
 		{
 			*cout++ = *cin++;	//copy R
 			*cout++ = *cin++;	//copy G
 			*cout++ = *cin++;	//copy B
 			a1 = *cin++;
-			a2 = (uint8_t)(sl[i].a*255.0);
+			a2 = sel[i];
 			*cout++ = (a1>a2) ? a1 : a2;
 		}
 		break;
 	case 2:		//min
-		for (i=0;i<in->h*in->w;i++)
+		for (i=0;i<n;i++)
 		{
 			*cout++ = *cin++;	//copy R
 			*cout++ = *cin++;	//copy G
 			*cout++ = *cin++;	//copy B
 			a1 = *cin++;
-			a2 = (uint8_t)(sl[i].a*255.0);
+			a2 = sel[i];
 			*cout++ = (a1<a2) ? a1 : a2;
 		}
 		break;
 	case 3:		//add
-		for (i=0;i<in->h*in->w;i++)
+		for (i=0;i<n;i++)
 		{
 			*cout++ = *cin++;	//copy R
 			*cout++ = *cin++;	//copy G
 			*cout++ = *cin++;	//copy B
 			a1 = *cin++;
-			a2 = (uint8_t)(sl[i].a*255.0);
+			a2 = sel[i];
 			t=(uint32_t)a1+(uint32_t)a2;
 			*cout++ = (t<=255) ? (uint8_t)t : 255;
 		}
 		break;
 	case 4:		//subtract
-		for (i=0;i<in->h*in->w;i++)
+		for (i=0;i<n;i++)
 		{
 			*cout++ = *cin++;	//copy R
 			*cout++ = *cin++;	//copy G
 			*cout++ = *cin++;	//copy B
 			a1 = *cin++;
-			a2 = (uint8_t)(sl[i].a*255.0);
+			a2 = sel[i];
 			*cout++ = (a1>a2) ? a1-a2 : 0;
 		}
 		break;
 	default:
 		break;
 	}
-	free(sl);
+}
+
+//-------------------------------------------------
+//selects and applies alpha on a strip of n rows
+//sl = the strip in float, in/out = its rows in the frames
+void select_strip(float_rgba *sl, int w, int n, const uint32_t *inframe, uint32_t *outframe, void *arg)
+{
+	sel_args *sa;
+
+	sa=(sel_args*)arg;
+	select_alpha(sl, w, n, sa, sa->in->sel);
+	apply_alpha((const uint8_t*)inframe, (uint8_t*)outframe, sa->in->sel, n*w, sa->in->op);
+}
+
+//-------------------------------------------------
+//stores the selection of a strip of colors in the table,
+//at the index of each color
+void table_strip(float_rgba *sl, int w, int n, const uint32_t *inframe, uint32_t *outframe, void *arg)
+{
+	sel_args *sa;
+	int i;
+
+	(void)outframe;
+	sa=(sel_args*)arg;
+	select_alpha(sl, w, n, sa, sa->in->sel);
+	for (i=0;i<n*w;i++)
+		sa->in->tab[inframe[i]&0xFFFFFF] = sa->in->sel[i];
+}
+
+//-------------------------------------------------
+//selection of every 24 bit color, the same as computed
+//per pixel, 256 planes of 256x256 colors
+void build_table(inst *in, sel_args *sa, float f1)
+{
+	uint32_t *c;
+	int r,i;
+
+	if (in->tab==NULL)
+		in->tab = malloc(1<<24);
+	c = malloc(65536*sizeof(uint32_t));
+	if ((in->tab==NULL)||(c==NULL))
+	{
+		free(c);
+		return;
+	}
+	
+	for (r=0;r<256;r++)
+	{
+		for (i=0;i<65536;i++)
+			c[i] = r | (i<<8);
+		cfc_stream(c, c, 256, 256, in->sl, cfc_strip_rows(256), f1, 0, table_strip, sa);
+	}
+	free(c);
+	in->dirty=0;
+}
+
+//-------------------------------------------------
+//RGBA8888 little endian
+void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)
+{
+	inst *in;
+	sel_args sa;
+	float f1=1.0/256.0;
+	int i,y,n;
+
+	assert(instance);
+	in=(inst*)instance;
+	
+	sa.in=in;
+	sa.key.r=in->col.r;
+	sa.key.g=in->col.g;
+	sa.key.b=in->col.b;
+	sa.key.a=1.0;
+	sa.d.x=in->del1;
+	sa.d.y=in->del2;
+	sa.d.z=in->del3;
+	sa.n.x=in->nud1;
+	sa.n.y=in->nud2;
+	sa.n.z=in->nud3;
+	
+	if (in->cache==1)
+	{
+		//the selection depends only on the color, look it up
+		if ((in->dirty==1)||(in->tab==NULL))
+			build_table(in, &sa, f1);
+		if (in->tab!=NULL)
+		{
+			for (y=0;y<in->h;y+=n)
+			{
+				n = (in->h-y<in->rows) ? in->h-y : in->rows;
+				for (i=0;i<n*in->w;i++)
+					in->sel[i] = in->tab[inframe[y*in->w+i]&0xFFFFFF];
+				apply_alpha((const uint8_t*)(inframe+y*in->w), (uint8_t*)(outframe+y*in->w), in->sel, n*in->w, in->op);
+			}
+			return;
+		}
+	}
+	
+	//convert to float in strips (alpha is overwritten by the
+	//selection), select and apply, while the strip is in cache
+	cfc_stream(inframe, outframe, in->w, in->h, in->sl, in->rows, f1, 0, select_strip, &sa);
 }
 
 //**********************************************************
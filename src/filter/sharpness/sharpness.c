@@ -35,6 +35,7 @@ Copyright (C) 2010  Marko Cebokli    http://lea.hamradio.si/~s57uuu
 //#include <math.h>
 #include <assert.h>
 #include <string.h>
+#include "frei0r_planar.h"
 
 #define MIN_MATRIX_SIZE 3
 #define MAX_MATRIX_SIZE 63
@@ -306,27 +307,19 @@ switch(param_index)
 void f0r_update(f0r_instance_t instance, double time, const uint32_t* inframe, uint32_t* outframe)
 {
 inst *in;
-int i;
 
 assert(instance);
 in=(inst*)instance;
 
 //Frei0r works with packed color, Mplayer with planar color
-for (i=0;i<(in->w*in->h);i++)	//copy to planar
-	{
-	in->Rplani[i]=inframe[i]&255;
-	in->Gplani[i]=(inframe[i]>>8)&255;
-	in->Bplani[i]=(inframe[i]>>16)&255;
-	}
+planar_split8(inframe, in->Rplani, in->Gplani, in->Bplani, in->w*in->h);
 
 unsharp(in->Rplano, in->Rplani, in->w, in->w, in->w, in->h, &in->fp);
 unsharp(in->Gplano, in->Gplani, in->w, in->w, in->w, in->h, &in->fp);
 unsharp(in->Bplano, in->Bplani, in->w, in->w, in->w, in->h, &in->fp);
 
-for (i=0;i<(in->w*in->h);i++)	//copy to packed, preserve alpha
-	{
-	outframe[i]=((uint32_t)in->Rplano[i])|((uint32_t)in->Gplano[i]<<8)|((uint32_t)in->Bplano[i]<<16)|(inframe[i]&0xFF000000);
-	}
+//copy to packed, preserve alpha
+planar_merge8(in->Rplano, in->Gplano, in->Bplano, inframe, outframe, in->w*in->h);
 
 
 }
@@ -25,6 +25,7 @@
 
 #include "frei0r.h"
 #include "frei0r_math.h"
+#include "frei0r_histogram.h"
 
 typedef struct three_point_balance_instance
 {
@@ -53,7 +54,7 @@ void f0r_get_plugin_info(f0r_plugin_info_t* three_point_balance_info)
   three_point_balance_info->color_model = F0R_COLOR_MODEL_RGBA8888;
   three_point_balance_info->frei0r_version = FREI0R_MAJOR_VERSION;
   three_point_balance_info->major_version = 0; 
-  three_point_balance_info->minor_version = 1; 
+  three_point_balance_info->minor_version = 2; 
   three_point_balance_info->num_params = 5; 
   three_point_balance_info->explanation = "Adjust color balance with 3 color points";
 }
@@ -227,12 +228,9 @@ void f0r_update(f0r_instance_t instance, double time,
   assert(instance);
   three_point_balance_instance_t* inst = (three_point_balance_instance_t*)instance;
   
-  unsigned char* dst = (unsigned char*)outframe;
-  const unsigned char* src = (unsigned char*)inframe;
-
-  int mapRed[256];
-  int mapGreen[256];
-  int mapBlue[256];
+  unsigned char mapRed[256];
+  unsigned char mapGreen[256];
+  unsigned char mapBlue[256];
 
   double redPoints[6] = {inst->blackColor.r, 0, inst->grayColor.r, 0.5, inst->whiteColor.r, 1};
   double greenPoints[6] = {inst->blackColor.g, 0, inst->grayColor.g, 0.5, inst->whiteColor.g, 1};
@@ -254,29 +252,18 @@ void f0r_update(f0r_instance_t instance, double time,
   free(greenCoeffs);
   free(blueCoeffs);
 
-  for(int j = 0; j < inst->width; j++) {
-	int copyPixel = inst->splitPreview && ((inst->srcPosition && j < inst->width / 2) || (!inst->srcPosition && j >= inst->width / 2));
-	for(int i = 0; i < inst->height; i++) {
-	  int offset = (i * inst->width + j) * 4;
-	  if (copyPixel) {
-		dst[offset] = src[offset];
-		offset++;
-		dst[offset] = src[offset];
-		offset++;
-		dst[offset] = src[offset];
-		offset++;
-	  } else {
-		dst[offset] = mapRed[src[offset]];
-		offset++;
-		dst[offset] = mapGreen[src[offset]];
-		offset++;
-		dst[offset] = mapBlue[src[offset]];
-		offset++;
-	  }
-	  dst[offset] = src[offset]; // copy alpha
-	  offset++;
-	}
+  // the preview half of each row is the source, the rest is mapped
+  unsigned int half = inst->width / 2;
+  unsigned int copyFrom = 0, copyTo = 0;
+  if (inst->splitPreview) {
+	copyFrom = inst->srcPosition ? 0 : half;
+	copyTo = inst->srcPosition ? half : inst->width;
+  }
+  for(unsigned int i = 0; i < inst->height; i++) {
+	const uint32_t* src = inframe + i * inst->width;
+	uint32_t* dst = outframe + i * inst->width;
+	histo_lut_apply(src, dst, copyFrom, mapRed, mapGreen, mapBlue);
+	memcpy(dst + copyFrom, src + copyFrom, (copyTo - copyFrom) * sizeof(uint32_t));
+	histo_lut_apply(src + copyTo, dst + copyTo, inst->width - copyTo, mapRed, mapGreen, mapBlue);
   }
-  
 }
-
@@ -45,47 +45,44 @@ public:
     const uint8_t *src1 = reinterpret_cast<const uint8_t*>(in1);
     const uint8_t *src2 = reinterpret_cast<const uint8_t*>(in2);
     uint8_t *dst = reinterpret_cast<uint8_t*>(out);
-    uint32_t sizeCounter = size;
-    uint32_t r1, g1, b1;
-    uint32_t r2, g2, b2;
-  
-    while (sizeCounter--)
-      {
-        r1 = src1[0];
-        g1 = src1[1];
-        b1 = src1[2];
-        r2 = src2[0];
-        g2 = src2[1];
-        b2 = src2[2];
-        rgb_to_hsl_int(&r1, &g1, &b1);
-        rgb_to_hsl_int(&r2, &g2, &b2);
+    uint16_t h1[SPAN], h2[SPAN];
+    uint8_t s1[SPAN], s2[SPAN], v1[SPAN], v2[SPAN];
+    hsl_planes p1 = { h1, s1, v1 };
+    hsl_planes p2 = { h2, s2, v2 };
+    /*  hue and saturation of in2, lightness of in1  */
+    hsl_planes mix = { h2, s2, v1 };
+    unsigned int n, i;
 
-        /*  transfer hue and saturation to the source pixel  */
-        r1 = r2;
-        g1 = g2;
+    /*  assumes inputs are only 4 byte RGBA pixels  */
+    for (unsigned int done = 0; done < size; done += n)
+      {
+        n = MIN (size - done, SPAN);
 
-        /*  set the dstination  */
-        hsl_to_rgb_int(&r1, &g1, &b1);
+        rgba_span_to_hsl (src1, &p1, n);
+        rgba_span_to_hsl (src2, &p2, n);
 
-        dst[0] = r1;
-        dst[1] = g1;
-        dst[2] = b1;
+        /*  alpha first, the conversion keeps it  */
+        for (i = 0; i < n; i++)
+          dst[NBYTES*i+3] = MIN (src1[NBYTES*i+3], src2[NBYTES*i+3]);
 
-        dst[3] = MIN(src1[3], src2[3]);
+        /*  set the dstination  */
+        hsl_span_to_rgba (&mix, dst, n);
 
-        src1 += NBYTES;
-        src2 += NBYTES;
-        dst += NBYTES;
+        src1 += NBYTES*n;
+        src2 += NBYTES*n;
+        dst += NBYTES*n;
       }
   }
-  
-    
+
+private:
+  /*  pixels converted per step, the planes live on the stack  */
+  static const unsigned int SPAN = 256;
 };
 
 
 frei0r::construct<color_only> plugin("color_only",
                                      "Perform a conversion to color only of the source input1 using the hue and saturation values of input2.",
                                      "Jean-Sebastien Senecal",
-                                     0,2,
+                                     0,3,
                                      F0R_COLOR_MODEL_RGBA8888);
 
@@ -44,51 +44,49 @@ public:
     const uint8_t *src1 = reinterpret_cast<const uint8_t*>(in1);
     const uint8_t *src2 = reinterpret_cast<const uint8_t*>(in2);
     uint8_t *dst = reinterpret_cast<uint8_t*>(out);
-    uint32_t sizeCounter = size;
-    int r1, g1, b1;
-	int r2, g2, b2;
-  
+    uint16_t h1[SPAN], h2[SPAN];
+    uint8_t s1[SPAN], s2[SPAN], v1[SPAN], v2[SPAN];
+    hsv_planes p1 = { h1, s1, v1 };
+    hsv_planes p2 = { h2, s2, v2 };
+    unsigned int n, i;
+
     /*  assumes inputs are only 4 byte RGBA pixels  */
-    while (sizeCounter--)
+    for (unsigned int done = 0; done < size; done += n)
       {
-        r1 = src1[0];
-        g1 = src1[1];
-        b1 = src1[2];
-
-        r2 = src2[0];
-        g2 = src2[1];
-        b2 = src2[2];
+        n = MIN (size - done, SPAN);
 
-        rgb_to_hsv_int (&r1, &g1, &b1);
-        rgb_to_hsv_int (&r2, &g2, &b2);
+        rgba_span_to_hsv (src1, &p1, n);
+        rgba_span_to_hsv (src2, &p2, n);
 
         /*  Composition should have no effect if saturation is zero.
          *  otherwise, black would be painted red (see bug #123296).
          */
-        if (g2)
-          r1 = r2;
-
-        /*  set the dstination  */
-        hsv_to_rgb_int (&r1, &g1, &b1);
+        for (i = 0; i < n; i++)
+          if (s2[i])
+            h1[i] = h2[i];
 
-        dst[0] = r1;
-        dst[1] = g1;
-        dst[2] = b1;
+        /*  alpha first, the conversion keeps it  */
+        for (i = 0; i < n; i++)
+          dst[NBYTES*i+3] = MIN (src1[NBYTES*i+3], src2[NBYTES*i+3]);
 
-        dst[3] = MIN (src1[3], src2[3]);
+        /*  set the dstination  */
+        hsv_span_to_rgba (&p1, dst, n);
 
-        src1 += NBYTES;
-        src2 += NBYTES;
-        dst += NBYTES;
+        src1 += NBYTES*n;
+        src2 += NBYTES*n;
+        dst += NBYTES*n;
       }
   }
-     
+
+private:
+  /*  pixels converted per step, the planes live on the stack  */
+  static const unsigned int SPAN = 256;
 };
 
 
 frei0r::construct<hue> plugin("hue",
                               "Perform a conversion to hue only of the source input1 using the hue of input2.",
                               "Jean-Sebastien Senecal",
-                              0,2,
+                              0,3,
                               F0R_COLOR_MODEL_RGBA8888);
 
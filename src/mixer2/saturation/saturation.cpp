@@ -45,45 +45,44 @@ public:
     const uint8_t *src1 = reinterpret_cast<const uint8_t*>(in1);
     const uint8_t *src2 = reinterpret_cast<const uint8_t*>(in2);
     uint8_t *dst = reinterpret_cast<uint8_t*>(out);
-    uint32_t sizeCounter = size;
-    int r1, g1, b1;
-    int r2, g2, b2;
-  
-     /*  assumes inputs are only 4 byte RGBA pixels  */
-     while (sizeCounter--)
-       {
-         r1 = src1[0];
-         g1 = src1[1];
-         b1 = src1[2];
-         r2 = src2[0];
-         g2 = src2[1];
-         b2 = src2[2];
-         rgb_to_hsv_int(&r1, &g1, &b1);
-         rgb_to_hsv_int(&r2, &g2, &b2);
- 
-         g1 = g2;
- 
-         /*  set the dstination  */
-         hsv_to_rgb_int(&r1, &g1, &b1);
- 
-         dst[0] = r1;
-         dst[1] = g1;
-         dst[2] = b1;
-          
-         dst[3] = MIN(src1[3], src2[3]);
+    uint16_t h1[SPAN], h2[SPAN];
+    uint8_t s1[SPAN], s2[SPAN], v1[SPAN], v2[SPAN];
+    hsv_planes p1 = { h1, s1, v1 };
+    hsv_planes p2 = { h2, s2, v2 };
+    /*  saturation of in2, hue and value of in1  */
+    hsv_planes mix = { h1, s2, v1 };
+    unsigned int n, i;
 
-         src1 += NBYTES;
-         src2 += NBYTES;
-         dst += NBYTES;
-       }
-  }  
-    
+    /*  assumes inputs are only 4 byte RGBA pixels  */
+    for (unsigned int done = 0; done < size; done += n)
+      {
+        n = MIN (size - done, SPAN);
+
+        rgba_span_to_hsv (src1, &p1, n);
+        rgba_span_to_hsv (src2, &p2, n);
+
+        /*  alpha first, the conversion keeps it  */
+        for (i = 0; i < n; i++)
+          dst[NBYTES*i+3] = MIN (src1[NBYTES*i+3], src2[NBYTES*i+3]);
+
+        /*  set the dstination  */
+        hsv_span_to_rgba (&mix, dst, n);
+
+        src1 += NBYTES*n;
+        src2 += NBYTES*n;
+        dst += NBYTES*n;
+      }
+  }
+
+private:
+  /*  pixels converted per step, the planes live on the stack  */
+  static const unsigned int SPAN = 256;
 };
 
 
 frei0r::construct<saturation> plugin("saturation",
                                      "Perform a conversion to saturation only of the source input1 using the saturation level of input2.",
                                      "Jean-Sebastien Senecal",
-                                     0,2,
+                                     0,3,
                                      F0R_COLOR_MODEL_RGBA8888);
 
@@ -22,11 +22,14 @@
 #include <math.h>
 
 #include "frei0r.h"
+#include "frei0r_remap.h"
 
 typedef struct uvmap_instance
 {
   unsigned int width;
   unsigned int height;
+  int precision;   /* 16 bit UV, low bytes in B and A */
+  int bilinear;
 } uvmap_instance_t;
 
 int f0r_init()
@@ -45,14 +48,26 @@ void f0r_get_plugin_info(f0r_plugin_info_t* uvmapInfo)
   uvmapInfo->color_model = F0R_COLOR_MODEL_RGBA8888;
   uvmapInfo->frei0r_version = FREI0R_MAJOR_VERSION;
   uvmapInfo->major_version = 0; 
-  uvmapInfo->minor_version = 9; 
-  uvmapInfo->num_params =  0; 
+  uvmapInfo->minor_version = 10; 
+  uvmapInfo->num_params =  2; 
   uvmapInfo->explanation = "Uses Input 1 as UV Map to distort Input 2";
 }
 
 void f0r_get_param_info(f0r_param_info_t* info, int param_index)
 {
-  /* no params */
+  switch(param_index)
+  {
+  case 0:
+    info->name = "16 bit UV";
+    info->type = F0R_PARAM_BOOL;
+    info->explanation = "U is R*256+B and V is G*256+A; all-zero map pixels are empty";
+    break;
+  case 1:
+    info->name = "Bilinear";
+    info->type = F0R_PARAM_BOOL;
+    info->explanation = "Interpolate between source pixels";
+    break;
+  }
 }
 
 f0r_instance_t f0r_construct(unsigned int width, unsigned int height)
@@ -69,11 +84,37 @@ void f0r_destruct(f0r_instance_t instance)
 
 void f0r_set_param_value(f0r_instance_t instance, 
 			 f0r_param_t param, int param_index)
-{ /* no params */ }
+{
+  assert(instance);
+  uvmap_instance_t* inst = (uvmap_instance_t*)instance;
+
+  switch(param_index)
+  {
+  case 0:
+    inst->precision = ( *((double*)param) >= 0.5 );
+    break;
+  case 1:
+    inst->bilinear = ( *((double*)param) >= 0.5 );
+    break;
+  }
+}
 
 void f0r_get_param_value(f0r_instance_t instance,
 			 f0r_param_t param, int param_index)
-{ /* no params */ }
+{
+  assert(instance);
+  uvmap_instance_t* inst = (uvmap_instance_t*)instance;
+
+  switch(param_index)
+  {
+  case 0:
+    *((double*)param) = (inst->precision ? 1.0 : 0.0);
+    break;
+  case 1:
+    *((double*)param) = (inst->bilinear ? 1.0 : 0.0);
+    break;
+  }
+}
 
 void f0r_update2(f0r_instance_t instance,
 		 double time,
@@ -91,8 +132,13 @@ void f0r_update2(f0r_instance_t instance,
 	uint32_t* dst = outframe;
 	const uint32_t* uvmap = inframe1;
 	const uint32_t* src = inframe2;
-	float fx, fy;
-	long px, py;
+	/* source position in 1/256 pixel per map step */
+	float kx = w * 256.0f / (inst->precision ? 65535.0f : 255.0f);
+	float ky = h * 256.0f / (inst->precision ? 65535.0f : 255.0f);
+	unsigned int vmax = (inst->precision ? 65535 : 255);
+	unsigned int u, v;
+	remap_point p;
+	int sx, sy;
 	for( y = 0; y < h; ++y )
 		for( x = 0; x < w; ++x ) {
 			/* The coordinates start in the lower left corner:
@@ -104,20 +150,38 @@ void f0r_update2(f0r_instance_t instance,
 			 *   0  R ->
 			 *
 			 */
-			unsigned char* tmpc = (unsigned char*)uvmap;
-			fx = ((float)tmpc[0]) / 255.0;
-			fy = ((float)tmpc[1]) / 255.0;
-			fy = 1.0 - fy;
-
-			px = lrintf( w * fx );
-			py = lrintf( h * fy );
-			if ( tmpc[2] > 128 ) {
-				*dst++ = src[px+w*py];
+			uint32_t m = *uvmap++;
+			if ( inst->precision ) {
+				if ( m == 0 ) {
+					*dst++ = 0x00000000;
+					continue;
+				}
+				u = ((m & 0xFF) << 8) | ((m >> 16) & 0xFF);
+				v = (m & 0xFF00) | (m >> 24);
 			} else {
-				*dst++ = 0x00000000;
+				if ( ((m >> 16) & 0xFF) <= 128 ) {
+					*dst++ = 0x00000000;
+					continue;
+				}
+				u = m & 0xFF;
+				v = (m >> 8) & 0xFF;
+			}
+			sx = (int)( u * kx );
+			sy = (int)( (vmax - v) * ky );
+
+			if ( inst->bilinear ) {
+				/* fx == 1.0 lands one past the last pixel */
+				if ( sx > (int)(w - 1) * 256 ) sx = (w - 1) * 256;
+				if ( sy > (int)(h - 1) * 256 ) sy = (h - 1) * 256;
+				p.x = sx >> 8; p.fx = sx & 0xFF;
+				p.y = sy >> 8; p.fy = sy & 0xFF;
+				*dst++ = remap_bl( src, w, h, p );
+			} else {
+				sx = (sx + 128) >> 8;
+				sy = (sy + 128) >> 8;
+				if ( sx > (int)w - 1 ) sx = w - 1;
+				if ( sy > (int)h - 1 ) sy = h - 1;
+				*dst++ = src[sx + w * sy];
 			}
-			uvmap++;
 		}
 }
-
-